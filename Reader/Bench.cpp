@@ -0,0 +1,640 @@
+#ifdef ENABLE_NETWORK
+#include "framework.h"
+#include "types.h"
+#if TEST_MODEL
+#include "HtmlParser.h"
+#include "JsonPath.h"
+#include "CssSelector.h"
+#include "LegadoRuleParser.h"
+#include "QuickJsEngine.hpp"
+#include "JsCrypto.h"
+#include "RulePlan.h"
+#include "LegadoConverter.h"
+#include <stdio.h>
+#include <map>
+#include <vector>
+
+// benches of the parsers and the js engine, called by hand from Init of Reader.cpp
+
+// the whole file with a terminating zero, free() it
+static char* _load_file(const char* path, int* len)
+{
+    FILE* fp;
+    char* buf;
+
+    fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    buf = (char*)malloc(*len + 1);
+    if (buf)
+    {
+        *len = (int)fread(buf, 1, *len, fp);
+        buf[*len] = 0;
+    }
+    fclose(fp);
+    return buf;
+}
+
+static void _split_lines(const char* text, std::vector<std::string>& list)
+{
+    std::string line;
+    const char* p;
+
+    for (p = text; *p; p++)
+    {
+        if (*p == '\n')
+        {
+            list.push_back(line);
+            line.clear();
+        }
+        else
+        {
+            line += *p;
+        }
+    }
+    if (!line.empty())
+        list.push_back(line);
+}
+
+static LARGE_INTEGER _now(void)
+{
+    LARGE_INTEGER t;
+    QueryPerformanceCounter(&t);
+    return t;
+}
+
+static double _elapsed_ms(LARGE_INTEGER begin, LARGE_INTEGER end)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return (end.QuadPart - begin.QuadPart) * 1000.0 / freq.QuadPart;
+}
+
+void BenchContentFromDump(const char* xpath)
+{
+    char* html = NULL;
+    int htmllen = 0;
+    char* htmlfmt = NULL;
+    int fmtlen = 0;
+    void* doc = NULL;
+    void* ctx = NULL;
+    BOOL fkill = FALSE;
+    std::vector<std::string> value;
+    std::string before;
+    LARGE_INTEGER t0, t1, t2;
+    const int loop = 100;
+    int i;
+
+    html = _load_file("dump.html", &htmllen);
+    if (!html)
+        return;
+
+    // before: parse -> dump -> reparse
+    t0 = _now();
+    for (i = 0; i < loop; i++)
+    {
+        value.clear();
+        HtmlParser::Instance()->FormatHtml(html, htmllen, &htmlfmt, &fmtlen);
+        if (!htmlfmt)
+            continue;
+        HtmlParser::Instance()->HtmlParseBegin(htmlfmt, fmtlen, &doc, &ctx, &fkill);
+        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, xpath, value, &fkill);
+        HtmlParser::Instance()->HtmlParseEnd(doc, ctx);
+        HtmlParser::Instance()->FreeFormat(htmlfmt);
+        htmlfmt = NULL;
+    }
+    if (!value.empty())
+        before = value[0];
+
+    // after: parse once and walk the content nodes
+    t1 = _now();
+    for (i = 0; i < loop; i++)
+    {
+        value.clear();
+        HtmlParser::Instance()->HtmlParseBegin(html, htmllen, &doc, &ctx, &fkill);
+        HtmlParser::Instance()->HtmlParseTextByXpath(doc, ctx, xpath, value, &fkill);
+        HtmlParser::Instance()->HtmlParseEnd(doc, ctx);
+    }
+    t2 = _now();
+
+    // the completer takes the first value, both should be the whole chapter
+    logger_printk("content bench(%d loops, %d bytes): format+reparse=%.3fms, single parse=%.3fms, "
+        "content=%d/%d bytes, values=%d",
+        loop, htmllen,
+        _elapsed_ms(t0, t1) / loop,
+        _elapsed_ms(t1, t2) / loop,
+        (int)before.size(), value.empty() ? 0 : (int)value[0].size(), (int)value.size());
+
+    free(html);
+}
+
+// css: a legado @css: rule (jsoup = FALSE) or a default jsoup rule, e.g. div.list dd a@href
+void BenchCssFromDump(const char* css, BOOL jsoup)
+{
+    char* html = NULL;
+    int htmllen = 0;
+    void* doc = NULL;
+    void* ctx = NULL;
+    BOOL fkill = FALSE;
+    std::shared_ptr<CssSelector> selector;
+    std::vector<std::string> value;
+    std::string xpath;
+    LARGE_INTEGER t0, t1, t2;
+    const int loop = 1000;
+    int i;
+
+    html = _load_file("dump.html", &htmllen);
+    if (!html)
+        return;
+
+    // the same parsed doc for both, only the selection is compared
+    HtmlParser::Instance()->HtmlParseBegin(html, htmllen, &doc, &ctx, &fkill);
+
+    // before: translate to xpath with string manipulation for each rule
+    t0 = _now();
+    for (i = 0; i < loop; i++)
+    {
+        value.clear();
+        xpath = LegadoRuleParser::CssToXPath(css);
+        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, xpath, value, &fkill);
+    }
+
+    // after: compiled once and matched on the dom
+    t1 = _now();
+    for (i = 0; i < loop; i++)
+    {
+        value.clear();
+        selector = CssSelector::Get(css, jsoup);
+        if (selector)
+            selector->Query(doc, value, &fkill);
+    }
+    t2 = _now();
+
+    logger_printk("css bench(%d loops, %d bytes, %d values): xpath translation=%.3fms, compiled selector=%.3fms",
+        loop, htmllen, (int)value.size(),
+        _elapsed_ms(t0, t1) / loop,
+        _elapsed_ms(t1, t2) / loop);
+
+    HtmlParser::Instance()->HtmlParseEnd(doc, ctx);
+    free(html);
+}
+
+// jsonpath: a path of the native engine, e.g. $.data.list[*].name
+// jspath: the same value for the old js path, e.g. data.list.map(function(x){return x.name})
+void BenchJsonPathFromDump(const char* jsonpath, const char* jspath)
+{
+    char* json = NULL;
+    int jsonlen = 0;
+    cJSON* root = NULL;
+    std::shared_ptr<JsonPath> jp;
+    std::vector<std::string> value;
+    std::string code, result;
+    LARGE_INTEGER t0, t1, t2, t3;
+    const int loop = 100;
+    const int rules = 6; // name/author/bookUrl/cover/intro/kind of a search page
+    int i, j;
+
+    json = _load_file("dump.json", &jsonlen);
+    if (!json)
+        return;
+
+    jp = JsonPath::Get(jsonpath);
+    if (!jp)
+    {
+        free(json);
+        return;
+    }
+
+    // before: copy into js and JSON.parse for each rule
+    {
+        Reader::QuickJsEngine js;
+        code = std::string("var data = JSON.parse(result); ") + jspath;
+        t0 = _now();
+        for (i = 0; i < loop; i++)
+        {
+            for (j = 0; j < rules; j++)
+            {
+                js.setResult(std::string(json, jsonlen));
+                result = js.eval(code);
+            }
+        }
+        t1 = _now();
+    }
+
+    // native, parsed for each rule
+    for (i = 0; i < loop; i++)
+    {
+        for (j = 0; j < rules; j++)
+        {
+            value.clear();
+            root = cJSON_Parse(json);
+            jp->Query(root, value);
+            cJSON_Delete(root);
+        }
+    }
+    t2 = _now();
+
+    // native, parsed once per response
+    for (i = 0; i < loop; i++)
+    {
+        root = cJSON_Parse(json);
+        for (j = 0; j < rules; j++)
+        {
+            value.clear();
+            jp->Query(root, value);
+        }
+        cJSON_Delete(root);
+    }
+    t3 = _now();
+
+    logger_printk("jsonpath bench(%d loops x %d rules, %d bytes, %d values): js=%.3fms, native=%.3fms, native parse once=%.3fms",
+        loop, rules, jsonlen, (int)value.size(),
+        _elapsed_ms(t0, t1) / loop,
+        _elapsed_ms(t1, t2) / loop,
+        _elapsed_ms(t2, t3) / loop);
+
+    free(json);
+}
+
+// path: dump.html or dump.json of a search page
+// rules: the rules of one response separated by '\n', e.g. name/author/bookUrl/cover/intro/kind
+void BenchRulesFromDump(const char* path, const char* rules)
+{
+    char* buf = NULL;
+    int buflen = 0;
+    BOOL fkill = FALSE;
+    std::vector<std::string> list;
+    std::vector<std::string> value;
+    LegadoDocument::Stats s0, s1;
+    LARGE_INTEGER t0, t1, t2;
+    const int loop = 100;
+    int i, total = 0;
+    size_t j;
+
+    buf = _load_file(path, &buflen);
+    if (!buf)
+        return;
+
+    _split_lines(rules, list);
+
+    // before: each rule parses the response again
+    t0 = _now();
+    for (i = 0; i < loop; i++)
+    {
+        for (j = 0; j < list.size(); j++)
+        {
+            value.clear();
+            LegadoRuleParser::Instance()->ParseRule(buf, buflen, list[j], value, &fkill, LegadoRuleParser::RULE_SEARCH);
+        }
+    }
+
+    // after: one document per response, like a completer does
+    t1 = _now();
+    s0 = LegadoDocument::GetStats();
+    for (i = 0; i < loop; i++)
+    {
+        LegadoDocument doc(buf, buflen);
+        for (j = 0; j < list.size(); j++)
+        {
+            value.clear();
+            LegadoRuleParser::Instance()->ParseRule(doc, list[j], value, &fkill, LegadoRuleParser::RULE_SEARCH);
+            total += (int)value.size();
+        }
+    }
+    s1 = LegadoDocument::GetStats();
+    t2 = _now();
+
+    logger_printk("rules bench(%d loops x %d rules, %d bytes, %d values): parse per rule=%.3fms, shared document=%.3fms, "
+        "html parses=%d, reuses=%d, json parses=%d, reuses=%d",
+        loop, (int)list.size(), buflen, total / loop,
+        _elapsed_ms(t0, t1) / loop,
+        _elapsed_ms(t1, t2) / loop,
+        (int)(s1.htmlParses - s0.htmlParses), (int)(s1.htmlReuses - s0.htmlReuses),
+        (int)(s1.jsonParses - s0.jsonParses), (int)(s1.jsonReuses - s0.jsonReuses));
+
+    free(buf);
+}
+
+// js rules of a content page which all read the whole page, e.g. content/title/nextContentUrl
+// rules: separated by '\n'
+void BenchBridgeFromDump(const char* rules)
+{
+    char* html = NULL;
+    int htmllen = 0;
+    std::vector<std::string> list;
+    std::string result;
+    Reader::JsUsage before, after;
+    LARGE_INTEGER t0, t1, t2;
+    const int loop = 20;
+    int i;
+    size_t j;
+
+    html = _load_file("dump.html", &htmllen);
+    if (!html)
+        return;
+
+    _split_lines(rules, list);
+
+    // before: the page is converted to a js string for every rule
+    {
+        Reader::QuickJsEngine js;
+        js.setStringCacheSize(0);
+        t0 = _now();
+        for (i = 0; i < loop; i++)
+        {
+            html[htmllen - 1] = (char)('a' + i % 26); // another chapter
+            for (j = 0; j < list.size(); j++)
+            {
+                js.setResult(std::string(html, htmllen));
+                result = js.eval(list[j]);
+            }
+        }
+        t1 = _now();
+        before = js.takeUsage();
+    }
+
+    // after: the js string of the page is reused while it is unchanged
+    {
+        Reader::QuickJsEngine js;
+        for (i = 0; i < loop; i++)
+        {
+            html[htmllen - 1] = (char)('a' + i % 26);
+            for (j = 0; j < list.size(); j++)
+            {
+                js.setResult(html, htmllen);
+                result = js.eval(list[j]);
+            }
+        }
+        t2 = _now();
+        after = js.takeUsage();
+    }
+
+    logger_printk("bridge bench(%d chapters x %d rules, %d bytes): before=%.3fms, in=%llu, out=%llu bytes per chapter; "
+        "after=%.3fms, in=%llu, out=%llu, reused=%llu bytes per chapter",
+        loop, (int)list.size(), htmllen,
+        _elapsed_ms(t0, t1) / loop,
+        (unsigned long long)(before.bytesIn / loop), (unsigned long long)(before.bytesOut / loop),
+        _elapsed_ms(t1, t2) / loop,
+        (unsigned long long)(after.bytesIn / loop), (unsigned long long)(after.bytesOut / loop),
+        (unsigned long long)(after.bytesReused / loop));
+
+    free(html);
+}
+
+// known answer vectors of NIST SP800-38A/38D, FIPS 46/180 and RFC 2202/4231
+void TestJsCrypto(void)
+{
+    struct cipher_vector_t
+    {
+        const char* transformation;
+        const char* key;
+        const char* iv;
+        const char* plain;
+        const char* cipher;
+    };
+    static const cipher_vector_t cipher_vectors[] = {
+        { "AES/ECB/NoPadding", "2b7e151628aed2a6abf7158809cf4f3c", "",
+          "6bc1bee22e409f96e93d7e117393172a", "3ad77bb40d7a3660a89ecaf32466ef97" },
+        { "AES/CBC/NoPadding", "2b7e151628aed2a6abf7158809cf4f3c", "000102030405060708090a0b0c0d0e0f",
+          "6bc1bee22e409f96e93d7e117393172a", "7649abac8119b246cee98e9b12e9197d" },
+        { "AES/CBC/NoPadding", "603deb1015ca71be2b73aef0857d77811f352c073b6108d72d9810a30914dff4", "000102030405060708090a0b0c0d0e0f",
+          "6bc1bee22e409f96e93d7e117393172a", "f58c4c04d6e5f1ba779eabfb5f7bfbd6" },
+        { "AES/GCM/NoPadding", "0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000",
+          "00000000000000000000000000000000", "cea7403d4d606b6e074ec5d3baf39d18d0d1c8a799996bf0265b98b5d48ab919" },
+        { "DES/ECB/NoPadding", "133457799bbcdff1", "",
+          "0123456789abcdef", "85e813540f0ab405" },
+        { "DESede/ECB/NoPadding", "0123456789abcdef23456789abcdef01456789abcdef0123", "",
+          "5468652071756663", "a826fd8ce53b855f" },
+    };
+    struct digest_vector_t
+    {
+        const char* algorithm;
+        const char* key;
+        const char* data;
+        const char* digest;
+    };
+    static const digest_vector_t digest_vectors[] = {
+        { "SHA-1", NULL, "abc", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+        { "SHA-256", NULL, "abc", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+        { "HmacMD5", "Jefe", "what do ya want for nothing?", "750c783e6ab0b503eaa86e310a5db738" },
+        { "HmacSHA1", "Jefe", "what do ya want for nothing?", "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79" },
+        { "HmacSHA256", "Jefe", "what do ya want for nothing?", "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" },
+    };
+    // script, expected result; the cipher texts are from openssl enc
+    static const char* script_vectors[][2] = {
+        { "java.aesBase64DecodeToString('xWLdB27h1IH0W2u2fQUeQPYtaT/5GWttn5SkisONdDU=', '1234567890abcdef', 'AES/CBC/PKCS5Padding', 'abcdef1234567890')",
+          "\xE7\xAC\xAC\xE4\xB8\x80\xE7\xAB\xA0 \xE6\xAD\xA3\xE6\x96\x87" },
+        { "java.aesEncodeToBase64String('\xE7\xAC\xAC\xE4\xB8\x80\xE7\xAB\xA0 \xE6\xAD\xA3\xE6\x96\x87', '1234567890abcdef', 'AES/CBC/PKCS5Padding', 'abcdef1234567890')",
+          "xWLdB27h1IH0W2u2fQUeQPYtaT/5GWttn5SkisONdDU=" },
+        { "java.desDecodeToString('ba16c6a0257125af', '12345678', 'DES/ECB/PKCS5Padding', '')", "hello" },
+        { "java.tripleDESDecodeStr('602EILBy8Hg=', '123456789012345678901234', 'CBC', 'PKCS5Padding', '12345678')", "hello" },
+        { "java.createSymmetricCrypto('AES/CBC/PKCS5Padding', '1234567890abcdef', 'abcdef1234567890').decryptStr('xWLdB27h1IH0W2u2fQUeQPYtaT/5GWttn5SkisONdDU=')",
+          "\xE7\xAC\xAC\xE4\xB8\x80\xE7\xAB\xA0 \xE6\xAD\xA3\xE6\x96\x87" },
+        { "var c = java.createSymmetricCrypto('AES/GCM/NoPadding', '1234567890abcdef', 'abcdef123456'); c.decryptStr(c.encryptHex('hello'))", "hello" },
+        { "java.aesDecodeToString(java.aesEncodeToBase64String('hello', '1234567890abcdef', 'AES/ECB/ZeroPadding', ''), '1234567890abcdef', 'AES/ECB/ZeroPadding', '')", "hello" },
+        { "java.digestHex('abc', 'SHA-256')", "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" },
+        { "java.HMacBase64('what do ya want for nothing?', 'HmacSHA256', 'Jefe')", "W9zBRr9gdU5qBCQmCJV1x1oAPwidJzmDnexYuWTsOEM=" },
+        { "java.hexDecodeToString(java.hexEncodeToString('hello'))", "hello" },
+    };
+    std::string key, iv, plain, cipher, out, error, result;
+    int passed = 0, failed = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(cipher_vectors) / sizeof(cipher_vectors[0]); i++)
+    {
+        const cipher_vector_t& v = cipher_vectors[i];
+        JsCrypto::hexDecode(v.key, key);
+        JsCrypto::hexDecode(v.iv, iv);
+        JsCrypto::hexDecode(v.plain, plain);
+        if (JsCrypto::encrypt(v.transformation, key, iv, plain, out, error) && JsCrypto::hexEncode(out) == v.cipher
+            && JsCrypto::decrypt(v.transformation, key, iv, out, cipher, error) && cipher == plain)
+            passed++;
+        else
+        {
+            failed++;
+            logger_printk("crypto test failed: %s %s", v.transformation, error.c_str());
+        }
+    }
+
+    for (i = 0; i < sizeof(digest_vectors) / sizeof(digest_vectors[0]); i++)
+    {
+        const digest_vector_t& v = digest_vectors[i];
+        if ((v.key ? JsCrypto::hmac(v.algorithm, v.key, v.data, out) : JsCrypto::digest(v.algorithm, v.data, out))
+            && JsCrypto::hexEncode(out) == v.digest)
+            passed++;
+        else
+        {
+            failed++;
+            logger_printk("crypto test failed: %s", v.algorithm);
+        }
+    }
+
+    Reader::QuickJsEngine js;
+    for (i = 0; i < sizeof(script_vectors) / sizeof(script_vectors[0]); i++)
+    {
+        result = js.eval(script_vectors[i][0]);
+        if (!js.hasError() && result == script_vectors[i][1])
+            passed++;
+        else
+        {
+            failed++;
+            logger_printk("crypto test failed: %s => %s %s", script_vectors[i][0], result.c_str(), js.getLastError().c_str());
+        }
+    }
+
+    logger_printk("crypto test: %d passed, %d failed", passed, failed);
+}
+
+// chapter_kb: size of the encrypted chapter text of each call
+void BenchJsCrypto(int chapter_kb)
+{
+    const char* key = "1234567890abcdef";
+    const char* iv = "abcdef1234567890";
+    std::string text, cipher, out, error, code;
+    LARGE_INTEGER t0, t1, t2, t3;
+    const int loop = 100;
+    double mb;
+    int i;
+
+    while ((int)text.size() < chapter_kb * 1024)
+        text += "\xE7\xAC\xAC\xE4\xB8\x80\xE7\xAB\xA0 \xE6\xAD\xA3\xE6\x96\x87\xE5\x86\x85\xE5\xAE\xB9\n";
+    JsCrypto::encrypt("AES/CBC/PKCS5Padding", key, iv, text, cipher, error);
+    cipher = JsCrypto::base64Encode(cipher);
+    mb = (double)text.size() * loop / (1024 * 1024);
+
+    Reader::QuickJsEngine js;
+    code = std::string("java.aesBase64DecodeToString(result, '") + key + "', 'AES/CBC/PKCS5Padding', '" + iv + "')";
+
+    // native api only
+    t0 = _now();
+    for (i = 0; i < loop; i++)
+    {
+        std::string raw;
+        JsCrypto::base64Decode(cipher, raw);
+        JsCrypto::decrypt("AES/CBC/PKCS5Padding", key, iv, raw, out, error);
+    }
+    t1 = _now();
+
+    // what a rule does: decrypt the response from js
+    for (i = 0; i < loop; i++)
+    {
+        js.setResult(cipher);
+        out = js.eval(code);
+    }
+    t2 = _now();
+
+    for (i = 0; i < loop; i++)
+    {
+        js.setResult(text);
+        out = js.eval("java.HMacHex(result, 'HmacSHA256', 'key')");
+    }
+    t3 = _now();
+
+    logger_printk("crypto bench(%d loops, %d bytes): aes-cbc native=%.1fMB/s, aes-cbc js=%.1fMB/s, hmac-sha256 js=%.1fMB/s",
+        loop, (int)text.size(),
+        mb / (_elapsed_ms(t0, t1) / 1000),
+        mb / (_elapsed_ms(t1, t2) / 1000),
+        mb / (_elapsed_ms(t2, t3) / 1000));
+}
+
+// latency_ms: simulated round trip of each sub-resource request
+void BenchAjaxAsync(int latency_ms)
+{
+    LARGE_INTEGER t0, t1, t2;
+    std::string serial, parallel;
+
+    Reader::QuickJsEngine js;
+    js.setHttpCallback([latency_ms](const std::string& url, const std::string&, const std::string&,
+                                    const std::map<std::string, std::string>&) {
+        Sleep(latency_ms);
+        return url;
+    });
+
+    t0 = _now();
+    serial = js.eval("[1,2,3,4,5].map(function(i) { return java.ajax('part' + i); }).join(',')");
+    t1 = _now();
+    parallel = js.eval("Promise.all([1,2,3,4,5].map(function(i) { return java.ajaxAsync('part' + i); }))"
+        ".then(function(parts) { return parts.join(','); })");
+    t2 = _now();
+
+    logger_printk("ajax bench(5 requests, %dms each): serial=%.1fms, async=%.1fms, same result: %d",
+        latency_ms,
+        _elapsed_ms(t0, t1),
+        _elapsed_ms(t1, t2),
+        serial == parallel);
+}
+
+// the string surgery of the rules: compiled on every call vs the cached plans
+// rules: separated by '\n'
+void BenchRulePlan(const char* rules)
+{
+    LARGE_INTEGER t0, t1, t2;
+    std::vector<std::string> list;
+    int i, loop = 10000, native = 0;
+    size_t j;
+
+    _split_lines(rules, list);
+
+    t0 = _now();
+    for (i = 0; i < loop; i++)
+    {
+        for (j = 0; j < list.size(); j++)
+        {
+            RulePlan plan;
+            plan.Compile(list[j]);
+        }
+    }
+    t1 = _now();
+    for (i = 0; i < loop; i++)
+    {
+        for (j = 0; j < list.size(); j++)
+        {
+            std::shared_ptr<RulePlan> plan = RulePlan::Get("bench", list[j]);
+            if (i == 0 && plan && !plan->NeedJs())
+                native++;
+        }
+    }
+    t2 = _now();
+
+    logger_printk("rule plan bench(%d loops x %d rules, %d without js): compile per call=%.3fus, cached plan=%.3fus",
+        loop, (int)list.size(), native,
+        _elapsed_ms(t0, t1) * 1000 / loop,
+        _elapsed_ms(t1, t2) * 1000 / loop);
+}
+
+static void _bench_import_progress(int done, int total, void* param)
+{
+    (*(int*)param)++;
+}
+
+// path: a legado book source pack, e.g. the exported json of hundreds of sources
+void BenchLegadoImport(const char* path)
+{
+    char* json = NULL;
+    int len, progress = 0;
+    std::vector<book_source_t*> bs;
+    legado_convert_result_t result;
+    LARGE_INTEGER t0, t1;
+    size_t i;
+
+    json = _load_file(path, &len);
+    if (!json)
+        return;
+
+    t0 = _now();
+    convert_legado_pack(json, bs, _bench_import_progress, &progress, &result);
+    t1 = _now();
+
+    logger_printk("legado import bench(%d bytes): %.1fms, succ: %d, failed: %d, skipped: %d, duplicate: %d, progress: %d",
+        len, _elapsed_ms(t0, t1),
+        result.success_count, result.failed_count, result.skipped_count, result.duplicate_count, progress);
+
+    for (i = 0; i < bs.size(); i++)
+        delete bs[i];
+    free(json);
+}
+#endif
+#endif
@@ -0,0 +1,454 @@
+#include "framework.h"
+#include "BookSourceStore.h"
+#include "Jsondata.h"
+#include "cJSON.h"
+#include "Utils.h"
+#include <shlwapi.h>
+
+#define BOOK_SOURCE_FILE_NAME       _T(".book_sources.json")
+
+BookSourceStore::BookSourceStore()
+    : m_Dirty(FALSE)
+    , m_Migrate(FALSE)
+    , m_NextId(1)
+{
+    m_hMutex = CreateMutex(NULL, FALSE, NULL);
+    GetHiddenFilePath(BOOK_SOURCE_FILE_NAME, m_FileName);
+    m_Migrate = !PathFileExists(m_FileName);
+    Load();
+}
+
+BookSourceStore::~BookSourceStore()
+{
+    size_t i;
+
+    Save();
+    for (i = 0; i < m_Sources.size(); i++)
+        delete m_Sources[i].bs;
+    for (i = 0; i < m_Retired.size(); i++)
+        delete m_Retired[i];
+    m_Sources.clear();
+    m_Retired.clear();
+    if (m_hMutex)
+        CloseHandle(m_hMutex);
+}
+
+BookSourceStore* BookSourceStore::Instance()
+{
+    static BookSourceStore* s_BookSourceStore = NULL;
+    if (!s_BookSourceStore)
+        s_BookSourceStore = new BookSourceStore;
+    return s_BookSourceStore;
+}
+
+void BookSourceStore::ReleaseInstance()
+{
+    if (Instance())
+        delete Instance();
+}
+
+int BookSourceStore::Count(void)
+{
+    int count;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    count = (int)m_Sources.size();
+    ReleaseMutex(m_hMutex);
+    return count;
+}
+
+book_source_t* BookSourceStore::Get(int idx)
+{
+    book_source_t* bs = NULL;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    if (idx >= 0 && idx < (int)m_Sources.size())
+        bs = m_Sources[idx].bs;
+    ReleaseMutex(m_hMutex);
+    return bs;
+}
+
+book_source_t* BookSourceStore::Find(const char* host)
+{
+    book_source_t* bs = NULL;
+    int idx;
+
+    if (!host)
+        return NULL;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    idx = IndexOfLocked(host);
+    if (idx >= 0)
+        bs = m_Sources[idx].bs;
+    ReleaseMutex(m_hMutex);
+    return bs;
+}
+
+int BookSourceStore::IndexOf(const char* host)
+{
+    int idx;
+
+    if (!host)
+        return -1;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    idx = IndexOfLocked(host);
+    ReleaseMutex(m_hMutex);
+    return idx;
+}
+
+int BookSourceStore::IdOf(int idx)
+{
+    int id = 0;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    if (idx >= 0 && idx < (int)m_Sources.size())
+        id = m_Sources[idx].id;
+    ReleaseMutex(m_hMutex);
+    return id;
+}
+
+book_source_t* BookSourceStore::GetById(int id)
+{
+    std::unordered_map<int, book_source_t*>::iterator it;
+    book_source_t* bs = NULL;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    it = m_IdIndex.find(id);
+    if (it != m_IdIndex.end())
+        bs = it->second;
+    ReleaseMutex(m_hMutex);
+    return bs;
+}
+
+int BookSourceStore::IndexOfId(int id)
+{
+    size_t i;
+    int idx = -1;
+
+    // only the dialogs look for the position, the list is scanned
+    WaitForSingleObject(m_hMutex, INFINITE);
+    for (i = 0; i < m_Sources.size(); i++)
+    {
+        if (m_Sources[i].id == id)
+        {
+            idx = (int)i;
+            break;
+        }
+    }
+    ReleaseMutex(m_hMutex);
+    return idx;
+}
+
+int BookSourceStore::IndexOfLocked(const char* host)
+{
+    std::unordered_map<std::string, int>::iterator it;
+
+    it = m_HostIndex.find(host);
+    if (it == m_HostIndex.end())
+        return -1;
+    return it->second;
+}
+
+int BookSourceStore::AppendLocked(book_source_t* bs, int id)
+{
+    entry_t entry;
+    int idx;
+
+    if (id <= 0 || m_IdIndex.find(id) != m_IdIndex.end())
+        id = m_NextId;
+    if (id >= m_NextId)
+        m_NextId = id + 1;
+    entry.id = id;
+    entry.bs = bs;
+    idx = (int)m_Sources.size();
+    m_Sources.push_back(entry);
+    m_IdIndex[id] = bs;
+    // the first one wins if the host is duplicated
+    m_HostIndex.insert(std::make_pair(std::string(bs->host), idx));
+    m_Dirty = TRUE;
+    return idx;
+}
+
+void BookSourceStore::RebuildIndexLocked(void)
+{
+    size_t i;
+
+    m_HostIndex.clear();
+    for (i = 0; i < m_Sources.size(); i++)
+        m_HostIndex.insert(std::make_pair(std::string(m_Sources[i].bs->host), (int)i));
+}
+
+int BookSourceStore::Add(const book_source_t* bs)
+{
+    book_source_t* item;
+    int idx;
+
+    if (!bs)
+        return -1;
+
+    item = new book_source_t;
+    memcpy(item, bs, sizeof(book_source_t));
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    idx = AppendLocked(item, 0);
+    ReleaseMutex(m_hMutex);
+    return idx;
+}
+
+BOOL BookSourceStore::Set(int idx, const book_source_t* bs)
+{
+    BOOL ret = FALSE;
+    BOOL rehash;
+
+    if (!bs)
+        return FALSE;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    if (idx >= 0 && idx < (int)m_Sources.size())
+    {
+        rehash = 0 != strcmp(m_Sources[idx].bs->host, bs->host);
+        memcpy(m_Sources[idx].bs, bs, sizeof(book_source_t));
+        if (rehash)
+            RebuildIndexLocked();
+        m_Dirty = TRUE;
+        ret = TRUE;
+    }
+    ReleaseMutex(m_hMutex);
+    return ret;
+}
+
+BOOL BookSourceStore::Remove(int idx)
+{
+    BOOL ret = FALSE;
+
+    // removing and moving are done by user one by one, the positions after it are
+    // shifted so the index of hosts is rebuilt
+    WaitForSingleObject(m_hMutex, INFINITE);
+    if (idx >= 0 && idx < (int)m_Sources.size())
+    {
+        m_Retired.push_back(m_Sources[idx].bs);
+        m_IdIndex.erase(m_Sources[idx].id);
+        m_Sources.erase(m_Sources.begin() + idx);
+        RebuildIndexLocked();
+        m_Dirty = TRUE;
+        ret = TRUE;
+    }
+    ReleaseMutex(m_hMutex);
+    return ret;
+}
+
+BOOL BookSourceStore::Swap(int idx1, int idx2)
+{
+    BOOL ret = FALSE;
+    entry_t entry;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    if (idx1 >= 0 && idx1 < (int)m_Sources.size()
+        && idx2 >= 0 && idx2 < (int)m_Sources.size())
+    {
+        entry = m_Sources[idx1];
+        m_Sources[idx1] = m_Sources[idx2];
+        m_Sources[idx2] = entry;
+        RebuildIndexLocked();
+        m_Dirty = TRUE;
+        ret = TRUE;
+    }
+    ReleaseMutex(m_hMutex);
+    return ret;
+}
+
+void BookSourceStore::Clear(void)
+{
+    size_t i;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    for (i = 0; i < m_Sources.size(); i++)
+        m_Retired.push_back(m_Sources[i].bs);
+    m_Sources.clear();
+    m_HostIndex.clear();
+    m_IdIndex.clear();
+    m_Dirty = TRUE;
+    ReleaseMutex(m_hMutex);
+}
+
+void BookSourceStore::Merge(std::vector<book_source_t*>& sources, int* added, int* updated)
+{
+    size_t i;
+    int idx;
+
+    if (added)
+        *added = 0;
+    if (updated)
+        *updated = 0;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    for (i = 0; i < sources.size(); i++)
+    {
+        if (!sources[i])
+            continue;
+        idx = IndexOfLocked(sources[i]->host);
+        if (idx >= 0)
+        {
+            memcpy(m_Sources[idx].bs, sources[i], sizeof(book_source_t));
+            delete sources[i];
+            m_Dirty = TRUE;
+            if (updated)
+                (*updated)++;
+        }
+        else
+        {
+            AppendLocked(sources[i], 0);
+            if (added)
+                (*added)++;
+        }
+    }
+    ReleaseMutex(m_hMutex);
+    sources.clear();
+}
+
+void BookSourceStore::Replace(std::vector<book_source_t*>& sources)
+{
+    std::unordered_map<std::string, entry_t> old;
+    std::unordered_map<std::string, entry_t>::iterator it;
+    std::vector<entry_t> entries;
+    size_t i;
+    int idx;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    entries.swap(m_Sources);
+    m_HostIndex.clear();
+    for (i = 0; i < entries.size(); i++)
+    {
+        // the first one wins if the host is duplicated, the others are gone
+        if (!old.insert(std::make_pair(std::string(entries[i].bs->host), entries[i])).second)
+        {
+            m_Retired.push_back(entries[i].bs);
+            m_IdIndex.erase(entries[i].id);
+        }
+    }
+    for (i = 0; i < sources.size(); i++)
+    {
+        if (!sources[i])
+            continue;
+        idx = IndexOfLocked(sources[i]->host);
+        if (idx >= 0)
+        {
+            // duplicated in the vector, the last one wins as Merge
+            memcpy(m_Sources[idx].bs, sources[i], sizeof(book_source_t));
+            delete sources[i];
+            continue;
+        }
+        it = old.find(sources[i]->host);
+        if (it == old.end())
+        {
+            AppendLocked(sources[i], 0);
+            continue;
+        }
+        memcpy(it->second.bs, sources[i], sizeof(book_source_t));
+        delete sources[i];
+        m_HostIndex.insert(std::make_pair(std::string(it->second.bs->host), (int)m_Sources.size()));
+        m_Sources.push_back(it->second);
+        old.erase(it);
+    }
+    for (it = old.begin(); it != old.end(); it++)
+    {
+        m_Retired.push_back(it->second.bs);
+        m_IdIndex.erase(it->second.id);
+    }
+    m_Dirty = TRUE;
+    ReleaseMutex(m_hMutex);
+    sources.clear();
+}
+
+BOOL BookSourceStore::Load(void)
+{
+    char* json = NULL;
+    cJSON* root = NULL;
+    cJSON* array = NULL;
+    cJSON* item = NULL;
+    cJSON* id = NULL;
+    book_source_t* bs;
+
+    json = ReadHiddenFile(m_FileName, NULL);
+    if (!json)
+        return FALSE;
+
+    root = cJSON_Parse(json);
+    free(json);
+    if (!root)
+        return FALSE;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    array = cJSON_GetObjectItem(root, "book_sources");
+    cJSON_ArrayForEach(item, array)
+    {
+        bs = new book_source_t;
+        memset(bs, 0, sizeof(book_source_t));
+        book_source_from_json(item, bs);
+        id = cJSON_GetObjectItem(item, "id");
+        AppendLocked(bs, id ? id->valueint : 0);
+    }
+    m_Dirty = FALSE;
+    ReleaseMutex(m_hMutex);
+    cJSON_Delete(root);
+    return TRUE;
+}
+
+BOOL BookSourceStore::Save(void)
+{
+    BOOL ret = FALSE;
+    char* json = NULL;
+    cJSON* root = NULL;
+    cJSON* array = NULL;
+    cJSON* item = NULL;
+    size_t i;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    if (!m_Dirty)
+    {
+        ReleaseMutex(m_hMutex);
+        return TRUE;
+    }
+    root = cJSON_CreateObject();
+    array = cJSON_AddArrayToObject(root, "book_sources");
+    for (i = 0; i < m_Sources.size(); i++)
+    {
+        item = book_source_to_json(m_Sources[i].bs, TRUE);
+        cJSON_AddNumberToObject(item, "id", m_Sources[i].id);
+        cJSON_AddItemToArray(array, item);
+    }
+    m_Dirty = FALSE;
+    ReleaseMutex(m_hMutex);
+
+    json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (!json)
+        return FALSE;
+
+    ret = WriteHiddenFile(m_FileName, json, (int)strlen(json));
+    free(json);
+    if (!ret)
+    {
+        // try it again at the next saving
+        WaitForSingleObject(m_hMutex, INFINITE);
+        m_Dirty = TRUE;
+        ReleaseMutex(m_hMutex);
+    }
+    return ret;
+}
+
+BOOL BookSourceStore::ShouldMigrate(void)
+{
+    BOOL ret;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    ret = m_Migrate;
+    if (m_Migrate)
+    {
+        m_Migrate = FALSE;
+        m_Dirty = TRUE;
+    }
+    ReleaseMutex(m_hMutex);
+    return ret;
+}
@@ -0,0 +1,90 @@
+#ifndef __BOOK_SOURCE_STORE_H__
+#define __BOOK_SOURCE_STORE_H__
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include "types.h"
+
+// all the book sources in the order of user, it has no limit of count.
+// a source keeps its address until the process exits: the opened online books and
+// the running queries hold the pointers, so the removed sources are retired instead
+// of freed, and moving a source moves the pointer only.
+// a source is a fixed book_source_t (about 17 KB, most of it unused xpath buffers)
+// because every reader takes the fields in place. the retired ones are only those
+// removed by user, a sync or an import updates the sources of the same host in
+// place, so the memory is bounded by the sources which ever existed in one run.
+// a source has an id which is kept when it is edited or moved and is never reused while
+// running, the queries refer to the sources by the ids.
+// the sources are saved to their own file with the non-empty fields only, saving the
+// settings doesn't write them again.
+class BookSourceStore
+{
+private:
+    BookSourceStore();
+    ~BookSourceStore();
+
+public:
+    static BookSourceStore* Instance();
+    static void ReleaseInstance();
+
+    int Count(void);
+    // NULL if idx is out of range
+    book_source_t* Get(int idx);
+    // looked up by the index of hosts, the first one if the host is duplicated
+    book_source_t* Find(const char *host);
+    // -1 if not found
+    int IndexOf(const char *host);
+    // 0 if idx is out of range, the ids start from 1
+    int IdOf(int idx);
+    // NULL if the source is removed
+    book_source_t* GetById(int id);
+    // -1 if the source is removed
+    int IndexOfId(int id);
+
+    // the source is copied, return the index of it
+    int Add(const book_source_t *bs);
+    BOOL Set(int idx, const book_source_t *bs);
+    BOOL Remove(int idx);
+    BOOL Swap(int idx1, int idx2);
+    void Clear(void);
+    // the store takes the ownership of the sources which are allocated by new, the one
+    // which has the same host as an existing source replaces it in place, the others
+    // are appended. the vector is cleared.
+    void Merge(std::vector<book_source_t*> &sources, int *added = NULL, int *updated = NULL);
+    // same as Clear and Merge, the sources take the order of the vector, but the ones
+    // whose host is still there are updated in place and keep their ids, only the
+    // others are retired
+    void Replace(std::vector<book_source_t*> &sources);
+
+    // write the file if any source is changed
+    BOOL Save(void);
+    // TRUE for the first call if the file didn't exist, the sources of old versions are
+    // moved to the store then. the file is written at the next saving even if it is empty.
+    BOOL ShouldMigrate(void);
+
+private:
+    typedef struct entry_t
+    {
+        int id;
+        book_source_t* bs;
+    } entry_t;
+
+    BOOL Load(void);
+    int IndexOfLocked(const char *host);
+    int AppendLocked(book_source_t *bs, int id);
+    void RebuildIndexLocked(void);
+
+private:
+    HANDLE m_hMutex;
+    TCHAR m_FileName[MAX_PATH];
+    BOOL m_Dirty;
+    BOOL m_Migrate;
+    int m_NextId;
+    std::vector<entry_t> m_Sources;
+    std::vector<book_source_t*> m_Retired;
+    std::unordered_map<std::string, int> m_HostIndex;   // host -> index of m_Sources
+    std::unordered_map<int, book_source_t*> m_IdIndex;
+};
+
+#endif // !__BOOK_SOURCE_STORE_H__
@@ -6,12 +6,17 @@
 #include "Utils.h"
 #include "https.h"
 #include "Jsondata.h"
+#include "HtmlParser.h"
+#include "ContentFilter.h"
+#include "RulePlan.h"
+#include "SourceStat.h"
+#include "BookSourceStore.h"
 #include <shellapi.h>
 #include <commdlg.h>
 #include <stdio.h>
+#include <process.h>
 #include <regex>
 
-extern header_t *_header;
 extern HWND _hWnd;
 extern HINSTANCE hInst;
 extern void Save(HWND);
@@ -21,6 +26,8 @@ extern void ReloadBookSourceCombobox(HWND hDlg, int iPos);
 
 static BOOL g_EnableSync = TRUE;
 static req_handler_t g_hRequestSync = NULL;
+static HANDLE g_hImportThread = NULL;
+static TCHAR g_szTitle[256] = { 0 };
 
 static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam);
 
@@ -214,9 +221,9 @@ static void _get_data_from_ui(HWND hDlg, book_source_t *data)
         len = _tcslen(buf);
         for (i = 0; i < len; i++)
         {
-            if (buf[i] == _T('\n') && i > 0 && buf[i - 1] == _T('\r'))
+            if (buf[i] == _T('\n') && j > 0 && data->content_filter_keyword[j - 1] == _T('\r'))
             {
-                buf[i - 1] = _T('\n');
+                data->content_filter_keyword[j - 1] = _T('\n');
                 continue;
             }
             data->content_filter_keyword[j++] = buf[i];
@@ -257,21 +264,21 @@ static void _load_ui(HWND hDlg, int idx, BOOL initList)
         lvc.cx = 146;
         SendMessage(hList, LVM_INSERTCOLUMN, 0, (LPARAM)&lvc);
 
-        for (i = 0; i < _header->book_source_count; i++)
+        for (i = 0; i < BookSourceStore::Instance()->Count(); i++)
         {
             memset(&lvitem, 0, sizeof(LVITEM));
             lvitem.mask = LVIF_TEXT;
             lvitem.cchTextMax = MAX_PATH;
             lvitem.iItem = i;
             lvitem.iSubItem = 0;
-            lvitem.pszText = _header->book_sources[i].title;
+            lvitem.pszText = BookSourceStore::Instance()->Get(i)->title;
             ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
             ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
         }
     }
-    if (idx >= 0 && idx < _header->book_source_count)
+    if (idx >= 0 && idx < BookSourceStore::Instance()->Count())
     {
-        _set_data_to_ui(hDlg, &_header->book_sources[idx]);
+        _set_data_to_ui(hDlg, BookSourceStore::Instance()->Get(idx));
         ListView_SetItemState(hList, idx, LVIS_FOCUSED | LVIS_SELECTED, 0x000F);
     }
     else
@@ -285,6 +292,28 @@ static void _load_ui(HWND hDlg, int idx, BOOL initList)
     _enable_content_filter(hDlg);
 }
 
+static void _show_source_stat(HWND hDlg, int idx)
+{
+    source_health_t health;
+    TCHAR status[256] = { 0 };
+
+    SourceStat::Instance()->GetHealth(BookSourceStore::Instance()->Get(idx), &health);
+    LoadString(hInst, health.down ? IDS_BS_DOWN : IDS_BS_HEALTHY, status, 256);
+    MessageBoxFmt_(hDlg, IDS_BS_STAT, MB_ICONINFORMATION | MB_OK, IDS_BS_STAT_FMT,
+        status, health.request_count, health.error_count, health.parse_fail_count,
+        health.latency_p50, health.latency_p90,
+        health.query_count > 0 ? health.result_count / health.query_count : 0,
+        health.fail_streak);
+}
+
+static void _book_source_changed(void)
+{
+    // the cached data which built from book sources is out of date
+    HtmlParser::Instance()->ClearXpathCache();
+    ContentFilter::ClearCache();
+    RulePlan::ClearCache();
+}
+
 static BOOL _check_is_empty(HWND hDlg, book_source_t *data)
 {
     book_source_t *p_temp = NULL;
@@ -364,20 +393,37 @@ static BOOL _check_is_valid(HWND hDlg, book_source_t* data)
 
     if (data->content_filter_type == 2)
     {
-        try
-        {
-            e = new std::wregex(data->content_filter_keyword);
-        }
-        catch (...)
+        // one regex per line
+        const TCHAR* p = data->content_filter_keyword;
+        const TCHAR* t = NULL;
+        while (*p)
         {
-            if (e)
+            t = p;
+            while (*t && *t != _T('\r') && *t != _T('\n'))
+                t++;
+            try
             {
-                delete e;
+                if (t > p)
+                {
+                    e = new std::wregex(p, t);
+                    delete e;
+                    e = NULL;
+                }
             }
-            if (p_temp)
-                free(p_temp);
-            MessageBox_(hDlg, IDS_INVALID_REGEX, IDS_ERROR, MB_ICONERROR | MB_OK);
-            return FALSE;
+            catch (...)
+            {
+                if (e)
+                {
+                    delete e;
+                }
+                if (p_temp)
+                    free(p_temp);
+                MessageBox_(hDlg, IDS_INVALID_REGEX, IDS_ERROR, MB_ICONERROR | MB_OK);
+                return FALSE;
+            }
+            p = t;
+            while (*p == _T('\r') || *p == _T('\n'))
+                p++;
         }
     }
     if (p_temp)
@@ -387,8 +433,9 @@ static BOOL _check_is_valid(HWND hDlg, book_source_t* data)
 
 static BOOL _check_is_exist(HWND hDlg, int except, book_source_t *data)
 {
-    int i;
+    int i, count;
     book_source_t *p_temp = NULL;
+    book_source_t *bs = NULL;
     if (!data)
     {
         p_temp = (book_source_t*)malloc(sizeof(book_source_t));
@@ -397,14 +444,13 @@ static BOOL _check_is_exist(HWND hDlg, int except, book_source_t *data)
         data = p_temp;
     }
 
-    for (i = 0; i < _header->book_source_count; i++)
-    {
-        if (i != except && 0 == _tcscmp(data->title, _header->book_sources[i].title))
-            goto _yes;
-    }
-    for (i = 0; i < _header->book_source_count; i++)
+    // the index of hosts has only the first one of a duplicated host, which may be
+    // the except one, so every source is compared
+    count = BookSourceStore::Instance()->Count();
+    for (i = 0; i < count; i++)
     {
-        if (i != except && 0 == strcmp(data->host, _header->book_sources[i].host))
+        bs = BookSourceStore::Instance()->Get(i);
+        if (i != except && bs && (0 == _tcscmp(data->title, bs->title) || 0 == strcmp(data->host, bs->host)))
             goto _yes;
     }
     if (p_temp)
@@ -430,7 +476,7 @@ static BOOL _check_is_modify(HWND hDlg, int idx, book_source_t *data)
         data = p_temp;
     }
 
-    is_modify = 0 != memcmp(data, &_header->book_sources[idx], sizeof(book_source_t));
+    is_modify = 0 != memcmp(data, BookSourceStore::Instance()->Get(idx), sizeof(book_source_t));
     if (p_temp)
         free(p_temp);
     return is_modify;
@@ -444,10 +490,10 @@ static void _backup_curn_bsconfig(void)
     const TCHAR *bak_name = _T(".bs_bak.json");
     size_t i;
 
-    if (_header->book_source_count == 0)
+    if (BookSourceStore::Instance()->Count() == 0)
         return;
 
-    if (export_book_source(_header->book_sources, _header->book_source_count, &json))
+    if (export_book_source(&json))
     {
         GetModuleFileName(NULL, file_name, sizeof(TCHAR) * (MAX_PATH - 1));
         for (i = _tcslen(file_name) - 1; i >= 0; i--)
@@ -471,82 +517,97 @@ static void _backup_curn_bsconfig(void)
     export_book_source_free(json);
 }
 
-static BOOL _merge_bsconfig(HWND hDlg, const char *json)
+typedef struct import_task_t
 {
-    int book_source_count;
-    book_source_t *book_sources = NULL;
-    int i, j, ret;
-    int found;
-
-    book_sources = (book_source_t*)malloc(sizeof(book_source_t) * MAX_BOOKSRC_COUNT);
-    memset(book_sources, 0, sizeof(book_source_t) * MAX_BOOKSRC_COUNT);
-    book_source_count = 0;
-    if (!import_book_source(json, book_sources, &book_source_count))
-    {
-        free(book_sources);
-        return FALSE;
-    }
-    // no changed
-    if (book_source_count == _header->book_source_count && 0 == memcmp(book_sources, _header->book_sources, sizeof(book_sources)))
-    {
-        free(book_sources);
-        return TRUE;
-    }
+    HWND hDlg;
+    char *json;
+    BOOL ret;
+    std::vector<book_source_t*> book_sources;
+} import_task_t;
+
+// a legado pack has thousands of sources, the progress is posted to the dialog
+// and shown on its title, it is called by the thread which imports
+static void _import_progress(int done, int total, void *param)
+{
+    PostMessage((HWND)param, WM_IMPORT_PROGRESS, (WPARAM)done, (LPARAM)total);
+}
+
+static BOOL _import_bsconfig(HWND hDlg, const char *json, std::vector<book_source_t*> &book_sources)
+{
+    return import_book_source(json, book_sources, _import_progress, hDlg);
+}
+
+static unsigned __stdcall _import_thread(void *param)
+{
+    import_task_t *task = (import_task_t *)param;
+
+    task->ret = _import_bsconfig(task->hDlg, task->json, task->book_sources);
+    PostMessage(task->hDlg, WM_IMPORT_DONE, 0, (LPARAM)task);
+    return 0;
+}
+
+static void _free_import_task(import_task_t *task)
+{
+    size_t i;
+
+    for (i = 0; i < task->book_sources.size(); i++)
+        delete task->book_sources[i];
+    free(task->json);
+    delete task;
+}
+
+// the sources are imported already, ask user for the changed ones
+static void _merge_bsconfig(HWND hDlg, std::vector<book_source_t*> &book_sources)
+{
+    std::vector<book_source_t*> merges;
+    book_source_t *item;
+    size_t i, j;
+    int idx, ret;
+
     // do check
-    for (i = 0; i < book_source_count; i++)
+    for (i = 0; i < book_sources.size(); i++)
     {
-        found = 0;
-        for (j = 0; j < _header->book_source_count; j++)
+        idx = BookSourceStore::Instance()->IndexOf(book_sources[i]->host);
+        if (idx < 0)
         {
-            if (0 == memcmp(&book_sources[i], &_header->book_sources[j], sizeof(book_source_t)))
-            {
-                found = 1;
-                break;
-            }
-            if (0 == strcmp(book_sources[i].host, _header->book_sources[j].host))
-            {
-                found = 1;
-                ret = MessageBoxFmt_(hDlg, IDS_WARN, MB_ICONINFORMATION | MB_YESNO, IDS_BS_EXIST_TIP, _header->book_sources[j].title);
-                if (IDYES == ret)
-                {
-                    // replace
-                    memcpy(&_header->book_sources[j], &book_sources[i], sizeof(book_source_t));
-                }
-                else if (IDNO == ret)
-                {
-                    // ignore, keep old config
-                }
-                else
-                {
-                    // exit
-                    free(book_sources);
-                    return TRUE;
-                }
-                break;
-            }
+            // add new one
+            merges.push_back(book_sources[i]);
+            continue;
         }
-        if (found == 0)
+        item = BookSourceStore::Instance()->Get(idx);
+        if (0 == memcmp(book_sources[i], item, sizeof(book_source_t)))
         {
-            // add new one
-            if (_header->book_source_count < MAX_BOOKSRC_COUNT)
-            {
-                memcpy(&_header->book_sources[_header->book_source_count], &book_sources[i], sizeof(book_source_t));
-                _header->book_source_count++;
-            }
+            // no changed
+            delete book_sources[i];
+            continue;
+        }
+        ret = MessageBoxFmt_(hDlg, IDS_WARN, MB_ICONINFORMATION | MB_YESNOCANCEL, IDS_BS_EXIST_TIP, item->title);
+        if (IDYES == ret)
+        {
+            // replace
+            merges.push_back(book_sources[i]);
+        }
+        else if (IDNO == ret)
+        {
+            // ignore, keep old config
+            delete book_sources[i];
+        }
+        else
+        {
+            // exit
+            for (j = i; j < book_sources.size(); j++)
+                delete book_sources[j];
+            break;
         }
     }
-    free(book_sources);
-    return TRUE;
+    book_sources.clear();
+    BookSourceStore::Instance()->Merge(merges);
 }
 
-static void EnableDialog_Sync(HWND hDlg, BOOL enable)
+static void _enable_dialog(HWND hDlg, BOOL enable)
 {
-    TCHAR szSync[256] = { 0 };
-    TCHAR szStopSync[256] = { 0 };
     book_source_t *p_temp = NULL;
-    LoadString(hInst, IDS_AUTO_SYNC, szSync, 256);
-    LoadString(hInst, IDS_STOP_SYNC, szStopSync, 256);
-   
+
     EnableWindow(GetDlgItem(hDlg, IDC_EDIT_TITLE), enable);
     EnableWindow(GetDlgItem(hDlg, IDC_EDIT_HOST), enable);
     EnableWindow(GetDlgItem(hDlg, IDC_EDIT_QUERY), enable);
@@ -593,7 +654,16 @@ static void EnableDialog_Sync(HWND hDlg, BOOL enable)
         _enable_content_next(hDlg);
         _enable_content_filter(hDlg);
     }
+}
 
+static void EnableDialog_Sync(HWND hDlg, BOOL enable)
+{
+    TCHAR szSync[256] = { 0 };
+    TCHAR szStopSync[256] = { 0 };
+    LoadString(hInst, IDS_AUTO_SYNC, szSync, 256);
+    LoadString(hInst, IDS_STOP_SYNC, szStopSync, 256);
+
+    _enable_dialog(hDlg, enable);
     g_EnableSync = enable;
     if (enable)
         SetDlgItemText(hDlg, IDC_SYNC, szSync);
@@ -601,12 +671,20 @@ static void EnableDialog_Sync(HWND hDlg, BOOL enable)
         SetDlgItemText(hDlg, IDC_SYNC, szStopSync);
 }
 
+static void EnableDialog_Import(HWND hDlg, BOOL enable)
+{
+    _enable_dialog(hDlg, enable);
+    EnableWindow(GetDlgItem(hDlg, IDC_SYNC), enable);
+}
+
 static unsigned int DownloadBooksrcCompleter(request_result_t* result)
 {
     HWND hDlg = (HWND)result->param1;
     char* html = NULL;
     int htmllen = 0;
     int needfree = 0;
+    std::vector<book_source_t*> book_sources;
+    size_t i;
 
     g_hRequestSync = NULL;
 
@@ -656,14 +734,19 @@ static unsigned int DownloadBooksrcCompleter(request_result_t* result)
     _backup_curn_bsconfig();
 
     // import book src
-    if (!import_book_source(html, _header->book_sources, &_header->book_source_count))
+    if (!_import_bsconfig(hDlg, html, book_sources))
     {
+        for (i = 0; i < book_sources.size(); i++)
+            delete book_sources[i];
         EnableDialog_Sync(hDlg, TRUE);
         MessageBox_(hDlg, IDS_IMPORT_FAILED, IDS_ERROR, MB_ICONERROR | MB_OK);
         if (needfree == 1)
             free(html);
         return 1;
     }
+    // the synced sources replace all, the unchanged hosts are updated in place
+    BookSourceStore::Instance()->Replace(book_sources);
+    _book_source_changed();
 
     // update ui
     ListView_DeleteAllItems(GetDlgItem(hDlg, IDC_LIST_BOOKSRC));
@@ -690,7 +773,7 @@ static int DownloadBooksrc(HWND hDlg)
         return 0;
     }
 
-    if (_header->book_source_count > 0)
+    if (BookSourceStore::Instance()->Count() > 0)
     {
         if (IDYES != MessageBox_(hDlg, IDS_LOST_WARN, IDS_WARN, MB_ICONWARNING | MB_YESNO))
             return 0;
@@ -725,6 +808,8 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
     case WM_INITDIALOG:
         g_hRequestSync = NULL;
         g_EnableSync = TRUE;
+        g_hImportThread = NULL;
+        GetWindowText(hDlg, g_szTitle, 256);
         hList = GetDlgItem(hDlg, IDC_LIST_BOOKSRC);
         ListView_SetExtendedListViewStyleEx(hList, LVS_REPORT | LVM_SETEXTENDEDLISTVIEWSTYLE, LVS_EX_GRIDLINES | LVS_EX_FULLROWSELECT | LVS_EX_TWOCLICKACTIVATE);
         LoadString(hInst, IDS_NULL, buf, 256);
@@ -745,7 +830,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_CTX_NEXT), CB_ADDSTRING, 0, (LPARAM)_T("Disable"));
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_CTX_NEXT), CB_ADDSTRING, 0, (LPARAM)_T("Enable"));
         iPos = (int)SendMessage(GetDlgItem(GetParent(hDlg), IDC_COMBO_BS_LIST), CB_GETCURSEL, 0, NULL);
-        if (iPos < 0 || iPos >= _header->book_source_count)
+        if (iPos < 0 || iPos >= BookSourceStore::Instance()->Count())
             iPos = 0;
         _load_ui(hDlg, iPos, TRUE);
         return (INT_PTR)TRUE;
@@ -756,13 +841,6 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             // add item
             hList = GetDlgItem(hDlg, IDC_LIST_BOOKSRC);
 
-            // check is full
-            if (_header->book_source_count >= MAX_BOOKSRC_COUNT)
-            {
-                MessageBoxFmt_(hDlg, IDS_ERROR, MB_ICONERROR | MB_OK, IDS_BOOKSOURCE_FULL, MAX_BOOKSRC_COUNT);
-                return (INT_PTR)FALSE;
-            }
-
             if (!p_temp)
                 p_temp = (book_source_t*)malloc(sizeof(book_source_t));
             memset(p_temp, 0, sizeof(book_source_t));
@@ -790,9 +868,8 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             }
 
             // insert data
-            iPos = _header->book_source_count;
-            memcpy(&_header->book_sources[iPos], p_temp, sizeof(book_source_t));
-            _header->book_source_count++;
+            iPos = BookSourceStore::Instance()->Add(p_temp);
+            _book_source_changed();
 
             free(p_temp);
             p_temp = NULL;
@@ -803,7 +880,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             lvitem.cchTextMax = MAX_PATH;
             lvitem.iItem = iPos;
             lvitem.iSubItem = 0;
-            lvitem.pszText = _header->book_sources[iPos].title;
+            lvitem.pszText = BookSourceStore::Instance()->Get(iPos)->title;
             ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
             ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
             ListView_SetItemState(hList, iPos, LVIS_FOCUSED | LVIS_SELECTED, 0x000F);
@@ -826,6 +903,16 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             }
             g_hRequestSync = NULL;
             g_EnableSync = TRUE;
+            if (g_hImportThread)
+            {
+                // the import can't be stopped, drop its result
+                MSG msg;
+                WaitForSingleObject(g_hImportThread, INFINITE);
+                CloseHandle(g_hImportThread);
+                g_hImportThread = NULL;
+                if (PeekMessage(&msg, hDlg, WM_IMPORT_DONE, WM_IMPORT_DONE, PM_REMOVE))
+                    _free_import_task((import_task_t *)msg.lParam);
+            }
             // update parent combo
             iPos = ListView_GetNextItem(GetDlgItem(hDlg, IDC_LIST_BOOKSRC), -1, LVNI_SELECTED);
             ReloadBookSourceCombobox(GetParent(hDlg), iPos);
@@ -877,10 +964,10 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             }
 
             // check if want to add new
-            if (0 != _tcscmp(_header->book_sources[iPos].title, p_temp->title)
-                && 0 != strcmp(_header->book_sources[iPos].host, p_temp->host))
+            if (0 != _tcscmp(BookSourceStore::Instance()->Get(iPos)->title, p_temp->title)
+                && 0 != strcmp(BookSourceStore::Instance()->Get(iPos)->host, p_temp->host))
             {
-                if (IDYES != MessageBoxFmt_(hDlg, IDS_WARN, MB_ICONINFORMATION | MB_YESNO, IDS_BS_SAVE_TIP, _header->book_sources[iPos].title))
+                if (IDYES != MessageBoxFmt_(hDlg, IDS_WARN, MB_ICONINFORMATION | MB_YESNO, IDS_BS_SAVE_TIP, BookSourceStore::Instance()->Get(iPos)->title))
                 {
                     free(p_temp);
                     return (INT_PTR)FALSE;
@@ -888,7 +975,8 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             }
 
             // save
-            memcpy(&_header->book_sources[iPos], p_temp, sizeof(book_source_t));
+            BookSourceStore::Instance()->Set(iPos, p_temp);
+            _book_source_changed();
 
             free(p_temp);
             p_temp = NULL;
@@ -899,7 +987,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             lvitem.cchTextMax = MAX_PATH;
             lvitem.iItem = iPos;
             lvitem.iSubItem = 0;
-            lvitem.pszText = _header->book_sources[iPos].title;
+            lvitem.pszText = BookSourceStore::Instance()->Get(iPos)->title;
             ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
 
             // save cache
@@ -927,7 +1015,8 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             break;        
         case IDC_IMPORT:
         {
-            char* json;
+            import_task_t* task;
+            unsigned threadID;
             FILE* fp;
             int len;
             BOOL bSel;
@@ -960,30 +1049,23 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             fseek(fp, 0, SEEK_END);
             len = ftell(fp);
             fseek(fp, 0, SEEK_SET);
-            json = (char*)malloc(len+1);
-            json[len] = 0;
-            fread(json, 1, len, fp);
+            task = new import_task_t;
+            task->hDlg = hDlg;
+            task->ret = FALSE;
+            task->json = (char*)malloc(len+1);
+            task->json[len] = 0;
+            fread(task->json, 1, len, fp);
             fclose(fp);
 
-#if 1
-            if (!_merge_bsconfig(hDlg, json))
-#else
-            if (!import_book_source(json, _header->book_sources, &_header->book_source_count))
-#endif
+            // converting a large pack takes a while, the dialog keeps responding
+            EnableDialog_Import(hDlg, FALSE);
+            g_hImportThread = (HANDLE)_beginthreadex(NULL, 0, _import_thread, task, 0, &threadID);
+            if (!g_hImportThread)
             {
+                _free_import_task(task);
+                EnableDialog_Import(hDlg, TRUE);
                 MessageBox_(hDlg, IDS_IMPORT_FAILED, IDS_ERROR, MB_ICONERROR | MB_OK);
-                break;
             }
-            free(json);
-
-            // update ui
-            ListView_DeleteAllItems(GetDlgItem(hDlg, IDC_LIST_BOOKSRC));
-            _load_ui(hDlg, 0, TRUE);
-
-            // save cache
-            Save(_hWnd);
-
-            MessageBox_(hDlg, IDS_IMPORT_COMPLETED, IDS_SUCC, MB_ICONINFORMATION | MB_OK);
         }
         break;
         case IDC_EXPORT:
@@ -1009,7 +1091,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
                 break;
             }
 
-            if (!export_book_source(_header->book_sources, _header->book_source_count, &json))
+            if (!export_book_source(&json))
             {
                 MessageBox_(hDlg, IDS_EXPORT_FAILED, IDS_ERROR, MB_ICONERROR | MB_OK);
                 break;
@@ -1037,6 +1119,49 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             break;
         }
         break;
+    case WM_IMPORT_PROGRESS:
+        if ((int)wParam < (int)lParam)
+        {
+            _stprintf(buf, _T("%s (%d/%d)"), g_szTitle, (int)wParam, (int)lParam);
+            SetWindowText(hDlg, buf);
+        }
+        else
+        {
+            SetWindowText(hDlg, g_szTitle);
+        }
+        return (INT_PTR)TRUE;
+    case WM_IMPORT_DONE:
+    {
+        import_task_t* task = (import_task_t*)lParam;
+
+        if (g_hImportThread)
+        {
+            CloseHandle(g_hImportThread);
+            g_hImportThread = NULL;
+        }
+        SetWindowText(hDlg, g_szTitle);
+        EnableDialog_Import(hDlg, TRUE);
+        if (!task->ret)
+        {
+            _free_import_task(task);
+            MessageBox_(hDlg, IDS_IMPORT_FAILED, IDS_ERROR, MB_ICONERROR | MB_OK);
+            return (INT_PTR)TRUE;
+        }
+        // the changed sources are confirmed by user on the ui thread
+        _merge_bsconfig(hDlg, task->book_sources);
+        _free_import_task(task);
+        _book_source_changed();
+
+        // update ui
+        ListView_DeleteAllItems(GetDlgItem(hDlg, IDC_LIST_BOOKSRC));
+        _load_ui(hDlg, 0, TRUE);
+
+        // save cache
+        Save(_hWnd);
+
+        MessageBox_(hDlg, IDS_IMPORT_COMPLETED, IDS_SUCC, MB_ICONINFORMATION | MB_OK);
+        return (INT_PTR)TRUE;
+    }
     case WM_NOTIFY:
         if (LOWORD(wParam) == IDC_LIST_BOOKSRC)
         {
@@ -1071,7 +1196,7 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
             pt.x = LOWORD(lParam);
             pt.y = HIWORD(lParam);
             iPos = ListView_GetNextItem(GetDlgItem(hDlg, IDC_LIST_BOOKSRC), -1, LVNI_SELECTED);
-            if (iPos >= 0 && iPos < _header->book_source_count)
+            if (iPos >= 0 && iPos < BookSourceStore::Instance()->Count())
             {
                 s_iLastPos = iPos;
                 HMENU hMenu = CreatePopupMenu();
@@ -1085,11 +1210,13 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
                         LoadString(hInst, IDS_MOVE_UP, str, 256);
                         InsertMenu(hMenu, (UINT)-1, MF_BYPOSITION, IDM_BS_MOVE_UP, str);
                     }
-                    if (iPos < _header->book_source_count-1)
+                    if (iPos < BookSourceStore::Instance()->Count() - 1)
                     {
                         LoadString(hInst, IDS_MOVE_DOWN, str, 256);
                         InsertMenu(hMenu, (UINT)-1, MF_BYPOSITION, IDM_BS_MOVE_DOWN, str);
                     }
+                    LoadString(hInst, IDS_BS_STAT, str, 256);
+                    InsertMenu(hMenu, (UINT)-1, MF_BYPOSITION, IDM_BS_STAT, str);
                     LoadString(hInst, IDS_CLEAR, str, 256);
                     InsertMenu(hMenu, (UINT)-1, MF_BYPOSITION, IDM_BS_CLEAR, str);
                     int ret = TrackPopupMenu(hMenu, TPM_RETURNCMD, pt.x, pt.y, 0, hList, NULL);
@@ -1099,13 +1226,8 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
                         if (IDYES == MessageBox_(hDlg, IDS_DELETE_BS_CFM, IDS_WARN, MB_ICONINFORMATION | MB_YESNO))
                         {
                             // delete from data
-                            for (int i = iPos + 1; i < _header->book_source_count; i++)
-                            {
-                                book_source_t* item_1 = &_header->book_sources[i];
-                                book_source_t* item_2 = &_header->book_sources[i - 1];
-                                memcpy(item_2, item_1, sizeof(book_source_t));
-                            }
-                            _header->book_source_count--;
+                            BookSourceStore::Instance()->Remove(iPos);
+                            _book_source_changed();
 
                             // delete from list view
                             ListView_DeleteItem(hList, iPos);
@@ -1115,13 +1237,8 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
                     else if (IDM_BS_MOVE_UP == ret)
                     {
                         // move up
-                        book_source_t* item = (book_source_t*)malloc(sizeof(book_source_t));
-                        book_source_t* item_1 = &_header->book_sources[iPos];
-                        book_source_t* item_2 = &_header->book_sources[iPos - 1];
-                        memcpy(item, item_1, sizeof(book_source_t));
-                        memcpy(item_1, item_2, sizeof(book_source_t));
-                        memcpy(item_2, item, sizeof(book_source_t));
-                        free(item);
+                        BookSourceStore::Instance()->Swap(iPos, iPos - 1);
+                        _book_source_changed();
 
                         // update ui
                         ListView_DeleteAllItems(GetDlgItem(hDlg, IDC_LIST_BOOKSRC));
@@ -1130,24 +1247,23 @@ static INT_PTR CALLBACK BS_DlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARA
                     else if (IDM_BS_MOVE_DOWN == ret)
                     {
                         // move down
-                        book_source_t* item = (book_source_t*)malloc(sizeof(book_source_t));
-                        book_source_t* item_1 = &_header->book_sources[iPos];
-                        book_source_t* item_2 = &_header->book_sources[iPos + 1];
-                        memcpy(item, item_1, sizeof(book_source_t));
-                        memcpy(item_1, item_2, sizeof(book_source_t));
-                        memcpy(item_2, item, sizeof(book_source_t));
-                        free(item);
+                        BookSourceStore::Instance()->Swap(iPos, iPos + 1);
+                        _book_source_changed();
 
                         // update ui
                         ListView_DeleteAllItems(GetDlgItem(hDlg, IDC_LIST_BOOKSRC));
                         _load_ui(hDlg, iPos + 1, TRUE);
                     }
+                    else if (IDM_BS_STAT == ret)
+                    {
+                        _show_source_stat(hDlg, iPos);
+                    }
                     else if (IDM_BS_CLEAR == ret)
                     {
                         if (IDYES == MessageBox_(hDlg, IDS_CLEAR_BS_CFM, IDS_WARN, MB_ICONINFORMATION | MB_YESNO))
                         {
-                            _header->book_source_count = 0;
-                            memset(_header->book_sources, 0, sizeof(_header->book_sources));
+                            BookSourceStore::Instance()->Clear();
+                            _book_source_changed();
                             
                             // update ui
                             ListView_DeleteAllItems(GetDlgItem(hDlg, IDC_LIST_BOOKSRC));
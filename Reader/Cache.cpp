@@ -399,6 +399,7 @@ void Cache::default_header(header_t* header)
     header->chapter_rule.rule = 0;
 
     header->meun_font_follow = 0;
+    header->hedged_fetch = 0;
 
     for (i = 0; i<MAX_CUST_COLOR_COUNT; i++)
     {
@@ -0,0 +1,263 @@
+#ifdef ENABLE_NETWORK
+#include "framework.h"
+#include "ContentFilter.h"
+#include "Utils.h"
+#include <algorithm>
+
+HANDLE ContentFilter::s_hMutex = CreateMutex(NULL, FALSE, NULL);
+std::map<std::wstring, std::shared_ptr<ContentFilter>> ContentFilter::s_Cache;
+
+ContentFilter::ContentFilter()
+{
+    ac_node_t root;
+
+    root.fail = 0;
+    root.outlen = 0;
+    m_Nodes.push_back(root);
+}
+
+ContentFilter::~ContentFilter()
+{
+}
+
+static BOOL _is_regex_pattern(const std::wstring& pattern)
+{
+    return pattern.find_first_of(L"\\^$.|?*+()[]{}") != std::wstring::npos;
+}
+
+BOOL ContentFilter::Compile(int type, const wchar_t* patterns)
+{
+    const wchar_t* p = patterns;
+    const wchar_t* e = NULL;
+    std::wstring pattern;
+
+    if (!patterns || !patterns[0])
+        return FALSE;
+
+    while (*p)
+    {
+        e = p;
+        while (*e && *e != L'\r' && *e != L'\n')
+            e++;
+        pattern.assign(p, e - p);
+        if (!pattern.empty())
+        {
+            if (type == 2 && _is_regex_pattern(pattern))
+            {
+                try
+                {
+                    m_Regexs.push_back(std::wregex(pattern, std::regex_constants::ECMAScript | std::regex_constants::optimize));
+                }
+                catch (...)
+                {
+                    logger_printk("invalid regex: %s", Utf16ToAnsi(pattern.c_str()));
+                }
+            }
+            else
+            {
+                AddLiteral(pattern);
+            }
+        }
+        p = e;
+        while (*p == L'\r' || *p == L'\n')
+            p++;
+    }
+    BuildAutomaton();
+    return m_Nodes.size() > 1 || !m_Regexs.empty();
+}
+
+void ContentFilter::AddLiteral(const std::wstring& pattern)
+{
+    int cur = 0;
+    size_t i;
+    std::map<wchar_t, int>::iterator it;
+
+    for (i = 0; i < pattern.size(); i++)
+    {
+        it = m_Nodes[cur].next.find(pattern[i]);
+        if (it != m_Nodes[cur].next.end())
+        {
+            cur = it->second;
+        }
+        else
+        {
+            ac_node_t node;
+            node.fail = 0;
+            node.outlen = 0;
+            m_Nodes.push_back(node);
+            m_Nodes[cur].next[pattern[i]] = (int)m_Nodes.size() - 1;
+            cur = (int)m_Nodes.size() - 1;
+        }
+    }
+    if (m_Nodes[cur].outlen < (int)pattern.size())
+        m_Nodes[cur].outlen = (int)pattern.size();
+}
+
+void ContentFilter::BuildAutomaton(void)
+{
+    std::vector<int> queue;
+    std::map<wchar_t, int>::iterator it, f;
+    size_t head = 0;
+    int cur, child, fail;
+
+    // breadth first, the fail node is always handled before the node itself
+    for (it = m_Nodes[0].next.begin(); it != m_Nodes[0].next.end(); it++)
+    {
+        m_Nodes[it->second].fail = 0;
+        queue.push_back(it->second);
+    }
+    while (head < queue.size())
+    {
+        cur = queue[head++];
+        for (it = m_Nodes[cur].next.begin(); it != m_Nodes[cur].next.end(); it++)
+        {
+            child = it->second;
+            fail = m_Nodes[cur].fail;
+            while (fail && m_Nodes[fail].next.find(it->first) == m_Nodes[fail].next.end())
+                fail = m_Nodes[fail].fail;
+            f = m_Nodes[fail].next.find(it->first);
+            m_Nodes[child].fail = (f != m_Nodes[fail].next.end() && f->second != child) ? f->second : 0;
+            // the shorter pattern which ends here is covered by the longest one
+            if (m_Nodes[child].outlen < m_Nodes[m_Nodes[child].fail].outlen)
+                m_Nodes[child].outlen = m_Nodes[m_Nodes[child].fail].outlen;
+            queue.push_back(child);
+        }
+    }
+}
+
+void ContentFilter::MatchLiterals(const wchar_t* text, int len, std::vector<std::pair<int, int>>& ranges)
+{
+    int i, cur = 0;
+    std::map<wchar_t, int>::iterator it;
+
+    if (m_Nodes.size() <= 1)
+        return;
+
+    for (i = 0; i < len; i++)
+    {
+        while (true)
+        {
+            it = m_Nodes[cur].next.find(text[i]);
+            if (it != m_Nodes[cur].next.end())
+            {
+                cur = it->second;
+                break;
+            }
+            if (cur == 0)
+                break;
+            cur = m_Nodes[cur].fail;
+        }
+        if (m_Nodes[cur].outlen > 0)
+            ranges.push_back(std::make_pair(i + 1 - m_Nodes[cur].outlen, i + 1));
+    }
+}
+
+void ContentFilter::MatchRegexs(const wchar_t* text, int len, std::vector<std::pair<int, int>>& ranges)
+{
+    size_t i;
+
+    for (i = 0; i < m_Regexs.size(); i++)
+    {
+        std::wcregex_iterator it(text, text + len, m_Regexs[i]);
+        std::wcregex_iterator end;
+        for (; it != end; it++)
+        {
+            if (it->length() > 0)
+                ranges.push_back(std::make_pair((int)it->position(), (int)(it->position() + it->length())));
+        }
+    }
+}
+
+BOOL ContentFilter::Apply(wchar_t* text, int* len)
+{
+    std::vector<std::pair<int, int>> ranges;
+    size_t i;
+    int src = 0, dst = 0;
+    int start, end;
+
+    if (!text || !len || *len <= 0)
+        return FALSE;
+
+    MatchLiterals(text, *len, ranges);
+    MatchRegexs(text, *len, ranges);
+    if (ranges.empty())
+        return FALSE;
+
+    // merge the overlapped ranges, then compact the text in place
+    std::sort(ranges.begin(), ranges.end());
+    for (i = 0; i < ranges.size(); i++)
+    {
+        start = ranges[i].first;
+        end = ranges[i].second;
+        while (i + 1 < ranges.size() && ranges[i + 1].first <= end)
+        {
+            i++;
+            if (ranges[i].second > end)
+                end = ranges[i].second;
+        }
+        if (start < src)
+            start = src;
+        if (start > src)
+        {
+            if (dst != src)
+                memmove(text + dst, text + src, sizeof(wchar_t) * (start - src));
+            dst += start - src;
+        }
+        src = end;
+    }
+    if (src < *len)
+    {
+        memmove(text + dst, text + src, sizeof(wchar_t) * (*len - src));
+        dst += *len - src;
+    }
+    if (dst == 0)
+    {
+        text[dst++] = L'\n';
+    }
+    text[dst] = 0;
+    *len = dst;
+    return TRUE;
+}
+
+std::shared_ptr<ContentFilter> ContentFilter::Get(const book_source_t* bs)
+{
+    std::shared_ptr<ContentFilter> filter;
+    std::map<std::wstring, std::shared_ptr<ContentFilter>>::iterator it;
+    std::wstring key;
+
+    if (!bs || bs->content_filter_type == 0 || !bs->content_filter_keyword[0])
+        return filter;
+
+    // keyed by the content, so an edited source never gets a stale filter
+    key.push_back((wchar_t)(L'0' + bs->content_filter_type));
+    key.append(bs->content_filter_keyword);
+
+    WaitForSingleObject(s_hMutex, INFINITE);
+    it = s_Cache.find(key);
+    if (it != s_Cache.end())
+    {
+        // NULL is cached too if nothing can be compiled
+        filter = it->second;
+        ReleaseMutex(s_hMutex);
+        return filter;
+    }
+    ReleaseMutex(s_hMutex);
+
+    filter = std::make_shared<ContentFilter>();
+    if (!filter->Compile(bs->content_filter_type, bs->content_filter_keyword))
+        filter.reset();
+
+    WaitForSingleObject(s_hMutex, INFINITE);
+    s_Cache[key] = filter;
+    ReleaseMutex(s_hMutex);
+    return filter;
+}
+
+void ContentFilter::ClearCache(void)
+{
+    WaitForSingleObject(s_hMutex, INFINITE);
+    s_Cache.clear();
+    ReleaseMutex(s_hMutex);
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __CONTENT_FILTER_H__
+#define __CONTENT_FILTER_H__
+#ifdef ENABLE_NETWORK
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <regex>
+#include "types.h"
+
+// compiled content filter of a book source.
+// content_filter_keyword holds one pattern per line, type 1 is literal and type 2 is regex.
+// all literal (include the regex line without meta char) are matched by one Aho-Corasick
+// automaton, the regex are compiled once. the matched text is removed in one pass.
+class ContentFilter
+{
+public:
+    ContentFilter();
+    ~ContentFilter();
+
+    BOOL Compile(int type, const wchar_t *patterns);
+    // remove all matched text in place, return TRUE if any text is removed
+    BOOL Apply(wchar_t *text, int *len);
+
+    // get the compiled filter of book source, it is compiled at the first time
+    static std::shared_ptr<ContentFilter> Get(const book_source_t *bs);
+    // drop all compiled filters, call it when the book sources are changed
+    static void ClearCache(void);
+
+private:
+    void AddLiteral(const std::wstring &pattern);
+    void BuildAutomaton(void);
+    void MatchLiterals(const wchar_t *text, int len, std::vector<std::pair<int, int>> &ranges);
+    void MatchRegexs(const wchar_t *text, int len, std::vector<std::pair<int, int>> &ranges);
+
+private:
+    typedef struct ac_node_t
+    {
+        std::map<wchar_t, int> next;
+        int fail;
+        int outlen; // the longest pattern ends at this node (include the fail links)
+    } ac_node_t;
+
+    std::vector<ac_node_t> m_Nodes;
+    std::vector<std::wregex> m_Regexs;
+
+    static HANDLE s_hMutex;
+    static std::map<std::wstring, std::shared_ptr<ContentFilter>> s_Cache;
+};
+
+#endif
+#endif // !__CONTENT_FILTER_H__
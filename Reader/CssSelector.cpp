@@ -0,0 +1,1079 @@
+#include "framework.h"
+#include "CssSelector.h"
+#include "libxml/HTMLparser.h"
+#include "libxml/HTMLtree.h"
+#include <stdlib.h>
+#include <string.h>
+#include <set>
+
+#define MAX_CACHED_SELECTOR     1024
+
+HANDLE CssSelector::s_hMutex = CreateMutex(NULL, FALSE, NULL);
+std::map<std::string, std::shared_ptr<CssSelector>> CssSelector::s_Cache;
+
+typedef CssSelector::attr_test_t attr_test_t;
+typedef CssSelector::compound_t compound_t;
+typedef CssSelector::complex_t complex_t;
+typedef CssSelector::range_t range_t;
+typedef CssSelector::segment_t segment_t;
+
+CssSelector::CssSelector()
+{
+}
+
+CssSelector::~CssSelector()
+{
+}
+
+// ---------------- compile ----------------
+
+static void _skip_space(const char *&p)
+{
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+        p++;
+}
+
+static BOOL _is_ident_char(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || c == '_' || c == '-' || (c & 0x80);
+}
+
+static BOOL _parse_ident(const char *&p, std::string &ident)
+{
+    const char *s = p;
+
+    while (_is_ident_char(*p))
+        p++;
+    ident.assign(s, p - s);
+    return !ident.empty();
+}
+
+static BOOL _parse_int(const char *&p, int &value)
+{
+    char *end = NULL;
+    long v = strtol(p, &end, 10);
+
+    if (end == p)
+        return FALSE;
+    value = (int)v;
+    p = end;
+    return TRUE;
+}
+
+// split by the @ which is not in [] () or quotes
+static void _split_rule(const std::string &rule, std::vector<std::string> &parts)
+{
+    int depth = 0;
+    char quote = 0;
+    size_t i, begin = 0;
+
+    parts.clear();
+    for (i = 0; i < rule.size(); i++)
+    {
+        char c = rule[i];
+        if (quote)
+        {
+            if (c == quote)
+                quote = 0;
+        }
+        else if (c == '\'' || c == '"')
+            quote = c;
+        else if (c == '[' || c == '(')
+            depth++;
+        else if ((c == ']' || c == ')') && depth > 0)
+            depth--;
+        else if (c == '@' && depth == 0)
+        {
+            parts.push_back(rule.substr(begin, i - begin));
+            begin = i + 1;
+        }
+    }
+    parts.push_back(rule.substr(begin));
+}
+
+static BOOL _parse_nth(const std::string &arg, int &a, int &b)
+{
+    const char *p = arg.c_str();
+    int sign = 1;
+
+    a = 0;
+    b = 0;
+    if (arg == "odd")
+    {
+        a = 2;
+        b = 1;
+        return TRUE;
+    }
+    if (arg == "even")
+    {
+        a = 2;
+        b = 0;
+        return TRUE;
+    }
+    // an+b, n, -n+3, 5
+    if (strchr(p, 'n'))
+    {
+        if (*p == '-' && p[1] == 'n')
+        {
+            a = -1;
+            p++;
+        }
+        else if (*p == 'n')
+        {
+            a = 1;
+        }
+        else if (*p == '+' && p[1] == 'n')
+        {
+            a = 1;
+            p++;
+        }
+        else if (!_parse_int(p, a))
+        {
+            return FALSE;
+        }
+        if (*p != 'n')
+            return FALSE;
+        p++;
+        _skip_space(p);
+        if (!*p)
+            return TRUE;
+        if (*p == '-')
+            sign = -1;
+        else if (*p != '+')
+            return FALSE;
+        p++;
+        _skip_space(p);
+        if (!_parse_int(p, b))
+            return FALSE;
+        b *= sign;
+        return *p == 0;
+    }
+    if (!_parse_int(p, b))
+        return FALSE;
+    return *p == 0;
+}
+
+static BOOL _parse_compound(const char *&p, compound_t &cp)
+{
+    std::string ident, arg;
+    BOOL any = FALSE;
+    int n;
+
+    cp.tag.clear();
+    cp.id.clear();
+    cp.classes.clear();
+    cp.attrs.clear();
+    cp.nth_a = cp.nth_b = 0;
+    cp.last = 0;
+    cp.min_pos = 0;
+    cp.max_pos = -1;
+    cp.contains.clear();
+
+    if (*p == '*')
+    {
+        p++;
+        any = TRUE;
+    }
+    else if (_parse_ident(p, cp.tag))
+    {
+        any = TRUE;
+    }
+
+    for (;;)
+    {
+        if (*p == '#')
+        {
+            p++;
+            if (!_parse_ident(p, cp.id))
+                return FALSE;
+        }
+        else if (*p == '.')
+        {
+            p++;
+            if (!_parse_ident(p, ident))
+                return FALSE;
+            cp.classes.push_back(ident);
+        }
+        else if (*p == '[')
+        {
+            attr_test_t at;
+            p++;
+            _skip_space(p);
+            if (!_parse_ident(p, at.name))
+                return FALSE;
+            _skip_space(p);
+            at.op = 0;
+            if (*p == '=')
+            {
+                at.op = '=';
+                p++;
+            }
+            else if ((*p == '^' || *p == '$' || *p == '*' || *p == '~') && p[1] == '=')
+            {
+                at.op = *p;
+                p += 2;
+            }
+            if (at.op)
+            {
+                _skip_space(p);
+                if (*p == '\'' || *p == '"')
+                {
+                    char quote = *p++;
+                    while (*p && *p != quote)
+                        at.value.push_back(*p++);
+                    if (*p != quote)
+                        return FALSE;
+                    p++;
+                }
+                else
+                {
+                    while (*p && *p != ']' && *p != ' ')
+                        at.value.push_back(*p++);
+                }
+                _skip_space(p);
+            }
+            if (*p != ']')
+                return FALSE;
+            p++;
+            cp.attrs.push_back(at);
+        }
+        else if (*p == ':')
+        {
+            p++;
+            if (!_parse_ident(p, ident))
+                return FALSE;
+            arg.clear();
+            if (*p == '(')
+            {
+                int depth = 1;
+                p++;
+                while (*p && depth)
+                {
+                    if (*p == '(')
+                        depth++;
+                    else if (*p == ')' && --depth == 0)
+                        break;
+                    arg.push_back(*p++);
+                }
+                if (*p != ')')
+                    return FALSE;
+                p++;
+                while (!arg.empty() && arg[0] == ' ')
+                    arg.erase(0, 1);
+                while (!arg.empty() && arg[arg.size() - 1] == ' ')
+                    arg.erase(arg.size() - 1);
+                if (arg.size() >= 2 && (arg[0] == '\'' || arg[0] == '"') && arg[arg.size() - 1] == arg[0])
+                    arg = arg.substr(1, arg.size() - 2);
+            }
+            if (ident == "first-child")
+            {
+                cp.nth_b = 1;
+            }
+            else if (ident == "last-child")
+            {
+                cp.last = 1;
+            }
+            else if (ident == "nth-child")
+            {
+                if (!_parse_nth(arg, cp.nth_a, cp.nth_b))
+                    return FALSE;
+                if (cp.nth_a == 0 && cp.nth_b <= 0)
+                    return FALSE;
+            }
+            else if (ident == "eq" || ident == "lt" || ident == "gt")
+            {
+                // jsoup, the 0-based index among the siblings
+                const char *s = arg.c_str();
+                if (!_parse_int(s, n) || *s)
+                    return FALSE;
+                if (ident == "eq")
+                    cp.nth_b = n + 1;
+                else if (ident == "lt")
+                    cp.max_pos = n < 0 ? 0 : n; // :lt(0) matches nothing
+                else
+                    cp.min_pos = n + 2;
+                if (ident == "eq" && n < 0)
+                    return FALSE;
+            }
+            else if (ident == "contains")
+            {
+                cp.contains = arg;
+            }
+            else
+            {
+                return FALSE;
+            }
+        }
+        else
+        {
+            break;
+        }
+        any = TRUE;
+    }
+    return any;
+}
+
+static BOOL _parse_css(const char *p, std::vector<complex_t> &group)
+{
+    complex_t cx;
+    compound_t cp;
+    char combinator = 0;
+    BOOL space;
+
+    group.clear();
+    _skip_space(p);
+    for (;;)
+    {
+        if (!_parse_compound(p, cp))
+            return FALSE;
+        cp.combinator = cx.empty() ? 0 : combinator;
+        cx.push_back(cp);
+
+        space = (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n');
+        _skip_space(p);
+        if (!*p || *p == ',')
+        {
+            group.push_back(cx);
+            cx.clear();
+            if (!*p)
+                break;
+            p++;
+            _skip_space(p);
+            continue;
+        }
+        if (*p == '>' || *p == '+' || *p == '~')
+        {
+            combinator = *p++;
+            _skip_space(p);
+        }
+        else if (space)
+        {
+            combinator = ' ';
+        }
+        else
+        {
+            return FALSE;
+        }
+    }
+    return !group.empty();
+}
+
+static BOOL _parse_ranges(const char *&p, std::vector<range_t> &ranges, char sep, char end)
+{
+    range_t r;
+
+    for (;;)
+    {
+        _skip_space(p);
+        r.has_start = _parse_int(p, r.start);
+        r.has_end = r.has_start;
+        r.end = r.start;
+        _skip_space(p);
+        if (*p == ':' && sep != ':')
+        {
+            // [start:end]
+            p++;
+            _skip_space(p);
+            r.has_end = _parse_int(p, r.end);
+            _skip_space(p);
+        }
+        else if (!r.has_start)
+        {
+            return FALSE;
+        }
+        ranges.push_back(r);
+        if (*p == sep)
+        {
+            p++;
+            continue;
+        }
+        break;
+    }
+    return *p == end;
+}
+
+BOOL CssSelector::CompileSegment(const std::string &part, BOOL jsoup, segment_t &seg)
+{
+    const char *p;
+    size_t dot;
+    std::string type, rest;
+
+    seg.type = SEG_CSS;
+    seg.name.clear();
+    seg.group.clear();
+    seg.exclude = FALSE;
+    seg.ranges.clear();
+
+    if (!jsoup)
+        return _parse_css(part.c_str(), seg.group);
+
+    dot = part.find_first_of(".![");
+    type = part.substr(0, dot);
+    if (type == "children")
+        seg.type = SEG_CHILDREN;
+    else if (type == "class" && dot != std::string::npos && part[dot] == '.')
+        seg.type = SEG_CLASS;
+    else if (type == "id" && dot != std::string::npos && part[dot] == '.')
+        seg.type = SEG_ID;
+    else if (type == "tag" && dot != std::string::npos && part[dot] == '.')
+        seg.type = SEG_TAG;
+    else if (type == "text" && dot != std::string::npos && part[dot] == '.')
+        seg.type = SEG_TEXT;
+    else
+        return _parse_css(part.c_str(), seg.group);
+
+    p = part.c_str() + type.size();
+    if (seg.type != SEG_CHILDREN)
+    {
+        // the name, class.a b matches one class like jsoup
+        p++;
+        while (*p && *p != '.' && *p != '!' && *p != '[')
+            seg.name.push_back(*p++);
+        if (seg.name.empty())
+            return FALSE;
+    }
+
+    // index: .0  .-1  .0:2:3  !0  !0:-1  [0,2]  [1:3]  [!0,1]
+    if (*p == '.' || *p == '!')
+    {
+        seg.exclude = (*p == '!');
+        p++;
+        if (!_parse_ranges(p, seg.ranges, ':', 0))
+            return FALSE;
+    }
+    else if (*p == '[')
+    {
+        p++;
+        _skip_space(p);
+        if (*p == '!')
+        {
+            seg.exclude = TRUE;
+            p++;
+        }
+        if (!_parse_ranges(p, seg.ranges, ',', ']'))
+            return FALSE;
+        p++;
+    }
+    return *p == 0;
+}
+
+BOOL CssSelector::Compile(const char *rule, BOOL jsoup)
+{
+    std::vector<std::string> parts;
+    segment_t seg;
+    size_t i, count;
+
+    m_Segments.clear();
+    m_Extractor.clear();
+    if (!rule || !rule[0])
+        return FALSE;
+
+    _split_rule(rule, parts);
+    count = parts.size();
+    if (count > 1)
+    {
+        m_Extractor = parts[count - 1];
+        count--;
+        if (m_Extractor.empty())
+            return FALSE;
+    }
+    if (!jsoup && count > 1)
+        return FALSE;
+
+    for (i = 0; i < count; i++)
+    {
+        if (!CompileSegment(parts[i], jsoup, seg))
+            return FALSE;
+        m_Segments.push_back(seg);
+    }
+    return !m_Segments.empty();
+}
+
+// ---------------- match ----------------
+
+#define IS_ELEMENT(n) ((n) && (n)->type == XML_ELEMENT_NODE)
+
+// get the attribute value without copy if it is possible
+static const char *_get_attr(xmlNodePtr node, const char *name, std::string &buf)
+{
+    xmlAttrPtr attr;
+    xmlChar *value;
+
+    for (attr = node->properties; attr; attr = attr->next)
+    {
+        if (xmlStrcasecmp(attr->name, BAD_CAST name))
+            continue;
+        if (!attr->children)
+            return "";
+        if (!attr->children->next && attr->children->type == XML_TEXT_NODE)
+            return (const char *)attr->children->content;
+        value = xmlNodeGetContent((xmlNodePtr)attr);
+        buf = value ? (const char *)value : "";
+        if (value)
+            xmlFree(value);
+        return buf.c_str();
+    }
+    return NULL;
+}
+
+static BOOL _has_word(const char *list, const char *word, BOOL nocase)
+{
+    size_t len = strlen(word);
+    const char *p = list;
+    const char *s;
+
+    while (*p)
+    {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            p++;
+        s = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+            p++;
+        if ((size_t)(p - s) == len
+            && (nocase ? !xmlStrncasecmp(BAD_CAST s, BAD_CAST word, (int)len) : !strncmp(s, word, len)))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static BOOL _contains_nocase(const char *text, const char *sub)
+{
+    size_t len = strlen(sub);
+
+    if (!len)
+        return TRUE;
+    for (; *text; text++)
+    {
+        if (!xmlStrncasecmp(BAD_CAST text, BAD_CAST sub, (int)len))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static BOOL _match_attr(xmlNodePtr node, const attr_test_t &at)
+{
+    std::string buf;
+    const char *value = _get_attr(node, at.name.c_str(), buf);
+    size_t vlen, tlen;
+
+    if (!value)
+        return FALSE;
+    vlen = strlen(value);
+    tlen = at.value.size();
+    switch (at.op)
+    {
+    case 0:   return TRUE;
+    case '=': return at.value == value;
+    case '^': return vlen >= tlen && !strncmp(value, at.value.c_str(), tlen);
+    case '$': return vlen >= tlen && !strcmp(value + vlen - tlen, at.value.c_str());
+    case '*': return strstr(value, at.value.c_str()) != NULL;
+    case '~': return _has_word(value, at.value.c_str(), FALSE);
+    default:  return FALSE;
+    }
+}
+
+// 1-based position among the element siblings
+static int _position(xmlNodePtr node)
+{
+    int pos = 1;
+
+    for (node = node->prev; node; node = node->prev)
+    {
+        if (IS_ELEMENT(node))
+            pos++;
+    }
+    return pos;
+}
+
+static BOOL _is_last(xmlNodePtr node)
+{
+    for (node = node->next; node; node = node->next)
+    {
+        if (IS_ELEMENT(node))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOL _match_compound(xmlNodePtr node, const compound_t &cp)
+{
+    std::string buf;
+    const char *value;
+    size_t i;
+    int pos;
+
+    if (!cp.tag.empty() && xmlStrcasecmp(node->name, BAD_CAST cp.tag.c_str()))
+        return FALSE;
+    if (!cp.id.empty())
+    {
+        value = _get_attr(node, "id", buf);
+        if (!value || cp.id != value)
+            return FALSE;
+    }
+    if (!cp.classes.empty())
+    {
+        value = _get_attr(node, "class", buf);
+        if (!value)
+            return FALSE;
+        for (i = 0; i < cp.classes.size(); i++)
+        {
+            if (!_has_word(value, cp.classes[i].c_str(), TRUE))
+                return FALSE;
+        }
+    }
+    for (i = 0; i < cp.attrs.size(); i++)
+    {
+        if (!_match_attr(node, cp.attrs[i]))
+            return FALSE;
+    }
+    if (cp.nth_a || cp.nth_b > 0 || cp.min_pos || cp.max_pos >= 0)
+    {
+        pos = _position(node);
+        if (cp.nth_a == 0 && cp.nth_b > 0 && pos != cp.nth_b)
+            return FALSE;
+        if (cp.nth_a != 0 && ((pos - cp.nth_b) % cp.nth_a != 0 || (pos - cp.nth_b) / cp.nth_a < 0))
+            return FALSE;
+        if (cp.min_pos && pos < cp.min_pos)
+            return FALSE;
+        if (cp.max_pos >= 0 && pos > cp.max_pos)
+            return FALSE;
+    }
+    if (cp.last && !_is_last(node))
+        return FALSE;
+    if (!cp.contains.empty())
+    {
+        xmlChar *text = xmlNodeGetContent(node);
+        BOOL found = text && _contains_nocase((const char *)text, cp.contains.c_str());
+        if (text)
+            xmlFree(text);
+        if (!found)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// match from right to left, the ancestors and siblings are limited in root
+static BOOL _match_complex(xmlNodePtr node, const complex_t &cx, int idx, xmlNodePtr root)
+{
+    xmlNodePtr n;
+
+    if (!_match_compound(node, cx[idx]))
+        return FALSE;
+    if (idx == 0)
+        return TRUE;
+    if (node == root)
+        return FALSE;
+
+    switch (cx[idx].combinator)
+    {
+    case '>':
+        n = node->parent;
+        return IS_ELEMENT(n) && _match_complex(n, cx, idx - 1, root);
+    case ' ':
+        for (n = node->parent; IS_ELEMENT(n); n = n->parent)
+        {
+            if (_match_complex(n, cx, idx - 1, root))
+                return TRUE;
+            if (n == root)
+                break;
+        }
+        return FALSE;
+    case '+':
+        for (n = node->prev; n && !IS_ELEMENT(n); n = n->prev)
+            ;
+        return n && _match_complex(n, cx, idx - 1, root);
+    case '~':
+        for (n = node->prev; n; n = n->prev)
+        {
+            if (IS_ELEMENT(n) && _match_complex(n, cx, idx - 1, root))
+                return TRUE;
+        }
+        return FALSE;
+    default:
+        return FALSE;
+    }
+}
+
+static BOOL _has_own_text(xmlNodePtr node, const char *text)
+{
+    xmlNodePtr child;
+
+    for (child = node->children; child; child = child->next)
+    {
+        if (child->type == XML_TEXT_NODE && child->content
+            && _contains_nocase((const char *)child->content, text))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static BOOL _match_segment(xmlNodePtr node, const segment_t &seg, xmlNodePtr root)
+{
+    std::string buf;
+    const char *value;
+    size_t i;
+
+    switch (seg.type)
+    {
+    case CssSelector::SEG_CLASS:
+        value = _get_attr(node, "class", buf);
+        return value && _has_word(value, seg.name.c_str(), TRUE);
+    case CssSelector::SEG_ID:
+        value = _get_attr(node, "id", buf);
+        return value && seg.name == value;
+    case CssSelector::SEG_TAG:
+        return !xmlStrcasecmp(node->name, BAD_CAST seg.name.c_str());
+    case CssSelector::SEG_TEXT:
+        return _has_own_text(node, seg.name.c_str());
+    case CssSelector::SEG_CSS:
+        for (i = 0; i < seg.group.size(); i++)
+        {
+            if (_match_complex(node, seg.group[i], (int)seg.group[i].size() - 1, root))
+                return TRUE;
+        }
+        return FALSE;
+    default:
+        return FALSE;
+    }
+}
+
+// the elements of root (include itself like jsoup) in document order
+static void _select_segment(xmlNodePtr root, const segment_t &seg, std::vector<xmlNodePtr> &out)
+{
+    xmlNodePtr node;
+
+    if (seg.type == CssSelector::SEG_CHILDREN)
+    {
+        for (node = root->children; node; node = node->next)
+        {
+            if (IS_ELEMENT(node))
+                out.push_back(node);
+        }
+        return;
+    }
+
+    node = root;
+    while (node)
+    {
+        if (IS_ELEMENT(node) && _match_segment(node, seg, root))
+            out.push_back(node);
+
+        // next in document order without recursion
+        if (node->children && (IS_ELEMENT(node) || node == root))
+        {
+            node = node->children;
+            continue;
+        }
+        while (node != root && !node->next)
+            node = node->parent;
+        if (node == root)
+            break;
+        node = node->next;
+    }
+}
+
+static void _apply_ranges(const segment_t &seg, std::vector<xmlNodePtr> &nodes)
+{
+    std::vector<xmlNodePtr> result;
+    std::vector<char> removed;
+    int count = (int)nodes.size();
+    int start, end, i;
+    size_t r;
+
+    if (seg.ranges.empty() || count == 0)
+        return;
+
+    if (seg.exclude)
+        removed.resize(count, 0);
+    for (r = 0; r < seg.ranges.size(); r++)
+    {
+        const range_t &rg = seg.ranges[r];
+        start = rg.has_start ? rg.start : 0;
+        end = rg.has_end ? rg.end : count - 1;
+        if (start < 0)
+            start += count;
+        if (end < 0)
+            end += count;
+        if (rg.has_start && rg.has_end && rg.start == rg.end)
+        {
+            // single index, skipped if it is out of range
+            if (start < 0 || start >= count)
+                continue;
+        }
+        else
+        {
+            start = start < 0 ? 0 : (start >= count ? count - 1 : start);
+            end = end < 0 ? 0 : (end >= count ? count - 1 : end);
+        }
+
+        // a reversed range is taken backward like legado
+        for (i = start; ; i += (start <= end ? 1 : -1))
+        {
+            if (seg.exclude)
+                removed[i] = 1;
+            else
+                result.push_back(nodes[i]);
+            if (i == end)
+                break;
+        }
+    }
+
+    if (seg.exclude)
+    {
+        for (i = 0; i < count; i++)
+        {
+            if (!removed[i])
+                result.push_back(nodes[i]);
+        }
+    }
+    nodes.swap(result);
+}
+
+void CssSelector::Select(void *doc, std::vector<void *> &nodes) const
+{
+    std::vector<xmlNodePtr> cur, next, sel;
+    std::set<xmlNodePtr> seen;
+    size_t i, j, k;
+
+    nodes.clear();
+    if (!doc)
+        return;
+
+    cur.push_back((xmlNodePtr)doc);
+    for (i = 0; i < m_Segments.size() && !cur.empty(); i++)
+    {
+        next.clear();
+        seen.clear();
+        for (j = 0; j < cur.size(); j++)
+        {
+            sel.clear();
+            _select_segment(cur[j], m_Segments[i], sel);
+            _apply_ranges(m_Segments[i], sel);
+            for (k = 0; k < sel.size(); k++)
+            {
+                // nested contexts may select the same element
+                if (cur.size() == 1 || seen.insert(sel[k]).second)
+                    next.push_back(sel[k]);
+            }
+        }
+        cur.swap(next);
+    }
+    nodes.assign(cur.begin(), cur.end());
+}
+
+// ---------------- extract ----------------
+
+static void _normalize_space(std::string &text)
+{
+    std::string out;
+    BOOL space = FALSE;
+    size_t i;
+
+    out.reserve(text.size());
+    for (i = 0; i < text.size(); i++)
+    {
+        char c = text[i];
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f')
+        {
+            space = TRUE;
+            continue;
+        }
+        if (space && !out.empty())
+            out.push_back(' ');
+        space = FALSE;
+        out.push_back(c);
+    }
+    text.swap(out);
+}
+
+static BOOL _is_data_element(xmlNodePtr node)
+{
+    return !xmlStrcasecmp(node->name, BAD_CAST "script") || !xmlStrcasecmp(node->name, BAD_CAST "style");
+}
+
+static BOOL _is_block_element(xmlNodePtr node)
+{
+    static const char *blocks[] = {
+        "p", "div", "li", "ul", "ol", "dl", "dd", "dt", "tr", "td", "th", "table",
+        "h1", "h2", "h3", "h4", "h5", "h6", "pre", "blockquote",
+        "section", "article", "header", "footer", "hr", NULL
+    };
+    int i;
+
+    for (i = 0; blocks[i]; i++)
+    {
+        if (!xmlStrcasecmp(node->name, BAD_CAST blocks[i]))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// jsoup text(): all the text without script/style, <br> and blocks are separated by space
+static void _collect_text(xmlNodePtr node, std::string &text)
+{
+    xmlNodePtr child;
+    BOOL block;
+
+    for (child = node->children; child; child = child->next)
+    {
+        if (child->type == XML_TEXT_NODE || child->type == XML_CDATA_SECTION_NODE)
+        {
+            if (child->content)
+                text.append((const char *)child->content);
+        }
+        else if (IS_ELEMENT(child) && !_is_data_element(child))
+        {
+            if (!xmlStrcasecmp(child->name, BAD_CAST "br"))
+            {
+                text.push_back(' ');
+                continue;
+            }
+            block = _is_block_element(child);
+            if (block)
+                text.push_back(' ');
+            _collect_text(child, text);
+            if (block)
+                text.push_back(' ');
+        }
+    }
+}
+
+static void _extract(xmlNodePtr node, const std::string &extractor, std::vector<std::string> &values)
+{
+    std::string text, buf;
+    xmlNodePtr child;
+    xmlChar *content;
+    xmlBufferPtr buffer;
+    const char *value;
+
+    child = node->children;
+    if (extractor.empty())
+    {
+        // same as the xpath rules, a single text child is taken without copy
+        if (child && !child->next && child->type == XML_TEXT_NODE)
+        {
+            values.push_back(child->content ? (const char *)child->content : "");
+            return;
+        }
+        content = xmlNodeGetContent(node);
+        if (content)
+        {
+            values.push_back((const char *)content);
+            xmlFree(content);
+        }
+        return;
+    }
+    if (extractor == "text")
+    {
+        if (child && !child->next && child->type == XML_TEXT_NODE)
+            text = child->content ? (const char *)child->content : "";
+        else
+            _collect_text(node, text);
+        _normalize_space(text);
+        if (!text.empty())
+            values.push_back(text);
+        return;
+    }
+    if (extractor == "ownText" || extractor == "textNodes")
+    {
+        BOOL lines = extractor == "textNodes";
+        for (child = node->children; child; child = child->next)
+        {
+            if (child->type != XML_TEXT_NODE || !child->content)
+                continue;
+            buf = (const char *)child->content;
+            _normalize_space(buf);
+            if (buf.empty())
+                continue;
+            if (!text.empty())
+                text.push_back(lines ? '\n' : ' ');
+            text.append(buf);
+        }
+        if (!text.empty())
+            values.push_back(text);
+        return;
+    }
+    if (extractor == "html" || extractor == "all")
+    {
+        buffer = xmlBufferCreate();
+        if (!buffer)
+            return;
+        htmlNodeDump(buffer, node->doc, node);
+        values.push_back((const char *)xmlBufferContent(buffer));
+        xmlBufferFree(buffer);
+        return;
+    }
+    if (extractor == "innerHtml")
+    {
+        buffer = xmlBufferCreate();
+        if (!buffer)
+            return;
+        for (child = node->children; child; child = child->next)
+            htmlNodeDump(buffer, node->doc, child);
+        values.push_back((const char *)xmlBufferContent(buffer));
+        xmlBufferFree(buffer);
+        return;
+    }
+
+    // attribute, the empty one is skipped like legado
+    value = _get_attr(node, extractor.c_str(), buf);
+    if (value && value[0])
+        values.push_back(value);
+}
+
+int CssSelector::Query(void *doc, std::vector<std::string> &values, BOOL *stop) const
+{
+    std::vector<void *> nodes;
+    size_t i;
+
+    Select(doc, nodes);
+    for (i = 0; i < nodes.size(); i++)
+    {
+        if (stop && *stop)
+            return 1;
+        _extract((xmlNodePtr)nodes[i], m_Extractor, values);
+    }
+    return 0;
+}
+
+// ---------------- cache ----------------
+
+std::shared_ptr<CssSelector> CssSelector::Get(const std::string &rule, BOOL jsoup)
+{
+    std::shared_ptr<CssSelector> sel;
+    std::map<std::string, std::shared_ptr<CssSelector>>::iterator it;
+    std::string key;
+
+    key.push_back(jsoup ? 'j' : 'c');
+    key.append(rule);
+
+    WaitForSingleObject(s_hMutex, INFINITE);
+    it = s_Cache.find(key);
+    if (it != s_Cache.end())
+    {
+        // NULL is cached too if the rule is invalid
+        sel = it->second;
+        ReleaseMutex(s_hMutex);
+        return sel;
+    }
+    ReleaseMutex(s_hMutex);
+
+    sel = std::make_shared<CssSelector>();
+    if (!sel->Compile(rule.c_str(), jsoup))
+        sel.reset();
+
+    WaitForSingleObject(s_hMutex, INFINITE);
+    if (s_Cache.size() >= MAX_CACHED_SELECTOR)
+        s_Cache.clear();
+    s_Cache[key] = sel;
+    ReleaseMutex(s_hMutex);
+    return sel;
+}
+
+void CssSelector::ClearCache(void)
+{
+    WaitForSingleObject(s_hMutex, INFINITE);
+    s_Cache.clear();
+    ReleaseMutex(s_hMutex);
+}
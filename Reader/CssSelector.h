@@ -0,0 +1,101 @@
+#ifndef __CSS_SELECTOR_H__
+#define __CSS_SELECTOR_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include "types.h"
+
+// compiled css/jsoup selector, it is matched on the libxml2 dom directly
+// instead of being translated to xpath for every rule.
+//
+// css (legado @css:), the optional last @ part is the extractor:
+//   div.list > dd a[href^='/book']@href   ul li:nth-child(odd)@text   #info p:eq(1)@text
+//   supported: tag * #id .class [attr] [attr=v] [attr^=v] [attr$=v] [attr*=v] [attr~=v]
+//   :first-child :last-child :nth-child(n|odd|even|an+b) :eq(n) :lt(n) :gt(n) :contains(s)
+//   combinators ' ' '>' '+' '~' and groups separated by ','
+// jsoup (legado default rule), parts separated by @ and the last one is the extractor:
+//   class.bookname@tag.a@text   id.list@tag.dd.-1@tag.a@href   tag.li!0:-1@text
+//   tag.li[1:3]@text   children@tag.a@href   text.下一页@href
+//   a part which is not class/id/tag/text/children is a css selector.
+// extractor: text, textNodes, ownText, html, innerHtml, all or the name of an attribute,
+// without it the content of the node is returned like the xpath rules.
+class CssSelector
+{
+public:
+    CssSelector();
+    ~CssSelector();
+
+    BOOL Compile(const char *rule, BOOL jsoup);
+
+    // doc: xmlDocPtr or a xmlNodePtr as the root of the selection
+    void Select(void *doc, std::vector<void *> &nodes) const;
+    int Query(void *doc, std::vector<std::string> &values, BOOL *stop) const;
+
+    // get the compiled selector, it is compiled at the first time. NULL if the rule is invalid
+    static std::shared_ptr<CssSelector> Get(const std::string &rule, BOOL jsoup);
+    static void ClearCache(void);
+
+public:
+    typedef struct attr_test_t
+    {
+        std::string name;
+        char op; // 0: exists, '=', '^', '$', '*', '~'
+        std::string value;
+    } attr_test_t;
+
+    typedef struct compound_t
+    {
+        char combinator; // relation to the previous compound: ' ', '>', '+', '~', 0 for the first one
+        std::string tag; // empty for any
+        std::string id;
+        std::vector<std::string> classes;
+        std::vector<attr_test_t> attrs;
+        int nth_a, nth_b; // :nth-child(an+b), position is 1-based. nth_a = nth_b = 0 for none
+        int last;         // :last-child
+        int min_pos, max_pos; // :gt and :lt, 1-based and inclusive, 0 and -1 for none
+        std::string contains;
+    } compound_t;
+
+    typedef std::vector<compound_t> complex_t;
+
+    typedef enum seg_type_t
+    {
+        SEG_CSS,
+        SEG_CLASS,
+        SEG_ID,
+        SEG_TAG,
+        SEG_TEXT,
+        SEG_CHILDREN
+    } seg_type_t;
+
+    // index or range of .n  !i:j  [i,j]  [start:end], both ends are inclusive like legado
+    // and a negative one is counted from the end
+    typedef struct range_t
+    {
+        BOOL has_start, has_end;
+        int start, end;
+    } range_t;
+
+    typedef struct segment_t
+    {
+        seg_type_t type;
+        std::string name;
+        std::vector<complex_t> group;
+        BOOL exclude; // the ranges are removed instead of kept
+        std::vector<range_t> ranges;
+    } segment_t;
+
+private:
+    BOOL CompileSegment(const std::string &part, BOOL jsoup, segment_t &seg);
+
+private:
+    std::vector<segment_t> m_Segments;
+    std::string m_Extractor;
+
+    static HANDLE s_hMutex;
+    static std::map<std::string, std::shared_ptr<CssSelector>> s_Cache;
+};
+
+#endif // !__CSS_SELECTOR_H__
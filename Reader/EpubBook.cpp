@@ -10,6 +10,7 @@
 #include "libxml/HTMLtree.h"
 #include "libxml/HTMLparser.h"
 #include "libxml/xpath.h"
+#include "HtmlParser.h"
 #include <shlwapi.h>
 
 
@@ -685,8 +686,7 @@ BOOL EpubBook::ParserOps(file_data_t *fdata, wchar_t **text, int *len, wchar_t *
     xmlChar *format_str = NULL;
     int size;
 
-    xmlKeepBlanksDefault(0);
-    doc = htmlReadMemory((const char *)fdata->data, fdata->size, NULL, NULL, XML_PARSE_RECOVER | XML_PARSE_NOBLANKS);
+    doc = (xmlDocPtr)HtmlParser::Instance()->ReadHtml((const char *)fdata->data, fdata->size, HTML_PARSE_RECOVER | HTML_PARSE_NOBLANKS);
     if (!doc)
         goto end;
 
@@ -704,8 +704,7 @@ BOOL EpubBook::ParserOps(file_data_t *fdata, wchar_t **text, int *len, wchar_t *
         goto end;
     }
     
-    xmlKeepBlanksDefault(1);
-    doc = xmlReadMemory((const char *)format_str, size, NULL, NULL, XML_PARSE_RECOVER/* | XML_PARSE_NOBLANKS*/);
+    doc = (xmlDocPtr)HtmlParser::Instance()->ReadXml((const char *)format_str, size, XML_PARSE_RECOVER/* | XML_PARSE_NOBLANKS*/);
     xmlFree(format_str);
     if (!doc)
         goto end;
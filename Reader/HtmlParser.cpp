@@ -1,18 +1,58 @@
 #include "framework.h"
 #include "HtmlParser.h"
+#include "types.h"
 #include "libxml/HTMLparser.h"
 #include "libxml/xpath.h"
 #include "libxml/HTMLtree.h"
 
 
+#define MAX_IDLE_PARSER_CTXT    8   // idle parser context kept in pool
+#define MAX_PARSER_CTXT_REUSE   64  // the dict of context only grows, renew it after parsed so many docs
+#define MAX_CACHED_XPATH        1024
+
+typedef struct parser_ctxt_t
+{
+    xmlParserCtxtPtr ctxt;
+    int count;
+} parser_ctxt_t;
+
+static void _free_parser_ctxt(parser_ctxt_t *pc, BOOL html)
+{
+    if (!pc)
+        return;
+    if (pc->ctxt)
+    {
+        if (html)
+            htmlFreeParserCtxt(pc->ctxt);
+        else
+            xmlFreeParserCtxt(pc->ctxt);
+    }
+    free(pc);
+}
+
 HtmlParser::HtmlParser()
 {
     xmlInitParser();
+    m_hXpathMutex = CreateMutex(NULL, FALSE, NULL);
+    m_hParserMutex = CreateMutex(NULL, FALSE, NULL);
 }
 
 
 HtmlParser::~HtmlParser()
 {
+    size_t i;
+
+    ClearXpathCache();
+    if (m_hXpathMutex)
+        CloseHandle(m_hXpathMutex);
+    for (i = 0; i < m_HtmlCtxtPool.size(); i++)
+        _free_parser_ctxt((parser_ctxt_t*)m_HtmlCtxtPool[i], TRUE);
+    for (i = 0; i < m_XmlCtxtPool.size(); i++)
+        _free_parser_ctxt((parser_ctxt_t*)m_XmlCtxtPool[i], FALSE);
+    m_HtmlCtxtPool.clear();
+    m_XmlCtxtPool.clear();
+    if (m_hParserMutex)
+        CloseHandle(m_hParserMutex);
     xmlCleanupParser();
 }
 
@@ -30,6 +70,87 @@ void HtmlParser::ReleaseInstance()
         delete Instance();
 }
 
+void* HtmlParser::AcquireParserCtxt(BOOL html)
+{
+    parser_ctxt_t* pc = NULL;
+    std::vector<void*>& pool = html ? m_HtmlCtxtPool : m_XmlCtxtPool;
+
+    WaitForSingleObject(m_hParserMutex, INFINITE);
+    if (!pool.empty())
+    {
+        pc = (parser_ctxt_t*)pool.back();
+        pool.pop_back();
+    }
+    ReleaseMutex(m_hParserMutex);
+    if (pc)
+        return pc;
+
+    pc = (parser_ctxt_t*)malloc(sizeof(parser_ctxt_t));
+    if (!pc)
+        return NULL;
+    pc->count = 0;
+    pc->ctxt = html ? htmlNewParserCtxt() : xmlNewParserCtxt();
+    if (!pc->ctxt)
+    {
+        free(pc);
+        return NULL;
+    }
+    return pc;
+}
+
+void HtmlParser::ReleaseParserCtxt(void* pctxt, BOOL html)
+{
+    parser_ctxt_t* pc = (parser_ctxt_t*)pctxt;
+    std::vector<void*>& pool = html ? m_HtmlCtxtPool : m_XmlCtxtPool;
+
+    if (!pc)
+        return;
+    if (pc->count < MAX_PARSER_CTXT_REUSE)
+    {
+        WaitForSingleObject(m_hParserMutex, INFINITE);
+        if (pool.size() < MAX_IDLE_PARSER_CTXT)
+        {
+            pool.push_back(pc);
+            pc = NULL;
+        }
+        ReleaseMutex(m_hParserMutex);
+    }
+    _free_parser_ctxt(pc, html);
+}
+
+void* HtmlParser::ReadDoc(const char* buf, int len, int options, BOOL html)
+{
+    parser_ctxt_t* pc = NULL;
+    xmlDocPtr doc = NULL;
+
+    pc = (parser_ctxt_t*)AcquireParserCtxt(html);
+    if (!pc)
+        return NULL;
+
+    // the context is reset by ReadMemory and its dict is kept. NODICT makes the doc own its
+    // strings instead of sharing the dict, so freeing the doc on one thread never touches
+    // the dict which is parsing the next doc on another thread
+    options |= XML_PARSE_NODICT;
+    if (html)
+        doc = htmlCtxtReadMemory(pc->ctxt, buf, len, NULL, NULL, options);
+    else
+        doc = xmlCtxtReadMemory(pc->ctxt, buf, len, NULL, NULL, options);
+    pc->count++;
+
+    ReleaseParserCtxt(pc, html);
+    return doc;
+}
+
+void* HtmlParser::ReadHtml(const char* html, int len, int options)
+{
+    return ReadDoc(html, len, options, TRUE);
+}
+
+void* HtmlParser::ReadXml(const char* xml, int len, int options)
+{
+    return ReadDoc(xml, len, options, FALSE);
+}
+
 char * HtmlParser::CreateContent(const char* xml)
 {
     char *content = NULL;
@@ -69,8 +190,213 @@ void HtmlParser::ReleaseContent(char *content)
         free(content);
 }
 
+static void _free_comp_expr(void *comp)
+{
+    if (comp)
+        xmlXPathFreeCompExpr((xmlXPathCompExprPtr)comp);
+}
+
+std::shared_ptr<void> HtmlParser::GetCompiledXpath(const std::string& xpath)
+{
+    std::shared_ptr<void> comp;
+    std::map<std::string, std::shared_ptr<void>>::iterator it;
+    xmlXPathCompExprPtr expr = NULL;
+
+    WaitForSingleObject(m_hXpathMutex, INFINITE);
+    it = m_XpathCache.find(xpath);
+    if (it != m_XpathCache.end())
+    {
+        comp = it->second;
+        ReleaseMutex(m_hXpathMutex);
+        return comp;
+    }
+    ReleaseMutex(m_hXpathMutex);
+
+    // compile outside the lock, the same book source xpath is used again and again
+    expr = xmlXPathCompile(BAD_CAST xpath.c_str());
+    if (expr)
+        comp = std::shared_ptr<void>(expr, _free_comp_expr);
+    else
+        logger_printk("xpath compile failed: %s", xpath.c_str());
+
+    WaitForSingleObject(m_hXpathMutex, INFINITE);
+    it = m_XpathCache.find(xpath);
+    if (it != m_XpathCache.end())
+    {
+        // another thread won the race, use the cached one
+        comp = it->second;
+    }
+    else
+    {
+        // NULL is cached too if the xpath is invalid, it is logged once.
+        // xpath come from the book sources, the cache only grows with them
+        if (m_XpathCache.size() >= MAX_CACHED_XPATH)
+            m_XpathCache.clear();
+        m_XpathCache[xpath] = comp;
+    }
+    ReleaseMutex(m_hXpathMutex);
+    return comp;
+}
+
+void* HtmlParser::EvalXpath(const std::string& xpath, void* ctx)
+{
+    // the caller holds a reference, so the expression stays valid even if the cache is cleared
+    std::shared_ptr<void> comp = GetCompiledXpath(xpath);
+
+    if (!comp || !ctx)
+        return NULL;
+    return xmlXPathCompiledEval((xmlXPathCompExprPtr)comp.get(), (xmlXPathContextPtr)ctx);
+}
+
+void HtmlParser::ClearXpathCache(void)
+{
+    if (!m_hXpathMutex)
+        return;
+    WaitForSingleObject(m_hXpathMutex, INFINITE);
+    m_XpathCache.clear();
+    ReleaseMutex(m_hXpathMutex);
+}
+
 #define GOTO_STOP(s) if (*(s)) goto _stop
 
+#define XPATH_RESULT_BLOCK_SIZE     (64 * 1024)
+
+XpathResult::XpathResult(BOOL utf16)
+    : m_Utf16(utf16)
+    , m_BlockUsed(0)
+    , m_BlockSize(0)
+{
+}
+
+XpathResult::~XpathResult()
+{
+    Clear();
+}
+
+int XpathResult::Size(void) const
+{
+    return (int)m_Values.size();
+}
+
+BOOL XpathResult::IsUtf16(void) const
+{
+    return m_Utf16;
+}
+
+const char* XpathResult::At(int index, int* len) const
+{
+    if (m_Utf16 || index < 0 || index >= (int)m_Values.size())
+        return NULL;
+    if (len)
+        *len = m_Values[index].len;
+    return (const char*)m_Values[index].str;
+}
+
+wchar_t* XpathResult::WAt(int index, int* len) const
+{
+    if (!m_Utf16 || index < 0 || index >= (int)m_Values.size())
+        return NULL;
+    if (len)
+        *len = m_Values[index].len;
+    return (wchar_t*)m_Values[index].str;
+}
+
+void* XpathResult::Alloc(size_t size)
+{
+    char* block = NULL;
+
+    size = (size + 7) & ~((size_t)7);
+    if (m_Blocks.empty() || m_BlockUsed + size > m_BlockSize)
+    {
+        if (size > XPATH_RESULT_BLOCK_SIZE / 4)
+        {
+            // big value has its own block, keep using the current one
+            block = (char*)malloc(size);
+            if (!block)
+                return NULL;
+            m_Blocks.insert(m_Blocks.empty() ? m_Blocks.end() : m_Blocks.end() - 1, block);
+            return block;
+        }
+        block = (char*)malloc(XPATH_RESULT_BLOCK_SIZE);
+        if (!block)
+            return NULL;
+        m_Blocks.push_back(block);
+        m_BlockSize = XPATH_RESULT_BLOCK_SIZE;
+        m_BlockUsed = 0;
+    }
+    block = m_Blocks.back() + m_BlockUsed;
+    m_BlockUsed += size;
+    return block;
+}
+
+static BOOL _is_clear_char(int c)
+{
+    return c == ' ' || c == '\r' || c == '\t' || c == '\n';
+}
+
+BOOL XpathResult::Append(const char* str, int len, BOOL clear)
+{
+    value_t value;
+    char* dst = NULL;
+    wchar_t* wdst = NULL;
+    int i, n = 0;
+
+    if (!str)
+        return FALSE;
+    if (len < 0)
+        len = (int)strlen(str);
+
+    if (m_Utf16)
+    {
+        // utf-16 never has more code units than utf-8 bytes
+        wdst = (wchar_t*)Alloc(sizeof(wchar_t) * (len + 1));
+        if (!wdst)
+            return FALSE;
+        n = len > 0 ? MultiByteToWideChar(CP_UTF8, 0, str, len, wdst, len) : 0;
+        if (clear)
+        {
+            int j = 0;
+            for (i = 0; i < n; i++)
+            {
+                if (!_is_clear_char(wdst[i]))
+                    wdst[j++] = wdst[i];
+            }
+            n = j;
+        }
+        wdst[n] = 0;
+        value.str = wdst;
+    }
+    else
+    {
+        dst = (char*)Alloc(len + 1);
+        if (!dst)
+            return FALSE;
+        for (i = 0; i < len; i++)
+        {
+            if (clear && _is_clear_char(str[i]))
+                continue;
+            dst[n++] = str[i];
+        }
+        dst[n] = 0;
+        value.str = dst;
+    }
+    value.len = n;
+    m_Values.push_back(value);
+    return TRUE;
+}
+
+void XpathResult::Clear(void)
+{
+    size_t i;
+
+    for (i = 0; i < m_Blocks.size(); i++)
+        free(m_Blocks[i]);
+    m_Blocks.clear();
+    m_Values.clear();
+    m_BlockUsed = 0;
+    m_BlockSize = 0;
+}
+
 int HtmlParser::HtmlParseByXpath(const char* html, int len, const std::string& xpath, std::vector<std::string>& value, BOOL* stop, BOOL clear)
 {
     int i;
@@ -83,7 +409,7 @@ int HtmlParser::HtmlParseByXpath(const char* html, int len, const std::string& x
 
     GOTO_STOP(stop);
 
-    doc = htmlReadMemory(html, len, NULL, NULL, HTML_PARSE_RECOVER);
+    doc = (xmlDocPtr)ReadHtml(html, len, HTML_PARSE_RECOVER);
     if (doc == NULL)
     {
         return 1;
@@ -100,7 +426,7 @@ int HtmlParser::HtmlParseByXpath(const char* html, int len, const std::string& x
 
     GOTO_STOP(stop);
 
-    xpathObj = xmlXPathEvalExpression(BAD_CAST xpath.c_str(), xpathCtx);
+    xpathObj = (xmlXPathObjectPtr)EvalXpath(xpath, xpathCtx);
     xmlXPathFreeContext(xpathCtx);
     xpathCtx = NULL;
     if (xpathObj == NULL)
@@ -164,7 +490,7 @@ int HtmlParser::HtmlParseBegin(const char *html, int len, void** pdoc, void** pc
     *pdoc = NULL;
     *pctx = NULL;
     GOTO_STOP(stop);
-    doc = htmlReadMemory(html, len, NULL, NULL, HTML_PARSE_RECOVER);
+    doc = (xmlDocPtr)ReadHtml(html, len, HTML_PARSE_RECOVER);
     if (doc == NULL)
     {
         return 1;
@@ -206,7 +532,7 @@ int HtmlParser::HtmlParseByXpath(void* doc_, void* ctx_, const std::string& xpat
 
     GOTO_STOP(stop);
 
-    xpathObj = xmlXPathEvalExpression(BAD_CAST xpath.c_str(), xpathCtx);
+    xpathObj = (xmlXPathObjectPtr)EvalXpath(xpath, xpathCtx);
     if (xpathObj == NULL)
     {
         return 1;
@@ -250,6 +576,80 @@ _stop:
     return 1;
 }
 
+int HtmlParser::HtmlParseByXpath(void* doc_, void* ctx_, const std::string& xpath, XpathResult& value, BOOL* stop, BOOL clear)
+{
+    int i;
+    xmlDocPtr doc = (xmlDocPtr)doc_;
+    xmlXPathContextPtr xpathCtx = (xmlXPathContextPtr)ctx_;
+    xmlXPathObjectPtr xpathObj = NULL;
+    xmlNodeSetPtr nodeset = NULL;
+    xmlNodePtr node = NULL;
+    xmlBufferPtr buffer = NULL;
+    const char* str = NULL;
+    int len;
+
+    if (!doc || !xpathCtx)
+        return 1;
+
+    GOTO_STOP(stop);
+
+    xpathObj = (xmlXPathObjectPtr)EvalXpath(xpath, xpathCtx);
+    if (xpathObj == NULL)
+    {
+        return 1;
+    }
+
+    if (xmlXPathNodeSetIsEmpty(xpathObj->nodesetval))
+    {
+        xmlXPathFreeObject(xpathObj);
+        // No result
+        return 0;
+    }
+
+    nodeset = xpathObj->nodesetval;
+    for (i = 0; i < nodeset->nodeNr; i++)
+    {
+        GOTO_STOP(stop);
+        node = nodeset->nodeTab[i];
+        str = NULL;
+        len = -1;
+        if (node->type == XML_TEXT_NODE || node->type == XML_CDATA_SECTION_NODE)
+        {
+            str = (const char*)node->content;
+        }
+        else if (node->children && !node->children->next && node->children->type == XML_TEXT_NODE)
+        {
+            str = (const char*)node->children->content;
+        }
+        else
+        {
+            // mixed content, collect the text into one reused buffer
+            if (!buffer)
+                buffer = xmlBufferCreate();
+            if (buffer)
+            {
+                xmlBufferEmpty(buffer);
+                xmlNodeBufGetContent(buffer, node);
+                str = (const char*)xmlBufferContent(buffer);
+                len = xmlBufferLength(buffer);
+            }
+        }
+        if (str)
+            value.Append(str, len, clear);
+    }
+    if (buffer)
+        xmlBufferFree(buffer);
+    xmlXPathFreeObject(xpathObj);
+    return 0;
+
+_stop:
+    if (buffer)
+        xmlBufferFree(buffer);
+    if (xpathObj)
+        xmlXPathFreeObject(xpathObj);
+    return 1;
+}
+
 int HtmlParser::HtmlParseEnd(void* doc_, void* ctx_)
 {
     xmlDocPtr doc = (xmlDocPtr)doc_;
@@ -262,15 +662,441 @@ int HtmlParser::HtmlParseEnd(void* doc_, void* ctx_)
     return 0;
 }
 
+typedef struct text_walker_t
+{
+    std::string *text;
+    BOOL last_br;
+    BOOL *stop;
+} text_walker_t;
+
+static BOOL _is_skip_element(const xmlChar *name)
+{
+    return !xmlStrcasecmp(name, BAD_CAST "script")
+        || !xmlStrcasecmp(name, BAD_CAST "style")
+        || !xmlStrcasecmp(name, BAD_CAST "noscript");
+}
+
+static BOOL _is_block_element(const xmlChar *name)
+{
+    static const char *blocks[] = {
+        "p", "div", "li", "ul", "ol", "dl", "dd", "dt", "tr", "table",
+        "h1", "h2", "h3", "h4", "h5", "h6", "pre", "blockquote",
+        "section", "article", "header", "footer", "hr", NULL
+    };
+    int i;
+
+    for (i = 0; blocks[i]; i++)
+    {
+        if (!xmlStrcasecmp(name, BAD_CAST blocks[i]))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static void _new_line(text_walker_t *w)
+{
+    if (!w->text->empty() && (*w->text)[w->text->size() - 1] != '\n')
+        w->text->push_back('\n');
+}
+
+static void _walk_text(xmlNodePtr node, text_walker_t *w)
+{
+    xmlNodePtr cur;
+
+    for (cur = node; cur; cur = cur->next)
+    {
+        if (*w->stop)
+            return;
+
+        switch (cur->type)
+        {
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+            // same as HTML_PARSE_NOBLANKS, ignore the indent between tags
+            if (!cur->content || xmlIsBlankNode(cur))
+                break;
+            w->text->append((const char *)cur->content);
+            w->last_br = FALSE;
+            break;
+        case XML_ELEMENT_NODE:
+            if (!xmlStrcasecmp(cur->name, BAD_CAST "br"))
+            {
+                // "<br><br>" is one paragraph break, keep the old TidyHtml behavior
+                if (!w->last_br)
+                    w->text->push_back('\n');
+                w->last_br = !w->last_br;
+            }
+            else if (!_is_skip_element(cur->name))
+            {
+                if (_is_block_element(cur->name))
+                {
+                    _new_line(w);
+                    _walk_text(cur->children, w);
+                    _new_line(w);
+                }
+                else
+                {
+                    _walk_text(cur->children, w);
+                }
+                w->last_br = FALSE;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+int HtmlParser::HtmlParseTextByXpath(void* doc_, void* ctx_, const std::string& xpath, std::vector<std::string>& value, BOOL* stop)
+{
+    int i;
+    xmlDocPtr doc = (xmlDocPtr)doc_;
+    xmlXPathContextPtr xpathCtx = (xmlXPathContextPtr)ctx_;
+    xmlXPathObjectPtr xpathObj = NULL;
+    xmlNodeSetPtr nodeset = NULL;
+    xmlNodePtr node = NULL;
+    text_walker_t walker;
+    std::string text;
+
+    if (!doc || !xpathCtx)
+        return 1;
+
+    GOTO_STOP(stop);
+
+    walker.text = &text;
+    walker.last_br = FALSE;
+    walker.stop = stop;
+    xpathObj = (xmlXPathObjectPtr)EvalXpath(xpath, xpathCtx);
+    if (xpathObj == NULL)
+    {
+        return 1;
+    }
+
+    if (xmlXPathNodeSetIsEmpty(xpathObj->nodesetval))
+    {
+        xmlXPathFreeObject(xpathObj);
+        // No result
+        return 0;
+    }
+
+    // all the matched nodes are one content, e.g. the text runs between <br> of .../text()
+    nodeset = xpathObj->nodesetval;
+    for (i = 0; i < nodeset->nodeNr; i++)
+    {
+        GOTO_STOP(stop);
+        node = nodeset->nodeTab[i];
+        _new_line(&walker);
+        if (node->type == XML_ELEMENT_NODE)
+            _walk_text(node->children, &walker);
+        else if (node->type == XML_TEXT_NODE || node->type == XML_CDATA_SECTION_NODE || node->type == XML_ATTRIBUTE_NODE)
+        {
+            if (xmlIsBlankNode(node))
+                continue;
+            xmlChar* keyword = xmlNodeGetContent(node);
+            if (keyword)
+            {
+                text.append((const char*)keyword);
+                xmlFree(keyword);
+            }
+        }
+    }
+    value.push_back(text);
+    xmlXPathFreeObject(xpathObj);
+    return 0;
+
+_stop:
+    if (xpathObj)
+        xmlXPathFreeObject(xpathObj);
+    return 1;
+}
+
+// get the position of the step separator '/' which is not in predicate or literal,
+// return FALSE if the xpath is an union of several paths
+static BOOL _get_steps(const std::string& xpath, std::vector<size_t>& steps)
+{
+    size_t i;
+    int depth = 0;
+    char quote = 0;
+
+    for (i = 0; i < xpath.size(); i++)
+    {
+        char c = xpath[i];
+        if (quote)
+        {
+            if (c == quote)
+                quote = 0;
+            continue;
+        }
+        switch (c)
+        {
+        case '\'':
+        case '"':
+            quote = c;
+            break;
+        case '[':
+        case '(':
+            depth++;
+            break;
+        case ']':
+        case ')':
+            depth--;
+            break;
+        case '|':
+            if (depth == 0)
+                return FALSE;
+            break;
+        case '/':
+            if (depth == 0)
+                steps.push_back(i);
+            break;
+        default:
+            break;
+        }
+    }
+    return TRUE;
+}
+
+int HtmlParser::FindCommonPrefix(const std::vector<std::string>& xpaths, std::string& prefix, std::vector<std::string>& suffixes)
+{
+    std::vector<size_t> steps;
+    std::vector<size_t> other;
+    size_t i, j, len;
+    int k;
+
+    if (xpaths.size() < 2)
+        return 1;
+    if (!_get_steps(xpaths[0], steps))
+        return 1;
+    for (i = 1; i < xpaths.size(); i++)
+    {
+        other.clear();
+        if (!_get_steps(xpaths[i], other))
+            return 1;
+    }
+    steps.push_back(xpaths[0].size());
+
+    // the longest prefix ends at a step boundary of every xpath
+    for (k = (int)steps.size() - 1; k >= 0; k--)
+    {
+        len = steps[k];
+        if (len == 0 || xpaths[0][len - 1] == '/')
+            continue;
+        for (j = 1; j < xpaths.size(); j++)
+        {
+            if (xpaths[j].compare(0, len, xpaths[0], 0, len) != 0)
+                break;
+            if (xpaths[j].size() != len && xpaths[j][len] != '/')
+                break;
+        }
+        if (j == xpaths.size())
+            break;
+    }
+    if (k < 0)
+        return 1;
+
+    prefix = xpaths[0].substr(0, len);
+    suffixes.clear();
+    for (i = 0; i < xpaths.size(); i++)
+    {
+        if (xpaths[i].size() == len)
+            suffixes.push_back(".");
+        else
+            suffixes.push_back("." + xpaths[i].substr(len)); // "./@href" or ".//a"
+    }
+    return 0;
+}
+
+// return the text of the node without copy if it is possible
+static const char* _get_node_value(xmlNodePtr node, xmlChar** tofree)
+{
+    *tofree = NULL;
+    switch (node->type)
+    {
+    case XML_TEXT_NODE:
+    case XML_CDATA_SECTION_NODE:
+        return (const char*)node->content;
+    case XML_ATTRIBUTE_NODE:
+    case XML_ELEMENT_NODE:
+        if (node->children && !node->children->next && node->children->type == XML_TEXT_NODE)
+            return (const char*)node->children->content;
+        break;
+    default:
+        break;
+    }
+    *tofree = xmlNodeGetContent(node);
+    return (const char*)*tofree;
+}
+
+static const char* _get_object_value(xmlXPathObjectPtr obj, int index, xmlChar** tofree)
+{
+    *tofree = NULL;
+    if (!obj)
+        return NULL;
+    if (obj->type == XPATH_STRING)
+        return (const char*)obj->stringval;
+    if (xmlXPathNodeSetIsEmpty(obj->nodesetval) || index >= obj->nodesetval->nodeNr)
+        return NULL;
+    return _get_node_value(obj->nodesetval->nodeTab[index], tofree);
+}
+
+static void _free_objects(std::vector<xmlXPathObjectPtr>& objs)
+{
+    size_t i;
+
+    for (i = 0; i < objs.size(); i++)
+    {
+        if (objs[i])
+            xmlXPathFreeObject(objs[i]);
+        objs[i] = NULL;
+    }
+}
+
+int HtmlParser::HtmlParseRowsByXpath(void* doc_, void* ctx_, const std::vector<std::string>& xpaths, xpath_row_cb cb, void* arg, BOOL* stop)
+{
+    int i, j, n, rows;
+    int count = (int)xpaths.size();
+    xmlDocPtr doc = (xmlDocPtr)doc_;
+    xmlXPathContextPtr xpathCtx = (xmlXPathContextPtr)ctx_;
+    xmlNodePtr ctxnode = NULL;
+    xmlXPathObjectPtr prefixObj = NULL;
+    xmlXPathObjectPtr obj = NULL;
+    std::vector<xmlXPathObjectPtr> objs(count, (xmlXPathObjectPtr)NULL);
+    std::vector<xmlXPathObjectPtr> cells;
+    std::vector<const char*> values(count, (const char*)NULL);
+    std::vector<xmlChar*> tofree(count, (xmlChar*)NULL);
+    std::string prefix;
+    std::vector<std::string> suffixes;
+    BOOL single = TRUE;
+    BOOL next = TRUE;
+
+    if (!doc || !xpathCtx || count == 0 || !cb)
+        return 1;
+
+    GOTO_STOP(stop);
+
+    ctxnode = xpathCtx->node;
+    if (0 == FindCommonPrefix(xpaths, prefix, suffixes))
+    {
+        prefixObj = (xmlXPathObjectPtr)EvalXpath(prefix, xpathCtx);
+        if (prefixObj == NULL)
+            return 1;
+        if (xmlXPathNodeSetIsEmpty(prefixObj->nodesetval))
+        {
+            xmlXPathFreeObject(prefixObj);
+            // No result
+            return 0;
+        }
+
+        // every suffix must match exactly one node under each prefix node, otherwise
+        // (e.g. a dd with two links or without link) the rows are not the same as
+        // evaluating the xpath one by one, fall back to that below
+        rows = prefixObj->nodesetval->nodeNr;
+        cells.assign((size_t)rows * count, (xmlXPathObjectPtr)NULL);
+        for (i = 0; i < rows && single; i++)
+        {
+            GOTO_STOP(stop);
+            xpathCtx->node = prefixObj->nodesetval->nodeTab[i];
+            for (j = 0; j < count; j++)
+            {
+                if (suffixes[j] == ".")
+                    continue;
+                obj = (xmlXPathObjectPtr)EvalXpath(suffixes[j], xpathCtx);
+                cells[i * count + j] = obj;
+                if (!obj || obj->type != XPATH_NODESET || xmlXPathNodeSetGetLength(obj->nodesetval) != 1)
+                {
+                    single = FALSE;
+                    break;
+                }
+            }
+        }
+        xpathCtx->node = ctxnode;
+
+        for (i = 0; i < rows && next && single; i++)
+        {
+            GOTO_STOP(stop);
+            for (j = 0; j < count; j++)
+            {
+                if (suffixes[j] == ".")
+                    values[j] = _get_node_value(prefixObj->nodesetval->nodeTab[i], &tofree[j]);
+                else
+                    values[j] = _get_object_value(cells[i * count + j], 0, &tofree[j]);
+                if (!values[j])
+                    break;
+            }
+            // skip the row which is not completed
+            if (j == count)
+                next = cb(&values[0], count, arg);
+            for (j = 0; j < count; j++)
+            {
+                if (tofree[j])
+                    xmlFree(tofree[j]);
+                tofree[j] = NULL;
+            }
+        }
+        _free_objects(cells);
+        xmlXPathFreeObject(prefixObj);
+        prefixObj = NULL;
+        if (single)
+            return 0;
+    }
+
+    // evaluate one by one and zip them, they must have the same number of nodes,
+    // e.g. chapter title and url, or the rows are mismatched
+    rows = -1;
+    for (j = 0; j < count; j++)
+    {
+        GOTO_STOP(stop);
+        objs[j] = (xmlXPathObjectPtr)EvalXpath(xpaths[j], xpathCtx);
+        if (!objs[j])
+            goto _stop;
+        n = xmlXPathNodeSetIsEmpty(objs[j]->nodesetval) ? 0 : objs[j]->nodesetval->nodeNr;
+        if (rows < 0)
+            rows = n;
+        else if (n != rows)
+            goto _stop;
+    }
+    for (i = 0; i < rows && next; i++)
+    {
+        GOTO_STOP(stop);
+        for (j = 0; j < count; j++)
+        {
+            values[j] = _get_object_value(objs[j], i, &tofree[j]);
+            if (!values[j])
+                break;
+        }
+        if (j == count)
+            next = cb(&values[0], count, arg);
+        for (j = 0; j < count; j++)
+        {
+            if (tofree[j])
+                xmlFree(tofree[j]);
+            tofree[j] = NULL;
+        }
+    }
+    _free_objects(objs);
+    return 0;
+
+_stop:
+    xpathCtx->node = ctxnode;
+    for (j = 0; j < count; j++)
+    {
+        if (tofree[j])
+            xmlFree(tofree[j]);
+    }
+    _free_objects(objs);
+    _free_objects(cells);
+    if (prefixObj)
+        xmlXPathFreeObject(prefixObj);
+    return 1;
+}
+
 int HtmlParser::FormatHtml(char *html, int len, char **htmlfmt, int *fmtlen)
 {
     xmlDocPtr doc = NULL;
     xmlChar *format_str = NULL;
     int size = 0;
 
-    xmlKeepBlanksDefault(0);
-    xmlIndentTreeOutput = 0;
-    doc = htmlReadMemory(html, len, NULL, NULL, HTML_PARSE_RECOVER | HTML_PARSE_NOBLANKS);
+    doc = (xmlDocPtr)ReadHtml(html, len, HTML_PARSE_RECOVER | HTML_PARSE_NOBLANKS);
 
     if (doc)
     {
@@ -280,12 +1106,11 @@ int HtmlParser::FormatHtml(char *html, int len, char **htmlfmt, int *fmtlen)
         {
             if (format_str)
                 xmlFree(format_str);
+            format_str = NULL;
+            size = 0;
         }
     }
 
-    xmlKeepBlanksDefault(1);
-    xmlIndentTreeOutput = 0;
-
     *htmlfmt = (char *)format_str;
     *fmtlen = size;
     return 0;
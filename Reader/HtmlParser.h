@@ -3,6 +3,48 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <memory>
+
+// xpath result set, all strings are kept in an arena and freed in one shot
+// when the set is cleared or destroyed. with utf16 the values are converted
+// to utf-16 while they are copied into the arena.
+class XpathResult
+{
+public:
+    XpathResult(BOOL utf16 = FALSE);
+    ~XpathResult();
+
+    int Size(void) const;
+    BOOL IsUtf16(void) const;
+    const char* At(int index, int *len = NULL) const;
+    // the buffer is owned by the set, it can be modified in place (e.g. FormatText)
+    wchar_t* WAt(int index, int *len = NULL) const;
+    BOOL Append(const char *str, int len, BOOL clear = FALSE);
+    void Clear(void);
+
+private:
+    XpathResult(const XpathResult&);
+    XpathResult& operator=(const XpathResult&);
+    void* Alloc(size_t size);
+
+private:
+    typedef struct value_t
+    {
+        void* str;
+        int len;
+    } value_t;
+
+    BOOL m_Utf16;
+    std::vector<char*> m_Blocks;
+    size_t m_BlockUsed;
+    size_t m_BlockSize;
+    std::vector<value_t> m_Values;
+};
+
+// one row of a batched query, values point into the doc and are only valid in the callback,
+// return FALSE to stop the iteration
+typedef BOOL (*xpath_row_cb)(const char **values, int count, void *arg);
 
 class HtmlParser
 {
@@ -19,14 +61,46 @@ public:
     // for multi parser
     int HtmlParseBegin(const char *html, int len, void **doc, void **ctx, BOOL* stop);
     int HtmlParseByXpath(void *doc, void *ctx, const std::string &xpath, std::vector<std::string> &value, BOOL* stop, BOOL clear = FALSE);
+    int HtmlParseByXpath(void *doc, void *ctx, const std::string &xpath, XpathResult &value, BOOL* stop, BOOL clear = FALSE);
     int HtmlParseEnd(void *doc, void *ctx);
 
+    // extract readable text of the matched nodes from the already parsed doc,
+    // <br> and block elements are mapped to line breaks while walking the tree.
+    // the matched nodes are joined by line breaks into one value, e.g. the text runs of .../text()
+    int HtmlParseTextByXpath(void *doc, void *ctx, const std::string &xpath, std::vector<std::string> &value, BOOL *stop);
+
+    // evaluate several xpath as rows, e.g. chapter title and url. when they share a common prefix
+    // (//dd/a and //dd/a/@href) the prefix is evaluated once and the rest is evaluated per node.
+    // return 1 without any row if the xpath don't match the same number of nodes
+    int HtmlParseRowsByXpath(void *doc, void *ctx, const std::vector<std::string> &xpaths, xpath_row_cb cb, void *arg, BOOL *stop);
+
     int FormatHtml(char *html, int len, char **htmlfmt, int *fmtlen);
     void FreeFormat(char *htmlfmt);
 
+    // parse with explicit options (no global libxml2 state) and a pooled parser context,
+    // they can be called from several threads at the same time, free the doc by xmlFreeDoc
+    void* ReadHtml(const char *html, int len, int options);
+    void* ReadXml(const char *xml, int len, int options);
+
+    // drop all compiled xpath, call it when the book sources are changed
+    void ClearXpathCache(void);
+
 private:
     char * CreateContent(const char* xml);
     void ReleaseContent(char *content);
+    void* ReadDoc(const char *buf, int len, int options, BOOL html);
+    void* AcquireParserCtxt(BOOL html);
+    void ReleaseParserCtxt(void *pctxt, BOOL html);
+    std::shared_ptr<void> GetCompiledXpath(const std::string &xpath);
+    void* EvalXpath(const std::string &xpath, void *ctx);
+    int FindCommonPrefix(const std::vector<std::string> &xpaths, std::string &prefix, std::vector<std::string> &suffixes);
+
+private:
+    HANDLE m_hXpathMutex;
+    std::map<std::string, std::shared_ptr<void>> m_XpathCache;
+    HANDLE m_hParserMutex;
+    std::vector<void*> m_HtmlCtxtPool;
+    std::vector<void*> m_XmlCtxtPool;
 };
 
 #endif // !__CHTML_PARSER_H__
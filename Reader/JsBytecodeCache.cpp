@@ -0,0 +1,346 @@
+/*
+ * JsBytecodeCache.cpp - Compile-once cache for Legado rule scripts
+ */
+
+#include "JsBytecodeCache.h"
+#include <cstdio>
+#include <cstring>
+
+// file layout: magic, version, engine(u64), count, then for each entry:
+// hash(u64), source length(u32), source, bytecode length(u32), bytecode, checksum(u64)
+// JS_ReadObject trusts the bytecode, so the file is dropped as a whole if the
+// engine or any checksum is not the same
+static const char CACHE_FILE_MAGIC[4] = { 'R', 'J', 'B', 'C' };
+static const uint32_t CACHE_FILE_VERSION = 2;
+
+// a small script exercising a few opcodes, its bytecode changes with the quickjs build
+static const char ENGINE_PROBE[] = "(function(a, b) { var s = ''; for (var i in a) s += a[i] * b; return s; })";
+
+#define FNV_OFFSET_BASIS    14695981039346656037ULL
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t len)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+JsBytecodeCache::JsBytecodeCache(JSContext* ctx, size_t maxEntries)
+    : m_ctx(ctx)
+    , m_maxEntries(maxEntries ? maxEntries : 1)
+    , m_clock(0)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+JsBytecodeCache::~JsBytecodeCache()
+{
+    clear();
+}
+
+uint64_t JsBytecodeCache::hashSource(const std::string& code)
+{
+    return fnv1a(FNV_OFFSET_BASIS, code.data(), code.length());
+}
+
+uint64_t JsBytecodeCache::engineVersion()
+{
+    uint64_t hash = 0;
+    size_t len = 0;
+    uint8_t* buf;
+    JSValue func;
+
+    if (!m_ctx) {
+        return 0;
+    }
+    func = JS_Eval(m_ctx, ENGINE_PROBE, sizeof(ENGINE_PROBE) - 1, "<probe>",
+                   JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+    if (JS_IsException(func)) {
+        JS_FreeValue(m_ctx, JS_GetException(m_ctx));
+        return 0;
+    }
+    buf = JS_WriteObject(m_ctx, &len, func, JS_WRITE_OBJ_BYTECODE);
+    JS_FreeValue(m_ctx, func);
+    if (buf) {
+        uint32_t ptrsize = (uint32_t)sizeof(void*);
+        hash = fnv1a(FNV_OFFSET_BASIS, &ptrsize, sizeof(ptrsize));
+        hash = fnv1a(hash, buf, len);
+        js_free(m_ctx, buf);
+    }
+    return hash;
+}
+
+void JsBytecodeCache::clear()
+{
+    for (auto& it : m_entries) {
+        JS_FreeValue(m_ctx, it.second.func);
+    }
+    m_entries.clear();
+}
+
+void JsBytecodeCache::evictOne()
+{
+    auto victim = m_entries.end();
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        if (victim == m_entries.end() || it->second.lastUse < victim->second.lastUse) {
+            victim = it;
+        }
+    }
+    if (victim != m_entries.end()) {
+        JS_FreeValue(m_ctx, victim->second.func);
+        m_entries.erase(victim);
+        m_stats.evictions++;
+    }
+}
+
+JSValue JsBytecodeCache::getFunction(const std::string& code, const char* filename)
+{
+    uint64_t hash = hashSource(code);
+    auto it = m_entries.find(hash);
+
+    if (it != m_entries.end() && it->second.source == code) {
+        Entry& entry = it->second;
+        entry.lastUse = ++m_clock;
+        if (!JS_IsUndefined(entry.func)) {
+            m_stats.hits++;
+            return JS_DupValue(m_ctx, entry.func);
+        }
+        // saved by the last run, the bytecode of another quickjs version is rejected
+        if (!entry.bytecode.empty()) {
+            JSValue func = JS_ReadObject(m_ctx, entry.bytecode.data(), entry.bytecode.size(), JS_READ_OBJ_BYTECODE);
+            entry.bytecode.clear();
+            entry.bytecode.shrink_to_fit();
+            if (!JS_IsException(func)) {
+                entry.func = func;
+                m_stats.diskHits++;
+                m_stats.hits++;
+                return JS_DupValue(m_ctx, func);
+            }
+            JS_FreeValue(m_ctx, JS_GetException(m_ctx));
+        }
+    }
+
+    m_stats.misses++;
+    JSValue func = JS_Eval(m_ctx, code.c_str(), code.length(), filename,
+                           JS_EVAL_TYPE_GLOBAL | JS_EVAL_FLAG_COMPILE_ONLY);
+    if (JS_IsException(func)) {
+        // syntax error, it is reported by the caller
+        return func;
+    }
+
+    if (it != m_entries.end()) {
+        // hash collision or the stale entry, replace it
+        JS_FreeValue(m_ctx, it->second.func);
+        m_entries.erase(it);
+    }
+    if (m_entries.size() >= m_maxEntries) {
+        evictOne();
+    }
+
+    Entry& entry = m_entries[hash];
+    entry.source = code;
+    entry.func = JS_DupValue(m_ctx, func);
+    entry.lastUse = ++m_clock;
+    return func;
+}
+
+JSValue JsBytecodeCache::eval(const std::string& code, const char* filename)
+{
+    JSValue func = getFunction(code, filename);
+    if (JS_IsException(func)) {
+        return func;
+    }
+    // JS_EvalFunction takes the ownership of func
+    return JS_EvalFunction(m_ctx, func);
+}
+
+void JsBytecodeCache::detach()
+{
+    for (auto it = m_entries.begin(); it != m_entries.end(); ) {
+        Entry& entry = it->second;
+        if (!JS_IsUndefined(entry.func)) {
+            size_t len = 0;
+            uint8_t* buf = JS_WriteObject(m_ctx, &len, entry.func, JS_WRITE_OBJ_BYTECODE);
+            JS_FreeValue(m_ctx, entry.func);
+            entry.func = JS_UNDEFINED;
+            if (buf) {
+                entry.bytecode.assign(buf, buf + len);
+                js_free(m_ctx, buf);
+            }
+        }
+        if (entry.bytecode.empty()) {
+            it = m_entries.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    m_ctx = nullptr;
+}
+
+void JsBytecodeCache::attach(JSContext* ctx)
+{
+    m_ctx = ctx;
+}
+
+JsCacheStats JsBytecodeCache::stats() const
+{
+    JsCacheStats stats = m_stats;
+    stats.entries = m_entries.size();
+    return stats;
+}
+
+static bool writeU32(FILE* fp, uint32_t v)
+{
+    return fwrite(&v, sizeof(v), 1, fp) == 1;
+}
+
+static bool readU32(FILE* fp, uint32_t* v)
+{
+    return fread(v, sizeof(*v), 1, fp) == 1;
+}
+
+static bool writeU64(FILE* fp, uint64_t v)
+{
+    return fwrite(&v, sizeof(v), 1, fp) == 1;
+}
+
+static bool readU64(FILE* fp, uint64_t* v)
+{
+    return fread(v, sizeof(*v), 1, fp) == 1;
+}
+
+static uint64_t entryChecksum(const std::string& source, const uint8_t* bytecode, size_t len)
+{
+    uint64_t hash = fnv1a(FNV_OFFSET_BASIS, source.data(), source.length());
+    return fnv1a(hash, bytecode, len);
+}
+
+bool JsBytecodeCache::save(const std::string& path)
+{
+    uint64_t engine = engineVersion();
+    if (!engine) {
+        return false;
+    }
+
+    FILE* fp = fopen(path.c_str(), "wb");
+    if (!fp) {
+        return false;
+    }
+
+    bool ok = fwrite(CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC), 1, fp) == 1
+        && writeU32(fp, CACHE_FILE_VERSION)
+        && writeU64(fp, engine)
+        && writeU32(fp, (uint32_t)m_entries.size());
+
+    uint32_t count = 0;
+    for (auto it = m_entries.begin(); ok && it != m_entries.end(); ++it) {
+        const Entry& entry = it->second;
+        uint8_t* buf = nullptr;
+        size_t len = 0;
+
+        if (!JS_IsUndefined(entry.func)) {
+            buf = JS_WriteObject(m_ctx, &len, entry.func, JS_WRITE_OBJ_BYTECODE);
+        }
+        const uint8_t* data = buf ? buf : entry.bytecode.data();
+        if (!buf) {
+            len = entry.bytecode.size();
+        }
+        if (len == 0) {
+            continue;
+        }
+
+        ok = fwrite(&it->first, sizeof(it->first), 1, fp) == 1
+            && writeU32(fp, (uint32_t)entry.source.length())
+            && fwrite(entry.source.data(), 1, entry.source.length(), fp) == entry.source.length()
+            && writeU32(fp, (uint32_t)len)
+            && fwrite(data, 1, len, fp) == len
+            && writeU64(fp, entryChecksum(entry.source, data, len));
+        if (buf) {
+            js_free(m_ctx, buf);
+        }
+        count++;
+    }
+
+    // the entries without bytecode are skipped, fix the count
+    if (ok && count != m_entries.size()) {
+        ok = fseek(fp, sizeof(CACHE_FILE_MAGIC) + sizeof(uint32_t) + sizeof(uint64_t), SEEK_SET) == 0
+            && writeU32(fp, count);
+    }
+    fclose(fp);
+    if (!ok) {
+        // a partial file is rejected by the count or the checksum, don't keep it anyway
+        remove(path.c_str());
+    }
+    return ok;
+}
+
+bool JsBytecodeCache::load(const std::string& path)
+{
+    char magic[4];
+    uint32_t version = 0, count = 0, i;
+    uint64_t engine = 0;
+    std::unordered_map<uint64_t, Entry> entries;
+
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+
+    if (fread(magic, sizeof(magic), 1, fp) != 1
+        || memcmp(magic, CACHE_FILE_MAGIC, sizeof(magic)) != 0
+        || !readU32(fp, &version) || version != CACHE_FILE_VERSION
+        || !readU64(fp, &engine) || engine != engineVersion()
+        || !readU32(fp, &count)) {
+        fclose(fp);
+        return false;
+    }
+
+    for (i = 0; i < count; i++) {
+        uint64_t hash = 0, checksum = 0;
+        uint32_t len = 0;
+        Entry entry;
+
+        if (fread(&hash, sizeof(hash), 1, fp) != 1 || !readU32(fp, &len)) {
+            break;
+        }
+        entry.source.resize(len);
+        if (len && fread(&entry.source[0], 1, len, fp) != len) {
+            break;
+        }
+        if (!readU32(fp, &len)) {
+            break;
+        }
+        entry.bytecode.resize(len);
+        if (len && fread(entry.bytecode.data(), 1, len, fp) != len) {
+            break;
+        }
+        if (!readU64(fp, &checksum)
+            || checksum != entryChecksum(entry.source, entry.bytecode.data(), entry.bytecode.size())
+            || hash != hashSource(entry.source)) {
+            break;
+        }
+        entry.func = JS_UNDEFINED;
+        entry.lastUse = 0;
+        entries[hash] = std::move(entry);
+    }
+    fclose(fp);
+    if (i != count) {
+        // truncated or modified, nothing of it is used
+        return false;
+    }
+
+    for (auto& it : entries) {
+        if (m_entries.size() >= m_maxEntries) {
+            break;
+        }
+        if (!m_entries.count(it.first)) {
+            m_entries[it.first] = std::move(it.second);
+        }
+    }
+    return true;
+}
@@ -0,0 +1,122 @@
+/*
+ * JsBytecodeCache.h - Compile-once cache for Legado rule scripts
+ *
+ * A rule like "//div[@id='content']@js:result.replace(...)" is evaluated for
+ * every result item of every chapter. The script is compiled once with
+ * JS_EVAL_FLAG_COMPILE_ONLY, the function bytecode is kept by the hash of the
+ * source and executed with JS_EvalFunction afterwards.
+ */
+
+#ifndef JS_BYTECODE_CACHE_H
+#define JS_BYTECODE_CACHE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+extern "C" {
+#include "quickjs.h"
+}
+
+struct JsCacheStats {
+    uint64_t hits;          // executed from the cached bytecode
+    uint64_t misses;        // compiled from the source
+    uint64_t diskHits;      // bytecode read from the cache file or a recycled runtime instead of compiling
+    uint64_t evictions;
+    size_t entries;
+
+    double hitRate() const {
+        uint64_t total = hits + misses;
+        return total ? (double)hits / total : 0.0;
+    }
+};
+
+/**
+ * JsBytecodeCache - bytecode of the evaluated scripts of one JSContext
+ *
+ * The bytecode belongs to the runtime of the context, so each engine owns
+ * its own cache, and it must be destroyed before the context is freed.
+ */
+class JsBytecodeCache {
+public:
+    explicit JsBytecodeCache(JSContext* ctx, size_t maxEntries = 256);
+    ~JsBytecodeCache();
+
+    // Disable copy
+    JsBytecodeCache(const JsBytecodeCache&) = delete;
+    JsBytecodeCache& operator=(const JsBytecodeCache&) = delete;
+
+    /**
+     * Evaluate a global script, same as JS_Eval(ctx, code, len, filename, JS_EVAL_TYPE_GLOBAL)
+     * @return The value to be freed by the caller, JS_EXCEPTION on error
+     */
+    JSValue eval(const std::string& code, const char* filename = "<eval>");
+
+    /**
+     * Get the compiled function of a global script, to run it several times
+     * with JS_EvalFunction(ctx, JS_DupValue(ctx, func))
+     * @return The function to be freed by the caller, JS_EXCEPTION on syntax error
+     */
+    JSValue getFunction(const std::string& code, const char* filename = "<eval>");
+
+    /**
+     * Free all the cached bytecode
+     */
+    void clear();
+
+    /**
+     * Serialize the compiled functions and free them, the cache keeps only the
+     * bytecode and can be attached to the context of a new runtime
+     */
+    void detach();
+
+    /**
+     * Use the cache with another context, the bytecode is read on the first use
+     */
+    void attach(JSContext* ctx);
+
+    /**
+     * Persist the bytecode with JS_WriteObject, so a cold start skips parsing too
+     * @param path Cache file path
+     * @return true if the file is written
+     */
+    bool save(const std::string& path);
+
+    /**
+     * Load the bytecode saved by save(), it is read by JS_ReadObject on the first use.
+     * The whole file is rejected if it is written by another quickjs build or any
+     * entry does not match its checksum
+     * @param path Cache file path
+     * @return true if the file is loaded
+     */
+    bool load(const std::string& path);
+
+    JsCacheStats stats() const;
+
+    static uint64_t hashSource(const std::string& code);
+
+    /**
+     * Hash of the bytecode of a probe script, the cache file of another quickjs build is rejected
+     * @return 0 if the context is detached
+     */
+    uint64_t engineVersion();
+
+private:
+    struct Entry {
+        std::string source;             // compared on hit, the hash may collide
+        JSValue func;                   // JS_UNDEFINED until compiled or read
+        std::vector<uint8_t> bytecode;  // loaded from file, not read yet
+        uint64_t lastUse;
+    };
+
+    JSContext* m_ctx;
+    size_t m_maxEntries;
+    uint64_t m_clock;
+    std::unordered_map<uint64_t, Entry> m_entries;
+    JsCacheStats m_stats;
+
+    void evictOne();
+};
+
+#endif // JS_BYTECODE_CACHE_H
@@ -0,0 +1,674 @@
+/*
+ * JsCrypto.cpp - Native crypto of the java.* API for Legado rule scripts
+ */
+
+#include "JsCrypto.h"
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <wolfssl/options.h>
+#include <wolfssl/openssl/evp.h>
+#include <wolfssl/openssl/hmac.h>
+// the shipped wolfSSL is built without some modes, their evp functions are neither
+// declared nor linked, such a transformation fails as unsupported
+#ifdef HAVE_AES_ECB
+#define CIPHER_AES_ECB
+#endif
+#if defined(HAVE_AES_CBC) || defined(WOLFSSL_AES_DIRECT)
+#define CIPHER_AES_CBC
+#endif
+#ifdef WOLFSSL_AES_COUNTER
+#define CIPHER_AES_CTR
+#endif
+#ifdef WOLFSSL_AES_CFB
+#define CIPHER_AES_CFB
+#endif
+#ifdef WOLFSSL_AES_OFB
+#define CIPHER_AES_OFB
+#endif
+#ifdef HAVE_AESGCM
+#define CIPHER_AES_GCM
+#endif
+#ifdef WOLFSSL_DES_ECB
+#define CIPHER_DES_ECB
+#endif
+#else
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#define CIPHER_AES_ECB
+#define CIPHER_AES_CBC
+#define CIPHER_AES_CTR
+#define CIPHER_AES_CFB
+#define CIPHER_AES_OFB
+#define CIPHER_AES_GCM
+#define CIPHER_DES_ECB
+#endif
+
+static const char base64_chars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static std::string upper(const std::string& s)
+{
+    std::string r(s);
+    for (size_t i = 0; i < r.size(); i++)
+        if (r[i] >= 'a' && r[i] <= 'z')
+            r[i] -= 'a' - 'A';
+    return r;
+}
+
+static void split(const std::string& s, char sep, std::vector<std::string>& parts)
+{
+    size_t begin = 0, end;
+    while ((end = s.find(sep, begin)) != std::string::npos) {
+        parts.push_back(s.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    parts.push_back(s.substr(begin));
+}
+
+enum CipherPadding {
+    PADDING_PKCS5,
+    PADDING_ZERO,
+    PADDING_NONE
+};
+
+struct CipherSpec {
+    const EVP_CIPHER* cipher;
+    CipherPadding padding;
+    bool gcm;
+    int blockSize;
+    std::string key;
+    std::string iv;
+};
+
+static const EVP_CIPHER* aesCipher(const std::string& mode, size_t keyLen)
+{
+    int k = keyLen == 16 ? 0 : keyLen == 24 ? 1 : keyLen == 32 ? 2 : -1;
+    if (k < 0)
+        return nullptr;
+#ifdef CIPHER_AES_ECB
+    if (mode == "ECB") {
+        const EVP_CIPHER* (*f[])() = { EVP_aes_128_ecb, EVP_aes_192_ecb, EVP_aes_256_ecb };
+        return f[k]();
+    }
+#endif
+#ifdef CIPHER_AES_CBC
+    if (mode == "CBC") {
+        const EVP_CIPHER* (*f[])() = { EVP_aes_128_cbc, EVP_aes_192_cbc, EVP_aes_256_cbc };
+        return f[k]();
+    }
+#endif
+#ifdef CIPHER_AES_CTR
+    if (mode == "CTR") {
+        const EVP_CIPHER* (*f[])() = { EVP_aes_128_ctr, EVP_aes_192_ctr, EVP_aes_256_ctr };
+        return f[k]();
+    }
+#endif
+#ifdef CIPHER_AES_CFB
+    if (mode == "CFB" || mode == "CFB128") {
+        const EVP_CIPHER* (*f[])() = { EVP_aes_128_cfb128, EVP_aes_192_cfb128, EVP_aes_256_cfb128 };
+        return f[k]();
+    }
+    if (mode == "CFB8") {
+        const EVP_CIPHER* (*f[])() = { EVP_aes_128_cfb8, EVP_aes_192_cfb8, EVP_aes_256_cfb8 };
+        return f[k]();
+    }
+#endif
+#ifdef CIPHER_AES_OFB
+    if (mode == "OFB") {
+        const EVP_CIPHER* (*f[])() = { EVP_aes_128_ofb, EVP_aes_192_ofb, EVP_aes_256_ofb };
+        return f[k]();
+    }
+#endif
+#ifdef CIPHER_AES_GCM
+    if (mode == "GCM") {
+        const EVP_CIPHER* (*f[])() = { EVP_aes_128_gcm, EVP_aes_192_gcm, EVP_aes_256_gcm };
+        return f[k]();
+    }
+#endif
+    return nullptr;
+}
+
+// resolve the cipher, padding and the real key of a java transformation
+static bool parseTransformation(const std::string& transformation, const std::string& key,
+                                const std::string& iv, CipherSpec& spec, std::string& error)
+{
+    std::vector<std::string> parts;
+    split(upper(transformation), '/', parts);
+
+    std::string algorithm = parts[0];
+    std::string mode = parts.size() > 1 ? parts[1] : "ECB";
+    std::string padding = parts.size() > 2 ? parts[2] : "PKCS5PADDING";
+
+    if (padding == "PKCS5PADDING" || padding == "PKCS7PADDING")
+        spec.padding = PADDING_PKCS5;
+    else if (padding == "ZEROPADDING")
+        spec.padding = PADDING_ZERO;
+    else if (padding == "NOPADDING")
+        spec.padding = PADDING_NONE;
+    else {
+        error = "unsupported padding " + padding;
+        return false;
+    }
+
+    spec.gcm = mode == "GCM";
+    spec.cipher = nullptr;
+    spec.key = key;
+    if (algorithm == "AES") {
+        spec.cipher = aesCipher(mode, key.size());
+        if (!spec.cipher && aesCipher(mode, 16)) {
+            error = "invalid AES key length " + std::to_string(key.size());
+            return false;
+        }
+        spec.blockSize = 16;
+    }
+    else if (algorithm == "DES") {
+        // like DESKeySpec, the first 8 bytes are the key
+        if (key.size() < 8) {
+            error = "invalid DES key length " + std::to_string(key.size());
+            return false;
+        }
+        spec.key = key.substr(0, 8);
+#ifdef CIPHER_DES_ECB
+        if (mode == "ECB")
+            spec.cipher = EVP_des_ecb();
+#endif
+        if (mode == "CBC")
+            spec.cipher = EVP_des_cbc();
+        spec.blockSize = 8;
+    }
+    else if (algorithm == "DESEDE" || algorithm == "3DES" || algorithm == "TRIPLEDES") {
+        // a 16 bytes key is the two keys form K1 K2 K1
+        if (key.size() == 16)
+            spec.key = key + key.substr(0, 8);
+        else if (key.size() >= 24)
+            spec.key = key.substr(0, 24);
+        else {
+            error = "invalid DESede key length " + std::to_string(key.size());
+            return false;
+        }
+#ifdef CIPHER_DES_ECB
+        if (mode == "ECB")
+            spec.cipher = EVP_des_ede3_ecb();
+#endif
+        if (mode == "CBC")
+            spec.cipher = EVP_des_ede3_cbc();
+        spec.blockSize = 8;
+    }
+    else {
+        error = "unsupported algorithm " + algorithm;
+        return false;
+    }
+    if (!spec.cipher) {
+        error = "unsupported mode " + mode + " of " + algorithm;
+        return false;
+    }
+
+    // ECB has no iv, an empty iv of the other modes is all zero
+    spec.iv.clear();
+    if (spec.gcm) {
+        spec.iv = iv.empty() ? std::string(12, '\0') : iv;
+    }
+    else if (EVP_CIPHER_iv_length(spec.cipher) > 0) {
+        size_t ivLen = (size_t)EVP_CIPHER_iv_length(spec.cipher);
+        if (!iv.empty() && iv.size() != ivLen) {
+            error = "invalid iv length " + std::to_string(iv.size()) + ", " + std::to_string(ivLen) + " expected";
+            return false;
+        }
+        spec.iv = iv.empty() ? std::string(ivLen, '\0') : iv;
+    }
+    return true;
+}
+
+static bool runCipher(const CipherSpec& spec, bool enc, const std::string& data, std::string& out, std::string& error)
+{
+    static const int TAG_SIZE = 16;
+    std::string input = data;
+    std::string tag;
+    int len = 0, total = 0;
+    bool ok = false;
+
+    if (spec.gcm && !enc) {
+        if (input.size() < (size_t)TAG_SIZE) {
+            error = "cipher text shorter than the GCM tag";
+            return false;
+        }
+        tag = input.substr(input.size() - TAG_SIZE);
+        input.resize(input.size() - TAG_SIZE);
+    }
+    if (spec.padding == PADDING_ZERO && enc && !spec.gcm && input.size() % spec.blockSize)
+        input.append(spec.blockSize - input.size() % spec.blockSize, '\0');
+
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        error = "out of memory";
+        return false;
+    }
+
+    out.resize(input.size() + spec.blockSize + TAG_SIZE);
+    unsigned char* buf = (unsigned char*)&out[0];
+
+    do {
+        if (EVP_CipherInit_ex(ctx, spec.cipher, nullptr, nullptr, nullptr, enc ? 1 : 0) != 1)
+            break;
+        if (spec.gcm && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, (int)spec.iv.size(), nullptr) != 1)
+            break;
+        if (EVP_CipherInit_ex(ctx, nullptr, nullptr, (const unsigned char*)spec.key.data(),
+                spec.iv.empty() ? nullptr : (const unsigned char*)spec.iv.data(), enc ? 1 : 0) != 1)
+            break;
+        EVP_CIPHER_CTX_set_padding(ctx, spec.padding == PADDING_PKCS5 ? 1 : 0);
+        if (!input.empty()) {
+            if (EVP_CipherUpdate(ctx, buf, &len, (const unsigned char*)input.data(), (int)input.size()) != 1)
+                break;
+            total = len;
+        }
+        if (spec.gcm && !enc && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, TAG_SIZE, (void*)tag.data()) != 1)
+            break;
+        if (EVP_CipherFinal_ex(ctx, buf + total, &len) != 1)
+            break;
+        total += len;
+        if (spec.gcm && enc) {
+            if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, TAG_SIZE, buf + total) != 1)
+                break;
+            total += TAG_SIZE;
+        }
+        ok = true;
+    } while (0);
+
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok) {
+        out.clear();
+        error = spec.gcm && !enc ? "GCM tag mismatch" : enc ? "encrypt failed" : "decrypt failed, bad key or padding";
+        return false;
+    }
+    out.resize(total);
+    if (spec.padding == PADDING_ZERO && !enc) {
+        while (!out.empty() && out.back() == '\0')
+            out.pop_back();
+    }
+    return true;
+}
+
+bool JsCrypto::encrypt(const std::string& transformation, const std::string& key, const std::string& iv,
+                       const std::string& data, std::string& out, std::string& error)
+{
+    CipherSpec spec;
+    if (!parseTransformation(transformation, key, iv, spec, error))
+        return false;
+    if (spec.padding == PADDING_NONE && !spec.gcm && EVP_CIPHER_block_size(spec.cipher) > 1
+        && data.size() % spec.blockSize) {
+        error = "data length is not a multiple of the block size with NoPadding";
+        return false;
+    }
+    return runCipher(spec, true, data, out, error);
+}
+
+bool JsCrypto::decrypt(const std::string& transformation, const std::string& key, const std::string& iv,
+                       const std::string& data, std::string& out, std::string& error)
+{
+    CipherSpec spec;
+    if (!parseTransformation(transformation, key, iv, spec, error))
+        return false;
+    return runCipher(spec, false, data, out, error);
+}
+
+static const EVP_MD* digestByName(const std::string& algorithm)
+{
+    std::string name = upper(algorithm);
+    if (name.compare(0, 4, "HMAC") == 0)
+        name = name.substr(4);
+    std::string compact;
+    for (size_t i = 0; i < name.size(); i++)
+        if (name[i] != '-' && name[i] != '_')
+            compact += name[i];
+
+    if (compact == "MD5")
+        return EVP_md5();
+    if (compact == "SHA" || compact == "SHA1")
+        return EVP_sha1();
+    if (compact == "SHA224")
+        return EVP_sha224();
+    if (compact == "SHA256")
+        return EVP_sha256();
+    if (compact == "SHA384")
+        return EVP_sha384();
+    if (compact == "SHA512")
+        return EVP_sha512();
+    return nullptr;
+}
+
+bool JsCrypto::digest(const std::string& algorithm, const std::string& data, std::string& out)
+{
+    const EVP_MD* md = digestByName(algorithm);
+    unsigned char buf[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+
+    if (!md || EVP_Digest((const unsigned char*)data.data(), (int)data.size(), buf, &len, md, nullptr) != 1)
+        return false;
+    out.assign((const char*)buf, len);
+    return true;
+}
+
+bool JsCrypto::hmac(const std::string& algorithm, const std::string& key, const std::string& data,
+                    std::string& out)
+{
+    const EVP_MD* md = digestByName(algorithm);
+    unsigned char buf[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+
+    if (!md || !HMAC(md, key.data(), (int)key.size(), (const unsigned char*)data.data(), (int)data.size(), buf, &len))
+        return false;
+    out.assign((const char*)buf, len);
+    return true;
+}
+
+std::string JsCrypto::hexEncode(const std::string& data)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(data.size() * 2);
+    for (size_t i = 0; i < data.size(); i++) {
+        unsigned char c = (unsigned char)data[i];
+        out += digits[c >> 4];
+        out += digits[c & 0x0F];
+    }
+    return out;
+}
+
+static int hexValue(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool JsCrypto::hexDecode(const std::string& hex, std::string& out)
+{
+    if (hex.size() % 2)
+        return false;
+    out.resize(hex.size() / 2);
+    for (size_t i = 0; i < out.size(); i++) {
+        int h = hexValue(hex[i * 2]), l = hexValue(hex[i * 2 + 1]);
+        if (h < 0 || l < 0) {
+            out.clear();
+            return false;
+        }
+        out[i] = (char)((h << 4) | l);
+    }
+    return true;
+}
+
+std::string JsCrypto::base64Encode(const std::string& data)
+{
+    std::string out;
+    const unsigned char* p = (const unsigned char*)data.data();
+    size_t n = data.size(), i;
+
+    out.reserve((n + 2) / 3 * 4);
+    for (i = 0; i + 2 < n; i += 3) {
+        out += base64_chars[p[i] >> 2];
+        out += base64_chars[((p[i] & 0x03) << 4) | (p[i + 1] >> 4)];
+        out += base64_chars[((p[i + 1] & 0x0F) << 2) | (p[i + 2] >> 6)];
+        out += base64_chars[p[i + 2] & 0x3F];
+    }
+    if (i < n) {
+        out += base64_chars[p[i] >> 2];
+        if (i + 1 < n) {
+            out += base64_chars[((p[i] & 0x03) << 4) | (p[i + 1] >> 4)];
+            out += base64_chars[(p[i + 1] & 0x0F) << 2];
+        }
+        else {
+            out += base64_chars[(p[i] & 0x03) << 4];
+            out += '=';
+        }
+        out += '=';
+    }
+    return out;
+}
+
+bool JsCrypto::base64Decode(const std::string& text, std::string& out)
+{
+    // accepts the url safe alphabet, line breaks and missing padding like android Base64
+    unsigned int val = 0;
+    int bits = 0;
+
+    out.clear();
+    out.reserve(text.size() * 3 / 4);
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        int v;
+        if (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '+' || c == '-') v = 62;
+        else if (c == '/' || c == '_') v = 63;
+        else if (c == '=') break;
+        else if (c == '\r' || c == '\n' || c == ' ' || c == '\t') continue;
+        else {
+            out.clear();
+            return false;
+        }
+        val = (val << 6) | (unsigned int)v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out += (char)((val >> bits) & 0xFF);
+        }
+    }
+    return true;
+}
+
+bool JsCrypto::decodeCipherText(const std::string& text, std::string& out)
+{
+    bool hex = !text.empty() && text.size() % 2 == 0;
+    for (size_t i = 0; hex && i < text.size(); i++)
+        hex = hexValue(text[i]) >= 0;
+    return hex ? hexDecode(text, out) : base64Decode(text, out);
+}
+
+// ============ java.* bindings ============
+
+enum {
+    CF_ENCRYPT      = 0x01,
+    CF_IN_BASE64    = 0x02, // cipher text is base64 only, otherwise hex or base64
+    CF_OUT_BASE64   = 0x04,
+    CF_OUT_HEX      = 0x08,
+    CF_SPLIT_ARGS   = 0x10, // (data, key, mode, padding, iv) instead of (data, key, transformation, iv)
+    CF_KEY_BASE64   = 0x20, // key and iv are base64
+    CF_AES          = 0x100,
+    CF_DES          = 0x200,
+    CF_DESEDE       = 0x400
+};
+
+struct CipherFunction {
+    const char* name;
+    int flags;
+};
+
+static const CipherFunction s_cipherFunctions[] = {
+    { "aesDecodeToString",              CF_AES },
+    { "aesBase64DecodeToString",        CF_AES | CF_IN_BASE64 },
+    { "aesEncodeToString",              CF_AES | CF_ENCRYPT },
+    { "aesEncodeToBase64String",        CF_AES | CF_ENCRYPT | CF_OUT_BASE64 },
+    { "aesDecodeArgsBase64Str",         CF_AES | CF_SPLIT_ARGS | CF_KEY_BASE64 },
+    { "aesEncodeArgsBase64Str",         CF_AES | CF_ENCRYPT | CF_OUT_BASE64 | CF_SPLIT_ARGS | CF_KEY_BASE64 },
+    { "desDecodeToString",              CF_DES },
+    { "desBase64DecodeToString",        CF_DES | CF_IN_BASE64 },
+    { "desEncodeToString",              CF_DES | CF_ENCRYPT },
+    { "desEncodeToBase64String",        CF_DES | CF_ENCRYPT | CF_OUT_BASE64 },
+    { "tripleDESDecodeStr",             CF_DESEDE | CF_SPLIT_ARGS },
+    { "tripleDESDecodeArgsBase64Str",   CF_DESEDE | CF_SPLIT_ARGS | CF_KEY_BASE64 },
+    { "tripleDESEncodeBase64Str",       CF_DESEDE | CF_ENCRYPT | CF_OUT_BASE64 | CF_SPLIT_ARGS },
+    { "tripleDESEncodeArgsBase64Str",   CF_DESEDE | CF_ENCRYPT | CF_OUT_BASE64 | CF_SPLIT_ARGS | CF_KEY_BASE64 },
+};
+
+// byte string of an argument, undefined and null are empty
+static bool argBytes(JSContext* ctx, int argc, JSValueConst* argv, int i, std::string& out)
+{
+    out.clear();
+    if (i >= argc || JS_IsUndefined(argv[i]) || JS_IsNull(argv[i]))
+        return true;
+    size_t len;
+    const char* str = JS_ToCStringLen(ctx, &len, argv[i]);
+    if (!str)
+        return false;
+    out.assign(str, len);
+    JS_FreeCString(ctx, str);
+    return true;
+}
+
+static JSValue newBytes(JSContext* ctx, const std::string& data)
+{
+    return JS_NewStringLen(ctx, data.data(), data.size());
+}
+
+static JSValue cipherCall(JSContext* ctx, const char* name, int flags, const std::string& transformation,
+                          const std::string& key, const std::string& iv, const std::string& data)
+{
+    std::string input, out, error;
+
+    if (flags & CF_ENCRYPT) {
+        if (!JsCrypto::encrypt(transformation, key, iv, data, out, error))
+            return JS_ThrowInternalError(ctx, "%s: %s", name, error.c_str());
+        if (flags & CF_OUT_BASE64)
+            return newBytes(ctx, JsCrypto::base64Encode(out));
+        if (flags & CF_OUT_HEX)
+            return newBytes(ctx, JsCrypto::hexEncode(out));
+        return newBytes(ctx, out);
+    }
+
+    bool decoded = (flags & CF_IN_BASE64) ? JsCrypto::base64Decode(data, input)
+                                          : JsCrypto::decodeCipherText(data, input);
+    if (!decoded)
+        return JS_ThrowInternalError(ctx, "%s: cipher text is not hex or base64", name);
+    if (!JsCrypto::decrypt(transformation, key, iv, input, out, error))
+        return JS_ThrowInternalError(ctx, "%s: %s", name, error.c_str());
+    return newBytes(ctx, out);
+}
+
+static JSValue js_cipher(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv, int magic)
+{
+    const CipherFunction& func = s_cipherFunctions[magic];
+    const char* algorithm = (func.flags & CF_AES) ? "AES" : (func.flags & CF_DES) ? "DES" : "DESede";
+    std::string data, key, transformation, iv;
+
+    if (!argBytes(ctx, argc, argv, 0, data) || !argBytes(ctx, argc, argv, 1, key))
+        return JS_EXCEPTION;
+    if (func.flags & CF_SPLIT_ARGS) {
+        std::string mode, padding;
+        if (!argBytes(ctx, argc, argv, 2, mode) || !argBytes(ctx, argc, argv, 3, padding)
+            || !argBytes(ctx, argc, argv, 4, iv))
+            return JS_EXCEPTION;
+        transformation = std::string(algorithm) + "/" + (mode.empty() ? "ECB" : mode)
+            + "/" + (padding.empty() ? "PKCS5Padding" : padding);
+    }
+    else {
+        if (!argBytes(ctx, argc, argv, 2, transformation) || !argBytes(ctx, argc, argv, 3, iv))
+            return JS_EXCEPTION;
+        if (transformation.empty())
+            transformation = algorithm;
+    }
+    if (func.flags & CF_KEY_BASE64) {
+        std::string raw;
+        if (!JsCrypto::base64Decode(key, raw))
+            return JS_ThrowInternalError(ctx, "%s: key is not base64", func.name);
+        key.swap(raw);
+        if (!JsCrypto::base64Decode(iv, raw))
+            return JS_ThrowInternalError(ctx, "%s: iv is not base64", func.name);
+        iv.swap(raw);
+    }
+    return cipherCall(ctx, func.name, func.flags, transformation, key, iv, data);
+}
+
+// methods of the object of java.createSymmetricCrypto, bound to its transformation, key and iv
+static const CipherFunction s_symmetricMethods[] = {
+    { "decrypt",        0 },
+    { "decryptStr",     0 },
+    { "encrypt",        CF_ENCRYPT },
+    { "encryptBase64",  CF_ENCRYPT | CF_OUT_BASE64 },
+    { "encryptHex",     CF_ENCRYPT | CF_OUT_HEX },
+};
+
+static JSValue js_symmetric_method(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv,
+                                   int magic, JSValue* func_data)
+{
+    const CipherFunction& func = s_symmetricMethods[magic];
+    std::string data, transformation, key, iv;
+
+    if (!argBytes(ctx, argc, argv, 0, data) || !argBytes(ctx, 3, func_data, 0, transformation)
+        || !argBytes(ctx, 3, func_data, 1, key) || !argBytes(ctx, 3, func_data, 2, iv))
+        return JS_EXCEPTION;
+    return cipherCall(ctx, func.name, func.flags, transformation, key, iv, data);
+}
+
+static JSValue js_createSymmetricCrypto(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv)
+{
+    JSValue data[3];
+    for (int i = 0; i < 3; i++)
+        data[i] = i < argc ? argv[i] : JS_UNDEFINED;
+
+    JSValue obj = JS_NewObject(ctx);
+    for (int i = 0; i < (int)(sizeof(s_symmetricMethods) / sizeof(s_symmetricMethods[0])); i++) {
+        JS_SetPropertyStr(ctx, obj, s_symmetricMethods[i].name,
+            JS_NewCFunctionData(ctx, js_symmetric_method, 1, i, 3, data));
+    }
+    return obj;
+}
+
+static JSValue js_digest(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv, int magic)
+{
+    // magic: bit 0 base64 output, bit 1 hmac
+    std::string data, algorithm, key, out;
+
+    if (!argBytes(ctx, argc, argv, 0, data) || !argBytes(ctx, argc, argv, 1, algorithm)
+        || !argBytes(ctx, argc, argv, 2, key))
+        return JS_EXCEPTION;
+    bool ok = (magic & 2) ? JsCrypto::hmac(algorithm, key, data, out) : JsCrypto::digest(algorithm, data, out);
+    if (!ok)
+        return JS_ThrowInternalError(ctx, "unsupported digest algorithm %s", algorithm.c_str());
+    return newBytes(ctx, (magic & 1) ? JsCrypto::base64Encode(out) : JsCrypto::hexEncode(out));
+}
+
+static JSValue js_hexEncodeToString(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv)
+{
+    std::string data;
+    if (!argBytes(ctx, argc, argv, 0, data))
+        return JS_EXCEPTION;
+    return newBytes(ctx, JsCrypto::hexEncode(data));
+}
+
+static JSValue js_hexDecodeToString(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv)
+{
+    std::string hex, out;
+    if (!argBytes(ctx, argc, argv, 0, hex))
+        return JS_EXCEPTION;
+    if (!JsCrypto::hexDecode(hex, out))
+        return JS_ThrowInternalError(ctx, "hexDecodeToString: invalid hex string");
+    return newBytes(ctx, out);
+}
+
+void JsCrypto::registerFunctions(JSContext* ctx, JSValueConst java)
+{
+    for (int i = 0; i < (int)(sizeof(s_cipherFunctions) / sizeof(s_cipherFunctions[0])); i++) {
+        JS_SetPropertyStr(ctx, java, s_cipherFunctions[i].name,
+            JS_NewCFunctionMagic(ctx, js_cipher, s_cipherFunctions[i].name, 5, JS_CFUNC_generic_magic, i));
+    }
+    JS_SetPropertyStr(ctx, java, "createSymmetricCrypto",
+        JS_NewCFunction(ctx, js_createSymmetricCrypto, "createSymmetricCrypto", 3));
+
+    JS_SetPropertyStr(ctx, java, "digestHex",
+        JS_NewCFunctionMagic(ctx, js_digest, "digestHex", 2, JS_CFUNC_generic_magic, 0));
+    JS_SetPropertyStr(ctx, java, "digestBase64Str",
+        JS_NewCFunctionMagic(ctx, js_digest, "digestBase64Str", 2, JS_CFUNC_generic_magic, 1));
+    JS_SetPropertyStr(ctx, java, "HMacHex",
+        JS_NewCFunctionMagic(ctx, js_digest, "HMacHex", 3, JS_CFUNC_generic_magic, 2));
+    JS_SetPropertyStr(ctx, java, "HMacBase64",
+        JS_NewCFunctionMagic(ctx, js_digest, "HMacBase64", 3, JS_CFUNC_generic_magic, 3));
+
+    JS_SetPropertyStr(ctx, java, "hexEncodeToString",
+        JS_NewCFunction(ctx, js_hexEncodeToString, "hexEncodeToString", 1));
+    JS_SetPropertyStr(ctx, java, "hexDecodeToString",
+        JS_NewCFunction(ctx, js_hexDecodeToString, "hexDecodeToString", 1));
+}
@@ -0,0 +1,48 @@
+/*
+ * JsCrypto.h - Native crypto of the java.* API for Legado rule scripts
+ *
+ * Book sources decrypt the chapter text with java.aesBase64DecodeToString,
+ * java.desDecodeToString, java.HMacHex and so on. Without them the scripts
+ * fail or carry their own crypto written in JS. They are implemented on the
+ * EVP api of the linked ssl library (wolfSSL built with OPENSSL_EXTRA on
+ * Windows) and registered on the java object of both script engines.
+ */
+
+#ifndef JS_CRYPTO_H
+#define JS_CRYPTO_H
+
+#include <string>
+
+extern "C" {
+#include "quickjs.h"
+}
+
+class JsCrypto {
+public:
+    // transformation: "AES/CBC/PKCS5Padding", "AES/ECB/NoPadding", "AES/GCM/NoPadding",
+    // "DES/CBC/ZeroPadding", "DESede/ECB/PKCS5Padding" ... the algorithm alone means
+    // ECB with PKCS5 padding like java. key and iv are raw bytes, the size of the aes
+    // key selects AES-128/192/256. GCM appends the 16 bytes tag to the cipher text.
+    static bool encrypt(const std::string& transformation, const std::string& key, const std::string& iv,
+                        const std::string& data, std::string& out, std::string& error);
+    static bool decrypt(const std::string& transformation, const std::string& key, const std::string& iv,
+                        const std::string& data, std::string& out, std::string& error);
+
+    // algorithm: MD5, SHA-1, SHA-224, SHA-256, SHA-384, SHA-512
+    static bool digest(const std::string& algorithm, const std::string& data, std::string& out);
+    // algorithm: HmacMD5, HmacSHA1, HmacSHA256 ... the Hmac prefix is optional
+    static bool hmac(const std::string& algorithm, const std::string& key, const std::string& data,
+                     std::string& out);
+
+    static std::string hexEncode(const std::string& data);
+    static bool hexDecode(const std::string& hex, std::string& out);
+    static std::string base64Encode(const std::string& data);
+    static bool base64Decode(const std::string& text, std::string& out);
+    // the cipher text given to the decode functions is hex or base64, like hutool decryptStr
+    static bool decodeCipherText(const std::string& text, std::string& out);
+
+    // add the crypto functions to the java object of a context
+    static void registerFunctions(JSContext* ctx, JSValueConst java);
+};
+
+#endif // JS_CRYPTO_H
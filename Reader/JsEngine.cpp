@@ -3,6 +3,8 @@
  */
 
 #include "JsEngine.h"
+#include "JsBytecodeCache.h"
+#include "JsCrypto.h"
 
 // Include QuickJS headers
 extern "C" {
@@ -34,6 +36,7 @@ static JsEngine* g_currentEngine = nullptr;
 JsEngine::JsEngine()
     : m_runtime(nullptr)
     , m_context(nullptr)
+    , m_codeCache(nullptr)
     , m_initialized(false)
 {
 }
@@ -75,12 +78,18 @@ bool JsEngine::initialize()
     // Register native functions
     registerNativeFunctions();
 
+    // Rule scripts are compiled once
+    m_codeCache = new JsBytecodeCache(m_context);
+
     m_initialized = true;
     return true;
 }
 
 void JsEngine::shutdown()
 {
+    // The bytecode belongs to the runtime, free it before the context
+    delete m_codeCache;
+    m_codeCache = nullptr;
     if (m_context) {
         JS_FreeContext(m_context);
         m_context = nullptr;
@@ -126,6 +135,7 @@ void JsEngine::registerNativeFunctions()
         JS_NewCFunction(m_context, js_htmlFormat, "htmlFormat", 1));
     JS_SetPropertyStr(m_context, javaObj, "timeFormat",
         JS_NewCFunction(m_context, js_timeFormat, "timeFormat", 1));
+    JsCrypto::registerFunctions(m_context, javaObj);
 
     // Set java object as global
     JS_SetPropertyStr(m_context, global, "java", javaObj);
@@ -189,8 +199,7 @@ std::string JsEngine::evaluate(const std::string& code)
         wrappedCode = "(" + code + ")";
     }
 
-    JSValue result = JS_Eval(m_context, wrappedCode.c_str(), wrappedCode.length(),
-                             "<eval>", JS_EVAL_TYPE_GLOBAL);
+    JSValue result = m_codeCache->eval(wrappedCode);
 
     if (JS_IsException(result)) {
         JSValue exception = JS_GetException(m_context);
@@ -216,6 +225,25 @@ std::string JsEngine::getLastError() const
     return m_lastError;
 }
 
+bool JsEngine::loadCodeCache(const std::string& path)
+{
+    return m_codeCache && m_codeCache->load(path);
+}
+
+bool JsEngine::saveCodeCache(const std::string& path)
+{
+    return m_codeCache && m_codeCache->save(path);
+}
+
+JsCacheStats JsEngine::getCacheStats() const
+{
+    JsCacheStats stats = {};
+    if (m_codeCache) {
+        stats = m_codeCache->stats();
+    }
+    return stats;
+}
+
 void JsEngine::setHttpCallback(std::function<std::string(const std::string&)> callback)
 {
     m_httpGetCallback = callback;
@@ -16,6 +16,8 @@
 struct JSRuntime;
 struct JSContext;
 typedef uint64_t JSValue;
+class JsBytecodeCache;
+struct JsCacheStats;
 
 namespace reader {
 
@@ -103,10 +105,32 @@ public:
      */
     void setHttpPostCallback(std::function<std::string(const std::string&, const std::string&, const std::map<std::string, std::string>&)> callback);
 
+    /**
+     * Load the compiled scripts saved by saveCodeCache(), so a cold start skips parsing
+     * @param path Cache file path
+     * @return true if the file is loaded
+     */
+    bool loadCodeCache(const std::string& path);
+
+    /**
+     * Save the compiled scripts with JS_WriteObject
+     * @param path Cache file path
+     * @return true if the file is written
+     */
+    bool saveCodeCache(const std::string& path);
+
+    /**
+     * Get the hit counters of the bytecode cache
+     */
+    JsCacheStats getCacheStats() const;
+
 private:
     // QuickJS runtime and context
     JSRuntime* m_runtime;
     JSContext* m_context;
+
+    // Compiled scripts keyed by the source hash
+    JsBytecodeCache* m_codeCache;
     
     bool m_initialized;
     std::string m_lastError;
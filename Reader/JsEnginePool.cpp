@@ -0,0 +1,325 @@
+/**
+ * JsEnginePool.cpp
+ * 
+ * QuickJS 引擎池实现
+ */
+
+#include "JsEnginePool.hpp"
+#include <thread>
+#include <cstring>
+
+namespace Reader {
+
+// ============ 构造和析构 ============
+
+JsEnginePool::JsEnginePool(size_t size, size_t memoryLimit)
+    : m_memoryLimit(memoryLimit)
+    , m_size(0)
+    , m_callbackVersion(0)
+    , m_gcInterval(0)
+    , m_recycleBytes(0)
+    , m_heapPolicyVersion(0)
+{
+    // 预先创建引擎，第一次求值时不再初始化运行时和 java.* 接口
+    resize(size);
+}
+
+JsEnginePool::~JsEnginePool() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& slot : m_slots) {
+        delete slot.engine;
+        slot.engine = nullptr;
+    }
+    m_slots.clear();
+    m_idle.clear();
+}
+
+size_t JsEnginePool::defaultSize() {
+    size_t n = std::thread::hardware_concurrency();
+    if (n < 1) n = 1;
+    if (n > 8) n = 8;
+    return n;
+}
+
+size_t JsEnginePool::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_size;
+}
+
+void JsEnginePool::resize(size_t size) {
+    if (size == 0) {
+        size = defaultSize();
+    }
+    
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_size = size;
+    
+    // 扩容：先复用已释放的槽位
+    size_t count = 0;
+    for (const auto& slot : m_slots) {
+        if (slot.engine) count++;
+    }
+    for (size_t i = 0; count < m_size; i++) {
+        if (i == m_slots.size()) {
+            m_slots.push_back(Slot());
+        }
+        Slot& slot = m_slots[i];
+        if (slot.engine) {
+            continue;
+        }
+        slot.engine = new QuickJsEngine(m_memoryLimit);
+        slot.busy = false;
+        slot.callbackVersion = 0;
+        slot.heapPolicyVersion = 0;
+        slot.seen.clear();
+        m_idle.push_back(i);
+        count++;
+    }
+    
+    trimLocked();
+    m_cond.notify_all();
+}
+
+void JsEnginePool::trimLocked() {
+    // 缩容：释放超出数量的空闲引擎，借出的引擎归还时再释放
+    size_t count = 0;
+    for (const auto& slot : m_slots) {
+        if (slot.engine) count++;
+    }
+    for (size_t i = m_slots.size(); i > 0 && count > m_size; i--) {
+        Slot& slot = m_slots[i - 1];
+        if (!slot.engine || slot.busy) {
+            continue;
+        }
+        for (auto it = m_idle.begin(); it != m_idle.end(); ++it) {
+            if (*it == i - 1) {
+                m_idle.erase(it);
+                break;
+            }
+        }
+        delete slot.engine;
+        slot.engine = nullptr;
+        count--;
+    }
+}
+
+// ============ 借出和归还 ============
+
+JsEnginePool::Lease JsEnginePool::acquire() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cond.wait(lock, [this] { return !m_idle.empty(); });
+    
+    size_t index = m_idle.back();
+    m_idle.pop_back();
+    
+    Slot& slot = m_slots[index];
+    QuickJsEngine* engine = slot.engine;
+    slot.busy = true;
+    slot.seen = m_variables;
+    std::map<std::string, std::string> vars = m_variables;
+    
+    bool updateCallback = slot.callbackVersion != m_callbackVersion;
+    HttpCallback httpCallback;
+    AsyncHttpCallback asyncHttpCallback;
+    LogCallback logCallback;
+    if (updateCallback) {
+        httpCallback = m_httpCallback;
+        asyncHttpCallback = m_asyncHttpCallback;
+        logCallback = m_logCallback;
+        slot.callbackVersion = m_callbackVersion;
+    }
+    lock.unlock();
+    
+    // 引擎已被独占，以下操作不需要持锁
+    engine->attachThread();
+    if (updateCallback) {
+        engine->setHttpCallback(httpCallback);
+        engine->setAsyncHttpCallback(asyncHttpCallback);
+        engine->setLogCallback(logCallback);
+    }
+    for (const auto& var : vars) {
+        engine->setVariable(var.first, var.second);
+    }
+    
+    return Lease(this, index, engine);
+}
+
+void JsEnginePool::release(size_t index) {
+    QuickJsEngine* engine;
+    std::map<std::string, std::string> seen;
+    bool updateHeapPolicy;
+    unsigned gcInterval;
+    size_t recycleBytes;
+    {
+        // resize 可能使 m_slots 重新分配，槽位只在锁内访问
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Slot& slot = m_slots[index];
+        engine = slot.engine;
+        seen.swap(slot.seen);
+        updateHeapPolicy = slot.heapPolicyVersion != m_heapPolicyVersion;
+        gcInterval = m_gcInterval;
+        recycleBytes = m_recycleBytes;
+        slot.heapPolicyVersion = m_heapPolicyVersion;
+    }
+    
+    // 找出本次求值中 java.put 或 setVariable 修改过的变量
+    std::map<std::string, std::string> changed;
+    for (const auto& var : engine->getVariables()) {
+        auto it = seen.find(var.first);
+        if (it == seen.end() || it->second != var.second) {
+            changed[var.first] = var.second;
+        }
+    }
+    engine->resetState();
+    
+    // 变量已清除，此时 GC 或重建运行时不会丢失状态
+    if (updateHeapPolicy) {
+        engine->setHeapPolicy(gcInterval, recycleBytes);
+    }
+    engine->idle();
+    
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& var : changed) {
+        m_variables[var.first] = std::move(var.second);
+    }
+    
+    Slot& slot = m_slots[index];
+    slot.busy = false;
+    m_idle.push_back(index);
+    trimLocked();
+    m_cond.notify_one();
+}
+
+JsEnginePool::Lease::Lease(JsEnginePool* pool, size_t slot, QuickJsEngine* engine)
+    : m_pool(pool)
+    , m_slot(slot)
+    , m_engine(engine)
+{
+}
+
+JsEnginePool::Lease::Lease(Lease&& other) noexcept
+    : m_pool(other.m_pool)
+    , m_slot(other.m_slot)
+    , m_engine(other.m_engine)
+{
+    other.m_pool = nullptr;
+    other.m_engine = nullptr;
+}
+
+JsEnginePool::Lease::~Lease() {
+    if (m_pool) {
+        m_pool->release(m_slot);
+    }
+}
+
+// ============ 共享状态 ============
+
+void JsEnginePool::setHttpCallback(HttpCallback callback) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_httpCallback = callback;
+    m_callbackVersion++;
+}
+
+void JsEnginePool::setAsyncHttpCallback(AsyncHttpCallback callback) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_asyncHttpCallback = callback;
+    m_callbackVersion++;
+}
+
+void JsEnginePool::setLogCallback(LogCallback callback) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_logCallback = callback;
+    m_callbackVersion++;
+}
+
+void JsEnginePool::setVariable(const std::string& name, const std::string& value) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_variables[name] = value;
+}
+
+std::string JsEnginePool::getVariable(const std::string& name) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_variables.find(name);
+    if (it != m_variables.end()) {
+        return it->second;
+    }
+    return "";
+}
+
+// ============ 堆管理 ============
+
+void JsEnginePool::setHeapPolicy(unsigned gcInterval, size_t recycleBytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_gcInterval = gcInterval;
+    m_recycleBytes = recycleBytes;
+    m_heapPolicyVersion++;
+}
+
+JsHeapStats JsEnginePool::getHeapStats() const {
+    JsHeapStats total;
+    memset(&total, 0, sizeof(total));
+    
+    // 只统计空闲引擎，借出的引擎可能正在修改统计
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& slot : m_slots) {
+        if (!slot.engine || slot.busy) {
+            continue;
+        }
+        JsHeapStats stats = slot.engine->getHeapStats();
+        total.usedBytes += stats.usedBytes;
+        total.limitBytes += stats.limitBytes;
+        total.objects += stats.objects;
+        total.strings += stats.strings;
+        total.gcRuns += stats.gcRuns;
+        total.recycles += stats.recycles;
+        if (stats.peakBytes > total.peakBytes) {
+            total.peakBytes = stats.peakBytes;
+        }
+    }
+    return total;
+}
+
+// ============ 字节码缓存 ============
+
+bool JsEnginePool::loadCodeCache(const std::string& path) {
+    std::vector<Lease> leases;
+    size_t count = size();
+    bool ok = true;
+    
+    // 借出全部引擎，保证加载时没有引擎在执行，调用者不能持有租约
+    for (size_t i = 0; i < count; i++) {
+        leases.push_back(acquire());
+    }
+    for (auto& lease : leases) {
+        ok = lease->loadCodeCache(path) && ok;
+    }
+    return ok;
+}
+
+bool JsEnginePool::saveCodeCache(const std::string& path) {
+    // 各个引擎编译过的脚本大致相同，保存一个即可
+    Lease lease = acquire();
+    return lease->saveCodeCache(path);
+}
+
+JsCacheStats JsEnginePool::getCacheStats() const {
+    JsCacheStats total;
+    memset(&total, 0, sizeof(total));
+    
+    // 只统计空闲引擎，借出的引擎可能正在修改统计
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& slot : m_slots) {
+        if (!slot.engine || slot.busy) {
+            continue;
+        }
+        JsCacheStats stats = slot.engine->getCacheStats();
+        total.hits += stats.hits;
+        total.misses += stats.misses;
+        total.diskHits += stats.diskHits;
+        total.evictions += stats.evictions;
+        total.entries += stats.entries;
+    }
+    return total;
+}
+
+} // namespace Reader
@@ -0,0 +1,171 @@
+/**
+ * JsEnginePool.hpp
+ * 
+ * QuickJS 引擎池，供多个线程并发执行书源规则
+ * 
+ * 一个 JSRuntime 不能被多个线程同时使用，单个引擎会把并发的搜索、
+ * 目录和正文解析串行化。引擎池预先创建 N 个引擎（各自注册好 java.* 接口），
+ * 每次求值借出一个，用完归还。
+ */
+
+#ifndef JS_ENGINE_POOL_HPP
+#define JS_ENGINE_POOL_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+#include "QuickJsEngine.hpp"
+
+namespace Reader {
+
+/**
+ * 引擎池
+ * 
+ * 变量隔离：
+ * - 借出时把池中的共享变量（setVariable / java.put 写入的）同步到引擎
+ * - 归还时把本次修改过的变量合并回池中，再清除引擎上的变量和 result
+ * 因此并发的求值之间互不可见 result 等临时状态，而 java.put 的值对之后的求值依然可见
+ * 
+ * 归还是引擎的空闲时机，按堆策略 GC，堆过大时重建运行时，共享变量在下次借出时重新同步
+ */
+class JsEnginePool {
+public:
+    class Lease;
+    
+    /**
+     * 构造函数
+     * @param size 引擎数量，0 表示按 CPU 核数决定
+     * @param memoryLimit 每个引擎的内存限制（字节）
+     */
+    explicit JsEnginePool(size_t size = 0, size_t memoryLimit = 16 * 1024 * 1024);
+    
+    /**
+     * 析构函数，调用前所有借出的引擎必须已归还
+     */
+    ~JsEnginePool();
+    
+    // 禁止拷贝
+    JsEnginePool(const JsEnginePool&) = delete;
+    JsEnginePool& operator=(const JsEnginePool&) = delete;
+    
+    /**
+     * 借出一个引擎，池中没有空闲引擎时等待
+     * @return 引擎租约，析构时自动归还
+     */
+    Lease acquire();
+    
+    /**
+     * 调整引擎数量，缩小时多余的引擎在归还后释放
+     * @param size 引擎数量，0 表示按 CPU 核数决定
+     */
+    void resize(size_t size);
+    
+    /**
+     * 获取引擎数量
+     */
+    size_t size() const;
+    
+    /**
+     * 默认引擎数量：CPU 核数，限制在 1 到 8 之间
+     */
+    static size_t defaultSize();
+    
+    // ============ 共享状态 ============
+    
+    void setHttpCallback(HttpCallback callback);
+    void setAsyncHttpCallback(AsyncHttpCallback callback);
+    void setLogCallback(LogCallback callback);
+    
+    void setVariable(const std::string& name, const std::string& value);
+    std::string getVariable(const std::string& name) const;
+    
+    /**
+     * 加载字节码缓存到每个引擎（字节码属于各自的运行时，不能共享）
+     */
+    bool loadCodeCache(const std::string& path);
+    
+    /**
+     * 保存其中一个空闲引擎的字节码缓存
+     */
+    bool saveCodeCache(const std::string& path);
+    
+    /**
+     * 所有引擎字节码缓存统计之和
+     */
+    JsCacheStats getCacheStats() const;
+    
+    // ============ 堆管理 ============
+    
+    /**
+     * 设置每个引擎的堆策略，见 QuickJsEngine::setHeapPolicy，引擎下次归还时生效
+     */
+    void setHeapPolicy(unsigned gcInterval, size_t recycleBytes);
+    
+    /**
+     * 所有空闲引擎的堆统计：内存和计数为总和，峰值为最大值
+     */
+    JsHeapStats getHeapStats() const;
+    
+    /**
+     * 引擎租约，持有期间独占一个引擎
+     */
+    class Lease {
+    public:
+        Lease(Lease&& other) noexcept;
+        ~Lease();
+        
+        Lease(const Lease&) = delete;
+        Lease& operator=(const Lease&) = delete;
+        Lease& operator=(Lease&&) = delete;
+        
+        QuickJsEngine* operator->() const { return m_engine; }
+        QuickJsEngine& operator*() const { return *m_engine; }
+        QuickJsEngine* get() const { return m_engine; }
+        
+    private:
+        friend class JsEnginePool;
+        Lease(JsEnginePool* pool, size_t slot, QuickJsEngine* engine);
+        
+        JsEnginePool* m_pool;
+        size_t m_slot;
+        QuickJsEngine* m_engine;
+    };
+
+private:
+    struct Slot {
+        QuickJsEngine* engine;
+        bool busy;
+        unsigned callbackVersion;                   // 已应用到引擎的回调版本
+        unsigned heapPolicyVersion;                 // 已应用到引擎的堆策略版本
+        std::map<std::string, std::string> seen;    // 借出时同步的共享变量
+    };
+    
+    size_t m_memoryLimit;
+    size_t m_size;
+    std::vector<Slot> m_slots;
+    std::vector<size_t> m_idle;
+    
+    HttpCallback m_httpCallback;
+    AsyncHttpCallback m_asyncHttpCallback;
+    LogCallback m_logCallback;
+    unsigned m_callbackVersion;
+    
+    unsigned m_gcInterval;
+    size_t m_recycleBytes;
+    unsigned m_heapPolicyVersion;
+    
+    std::map<std::string, std::string> m_variables;
+    
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+    
+    void release(size_t slot);
+    void trimLocked();
+};
+
+} // namespace Reader
+
+#endif // JS_ENGINE_POOL_HPP
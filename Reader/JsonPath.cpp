@@ -0,0 +1,723 @@
+#include "framework.h"
+#include "JsonPath.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CACHED_PATH     1024
+
+HANDLE JsonPath::s_hMutex = CreateMutex(NULL, FALSE, NULL);
+std::map<std::string, std::shared_ptr<JsonPath>> JsonPath::s_Cache;
+
+JsonPath::JsonPath()
+{
+}
+
+JsonPath::~JsonPath()
+{
+}
+
+static void _skip_space(const char *&p)
+{
+    while (*p == ' ' || *p == '\t')
+        p++;
+}
+
+static BOOL _is_name_char(char c)
+{
+    // utf-8 bytes of cjk member names are accepted too
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || c == '_' || c == '$' || c == '-' || (c & 0x80);
+}
+
+static BOOL _parse_name(const char *&p, std::string &name)
+{
+    const char *s = p;
+
+    while (_is_name_char(*p))
+        p++;
+    name.assign(s, p - s);
+    return !name.empty();
+}
+
+static BOOL _parse_quoted(const char *&p, std::string &str)
+{
+    char quote = *p;
+
+    if (quote != '\'' && quote != '"')
+        return FALSE;
+    p++;
+    str.clear();
+    while (*p && *p != quote)
+    {
+        if (*p == '\\' && p[1])
+            p++;
+        str.push_back(*p++);
+    }
+    if (*p != quote)
+        return FALSE;
+    p++;
+    return TRUE;
+}
+
+static BOOL _parse_int(const char *&p, int &value)
+{
+    char *end = NULL;
+    long v = strtol(p, &end, 10);
+
+    if (end == p)
+        return FALSE;
+    value = (int)v;
+    p = end;
+    return TRUE;
+}
+
+BOOL JsonPath::Compile(const char *path)
+{
+    const char *p = path;
+    step_t step;
+
+    m_Steps.clear();
+    if (!p)
+        return FALSE;
+
+    _skip_space(p);
+    if (*p == '$')
+        p++;
+
+    while (*p)
+    {
+        step.type = STEP_NAME;
+        step.recursive = FALSE;
+        step.names.clear();
+        step.indexes.clear();
+        step.filter.clear();
+        step.has_start = step.has_end = FALSE;
+        step.start = step.end = 0;
+        step.step = 1;
+
+        if (p[0] == '.' && p[1] == '.')
+        {
+            step.recursive = TRUE;
+            p += 2;
+            if (*p == '[')
+            {
+                if (!ParseBracket(p, step))
+                    return FALSE;
+                m_Steps.push_back(step);
+                continue;
+            }
+        }
+        else if (*p == '.')
+        {
+            p++;
+        }
+        else if (*p == '[')
+        {
+            if (!ParseBracket(p, step))
+                return FALSE;
+            m_Steps.push_back(step);
+            continue;
+        }
+        else if (m_Steps.empty() && p == path)
+        {
+            // "data.list" without leading $
+        }
+        else
+        {
+            return FALSE;
+        }
+
+        if (*p == '*')
+        {
+            step.type = STEP_WILDCARD;
+            p++;
+        }
+        else
+        {
+            std::string name;
+            if (!_parse_name(p, name))
+                return FALSE;
+            step.names.push_back(name);
+        }
+        m_Steps.push_back(step);
+    }
+    return TRUE;
+}
+
+BOOL JsonPath::ParseBracket(const char *&p, step_t &step)
+{
+    std::string name;
+    int value;
+
+    p++; // [
+    _skip_space(p);
+
+    if (*p == '*')
+    {
+        step.type = STEP_WILDCARD;
+        p++;
+    }
+    else if (*p == '?')
+    {
+        step.type = STEP_FILTER;
+        p++;
+        if (!ParseFilter(p, step))
+            return FALSE;
+    }
+    else if (*p == '\'' || *p == '"')
+    {
+        step.type = STEP_NAME;
+        for (;;)
+        {
+            if (!_parse_quoted(p, name))
+                return FALSE;
+            step.names.push_back(name);
+            _skip_space(p);
+            if (*p != ',')
+                break;
+            p++;
+            _skip_space(p);
+        }
+    }
+    else
+    {
+        // index, union of indexes or slice
+        step.type = STEP_INDEX;
+        if (*p != ':')
+        {
+            if (!_parse_int(p, value))
+                return FALSE;
+            step.indexes.push_back(value);
+            step.has_start = TRUE;
+            step.start = value;
+        }
+        _skip_space(p);
+        if (*p == ':')
+        {
+            step.type = STEP_SLICE;
+            step.indexes.clear();
+            p++;
+            _skip_space(p);
+            if (_parse_int(p, value))
+            {
+                step.has_end = TRUE;
+                step.end = value;
+            }
+            _skip_space(p);
+            if (*p == ':')
+            {
+                p++;
+                _skip_space(p);
+                if (_parse_int(p, value))
+                    step.step = value;
+                if (step.step == 0)
+                    return FALSE;
+            }
+        }
+        else
+        {
+            while (*p == ',')
+            {
+                p++;
+                _skip_space(p);
+                if (!_parse_int(p, value))
+                    return FALSE;
+                step.indexes.push_back(value);
+                _skip_space(p);
+            }
+        }
+    }
+
+    _skip_space(p);
+    if (*p != ']')
+        return FALSE;
+    p++;
+    return TRUE;
+}
+
+BOOL JsonPath::ParseOperand(const char *&p, operand_t &operand)
+{
+    std::string name;
+    int index;
+    char *end = NULL;
+
+    operand.is_path = FALSE;
+    operand.path.clear();
+    operand.type = cJSON_NULL;
+    operand.str.clear();
+    operand.num = 0;
+
+    _skip_space(p);
+    if (*p == '@')
+    {
+        operand.is_path = TRUE;
+        p++;
+        for (;;)
+        {
+            if (*p == '.')
+            {
+                p++;
+                if (!_parse_name(p, name))
+                    return FALSE;
+                operand.path.push_back(name);
+            }
+            else if (*p == '[')
+            {
+                p++;
+                _skip_space(p);
+                if (*p == '\'' || *p == '"')
+                {
+                    if (!_parse_quoted(p, name))
+                        return FALSE;
+                }
+                else
+                {
+                    if (!_parse_int(p, index))
+                        return FALSE;
+                    // a leading '#' marks an array index
+                    name = "#" + std::to_string(index);
+                }
+                _skip_space(p);
+                if (*p != ']')
+                    return FALSE;
+                p++;
+                operand.path.push_back(name);
+            }
+            else
+            {
+                break;
+            }
+        }
+        return TRUE;
+    }
+    if (*p == '\'' || *p == '"')
+    {
+        operand.type = cJSON_String;
+        return _parse_quoted(p, operand.str);
+    }
+    if (!strncmp(p, "true", 4))
+    {
+        operand.type = cJSON_True;
+        p += 4;
+        return TRUE;
+    }
+    if (!strncmp(p, "false", 5))
+    {
+        operand.type = cJSON_False;
+        p += 5;
+        return TRUE;
+    }
+    if (!strncmp(p, "null", 4))
+    {
+        operand.type = cJSON_NULL;
+        p += 4;
+        return TRUE;
+    }
+    operand.num = strtod(p, &end);
+    if (end == p)
+        return FALSE;
+    operand.type = cJSON_Number;
+    p = end;
+    return TRUE;
+}
+
+BOOL JsonPath::ParseFilter(const char *&p, step_t &step)
+{
+    std::vector<cond_t> term;
+    cond_t cond;
+    BOOL negate;
+
+    _skip_space(p);
+    if (*p != '(')
+        return FALSE;
+    p++;
+
+    for (;;)
+    {
+        _skip_space(p);
+        negate = FALSE;
+        if (*p == '!')
+        {
+            negate = TRUE;
+            p++;
+        }
+        if (!ParseOperand(p, cond.left))
+            return FALSE;
+        _skip_space(p);
+
+        cond.op = negate ? CMP_NOT_EXIST : CMP_EXIST;
+        if (!negate)
+        {
+            if (p[0] == '=' && p[1] == '=')
+                cond.op = CMP_EQ;
+            else if (p[0] == '!' && p[1] == '=')
+                cond.op = CMP_NE;
+            else if (p[0] == '<' && p[1] == '=')
+                cond.op = CMP_LE;
+            else if (p[0] == '>' && p[1] == '=')
+                cond.op = CMP_GE;
+            else if (p[0] == '<')
+                cond.op = CMP_LT;
+            else if (p[0] == '>')
+                cond.op = CMP_GT;
+        }
+        if (cond.op != CMP_EXIST && cond.op != CMP_NOT_EXIST)
+        {
+            p += (cond.op == CMP_LT || cond.op == CMP_GT) ? 1 : 2;
+            if (*p == '=') // === and !==
+                p++;
+            if (!ParseOperand(p, cond.right))
+                return FALSE;
+            _skip_space(p);
+        }
+        else if (!cond.left.is_path)
+        {
+            return FALSE;
+        }
+        term.push_back(cond);
+
+        if (p[0] == '&' && p[1] == '&')
+        {
+            p += 2;
+            continue;
+        }
+        step.filter.push_back(term);
+        term.clear();
+        if (p[0] == '|' && p[1] == '|')
+        {
+            p += 2;
+            continue;
+        }
+        break;
+    }
+
+    if (*p != ')')
+        return FALSE;
+    p++;
+    return TRUE;
+}
+
+static void _collect_descendants(const cJSON *node, std::vector<const cJSON *> &out)
+{
+    const cJSON *child;
+
+    out.push_back(node);
+    if (!cJSON_IsArray(node) && !cJSON_IsObject(node))
+        return;
+    for (child = node->child; child; child = child->next)
+        _collect_descendants(child, out);
+}
+
+static void _children(const cJSON *node, std::vector<const cJSON *> &items)
+{
+    const cJSON *child;
+
+    items.clear();
+    if (!cJSON_IsArray(node) && !cJSON_IsObject(node))
+        return;
+    for (child = node->child; child; child = child->next)
+        items.push_back(child);
+}
+
+void JsonPath::Apply(const step_t &step, const cJSON *node, std::vector<const cJSON *> &out) const
+{
+    std::vector<const cJSON *> items;
+    size_t i;
+    int count, idx;
+
+    switch (step.type)
+    {
+    case STEP_NAME:
+        if (!cJSON_IsObject(node))
+            return;
+        for (i = 0; i < step.names.size(); i++)
+        {
+            const cJSON *child = cJSON_GetObjectItemCaseSensitive(node, step.names[i].c_str());
+            if (child)
+                out.push_back(child);
+        }
+        break;
+
+    case STEP_WILDCARD:
+        _children(node, items);
+        out.insert(out.end(), items.begin(), items.end());
+        break;
+
+    case STEP_INDEX:
+        if (!cJSON_IsArray(node))
+            return;
+        // cJSON_GetArrayItem walks the list, take all children once
+        _children(node, items);
+        count = (int)items.size();
+        for (i = 0; i < step.indexes.size(); i++)
+        {
+            idx = step.indexes[i] < 0 ? count + step.indexes[i] : step.indexes[i];
+            if (idx >= 0 && idx < count)
+                out.push_back(items[idx]);
+        }
+        break;
+
+    case STEP_SLICE:
+    {
+        int start, end;
+
+        if (!cJSON_IsArray(node))
+            return;
+        _children(node, items);
+        count = (int)items.size();
+        if (step.step > 0)
+        {
+            start = step.has_start ? step.start : 0;
+            end = step.has_end ? step.end : count;
+        }
+        else
+        {
+            start = step.has_start ? step.start : count - 1;
+            end = step.has_end ? step.end : -count - 1;
+        }
+        if (start < 0)
+            start += count;
+        if (end < 0)
+            end += count;
+        if (step.step > 0)
+        {
+            if (start < 0)
+                start = 0;
+            if (end > count)
+                end = count;
+            for (idx = start; idx < end; idx += step.step)
+                out.push_back(items[idx]);
+        }
+        else
+        {
+            if (start > count - 1)
+                start = count - 1;
+            if (end < -1)
+                end = -1;
+            for (idx = start; idx > end; idx += step.step)
+                out.push_back(items[idx]);
+        }
+        break;
+    }
+
+    case STEP_FILTER:
+        _children(node, items);
+        for (i = 0; i < items.size(); i++)
+        {
+            if (Match(step.filter, items[i]))
+                out.push_back(items[i]);
+        }
+        break;
+    }
+}
+
+const cJSON *JsonPath::Resolve(const operand_t &operand, const cJSON *item)
+{
+    size_t i;
+
+    for (i = 0; item && i < operand.path.size(); i++)
+    {
+        const std::string &name = operand.path[i];
+        if (name[0] == '#' && cJSON_IsArray(item))
+            item = cJSON_GetArrayItem(item, atoi(name.c_str() + 1));
+        else if (cJSON_IsObject(item))
+            item = cJSON_GetObjectItemCaseSensitive(item, name.c_str());
+        else
+            item = NULL;
+    }
+    return item;
+}
+
+BOOL JsonPath::Compare(const cond_t &cond, const cJSON *item) const
+{
+    const cJSON *left = Resolve(cond.left, item);
+    const cJSON *right = NULL;
+    int ltype, rtype, cmp;
+    double lnum = 0, rnum = 0;
+    const char *lstr = NULL, *rstr = NULL;
+
+    if (cond.op == CMP_EXIST)
+        return left && !cJSON_IsNull(left) && !cJSON_IsFalse(left);
+    if (cond.op == CMP_NOT_EXIST)
+        return !left || cJSON_IsNull(left) || cJSON_IsFalse(left);
+    if (!left)
+        return cond.op == CMP_NE;
+
+    ltype = left->type & 0xFF;
+    lnum = left->valuedouble;
+    lstr = left->valuestring;
+    if (cond.right.is_path)
+    {
+        right = Resolve(cond.right, item);
+        if (!right)
+            return cond.op == CMP_NE;
+        rtype = right->type & 0xFF;
+        rnum = right->valuedouble;
+        rstr = right->valuestring;
+    }
+    else
+    {
+        rtype = cond.right.type;
+        rnum = cond.right.num;
+        rstr = cond.right.str.c_str();
+    }
+
+    if (ltype == cJSON_Number && rtype == cJSON_Number)
+        cmp = lnum < rnum ? -1 : (lnum > rnum ? 1 : 0);
+    else if (ltype == cJSON_String && rtype == cJSON_String)
+        cmp = strcmp(lstr ? lstr : "", rstr ? rstr : "");
+    else if (ltype == rtype && (ltype == cJSON_True || ltype == cJSON_False || ltype == cJSON_NULL))
+        cmp = 0;
+    else
+        return cond.op == CMP_NE; // different types are never equal
+
+    switch (cond.op)
+    {
+    case CMP_EQ: return cmp == 0;
+    case CMP_NE: return cmp != 0;
+    case CMP_LT: return cmp < 0;
+    case CMP_LE: return cmp <= 0;
+    case CMP_GT: return cmp > 0;
+    case CMP_GE: return cmp >= 0;
+    default: return FALSE;
+    }
+}
+
+BOOL JsonPath::Match(const std::vector<std::vector<cond_t>> &filter, const cJSON *item) const
+{
+    size_t i, j;
+
+    for (i = 0; i < filter.size(); i++)
+    {
+        for (j = 0; j < filter[i].size(); j++)
+        {
+            if (!Compare(filter[i][j], item))
+                break;
+        }
+        if (j == filter[i].size())
+            return TRUE;
+    }
+    return FALSE;
+}
+
+void JsonPath::Select(const cJSON *root, std::vector<const cJSON *> &nodes) const
+{
+    std::vector<const cJSON *> cur, next, scope;
+    size_t i, j;
+
+    nodes.clear();
+    if (!root)
+        return;
+
+    cur.push_back(root);
+    for (i = 0; i < m_Steps.size() && !cur.empty(); i++)
+    {
+        next.clear();
+        for (j = 0; j < cur.size(); j++)
+        {
+            if (m_Steps[i].recursive)
+            {
+                scope.clear();
+                _collect_descendants(cur[j], scope);
+                for (size_t k = 0; k < scope.size(); k++)
+                    Apply(m_Steps[i], scope[k], next);
+            }
+            else
+            {
+                Apply(m_Steps[i], cur[j], next);
+            }
+        }
+        cur.swap(next);
+    }
+    nodes.swap(cur);
+}
+
+std::string JsonPath::ToString(const cJSON *node)
+{
+    std::string text;
+    char *json;
+
+    if (!node)
+        return text;
+    switch (node->type & 0xFF)
+    {
+    case cJSON_String:
+        if (node->valuestring)
+            text = node->valuestring;
+        break;
+    case cJSON_True:
+        text = "true";
+        break;
+    case cJSON_False:
+        text = "false";
+        break;
+    case cJSON_NULL:
+        break;
+    default:
+        json = cJSON_PrintUnformatted(node);
+        if (json)
+        {
+            text = json;
+            free(json);
+        }
+        break;
+    }
+    return text;
+}
+
+void JsonPath::Query(const cJSON *root, std::vector<std::string> &values) const
+{
+    std::vector<const cJSON *> nodes;
+    const cJSON *child;
+    size_t i;
+
+    Select(root, nodes);
+    for (i = 0; i < nodes.size(); i++)
+    {
+        if (cJSON_IsArray(nodes[i]))
+        {
+            for (child = nodes[i]->child; child; child = child->next)
+                values.push_back(ToString(child));
+        }
+        else
+        {
+            values.push_back(ToString(nodes[i]));
+        }
+    }
+}
+
+std::shared_ptr<JsonPath> JsonPath::Get(const std::string &path)
+{
+    std::shared_ptr<JsonPath> jp;
+    std::map<std::string, std::shared_ptr<JsonPath>>::iterator it;
+
+    WaitForSingleObject(s_hMutex, INFINITE);
+    it = s_Cache.find(path);
+    if (it != s_Cache.end())
+    {
+        // NULL is cached too if the path is invalid
+        jp = it->second;
+        ReleaseMutex(s_hMutex);
+        return jp;
+    }
+    ReleaseMutex(s_hMutex);
+
+    jp = std::make_shared<JsonPath>();
+    if (!jp->Compile(path.c_str()))
+        jp.reset();
+
+    WaitForSingleObject(s_hMutex, INFINITE);
+    // rules come from the book sources, the cache only grows with them
+    if (s_Cache.size() >= MAX_CACHED_PATH)
+        s_Cache.clear();
+    s_Cache[path] = jp;
+    ReleaseMutex(s_hMutex);
+    return jp;
+}
+
+void JsonPath::ClearCache(void)
+{
+    WaitForSingleObject(s_hMutex, INFINITE);
+    s_Cache.clear();
+    ReleaseMutex(s_hMutex);
+}
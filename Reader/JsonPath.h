@@ -0,0 +1,101 @@
+#ifndef __JSON_PATH_H__
+#define __JSON_PATH_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include "types.h"
+#include "cJSON.h"
+
+// compiled jsonpath over the cJSON tree, it is used by the legado json rules.
+// supported syntax:
+//   $.a.b  $['a']['b']  $.a[0]  $.a[-1]  $.a[0,2]  $.a[1:5:2]  $.a[*]  $.a.*
+//   $..name  $..[0]
+//   $.a[?(@.price < 10 && @.type == 'x')]  $.a[?(@.isbn)]  $.a[?(!@.isbn)]
+class JsonPath
+{
+public:
+    JsonPath();
+    ~JsonPath();
+
+    BOOL Compile(const char *path);
+
+    // get the matched nodes, they belong to root
+    void Select(const cJSON *root, std::vector<const cJSON *> &nodes) const;
+    // get the matched values as text: string as is, number and bool printed, null is empty,
+    // object as unformatted json, an array is expanded to its items like legado.
+    void Query(const cJSON *root, std::vector<std::string> &values) const;
+
+    // get the compiled path, it is compiled at the first time. NULL if the path is invalid
+    static std::shared_ptr<JsonPath> Get(const std::string &path);
+    static void ClearCache(void);
+
+    static std::string ToString(const cJSON *node);
+
+private:
+    typedef enum step_type_t
+    {
+        STEP_NAME,      // .name or ['a','b']
+        STEP_WILDCARD,  // .* or [*]
+        STEP_INDEX,     // [0] or [0,-1]
+        STEP_SLICE,     // [start:end:step]
+        STEP_FILTER     // [?(expr)]
+    } step_type_t;
+
+    typedef enum cmp_op_t
+    {
+        CMP_EXIST,
+        CMP_NOT_EXIST,
+        CMP_EQ,
+        CMP_NE,
+        CMP_LT,
+        CMP_LE,
+        CMP_GT,
+        CMP_GE
+    } cmp_op_t;
+
+    typedef struct operand_t
+    {
+        BOOL is_path;                   // @.a.b, relative to the current item
+        std::vector<std::string> path;  // member names, a number means array index
+        int type;                       // cJSON_String, cJSON_Number, cJSON_True, cJSON_False or cJSON_NULL
+        std::string str;
+        double num;
+    } operand_t;
+
+    // terms are or-ed, factors of a term are and-ed
+    typedef struct cond_t
+    {
+        operand_t left;
+        cmp_op_t op;
+        operand_t right;
+    } cond_t;
+
+    typedef struct step_t
+    {
+        step_type_t type;
+        BOOL recursive;
+        std::vector<std::string> names;
+        std::vector<int> indexes;
+        BOOL has_start, has_end;
+        int start, end, step;
+        std::vector<std::vector<cond_t>> filter;
+    } step_t;
+
+    BOOL ParseBracket(const char *&p, step_t &step);
+    BOOL ParseFilter(const char *&p, step_t &step);
+    BOOL ParseOperand(const char *&p, operand_t &operand);
+    void Apply(const step_t &step, const cJSON *node, std::vector<const cJSON *> &out) const;
+    BOOL Match(const std::vector<std::vector<cond_t>> &filter, const cJSON *item) const;
+    BOOL Compare(const cond_t &cond, const cJSON *item) const;
+    static const cJSON *Resolve(const operand_t &operand, const cJSON *item);
+
+private:
+    std::vector<step_t> m_Steps;
+
+    static HANDLE s_hMutex;
+    static std::map<std::string, std::shared_ptr<JsonPath>> s_Cache;
+};
+
+#endif // !__JSON_PATH_H__
@@ -3,6 +3,7 @@
 #include "Keyset.h"
 #include "Utils.h"
 #include "LegadoConverter.h"
+#include "BookSourceStore.h"
 #include <stdio.h>
 
 
@@ -601,6 +602,7 @@ class json_header_t
     cJSON* line_indent;
     cJSON* blank_lines;
     cJSON* chapter_page;
+    cJSON* hedged_fetch;
     cJSON* ingore_version;
     cJSON* checkver_time;
     cJSON* global_key;
@@ -619,8 +621,7 @@ class json_header_t
     cJSON* tag_count;
     json_tagitem_t* tags[MAX_TAG_COUNT];
 #endif
-    cJSON* book_source_count;
-    json_book_source_t* book_sources[MAX_BOOKSRC_COUNT];
+    std::vector<json_book_source_t*> book_sources;
 public:
     json_header_t(cJSON* parent, header_t* data)
     {
@@ -657,6 +658,7 @@ public:
         line_indent = cJSON_AddNumberToObject(parent, "line_indent", data->line_indent);
         blank_lines = cJSON_AddNumberToObject(parent, "blank_lines", data->blank_lines);
         chapter_page = cJSON_AddNumberToObject(parent, "chapter_page", data->chapter_page);
+        hedged_fetch = cJSON_AddNumberToObject(parent, "hedged_fetch", data->hedged_fetch);
         ingore_version = cJSON_AddStringToObject(parent, "ingore_version", Utf16ToUtf8(data->ingore_version));
         checkver_time = cJSON_AddULongToObject(parent, "checkver_time", data->checkver_time);
 
@@ -726,15 +728,7 @@ public:
             cJSON_AddItemToArray(array, item);
         }
 #endif
-        memset(book_sources, 0, sizeof(json_book_source_t*) * MAX_BOOKSRC_COUNT);
-        book_source_count = cJSON_AddNumberToObject(parent, "book_source_count", data->book_source_count);
-        array = cJSON_AddArrayToObject(parent, "book_sources");
-        for (i = 0; i < data->book_source_count; i++)
-        {
-            item = cJSON_CreateObject();
-            book_sources[i] = new json_book_source_t(item, &(data->book_sources[i]));
-            cJSON_AddItemToArray(array, item);
-        }
+        // the book sources are saved by BookSourceStore in their own file
     }
     json_header_t(cJSON* parent) // for json parser
         : placement(NULL)
@@ -780,6 +774,7 @@ public:
         line_indent = cJSON_GetObjectItem(parent, "line_indent");
         blank_lines = cJSON_GetObjectItem(parent, "blank_lines");
         chapter_page = cJSON_GetObjectItem(parent, "chapter_page");
+        hedged_fetch = cJSON_GetObjectItem(parent, "hedged_fetch");
         ingore_version = cJSON_GetObjectItem(parent, "ingore_version");
         checkver_time = cJSON_GetObjectItem(parent, "checkver_time");
 
@@ -850,8 +845,7 @@ public:
             }
         }
 #endif
-        book_source_count = cJSON_GetObjectItem(parent, "book_source_count");
-        memset(book_sources, 0, sizeof(json_book_source_t*) * MAX_BOOKSRC_COUNT);
+        // the book sources of old versions, they are moved to BookSourceStore
         array = cJSON_GetObjectItem(parent, "book_sources");
         if (array)
         {
@@ -860,7 +854,7 @@ public:
             {
                 item = cJSON_GetArrayItem(array, i);
                 if (item)
-                    book_sources[i] = new json_book_source_t(item);
+                    book_sources.push_back(new json_book_source_t(item));
             }
         }
     }
@@ -898,11 +892,8 @@ public:
                 delete tags[i];
         }
 #endif
-        for (i = 0; i < MAX_BOOKSRC_COUNT; i++)
-        {
-            if (book_sources[i])
-                delete book_sources[i];
-        }
+        for (i = 0; i < (int)book_sources.size(); i++)
+            delete book_sources[i];
     }
     void GetData(header_t* data)
     {
@@ -967,6 +958,8 @@ public:
             data->blank_lines = blank_lines->valueint;
         if (chapter_page)
             data->chapter_page = chapter_page->valueint;
+        if (hedged_fetch)
+            data->hedged_fetch = hedged_fetch->valueint;
         if (ingore_version)
             wcscpy(data->ingore_version, Utf8ToUtf16(ingore_version->valuestring));
         if (checkver_time)
@@ -1022,12 +1015,15 @@ public:
                 tags[i]->GetData(&(data->tags[i]));
         }
 #endif
-        if (book_source_count)
-            data->book_source_count = book_source_count->valueint;
-        for (i = 0; i < data->book_source_count; i++)
+        // the book sources of old versions are moved to BookSourceStore once, when its file
+        // doesn't exist yet. they are not written to the header again.
+        if (!BookSourceStore::Instance()->ShouldMigrate())
+            return;
+        for (i = 0; i < (int)book_sources.size(); i++)
         {
-            if (book_sources[i])
-                book_sources[i]->GetData(&(data->book_sources[i]));
+            book_source_t bs = { 0 };
+            book_sources[i]->GetData(&bs);
+            BookSourceStore::Instance()->Add(&bs);
         }
     }
 };
@@ -1204,18 +1200,21 @@ BOOL parser_json(const char* json, header_t* defhdr, void** data, int* size)
     return TRUE;
 }
 
-BOOL import_book_source(const char* json, book_source_t *bs, int* count)
+BOOL import_book_source(const char* json, std::vector<book_source_t*>& bs, legado_progress_t progress, void* param)
 {
     cJSON* root, * book_sources, * item;
     json_book_source_t* json_bs;
+    book_source_t* data;
     int i;
 
     // 首先检查是否为 Legado 格式
     if (is_legado_format(json))
     {
         legado_convert_result_t result;
-        if (convert_legado_to_reader(json, bs, count, &result))
+        if (convert_legado_pack(json, bs, progress, param, &result))
         {
+            logger_printk("legado pack imported, succ: %d, failed: %d, skipped: %d, duplicate: %d",
+                result.success_count, result.failed_count, result.skipped_count, result.duplicate_count);
             return TRUE;
         }
         // 如果 Legado 转换失败，继续尝试 Reader 原生格式
@@ -1228,21 +1227,22 @@ BOOL import_book_source(const char* json, book_source_t *bs, int* count)
     }
 
     book_sources = cJSON_GetObjectItem(root, "book_sources");
-    if (!book_sources || cJSON_GetArraySize(book_sources) <= 0 || cJSON_GetArraySize(book_sources) > MAX_BOOKSRC_COUNT)
+    if (!book_sources || cJSON_GetArraySize(book_sources) <= 0)
     {
         cJSON_Delete(root);
         return FALSE;
     }
 
-    *count = 0;
     for (i = 0; i < cJSON_GetArraySize(book_sources); i++)
     {
         item = cJSON_GetArrayItem(book_sources, i);
         if (item)
         {
+            data = new book_source_t;
+            memset(data, 0, sizeof(book_source_t));
             json_bs = new json_book_source_t(item);
-            json_bs->GetData(&(bs[i]));
-            (*count)++;
+            json_bs->GetData(data);
+            bs.push_back(data);
             delete json_bs;
         }   
     }
@@ -1250,17 +1250,14 @@ BOOL import_book_source(const char* json, book_source_t *bs, int* count)
     return TRUE;
 }
 
-BOOL export_book_source(const book_source_t* bs, int count, char** json)
+BOOL export_book_source(char** json)
 {
     cJSON* root, * book_sources, * item;
     json_book_source_t* json_bs;
-    int i;
+    int i, count;
 
     *json = NULL;
-    if (!bs || count < 0 || count > MAX_BOOKSRC_COUNT)
-    {
-        return FALSE;
-    }
+    count = BookSourceStore::Instance()->Count();
 
     root = cJSON_CreateObject();
     book_sources = cJSON_AddArrayToObject(root, "book_sources");
@@ -1268,7 +1265,7 @@ BOOL export_book_source(const book_source_t* bs, int count, char** json)
     for (i = 0; i < count; i++)
     {
         item = cJSON_CreateObject();
-        json_bs = new json_book_source_t(item, &(bs[i]));
+        json_bs = new json_book_source_t(item, BookSourceStore::Instance()->Get(i));
         cJSON_AddItemToArray(book_sources, item);
         delete json_bs;
     }
@@ -1283,4 +1280,37 @@ void export_book_source_free(char* json)
 {
     if (json)
         free(json);
+}
+
+cJSON* book_source_to_json(const book_source_t* bs, BOOL compact)
+{
+    cJSON* item = cJSON_CreateObject();
+    cJSON* child, * next;
+    json_book_source_t* json_bs;
+
+    json_bs = new json_book_source_t(item, bs);
+    delete json_bs;
+    if (compact)
+    {
+        // most of the rules are empty, they are dropped and the parser keeps them 0
+        child = item->child;
+        while (child)
+        {
+            next = child->next;
+            if ((cJSON_IsString(child) && (!child->valuestring || !child->valuestring[0]))
+                || (cJSON_IsNumber(child) && child->valueint == 0))
+                cJSON_Delete(cJSON_DetachItemViaPointer(item, child));
+            child = next;
+        }
+    }
+    return item;
+}
+
+void book_source_from_json(cJSON* item, book_source_t* bs)
+{
+    json_book_source_t* json_bs;
+
+    json_bs = new json_book_source_t(item);
+    json_bs->GetData(bs);
+    delete json_bs;
 }
\ No newline at end of file
@@ -1,14 +1,24 @@
 #ifndef __JSON_DATA_H__
 #define __JSON_DATA_H__
 
+#include <vector>
 #include "types.h"
+#include "LegadoConverter.h"
 
 char* create_json(header_t* data);
 void create_json_free(char* json);
 BOOL parser_json(const char* json, header_t* defhdr, void **data, int *size);
 
-BOOL import_book_source(const char *json, book_source_t *bs, int *count);
-BOOL export_book_source(const book_source_t *bs, int count, char **json);
+// the sources are allocated by new and appended to bs, the caller owns them.
+// a legado pack is converted in parallel, progress is reported for it only
+BOOL import_book_source(const char *json, std::vector<book_source_t*> &bs, legado_progress_t progress = NULL, void *param = NULL);
+// all the sources of BookSourceStore
+BOOL export_book_source(char **json);
 void export_book_source_free(char* json);
 
+// a book source as a json object, the compact one has the non-empty fields only
+struct cJSON* book_source_to_json(const book_source_t *bs, BOOL compact);
+// the fields which are not found are kept, bs should be zeroed
+void book_source_from_json(struct cJSON *item, book_source_t *bs);
+
 #endif
\ No newline at end of file
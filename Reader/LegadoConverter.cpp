@@ -18,9 +18,18 @@
 #include "cJSON.h"
 #include "LegadoConverter.h"
 #include "Utils.h"
+#include "libxml/xpath.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <process.h>
+#include <map>
+#include <string>
+#include <regex>
+
+#define MAX_CONVERT_THREAD      8   // 批量导入的最大转换线程数
+#define CONVERT_PER_THREAD      16  // 每个线程至少分到的书源数量
+#define PROGRESS_INTERVAL       100 // ms, 进度回调的间隔
 
 // 检查规则是否包含不支持的 JS
 static BOOL contains_js(const char* rule)
@@ -458,43 +467,121 @@ BOOL parse_legado_search_url(const char* search_url, char* query_url, int* query
     return TRUE;
 }
 
+// 跳过空白和 UTF-8 BOM
+static const char* skip_space(const char* p)
+{
+    if ((unsigned char)p[0] == 0xEF && (unsigned char)p[1] == 0xBB && (unsigned char)p[2] == 0xBF)
+        p += 3;
+    while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+        p++;
+    return p;
+}
+
+// 找到从 p ('{' 或 '[') 开始的 JSON 值的结尾, 只数字符串以外的括号, 不做解析
+// 返回值之后的位置, 不完整时返回 NULL
+static const char* find_value_end(const char* p)
+{
+    int depth = 0;
+    BOOL in_string = FALSE;
+    
+    for (; *p; p++)
+    {
+        if (in_string)
+        {
+            if (*p == '\\' && p[1])
+                p++;
+            else if (*p == '"')
+                in_string = FALSE;
+            continue;
+        }
+        if (*p == '"')
+            in_string = TRUE;
+        else if (*p == '{' || *p == '[')
+            depth++;
+        else if (*p == '}' || *p == ']')
+        {
+            if (--depth == 0)
+                return p + 1;
+        }
+    }
+    return NULL;
+}
+
+// 流式扫描书源包, 找出顶层每个书源对象的起始位置 (数组的元素, 或单个对象本身)
+// 整个包不会被一次解析成 cJSON 树, 每个书源由转换线程单独解析
+static BOOL scan_legado_pack(const char* json, std::vector<const char*>& sources)
+{
+    const char* p = skip_space(json);
+    const char* end;
+    
+    if (*p == '{')
+    {
+        sources.push_back(p);
+        return TRUE;
+    }
+    if (*p != '[')
+        return FALSE;
+    
+    p = skip_space(p + 1);
+    while (*p == '{')
+    {
+        end = find_value_end(p);
+        if (!end)
+            break; // 文件被截断, 保留前面完整的书源
+        sources.push_back(p);
+        p = skip_space(end);
+        if (*p == ',')
+            p = skip_space(p + 1);
+    }
+    return *p == ']' || !sources.empty();
+}
+
 // 检测是否为 Legado 格式
+// 只解析第一个书源, 书源包可能有几千个书源
 BOOL is_legado_format(const char* json)
 {
-    if (!json)
-        return FALSE;
+    std::vector<const char*> sources;
+    const char* p;
     
-    cJSON* root = cJSON_Parse(json);
-    if (!root)
+    if (!json)
         return FALSE;
     
-    BOOL is_legado = FALSE;
-    
-    // Legado 格式是数组，每个元素有 bookSourceUrl 字段
-    if (cJSON_IsArray(root))
+    p = skip_space(json);
+    if (*p == '[')
     {
-        cJSON* first = cJSON_GetArrayItem(root, 0);
-        if (first)
-        {
-            cJSON* url = cJSON_GetObjectItem(first, "bookSourceUrl");
-            cJSON* name = cJSON_GetObjectItem(first, "bookSourceName");
-            if (url && name)
-                is_legado = TRUE;
-        }
+        p = skip_space(p + 1);
+        if (*p != '{')
+            return FALSE;
     }
-    // 也可能是单个书源对象
-    else if (cJSON_IsObject(root))
+    else if (*p != '{')
     {
-        cJSON* url = cJSON_GetObjectItem(root, "bookSourceUrl");
-        cJSON* name = cJSON_GetObjectItem(root, "bookSourceName");
-        if (url && name)
-            is_legado = TRUE;
+        return FALSE;
     }
     
-    cJSON_Delete(root);
+    cJSON* first = cJSON_ParseWithOpts(p, NULL, FALSE);
+    if (!first)
+        return FALSE;
+    
+    BOOL is_legado = FALSE;
+    
+    // Legado 格式是数组，每个元素有 bookSourceUrl 字段，也可能是单个书源对象
+    cJSON* url = cJSON_GetObjectItem(first, "bookSourceUrl");
+    cJSON* name = cJSON_GetObjectItem(first, "bookSourceName");
+    if (url && name)
+        is_legado = TRUE;
+    
+    cJSON_Delete(first);
     return is_legado;
 }
 
+// UTF-8 转为宽字符, 超长时截断
+// Utf8ToUtf16 共用一个缓冲区, 而书源是并行转换的
+static void utf8_to_wcs(const char* str, wchar_t* out, int max_len)
+{
+    if (MultiByteToWideChar(CP_UTF8, 0, str, -1, out, max_len) == 0)
+        out[max_len - 1] = L'\0';
+}
+
 // 转换单个 Legado 书源
 static BOOL convert_single_legado_source(cJSON* source, book_source_t* bs)
 {
@@ -523,15 +610,19 @@ static BOOL convert_single_legado_source(cJSON* source, book_source_t* bs)
     
     // 设置书源名称
     if (name->valuestring)
-        wcscpy(bs->title, Utf8ToUtf16(name->valuestring));
+        utf8_to_wcs(name->valuestring, bs->title, sizeof(bs->title) / sizeof(bs->title[0]));
     
     // 设置 host
-    if (url->valuestring)
-        strcpy(bs->host, url->valuestring);
+    if (!url->valuestring || !url->valuestring[0] || strlen(url->valuestring) >= sizeof(bs->host))
+        return FALSE;
+    strcpy(bs->host, url->valuestring);
     
     // 解析搜索 URL
     if (search_url->valuestring)
     {
+        // 超长的 URL 放不进 query_url
+        if (strlen(search_url->valuestring) >= sizeof(bs->query_url))
+            return FALSE;
         if (!parse_legado_search_url(search_url->valuestring, bs->query_url, 
                                       &bs->query_method, bs->query_params, &bs->query_charset))
             return FALSE;
@@ -553,11 +644,11 @@ static BOOL convert_single_legado_source(cJSON* source, book_source_t* bs)
             if (book_list && book_list->valuestring)
             {
                 // 组合 bookList 和 name 规则
-                sprintf(combined_rule, "%s", book_name->valuestring);
+                strncpy(combined_rule, book_name->valuestring, sizeof(combined_rule) - 1);
             }
             else
             {
-                strcpy(combined_rule, book_name->valuestring);
+                strncpy(combined_rule, book_name->valuestring, sizeof(combined_rule) - 1);
             }
             
             if (!convert_legado_rule_to_xpath(combined_rule, bs->book_name_xpath, sizeof(bs->book_name_xpath)))
@@ -648,7 +739,8 @@ static BOOL convert_single_legado_source(cJSON* source, book_source_t* bs)
         if (replace_regex && replace_regex->valuestring && strlen(replace_regex->valuestring) > 0)
         {
             bs->content_filter_type = 2; // 正则表达式
-            wcscpy(bs->content_filter_keyword, Utf8ToUtf16(replace_regex->valuestring));
+            utf8_to_wcs(replace_regex->valuestring, bs->content_filter_keyword,
+                sizeof(bs->content_filter_keyword) / sizeof(bs->content_filter_keyword[0]));
         }
     }
     
@@ -670,76 +762,223 @@ static BOOL convert_single_legado_source(cJSON* source, book_source_t* bs)
     return TRUE;
 }
 
-// 转换 Legado 书源为 Reader 格式
-BOOL convert_legado_to_reader(const char* json, book_source_t* bs, int* count, legado_convert_result_t* result)
+// 校验转换出的 XPath 能否编译
+static BOOL validate_xpath(const char* xpath)
 {
-    if (!json || !bs || !count)
+    xmlXPathCompExprPtr comp;
+    
+    if (!xpath[0])
+        return TRUE;
+    comp = xmlXPathCompile(BAD_CAST xpath);
+    if (!comp)
+        return FALSE;
+    xmlXPathFreeCompExpr(comp);
+    return TRUE;
+}
+
+// 校验转换后的书源, 与书源对话框的检查一致: 必填项不能为空, XPath 和正则必须能编译
+static BOOL validate_book_source(book_source_t* bs)
+{
+    const char* xpaths[] = {
+        bs->book_name_xpath, bs->book_mainpage_xpath, bs->book_author_xpath,
+        bs->chapter_page_xpath, bs->chapter_title_xpath, bs->chapter_url_xpath,
+        bs->chapter_next_url_xpath, bs->content_xpath, bs->content_next_url_xpath
+    };
+    int i;
+    
+    if (!bs->title[0] || !bs->host[0] || !bs->query_url[0])
         return FALSE;
+    if (!bs->book_name_xpath[0] || !bs->book_mainpage_xpath[0])
+        return FALSE;
+    if (!bs->chapter_title_xpath[0] || !bs->chapter_url_xpath[0] || !bs->content_xpath[0])
+        return FALSE;
+    if (bs->query_method != 0 && !bs->query_params[0])
+        return FALSE;
+    
+    for (i = 0; i < (int)(sizeof(xpaths) / sizeof(xpaths[0])); i++)
+    {
+        if (!validate_xpath(xpaths[i]))
+            return FALSE;
+    }
+    
+    // 正文过滤的正则无效时只关闭过滤, 不丢弃书源
+    if (bs->content_filter_type == 2)
+    {
+        try
+        {
+            std::wregex e(bs->content_filter_keyword);
+        }
+        catch (...)
+        {
+            bs->content_filter_type = 0;
+            bs->content_filter_keyword[0] = L'\0';
+        }
+    }
+    return TRUE;
+}
+
+typedef enum convert_state_t
+{
+    cs_succ = 0,
+    cs_skipped,     // 不兼容 (JS 规则, 非文本书源, 已禁用)
+    cs_failed       // 解析失败或校验失败
+} convert_state_t;
+
+typedef struct legado_pack_t
+{
+    std::vector<const char*> sources;   // 每个书源对象在 json 中的起始位置
+    std::vector<book_source_t*> results;
+    std::vector<char> states;
+    volatile LONG next;
+    volatile LONG done;
+} legado_pack_t;
+
+static unsigned __stdcall convert_legado_thread(void* param)
+{
+    legado_pack_t* pack = (legado_pack_t*)param;
+    book_source_t* bs = NULL;
+    cJSON* item;
+    LONG idx;
+    
+    while ((idx = InterlockedIncrement(&pack->next) - 1) < (LONG)pack->sources.size())
+    {
+        if (!bs)
+            bs = new book_source_t;
+        
+        // 只解析这一个对象, 解析到对象结尾即停止
+        item = cJSON_ParseWithOpts(pack->sources[idx], NULL, FALSE);
+        if (!item)
+        {
+            pack->states[idx] = cs_failed;
+        }
+        else
+        {
+            if (!convert_single_legado_source(item, bs))
+            {
+                pack->states[idx] = cs_skipped;
+            }
+            else if (!validate_book_source(bs))
+            {
+                pack->states[idx] = cs_failed;
+            }
+            else
+            {
+                pack->states[idx] = cs_succ;
+                pack->results[idx] = bs;
+                bs = NULL;
+            }
+            cJSON_Delete(item);
+        }
+        InterlockedIncrement(&pack->done);
+    }
+    if (bs)
+        delete bs;
+    return 0;
+}
+
+// 批量转换 Legado 书源包
+BOOL convert_legado_pack(const char* json, std::vector<book_source_t*>& bs, legado_progress_t progress, void* param, legado_convert_result_t* result)
+{
+    legado_pack_t pack;
+    HANDLE threads[MAX_CONVERT_THREAD] = { 0 };
+    std::map<std::string, size_t> hosts;
+    std::map<std::string, size_t>::iterator it;
+    SYSTEM_INFO si;
+    unsigned threadID;
+    int thread_count = 0;
+    int total, i;
     
     if (result)
     {
         memset(result, 0, sizeof(legado_convert_result_t));
     }
     
-    *count = 0;
+    if (!json)
+        return FALSE;
     
-    cJSON* root = cJSON_Parse(json);
-    if (!root)
+    if (!scan_legado_pack(json, pack.sources) || pack.sources.empty())
     {
         if (result)
             strcpy(result->error_msg, "JSON parse error");
         return FALSE;
     }
     
-    // 处理数组格式
-    if (cJSON_IsArray(root))
+    total = (int)pack.sources.size();
+    pack.results.resize(total, NULL);
+    pack.states.resize(total, cs_failed);
+    pack.next = 0;
+    pack.done = 0;
+    
+    // 书源之间互不依赖, 按 CPU 数量并行转换
+    GetSystemInfo(&si);
+    thread_count = (int)si.dwNumberOfProcessors;
+    if (thread_count > total / CONVERT_PER_THREAD)
+        thread_count = total / CONVERT_PER_THREAD;
+    if (thread_count > MAX_CONVERT_THREAD)
+        thread_count = MAX_CONVERT_THREAD;
+    for (i = 0; i < thread_count; i++)
     {
-        int array_size = cJSON_GetArraySize(root);
-        for (int i = 0; i < array_size && *count < MAX_BOOKSRC_COUNT; i++)
+        threads[i] = (HANDLE)_beginthreadex(NULL, 0, convert_legado_thread, &pack, 0, &threadID);
+        if (!threads[i])
+            break;
+    }
+    thread_count = i;
+    
+    if (thread_count == 0)
+    {
+        // 书源很少, 或者创建线程失败, 在当前线程转换
+        convert_legado_thread(&pack);
+    }
+    else
+    {
+        while (WAIT_TIMEOUT == WaitForMultipleObjects(thread_count, threads, TRUE, PROGRESS_INTERVAL))
         {
-            cJSON* item = cJSON_GetArrayItem(root, i);
-            if (item)
-            {
-                if (convert_single_legado_source(item, &bs[*count]))
-                {
-                    (*count)++;
-                    if (result)
-                        result->success_count++;
-                }
-                else
-                {
-                    if (result)
-                        result->skipped_count++;
-                }
-            }
+            if (progress)
+                progress(pack.done, total, param);
         }
+        for (i = 0; i < thread_count; i++)
+            CloseHandle(threads[i]);
     }
-    // 处理单个对象格式
-    else if (cJSON_IsObject(root))
+    if (progress)
+        progress(total, total, param);
+    
+    // 按 bookSourceUrl 去重, 保留第一次出现的位置, 后出现的书源覆盖前面的 (与 Legado 的导入一致)
+    for (i = 0; i < total; i++)
     {
-        if (convert_single_legado_source(root, &bs[0]))
+        if (pack.states[i] == cs_skipped)
+        {
+            if (result)
+                result->skipped_count++;
+            continue;
+        }
+        if (pack.states[i] == cs_failed)
+        {
+            if (result)
+                result->failed_count++;
+            continue;
+        }
+        it = hosts.find(pack.results[i]->host);
+        if (it != hosts.end())
         {
-            *count = 1;
+            delete bs[it->second];
+            bs[it->second] = pack.results[i];
             if (result)
-                result->success_count = 1;
+                result->duplicate_count++;
         }
         else
         {
+            hosts[pack.results[i]->host] = bs.size();
+            bs.push_back(pack.results[i]);
             if (result)
-                result->skipped_count = 1;
+                result->success_count++;
         }
     }
     
-    cJSON_Delete(root);
-    
-    if (*count > 0)
-    {
-        return TRUE;
-    }
-    else
+    if (bs.empty())
     {
         if (result)
             strcpy(result->error_msg, "No compatible book sources found");
         return FALSE;
     }
+    return TRUE;
 }
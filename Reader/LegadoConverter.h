@@ -1,6 +1,7 @@
 #ifndef __LEGADO_CONVERTER_H__
 #define __LEGADO_CONVERTER_H__
 
+#include <vector>
 #include "types.h"
 
 // Legado 书源转换结果
@@ -9,22 +10,31 @@ typedef struct legado_convert_result_t
     int success_count;      // 成功转换的书源数量
     int failed_count;       // 转换失败的书源数量
     int skipped_count;      // 跳过的书源数量（不兼容）
+    int duplicate_count;    // bookSourceUrl 重复而被覆盖的书源数量
     char error_msg[1024];   // 错误信息
 } legado_convert_result_t;
 
 // 检测是否为 Legado 格式的书源
 BOOL is_legado_format(const char* json);
 
-// 将 Legado 格式的书源转换为 Reader 格式
+// 批量转换的进度回调, 在调用 convert_legado_pack 的线程中调用
+//   done: 已处理的书源数量
+//   total: 书源包中的书源总数
+typedef void (*legado_progress_t)(int done, int total, void* param);
+
+// 将 Legado 格式的书源包转换为 Reader 格式
+// 书源包被流式扫描, 每个书源单独解析, 由多个线程并行转换和校验 (规则分类, XPath 编译),
+// 并按 bookSourceUrl 去重, 书源数量没有上限
 // 参数:
-//   json: Legado 格式的书源 JSON 字符串
-//   bs: 输出的 Reader 书源数组
-//   count: 输出的书源数量
+//   json: Legado 格式的书源 JSON 字符串 (书源数组或单个书源)
+//   bs: 追加转换成功的书源, 由 new 分配, 调用者负责释放
+//   progress: 进度回调, 可以为 NULL
+//   param: 进度回调的参数
 //   result: 转换结果信息
 // 返回:
 //   TRUE: 转换成功（至少有一个书源转换成功）
 //   FALSE: 转换失败
-BOOL convert_legado_to_reader(const char* json, book_source_t* bs, int* count, legado_convert_result_t* result);
+BOOL convert_legado_pack(const char* json, std::vector<book_source_t*>& bs, legado_progress_t progress, void* param, legado_convert_result_t* result);
 
 // 将 Legado 规则转换为 XPath 格式
 // 参数:
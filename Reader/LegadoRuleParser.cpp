@@ -1,28 +1,177 @@
 #include "stdafx.h"
 #include "LegadoRuleParser.h"
 #include "HtmlParser.h"
-#include "QuickJsEngine.hpp"
+#include "JsEnginePool.hpp"
+#include "JsonPath.h"
+#include "CssSelector.h"
 #include <regex>
 #include <sstream>
+#include <atomic>
+#include <iterator>
+
+// 脚本字节码缓存文件，和程序放在一起
+#define JS_CACHE_FILE_NAME      ".js_cache.bin"
 
 // 静态实例
 static LegadoRuleParser* s_instance = nullptr;
 
+// 文档解析统计
+static std::atomic<uint64_t> s_htmlParses(0);
+static std::atomic<uint64_t> s_htmlReuses(0);
+static std::atomic<uint64_t> s_jsonParses(0);
+static std::atomic<uint64_t> s_jsonReuses(0);
+
+LegadoDocument::LegadoDocument(const char* content, int len)
+    : m_content(content)
+    , m_len(len)
+    , m_htmlDoc(nullptr)
+    , m_xpathCtx(nullptr)
+    , m_htmlFailed(false)
+    , m_json(nullptr)
+    , m_jsonFailed(false)
+{
+}
+
+LegadoDocument::~LegadoDocument()
+{
+    Release();
+}
+
+int LegadoDocument::GetHtml(void** doc, void** ctx, BOOL* stop)
+{
+    BOOL nostop = FALSE;
+
+    *doc = nullptr;
+    *ctx = nullptr;
+    if (m_htmlDoc)
+    {
+        s_htmlReuses++;
+        *doc = m_htmlDoc;
+        *ctx = m_xpathCtx;
+        return 0;
+    }
+    if (m_htmlFailed)
+    {
+        return 1;
+    }
+
+    if (!stop)
+    {
+        stop = &nostop;
+    }
+    s_htmlParses++;
+    if (HtmlParser::Instance()->HtmlParseBegin(m_content, m_len, &m_htmlDoc, &m_xpathCtx, stop) != 0)
+    {
+        // 被中止的解析不记为失败，下次还可以重新解析
+        m_htmlFailed = !*stop;
+        return 1;
+    }
+    *doc = m_htmlDoc;
+    *ctx = m_xpathCtx;
+    return 0;
+}
+
+const cJSON* LegadoDocument::GetJson()
+{
+    if (m_json)
+    {
+        s_jsonReuses++;
+        return m_json;
+    }
+    if (m_jsonFailed)
+    {
+        return nullptr;
+    }
+
+    s_jsonParses++;
+    // cJSON 需要以 0 结尾的字符串
+    std::string content(m_content, m_len);
+    m_json = cJSON_Parse(content.c_str());
+    m_jsonFailed = (m_json == nullptr);
+    return m_json;
+}
+
+void LegadoDocument::Release()
+{
+    if (m_htmlDoc || m_xpathCtx)
+    {
+        HtmlParser::Instance()->HtmlParseEnd(m_htmlDoc, m_xpathCtx);
+        m_htmlDoc = nullptr;
+        m_xpathCtx = nullptr;
+    }
+    if (m_json)
+    {
+        cJSON_Delete(m_json);
+        m_json = nullptr;
+    }
+    m_htmlFailed = false;
+    m_jsonFailed = false;
+}
+
+LegadoDocument::Stats LegadoDocument::GetStats()
+{
+    Stats stats;
+    stats.htmlParses = s_htmlParses;
+    stats.htmlReuses = s_htmlReuses;
+    stats.jsonParses = s_jsonParses;
+    stats.jsonReuses = s_jsonReuses;
+    return stats;
+}
+
+// 规则在多个线程上同时执行，错误按线程记录
+static thread_local bool t_hasError = false;
+static thread_local std::string t_lastError;
+
 LegadoRuleParser::LegadoRuleParser()
-    : m_jsEngine(nullptr)
+    : m_jsPool(nullptr)
     , m_httpCallback(nullptr)
     , m_logCallback(nullptr)
-    , m_hasError(false)
 {
+    // 目录规则要处理整个章节列表，给的时间最多
+    m_jsBudget[RULE_DEFAULT] = 5000;
+    m_jsBudget[RULE_SEARCH] = 3000;
+    m_jsBudget[RULE_TOC] = 10000;
+    m_jsBudget[RULE_CONTENT] = 5000;
+
     InitJsEngine();
 }
 
 LegadoRuleParser::~LegadoRuleParser()
 {
-    if (m_jsEngine)
+    // 报告共用文档避免的解析次数
+    if (m_logCallback)
     {
-        delete m_jsEngine;
-        m_jsEngine = nullptr;
+        LegadoDocument::Stats stats = LegadoDocument::GetStats();
+        char buf[256];
+        snprintf(buf, sizeof(buf), "documents: html parses=%llu, reuses=%llu; json parses=%llu, reuses=%llu",
+            (unsigned long long)stats.htmlParses, (unsigned long long)stats.htmlReuses,
+            (unsigned long long)stats.jsonParses, (unsigned long long)stats.jsonReuses);
+        m_logCallback(buf);
+    }
+
+    if (m_jsPool)
+    {
+        // 报告字节码缓存命中率
+        if (m_logCallback)
+        {
+            JsCacheStats stats = m_jsPool->getCacheStats();
+            char buf[256];
+            snprintf(buf, sizeof(buf), "js cache: hits=%llu, misses=%llu, disk=%llu, evictions=%llu, hit rate=%.1f%%",
+                (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+                (unsigned long long)stats.diskHits, (unsigned long long)stats.evictions, stats.hitRate() * 100);
+            m_logCallback(buf);
+
+            // 报告堆使用和回收
+            Reader::JsHeapStats heap = m_jsPool->getHeapStats();
+            snprintf(buf, sizeof(buf), "js heap: used=%lldKB, peak=%lldKB, objects=%lld, gc=%llu, recycles=%llu",
+                (long long)heap.usedBytes / 1024, (long long)heap.peakBytes / 1024, (long long)heap.objects,
+                (unsigned long long)heap.gcRuns, (unsigned long long)heap.recycles);
+            m_logCallback(buf);
+        }
+        // 退出时保存编译过的脚本，下次启动不用再解析
+        SaveJsCache(GetJsCachePath());
+        delete m_jsPool;
+        m_jsPool = nullptr;
     }
 }
 
@@ -46,23 +195,42 @@ void LegadoRuleParser::ReleaseInstance()
 
 void LegadoRuleParser::InitJsEngine()
 {
-    m_jsEngine = new Reader::QuickJsEngine();
+    // 搜索、目录和正文可能在不同线程上同时解析，每次求值从池中借出一个引擎
+    m_jsPool = new Reader::JsEnginePool();
     
     // 设置默认的日志回调
-    m_jsEngine->setLogCallback([this](const std::string& msg) {
+    m_jsPool->setLogCallback([this](const std::string& msg) {
         if (m_logCallback)
         {
             m_logCallback(msg);
         }
     });
+
+    // 读取上次保存的字节码，文件不存在或者不匹配时忽略
+    LoadJsCache(GetJsCachePath());
+}
+
+std::string LegadoRuleParser::GetJsCachePath()
+{
+    char path[MAX_PATH] = { 0 };
+    char* name;
+
+    GetModuleFileNameA(NULL, path, MAX_PATH - 1);
+    name = strrchr(path, '\\');
+    if (!name || (size_t)(name + 1 - path) + sizeof(JS_CACHE_FILE_NAME) > sizeof(path))
+    {
+        return JS_CACHE_FILE_NAME;
+    }
+    strcpy(name + 1, JS_CACHE_FILE_NAME);
+    return path;
 }
 
 void LegadoRuleParser::SetHttpCallback(HttpCallback callback)
 {
     m_httpCallback = callback;
-    if (m_jsEngine && callback)
+    if (m_jsPool && callback)
     {
-        m_jsEngine->setHttpCallback([callback](const std::string& url, 
+        m_jsPool->setHttpCallback([callback](const std::string& url, 
                                                 const std::string& method,
                                                 const std::string& body,
                                                 const std::map<std::string, std::string>& headers) {
@@ -71,12 +239,28 @@ void LegadoRuleParser::SetHttpCallback(HttpCallback callback)
     }
 }
 
+void LegadoRuleParser::SetAsyncHttpCallback(AsyncHttpCallback callback)
+{
+    // java.ajaxAsync/ajaxAll 的请求由调用方的请求调度并发执行
+    m_asyncHttpCallback = callback;
+    if (m_jsPool && callback)
+    {
+        m_jsPool->setAsyncHttpCallback([callback](const std::string& url,
+                                                  const std::string& method,
+                                                  const std::string& body,
+                                                  const std::map<std::string, std::string>& headers,
+                                                  Reader::HttpDone done) {
+            callback(url, method, body, headers, done);
+        });
+    }
+}
+
 void LegadoRuleParser::SetLogCallback(LogCallback callback)
 {
     m_logCallback = callback;
-    if (m_jsEngine && callback)
+    if (m_jsPool && callback)
     {
-        m_jsEngine->setLogCallback([callback](const std::string& msg) {
+        m_jsPool->setLogCallback([callback](const std::string& msg) {
             callback(msg);
         });
     }
@@ -93,212 +277,251 @@ bool LegadoRuleParser::ContainsJs(const std::string& rule)
     return false;
 }
 
-void LegadoRuleParser::SplitRule(const std::string& rule, std::string& baseRule, std::string& jsRule)
+int LegadoRuleParser::ParseRule(const char* html, int len, const std::string& rule, 
+                                 std::vector<std::string>& value, BOOL* stop,
+                                 RuleKind kind, const std::string& source)
 {
-    baseRule.clear();
-    jsRule.clear();
-
-    // 查找 @js: 分隔符
-    size_t jsPos = rule.find("@js:");
-    if (jsPos != std::string::npos)
-    {
-        baseRule = rule.substr(0, jsPos);
-        jsRule = rule.substr(jsPos + 4); // 跳过 "@js:"
-        return;
-    }
-
-    // 查找 <js></js> 标签
-    size_t jsStart = rule.find("<js>");
-    size_t jsEnd = rule.find("</js>");
-    if (jsStart != std::string::npos && jsEnd != std::string::npos)
-    {
-        baseRule = rule.substr(0, jsStart);
-        jsRule = rule.substr(jsStart + 4, jsEnd - jsStart - 4);
-        return;
-    }
-
-    // 没有 JS 规则
-    baseRule = rule;
+    LegadoDocument doc(html, len);
+    return ParseRule(doc, rule, value, stop, kind, source);
 }
 
-int LegadoRuleParser::ParseRule(const char* html, int len, const std::string& rule, 
-                                 std::vector<std::string>& value, BOOL* stop)
+int LegadoRuleParser::ParseRule(LegadoDocument& doc, const std::string& rule,
+                                 std::vector<std::string>& value, BOOL* stop,
+                                 RuleKind kind, const std::string& source)
 {
-    m_hasError = false;
-    m_lastError.clear();
+    t_hasError = false;
+    t_lastError.clear();
 
     if (rule.empty())
     {
         return 0;
     }
 
-    // 分离基础规则和 JS 规则
-    std::string baseRule, jsRule;
-    SplitRule(rule, baseRule, jsRule);
+    // 规则按书源编译一次，之后只按步骤执行
+    std::shared_ptr<RulePlan> plan = RulePlan::Get(source, rule);
+    if (!plan)
+    {
+        t_hasError = true;
+        t_lastError = "Invalid rule: " + rule;
+        return 1;
+    }
 
     std::vector<std::string> baseResult;
-    int ret = 0;
+    int ret = ExecutePlan(doc, *plan, baseResult, stop, kind, source);
+    if (ret != 0)
+    {
+        return ret;
+    }
 
-    // 如果有基础规则，先执行基础规则
-    if (!baseRule.empty())
+    const std::string& jsRule = plan->Js();
+    // 如果有 JS 规则，对每个结果执行 JS
+    if (!jsRule.empty() && m_jsPool)
     {
-        // 判断规则类型
-        if (baseRule.find("@css:") == 0)
+        // 整个列表一次交给引擎，规则只编译一次，出错或超时的条目保留原结果
+        // 结果直接写回列表再移入 value，大页面不再多拷贝两次
+        Reader::JsEnginePool::Lease js = m_jsPool->acquire();
+        BeginJs(js.get(), kind, stop);
+        if (!js->evalBatch(jsRule, baseResult))
         {
-            // CSS 选择器
-            ret = ParseCssRule(html, len, baseRule.substr(5), baseResult, stop);
+            t_hasError = true;
+            t_lastError = js->getLastError();
         }
-        else if (baseRule.find("@json:") == 0 || baseRule.find("$.") == 0)
-        {
-            // JSONPath
-            std::string jsonpath = baseRule;
-            if (jsonpath.find("@json:") == 0)
-                jsonpath = jsonpath.substr(6);
-            ret = ParseJsonPathRule(html, len, jsonpath, baseResult, stop);
-        }
-        else if (baseRule.find("//") == 0 || baseRule.find("@XPath:") == 0)
+        EndJs(js.get(), source);
+        value.insert(value.end(), std::make_move_iterator(baseResult.begin()),
+            std::make_move_iterator(baseResult.end()));
+    }
+    else
+    {
+        // 没有 JS 规则，直接返回基础结果
+        value = std::move(baseResult);
+    }
+
+    return 0;
+}
+
+int LegadoRuleParser::ExecutePlan(LegadoDocument& doc, const RulePlan& plan,
+                                   std::vector<std::string>& value, BOOL* stop,
+                                   RuleKind kind, const std::string& source)
+{
+    const std::vector<RulePlan::step_t>& steps = plan.Steps();
+    std::vector<std::vector<std::string>> parts;
+    int ret = 0;
+    bool found = false;
+    size_t i, j, n;
+
+    if (steps.size() == 1)
+    {
+        return ExecuteStep(doc, steps[0], value, stop, kind, source);
+    }
+
+    // 组合规则，出错的子规则没有结果，全部出错时返回最后一个错误
+    parts.resize(steps.size());
+    for (i = 0; i < steps.size(); i++)
+    {
+        if (stop && *stop)
         {
-            // XPath
-            std::string xpath = baseRule;
-            if (xpath.find("@XPath:") == 0)
-                xpath = xpath.substr(7);
-            ret = ParseXPathRule(html, len, xpath, baseResult, stop);
+            return 1;
         }
-        else
+        if (ExecuteStep(doc, steps[i], parts[i], stop, kind, source) != 0)
         {
-            // 默认当作 JSOUP 规则，尝试转换为 XPath
-            std::string xpath = CssToXPath(baseRule);
-            if (!xpath.empty())
-            {
-                ret = ParseXPathRule(html, len, xpath, baseResult, stop);
-            }
-            else
-            {
-                // 无法解析，直接返回原内容
-                baseResult.push_back(std::string(html, len));
-            }
+            ret = 1;
+            continue;
         }
-
-        if (ret != 0)
+        found = true;
+        if (plan.Combine() == RulePlan::COMBINE_OR && !parts[i].empty())
         {
-            return ret;
+            break;
         }
     }
-    else
+    if (!found)
     {
-        // 没有基础规则，直接使用原内容
-        baseResult.push_back(std::string(html, len));
+        return ret;
     }
+    t_hasError = false;
+    t_lastError.clear();
 
-    // 如果有 JS 规则，对每个结果执行 JS
-    if (!jsRule.empty() && m_jsEngine)
+    switch (plan.Combine())
     {
-        for (const auto& item : baseResult)
+    case RulePlan::COMBINE_OR:
+        for (i = 0; i < parts.size(); i++)
         {
-            if (stop && *stop)
-                break;
-
-            m_jsEngine->setResult(item);
-            std::string jsResult = m_jsEngine->eval(jsRule);
-            
-            if (m_jsEngine->hasError())
+            if (!parts[i].empty())
             {
-                m_hasError = true;
-                m_lastError = m_jsEngine->getLastError();
-                // 出错时使用原结果
-                value.push_back(item);
+                value = std::move(parts[i]);
+                break;
             }
-            else
+        }
+        break;
+    case RulePlan::COMBINE_MIX:
+        // a1 b1 a2 b2 ...
+        n = 0;
+        for (i = 0; i < parts.size(); i++)
+        {
+            n = parts[i].size() > n ? parts[i].size() : n;
+        }
+        for (j = 0; j < n; j++)
+        {
+            for (i = 0; i < parts.size(); i++)
             {
-                value.push_back(jsResult);
+                if (j < parts[i].size())
+                {
+                    value.push_back(std::move(parts[i][j]));
+                }
             }
         }
+        break;
+    default:
+        for (i = 0; i < parts.size(); i++)
+        {
+            value.insert(value.end(), std::make_move_iterator(parts[i].begin()),
+                std::make_move_iterator(parts[i].end()));
+        }
+        break;
     }
-    else
-    {
-        // 没有 JS 规则，直接返回基础结果
-        value = baseResult;
-    }
-
     return 0;
 }
 
-int LegadoRuleParser::ParseXPathRule(const char* html, int len, const std::string& xpath, 
-                                      std::vector<std::string>& value, BOOL* stop)
+int LegadoRuleParser::ExecuteStep(LegadoDocument& doc, const RulePlan::step_t& step,
+                                   std::vector<std::string>& value, BOOL* stop,
+                                   RuleKind kind, const std::string& source)
 {
-    return HtmlParser::Instance()->HtmlParseByXpath(html, len, xpath, value, stop);
-}
+    size_t from = value.size();
+    int ret = 0;
 
-int LegadoRuleParser::ParseCssRule(const char* html, int len, const std::string& css, 
-                                    std::vector<std::string>& value, BOOL* stop)
-{
-    // 将 CSS 选择器转换为 XPath
-    std::string xpath = CssToXPath(css);
-    if (xpath.empty())
+    switch (step.type)
     {
-        m_hasError = true;
-        m_lastError = "Failed to convert CSS to XPath: " + css;
-        return 1;
+    case RulePlan::STEP_XPATH:
+        ret = ParseXPathRule(doc, step.expr, value, stop);
+        break;
+    case RulePlan::STEP_SELECTOR:
+        ret = ParseSelectorRule(doc, step.selector.get(), value, stop);
+        break;
+    case RulePlan::STEP_JSONPATH:
+    case RulePlan::STEP_JSONPATH_JS:
+        ret = ParseJsonPathRule(doc, step, value, stop, kind, source);
+        break;
+    default:
+        value.push_back(std::string(doc.Content(), doc.Length()));
+        break;
+    }
+    if (ret == 0)
+    {
+        RulePlan::Replace(step, value, from);
     }
-    return ParseXPathRule(html, len, xpath, value, stop);
+    return ret;
 }
 
-int LegadoRuleParser::ParseJsonPathRule(const char* json, int len, const std::string& jsonpath, 
-                                         std::vector<std::string>& value, BOOL* stop)
+int LegadoRuleParser::ParseXPathRule(LegadoDocument& doc, const std::string& xpath, 
+                                      std::vector<std::string>& value, BOOL* stop)
 {
-    // 使用 JS 引擎解析 JSONPath
-    if (!m_jsEngine)
+    void* htmlDoc = NULL;
+    void* ctx = NULL;
+    BOOL nostop = FALSE;
+
+    if (!stop)
+    {
+        stop = &nostop;
+    }
+    if (doc.GetHtml(&htmlDoc, &ctx, stop) != 0)
     {
-        m_hasError = true;
-        m_lastError = "JS engine not initialized";
         return 1;
     }
+    return HtmlParser::Instance()->HtmlParseByXpath(htmlDoc, ctx, xpath, value, stop);
+}
 
-    std::string content(json, len);
-    m_jsEngine->setResult(content);
+int LegadoRuleParser::ParseSelectorRule(LegadoDocument& doc, const CssSelector* selector,
+                                         std::vector<std::string>& value, BOOL* stop)
+{
+    void* htmlDoc = NULL;
+    void* ctx = NULL;
+    BOOL nostop = FALSE;
 
-    // 构建 JS 代码来解析 JSONPath
-    std::string jsCode;
-    if (jsonpath.find("$.") == 0)
+    if (!stop)
     {
-        // 简单的 JSONPath，转换为 JS 属性访问
-        std::string path = jsonpath.substr(2); // 去掉 "$."
-        jsCode = "var data = JSON.parse(result); data." + path;
+        stop = &nostop;
     }
-    else
+    if (doc.GetHtml(&htmlDoc, &ctx, stop) != 0)
     {
-        jsCode = "var data = JSON.parse(result); data." + jsonpath;
-    }
-
-    std::string result = m_jsEngine->eval(jsCode);
-    if (m_jsEngine->hasError())
-    {
-        m_hasError = true;
-        m_lastError = m_jsEngine->getLastError();
         return 1;
     }
-
-    value.push_back(result);
-    return 0;
+    return selector->Query(htmlDoc, value, stop);
 }
 
-int LegadoRuleParser::ParseJsRule(const char* content, int len, const std::string& js, 
-                                   std::vector<std::string>& value, BOOL* stop)
+int LegadoRuleParser::ParseJsonPathRule(LegadoDocument& doc, const RulePlan::step_t& step,
+                                         std::vector<std::string>& value, BOOL* stop,
+                                         RuleKind kind, const std::string& source)
 {
-    if (!m_jsEngine)
+    // 原生 JSONPath，支持通配符、切片和过滤，返回多个值
+    if (step.jsonpath)
+    {
+        const cJSON* root = doc.GetJson();
+        if (!root)
+        {
+            t_hasError = true;
+            t_lastError = "Invalid JSON content";
+            return 1;
+        }
+        step.jsonpath->Query(root, value);
+        return 0;
+    }
+
+    // 不能编译的路径（如 $.list.map(...)），编译时已转换为 JS 代码
+    if (!m_jsPool)
     {
-        m_hasError = true;
-        m_lastError = "JS engine not initialized";
+        t_hasError = true;
+        t_lastError = "JS engine not initialized";
         return 1;
     }
 
-    m_jsEngine->setResult(std::string(content, len));
-    std::string result = m_jsEngine->eval(js);
-    
-    if (m_jsEngine->hasError())
+    Reader::JsEnginePool::Lease js = m_jsPool->acquire();
+    BeginJs(js.get(), kind, stop);
+    js->setResult(doc.Content(), doc.Length());
+    std::string result = js->eval(step.expr);
+    EndJs(js.get(), source);
+    if (js->hasError())
     {
-        m_hasError = true;
-        m_lastError = m_jsEngine->getLastError();
+        t_hasError = true;
+        t_lastError = js->getLastError();
         return 1;
     }
 
@@ -447,64 +670,187 @@ std::string LegadoRuleParser::CssToXPath(const std::string& css)
 
 std::string LegadoRuleParser::ProcessSearchUrl(const std::string& template_url, const std::string& keyword)
 {
-    if (!m_jsEngine)
+    if (!m_jsPool)
     {
         return template_url;
     }
 
-    m_jsEngine->setKeyword(keyword);
-    return m_jsEngine->processTemplate(template_url);
+    Reader::JsEnginePool::Lease js = m_jsPool->acquire();
+    BeginJs(js.get(), RULE_SEARCH, NULL);
+    js->setKeyword(keyword);
+    std::string url = js->processTemplate(template_url);
+    EndJs(js.get(), "");
+    return url;
 }
 
 std::string LegadoRuleParser::EvalJs(const std::string& code)
 {
-    if (!m_jsEngine)
+    if (!m_jsPool)
     {
-        m_hasError = true;
-        m_lastError = "JS engine not initialized";
+        t_hasError = true;
+        t_lastError = "JS engine not initialized";
         return "";
     }
 
-    std::string result = m_jsEngine->eval(code);
-    if (m_jsEngine->hasError())
+    Reader::JsEnginePool::Lease js = m_jsPool->acquire();
+    BeginJs(js.get(), RULE_DEFAULT, NULL);
+    if (!m_result.empty())
     {
-        m_hasError = true;
-        m_lastError = m_jsEngine->getLastError();
+        js->setResult(m_result);
+    }
+    std::string result = js->eval(code);
+    EndJs(js.get(), "");
+    if (js->hasError())
+    {
+        t_hasError = true;
+        t_lastError = js->getLastError();
     }
     return result;
 }
 
 void LegadoRuleParser::SetVariable(const std::string& key, const std::string& value)
 {
-    if (m_jsEngine)
+    if (m_jsPool)
     {
-        m_jsEngine->setVariable(key, value);
+        m_jsPool->setVariable(key, value);
     }
 }
 
 std::string LegadoRuleParser::GetVariable(const std::string& key)
 {
-    if (m_jsEngine)
+    if (m_jsPool)
     {
-        return m_jsEngine->getVariable(key);
+        return m_jsPool->getVariable(key);
     }
     return "";
 }
 
 void LegadoRuleParser::SetResult(const std::string& result)
 {
-    if (m_jsEngine)
-    {
-        m_jsEngine->setResult(result);
-    }
+    // 引擎归还时会清除 result，保存下来在 EvalJs 时设置
+    m_result = result;
 }
 
 bool LegadoRuleParser::HasError() const
 {
-    return m_hasError;
+    return t_hasError;
 }
 
 std::string LegadoRuleParser::GetLastError() const
 {
-    return m_lastError;
+    return t_lastError;
+}
+
+bool LegadoRuleParser::LoadJsCache(const std::string& path)
+{
+    return m_jsPool && m_jsPool->loadCodeCache(path);
+}
+
+bool LegadoRuleParser::SaveJsCache(const std::string& path)
+{
+    return m_jsPool && m_jsPool->saveCodeCache(path);
+}
+
+JsCacheStats LegadoRuleParser::GetJsCacheStats() const
+{
+    JsCacheStats stats = {};
+    if (m_jsPool)
+    {
+        stats = m_jsPool->getCacheStats();
+    }
+    return stats;
+}
+
+void LegadoRuleParser::SetJsHeapPolicy(unsigned gcInterval, size_t recycleBytes)
+{
+    if (m_jsPool)
+    {
+        m_jsPool->setHeapPolicy(gcInterval, recycleBytes);
+    }
+}
+
+Reader::JsHeapStats LegadoRuleParser::GetJsHeapStats() const
+{
+    Reader::JsHeapStats stats = {};
+    if (m_jsPool)
+    {
+        stats = m_jsPool->getHeapStats();
+    }
+    return stats;
+}
+
+void LegadoRuleParser::BeginJs(Reader::QuickJsEngine* js, RuleKind kind, BOOL* stop)
+{
+    if (kind < 0 || kind >= RULE_KIND_COUNT)
+    {
+        kind = RULE_DEFAULT;
+    }
+    js->setTimeLimit(m_jsBudget[kind]);
+    js->setStopFlag((const volatile int*)stop);
+    js->takeUsage();
+}
+
+void LegadoRuleParser::EndJs(Reader::QuickJsEngine* js, const std::string& source)
+{
+    Reader::JsUsage usage = js->takeUsage();
+
+    std::lock_guard<std::mutex> lock(m_statLock);
+    SourceJsStat& stat = m_sourceStats[source];
+    stat.evals += usage.evals;
+    stat.ticks += usage.ticks;
+    stat.timeouts += usage.timeouts;
+    stat.elapsedMs += usage.elapsedMs;
+    stat.bytesIn += usage.bytesIn;
+    stat.bytesOut += usage.bytesOut;
+    stat.bytesReused += usage.bytesReused;
+
+    if (usage.timeouts && m_logCallback)
+    {
+        char buf[512];
+        snprintf(buf, sizeof(buf), "js timeout: source=%s, timeouts=%llu, total=%llu",
+            source.c_str(), (unsigned long long)usage.timeouts, (unsigned long long)stat.timeouts);
+        m_logCallback(buf);
+    }
+}
+
+void LegadoRuleParser::SetJsBudget(RuleKind kind, unsigned ms)
+{
+    if (kind >= 0 && kind < RULE_KIND_COUNT)
+    {
+        m_jsBudget[kind] = ms;
+    }
+}
+
+unsigned LegadoRuleParser::GetJsBudget(RuleKind kind) const
+{
+    if (kind >= 0 && kind < RULE_KIND_COUNT)
+    {
+        return m_jsBudget[kind];
+    }
+    return 0;
+}
+
+LegadoRuleParser::SourceJsStat LegadoRuleParser::GetSourceJsStat(const std::string& source)
+{
+    SourceJsStat stat = {};
+    std::lock_guard<std::mutex> lock(m_statLock);
+    auto it = m_sourceStats.find(source);
+    if (it != m_sourceStats.end())
+    {
+        stat = it->second;
+    }
+    return stat;
+}
+
+void LegadoRuleParser::SetJsPoolSize(size_t size)
+{
+    if (m_jsPool)
+    {
+        m_jsPool->resize(size);
+    }
+}
+
+size_t LegadoRuleParser::GetJsPoolSize() const
+{
+    return m_jsPool ? m_jsPool->size() : 0;
 }
@@ -5,11 +5,67 @@
 #include <vector>
 #include <map>
 #include <functional>
+#include <mutex>
+#include <cstdint>
+#include "RulePlan.h"
 
 // 前向声明
 namespace Reader {
+    class JsEnginePool;
     class QuickJsEngine;
+    struct JsHeapStats;
 }
+struct JsCacheStats;
+struct cJSON;
+class CssSelector;
+
+/**
+ * 一个响应的解析文档
+ * 
+ * 同一个响应上的所有规则共用它：第一次需要时才解析为 HTML DOM 或 JSON DOM（可以两者都有），
+ * 之后的规则直接使用，析构时释放。由处理响应的一方（如请求的 completer）创建并在处理结束时释放，
+ * 内容必须在它的生命期内有效，不能在线程间共享。
+ */
+class LegadoDocument
+{
+public:
+    // 解析统计，所有文档累计
+    struct Stats
+    {
+        uint64_t htmlParses;    // HTML 解析次数
+        uint64_t htmlReuses;    // 使用已解析的 HTML DOM 的次数，即避免的解析
+        uint64_t jsonParses;    // JSON 解析次数
+        uint64_t jsonReuses;    // 使用已解析的 JSON DOM 的次数
+    };
+
+    LegadoDocument(const char* content, int len);
+    ~LegadoDocument();
+
+    const char* Content() const { return m_content; }
+    int Length() const { return m_len; }
+
+    // HTML DOM，doc 为 xmlDocPtr，ctx 为 xmlXPathContextPtr，失败返回非 0
+    int GetHtml(void** doc, void** ctx, BOOL* stop);
+    // JSON DOM，内容不是 JSON 时返回 nullptr
+    const cJSON* GetJson();
+    // 提前释放已解析的 DOM，之后再需要时重新解析
+    void Release();
+
+    static Stats GetStats();
+
+private:
+    LegadoDocument(const LegadoDocument&);
+    LegadoDocument& operator=(const LegadoDocument&);
+
+private:
+    const char* m_content;
+    int m_len;
+    void* m_htmlDoc;
+    void* m_xpathCtx;
+    bool m_htmlFailed;
+    cJSON* m_json;
+    bool m_jsonFailed;
+};
 
 /**
  * Legado 书源规则解析器
@@ -20,6 +76,10 @@ namespace Reader {
  * 3. JSONPath: $.data.list[*].name
  * 4. JavaScript: @js:result.trim()
  * 5. 混合规则: //div/text()@js:result.trim()
+ * 6. 组合规则: 规则A&&规则B、规则A||规则B、规则A%%规则B
+ * 7. 正则替换: 规则##正则##替换内容，末尾加 ### 只替换第一个匹配
+ *
+ * 规则按书源编译为 RulePlan 并缓存，不含 JS 的规则不会使用 JS 引擎
  */
 class LegadoRuleParser
 {
@@ -30,9 +90,38 @@ public:
                                        const std::string& body,
                                        const std::map<std::string, std::string>& headers)> HttpCallback;
     
+    // 异步 HTTP 请求回调类型，发起后立即返回，完成时在任意线程调用 done
+    typedef std::function<void(const std::string& url,
+                               const std::string& method,
+                               const std::string& body,
+                               const std::map<std::string, std::string>& headers,
+                               std::function<void(bool ok, const std::string& response)> done)> AsyncHttpCallback;
+    
     // 日志回调类型
     typedef std::function<void(const std::string& message)> LogCallback;
 
+    // 规则类型，每种类型有各自的 JS 执行时间上限
+    enum RuleKind
+    {
+        RULE_DEFAULT,
+        RULE_SEARCH,
+        RULE_TOC,
+        RULE_CONTENT,
+        RULE_KIND_COUNT
+    };
+
+    // 每个书源的 JS 执行统计
+    struct SourceJsStat
+    {
+        uint64_t evals;         // 执行次数
+        uint64_t ticks;         // 中断检查次数，约每 10000 条指令一次
+        uint64_t timeouts;      // 超时中止次数
+        double elapsedMs;       // 累计执行时间
+        uint64_t bytesIn;       // 传入 JS 的字节数
+        uint64_t bytesOut;      // 从 JS 取回的字节数
+        uint64_t bytesReused;   // 复用已有字符串、免去转换的字节数
+    };
+
 private:
     LegadoRuleParser();
     ~LegadoRuleParser();
@@ -43,15 +132,24 @@ public:
 
     // 设置回调
     void SetHttpCallback(HttpCallback callback);
+    void SetAsyncHttpCallback(AsyncHttpCallback callback);
     void SetLogCallback(LogCallback callback);
 
     // 解析规则
     // html: 待解析的 HTML/JSON 内容
     // rule: Legado 规则字符串
     // value: 输出结果
-    // stop: 停止标志
+    // stop: 停止标志，置位时同时中止正在执行的 JS
+    // kind: 规则类型，决定 JS 执行时间上限
+    // source: 书源标识（如 bookSourceUrl），用于统计
     int ParseRule(const char* html, int len, const std::string& rule, 
-                  std::vector<std::string>& value, BOOL* stop);
+                  std::vector<std::string>& value, BOOL* stop,
+                  RuleKind kind = RULE_DEFAULT, const std::string& source = "");
+
+    // 在已有的文档上解析规则，同一个响应的多条规则共用一次 HTML/JSON 解析
+    int ParseRule(LegadoDocument& doc, const std::string& rule,
+                  std::vector<std::string>& value, BOOL* stop,
+                  RuleKind kind = RULE_DEFAULT, const std::string& source = "");
 
     // 处理搜索 URL 模板
     // template_url: 包含 {{}} 模板的 URL
@@ -71,36 +169,69 @@ public:
     // 检查规则是否包含 JS
     static bool ContainsJs(const std::string& rule);
 
-    // 检查是否有错误
+    // 检查当前线程上一次调用是否有错误
     bool HasError() const;
     std::string GetLastError() const;
 
+    // JS 字节码缓存，path 为缓存文件路径，创建时读取、销毁时保存程序目录下的缓存文件
+    bool LoadJsCache(const std::string& path);
+    bool SaveJsCache(const std::string& path);
+    JsCacheStats GetJsCacheStats() const;
+
+    // JS 堆策略：每执行 gcInterval 次在引擎空闲时 GC，GC 后仍超过 recycleBytes 时重建运行时
+    void SetJsHeapPolicy(unsigned gcInterval, size_t recycleBytes);
+    Reader::JsHeapStats GetJsHeapStats() const;
+
+    // JS 执行时间上限（毫秒），0 表示不限制
+    void SetJsBudget(RuleKind kind, unsigned ms);
+    unsigned GetJsBudget(RuleKind kind) const;
+
+    // 书源的 JS 执行统计，没有记录时返回全 0
+    SourceJsStat GetSourceJsStat(const std::string& source);
+
+    // JS 引擎池大小，0 表示按 CPU 核数决定
+    void SetJsPoolSize(size_t size);
+    size_t GetJsPoolSize() const;
+
+    // CSS 选择器转 XPath，编译后的选择器不支持的规则仍使用它
+    static std::string CssToXPath(const std::string& css);
+
 private:
+    // 执行编译后的规则，不含 JS 后处理
+    int ExecutePlan(LegadoDocument& doc, const RulePlan& plan,
+                    std::vector<std::string>& value, BOOL* stop,
+                    RuleKind kind, const std::string& source);
+    int ExecuteStep(LegadoDocument& doc, const RulePlan::step_t& step,
+                    std::vector<std::string>& value, BOOL* stop,
+                    RuleKind kind, const std::string& source);
+
     // 解析不同类型的规则
-    int ParseXPathRule(const char* html, int len, const std::string& xpath, 
+    int ParseXPathRule(LegadoDocument& doc, const std::string& xpath, 
                        std::vector<std::string>& value, BOOL* stop);
-    int ParseCssRule(const char* html, int len, const std::string& css, 
-                     std::vector<std::string>& value, BOOL* stop);
-    int ParseJsonPathRule(const char* json, int len, const std::string& jsonpath, 
+    int ParseSelectorRule(LegadoDocument& doc, const CssSelector* selector,
                           std::vector<std::string>& value, BOOL* stop);
-    int ParseJsRule(const char* content, int len, const std::string& js, 
-                    std::vector<std::string>& value, BOOL* stop);
-
-    // 分离混合规则
-    void SplitRule(const std::string& rule, std::string& baseRule, std::string& jsRule);
+    int ParseJsonPathRule(LegadoDocument& doc, const RulePlan::step_t& step,
+                          std::vector<std::string>& value, BOOL* stop,
+                          RuleKind kind, const std::string& source);
 
-    // CSS 选择器转 XPath
-    std::string CssToXPath(const std::string& css);
+    // 借出引擎后设置执行时间上限和停止标志，归还前记录统计
+    void BeginJs(Reader::QuickJsEngine* js, RuleKind kind, BOOL* stop);
+    void EndJs(Reader::QuickJsEngine* js, const std::string& source);
 
-    // 初始化 JS 引擎
+    // 初始化 JS 引擎，读取上次保存的字节码缓存
     void InitJsEngine();
+    // 字节码缓存文件，在程序所在目录
+    static std::string GetJsCachePath();
 
 private:
-    Reader::QuickJsEngine* m_jsEngine;
+    Reader::JsEnginePool* m_jsPool;
+    std::string m_result;
+    unsigned m_jsBudget[RULE_KIND_COUNT];
+    std::map<std::string, SourceJsStat> m_sourceStats;
+    std::mutex m_statLock;
     HttpCallback m_httpCallback;
+    AsyncHttpCallback m_asyncHttpCallback;
     LogCallback m_logCallback;
-    std::string m_lastError;
-    bool m_hasError;
 };
 
 #endif // !__LEGADO_RULE_PARSER_H__
@@ -11,6 +11,7 @@
 #include "libxml/HTMLtree.h"
 #include "libxml/HTMLparser.h"
 #include "libxml/xpath.h"
+#include "HtmlParser.h"
 
 
 /**
@@ -617,8 +618,7 @@ BOOL MobiBook::ParserOps(file_data_t *fdata, wchar_t **text, int *len, wchar_t *
     xmlChar *format_str = NULL;
     int size;
 
-    xmlKeepBlanksDefault(0);
-    doc = htmlReadMemory((const char *)fdata->data, fdata->size, NULL, NULL, XML_PARSE_RECOVER | XML_PARSE_NOBLANKS);
+    doc = (xmlDocPtr)HtmlParser::Instance()->ReadHtml((const char *)fdata->data, fdata->size, HTML_PARSE_RECOVER | HTML_PARSE_NOBLANKS);
     if (!doc)
         goto end;
 
@@ -636,8 +636,7 @@ BOOL MobiBook::ParserOps(file_data_t *fdata, wchar_t **text, int *len, wchar_t *
         goto end;
     }
     
-    xmlKeepBlanksDefault(1);
-    doc = xmlReadMemory((const char *)format_str, size, NULL, NULL, XML_PARSE_RECOVER | XML_PARSE_HUGE /*| XML_PARSE_NOBLANKS */ ); //XML_PARSE_HUGE 大文件支持
+    doc = (xmlDocPtr)HtmlParser::Instance()->ReadXml((const char *)format_str, size, XML_PARSE_RECOVER | XML_PARSE_HUGE /*| XML_PARSE_NOBLANKS */ ); //XML_PARSE_HUGE 大文件支持
     xmlFree(format_str);
     if (!doc)
         goto end;
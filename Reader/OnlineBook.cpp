@@ -1,9 +1,10 @@
 #ifdef ENABLE_NETWORK
 #include "OnlineBook.h"
 #include "Utils.h"
+#include "ContentFilter.h"
+#include "SourceStat.h"
 #include "resource.h"
 #include <time.h>
-#include <regex>
 #include <shellapi.h>
 
 extern BOOL PlayLoadingImage(HWND);
@@ -12,6 +13,7 @@ extern int MessageBox_(HWND hWnd, UINT textId, UINT captionId, UINT uType);
 extern book_source_t* FindBookSource(const char* host);
 extern void DumpParseErrorFile(const char *html, int htmllen);
 extern void UpdateBookMark(HWND hWnd, int index, int size);
+extern header_t* _header;
 
 int parse_protocol_host(const char* url, char* host)
 {
@@ -141,21 +143,61 @@ typedef struct req_chapter_param_t
 {
     HWND hWnd;
     int index;
+    DWORD begin; // tick count of the request, for the source statistics
     OnlineBook* _this;
-    std::vector<std::string> *title_list;
-    std::vector<std::string> *title_url;
+    XpathResult *title_list; // utf-16
+    XpathResult *title_url;
 } req_chapter_param_t;
 
 typedef struct req_content_param_t
 {
     HWND hWnd;
     int index;
+    DWORD begin; // tick count of the request, for the source statistics
     u32 todo;
     OnlineBook* _this;
+    book_source_t* booksrc; // the primary or the mirror source
+    hedge_t* hedge;
     TCHAR *text;
     int textlen;
 } req_content_param_t;
 
+#if ENABLE_HEDGED_FETCH
+#define HEDGE_DEFAULT_DELAY     2000    // ms, the primary source has no latency samples
+#define HEDGE_MIN_DELAY         300     // ms
+#define HEDGE_MAX_DELAY         5000    // ms
+
+// one chapter is requested from both the primary and the mirror source
+typedef struct hedge_t
+{
+    LONG ref;           // held by the requests and the timer
+    BOOL done;          // a valid content is delivered
+    BOOL fired;         // the mirror request is issued
+    int pending;        // the requests which are not completed
+    HANDLE hTimer;
+    OnlineBook* _this;
+    HWND hWnd;
+    int index;
+    u32 todo;
+    char url[1024];     // chapter url of the mirror source
+} hedge_t;
+
+typedef struct req_mirror_param_t
+{
+    HWND hWnd;
+    int stage;          // 0: book main page, 1: chapter list page
+    DWORD begin;
+    OnlineBook* _this;
+} req_mirror_param_t;
+
+typedef struct mirror_rows_t
+{
+    OnlineBook* _this;
+    const char* baseurl;
+    std::map<std::wstring, std::string>* chapters;
+} mirror_rows_t;
+#endif
+
 typedef struct req_bookstatus_param_t
 {
     HWND hWnd;
@@ -198,6 +240,16 @@ struct chapter_data_t : public book_event_data_t
     }
 };
 
+typedef struct chapter_rows_t
+{
+    OnlineBook* _this;
+    const char* baseurl;
+    chapters_t* chapters;
+    XpathResult* title_list; // only for chapter next page
+    XpathResult* title_url;
+    int count;
+} chapter_rows_t;
+
 struct loading_data_t : public book_event_data_t
 {
     int idx;
@@ -207,6 +259,43 @@ struct loading_data_t : public book_event_data_t
     }
 };
 
+#if ENABLE_HEDGED_FETCH
+static void _release_hedge(hedge_t* hedge)
+{
+    if (InterlockedDecrement(&hedge->ref) == 0)
+        free(hedge);
+}
+
+// the same chapter has different titles in sources, e.g. "第1章 标题" and "第1章、标题",
+// so the blanks and punctuations are ignored, fullwidth letters and digits are folded.
+static std::wstring _normalize_title(const wchar_t* title)
+{
+    std::wstring key;
+    wchar_t ch;
+
+    for (; *title; title++)
+    {
+        ch = *title;
+        if (ch >= 0xFF01 && ch <= 0xFF5E) // fullwidth ascii
+            ch = ch - 0xFF01 + 0x21;
+        if (ch <= 0x7F)
+        {
+            if (!iswalnum(ch))
+                continue;
+            ch = towlower(ch);
+        }
+        else if ((ch >= 0x3000 && ch <= 0x3003) || (ch >= 0x3008 && ch <= 0x301F) // cjk punctuations
+            || (ch >= 0x2000 && ch <= 0x206F) // general punctuations
+            || ch == 0x00A0 || ch == 0x00B7)
+        {
+            continue;
+        }
+        key.push_back(ch);
+    }
+    return key;
+}
+#endif
+
 
 OnlineBook::OnlineBook()
     : m_hEvent(NULL)
@@ -218,18 +307,42 @@ OnlineBook::OnlineBook()
     , m_cb(NULL)
     , m_arg(NULL)
     , m_IsNotCurnOpenedBook(TRUE)
+#if ENABLE_HEDGED_FETCH
+    , m_MirrorBooksrc(NULL)
+    , m_hTimerQueue(NULL)
+#endif
 {
     memset(m_MainPage, 0, sizeof(m_MainPage));
     memset(m_ChapterPage, 0, sizeof(m_ChapterPage));
     memset(m_BookName, 0, sizeof(m_BookName));
     memset(m_Host, 0, sizeof(m_Host));
+    memset(m_MirrorHost, 0, sizeof(m_MirrorHost));
+    memset(m_MirrorPage, 0, sizeof(m_MirrorPage));
     m_hMutex = CreateMutex(NULL, FALSE, NULL);
+#if ENABLE_HEDGED_FETCH
+    m_hTimerQueue = CreateTimerQueue();
+#endif
 }
 
 OnlineBook::~OnlineBook()
 {
     std::set<req_handler_t>::iterator it;
 
+#if ENABLE_HEDGED_FETCH
+    std::set<hedge_t*>::iterator hit;
+
+    // wait for the running hedge timer, so no mirror request is issued after the cancel
+    if (m_hTimerQueue)
+    {
+        DeleteTimerQueueEx(m_hTimerQueue, INVALID_HANDLE_VALUE);
+        m_hTimerQueue = NULL;
+    }
+    // the timers which are deleted before they fire never release their hedges
+    for (hit = m_HedgeTimers.begin(); hit != m_HedgeTimers.end(); hit++)
+        _release_hedge(*hit);
+    m_HedgeTimers.clear();
+#endif
+
     for (it = m_hRequestList.begin(); it != m_hRequestList.end(); it++)
     {
         hapi_cancel(*it);
@@ -587,6 +700,12 @@ BOOL OnlineBook::ParserBook(HWND hWnd)
         }
     }
 
+#if ENABLE_HEDGED_FETCH
+    // the chapters of mirror source are mapped by title, they are loaded in the background
+    if (m_result && m_MirrorBooksrc && _header->hedged_fetch)
+        LoadMirrorChapters(hWnd, m_MirrorPage, 0);
+#endif
+
     return m_result;
 }
 
@@ -625,6 +744,7 @@ BOOL OnlineBook::ParserChapterPage(HWND hWnd, int idx)
 
     param->hWnd = hWnd;
     param->index = idx;
+    param->begin = GetTickCount();
     param->_this = this;
     param->title_list = NULL;
     param->title_url = NULL;
@@ -681,6 +801,7 @@ BOOL OnlineBook::ParserChapters(HWND hWnd, int idx)
 
     param->hWnd = hWnd;
     param->index = idx;
+    param->begin = GetTickCount();
     param->_this = this;
     param->title_list = NULL;
     param->title_url = NULL;
@@ -712,35 +833,48 @@ BOOL OnlineBook::ParserContent(HWND hWnd, int idx, u32 todo)
     std::set<req_handler_t>::iterator it;
     request_t* preq;
     char url[1024] = { 0 };
+    BOOL requesting;
 
     if (idx < 0 || idx >= (int)m_Chapters.size())
         return FALSE;
 
     // check it's requesting
     WaitForSingleObject(m_hMutex, INFINITE);
+    requesting = FALSE;
     for (it = m_hRequestList.begin(); it != m_hRequestList.end(); it++)
     {
         preq = hapi_get_request_info(*it);
         param = (req_content_param_t*)preq->param1;
         if (preq->completer == GetContentCompleter && param->index == idx)
         {
-            // update
+            // update, the chapter may be requested from both the primary and the mirror source
             if (param->todo != todo)
                 param->todo = todo;
-            ReleaseMutex(m_hMutex);
-            return TRUE;
+            if (param->hedge)
+                param->hedge->todo = todo;
+            requesting = TRUE;
         }
     }
     ReleaseMutex(m_hMutex);
+    if (requesting)
+        return TRUE;
 
     param = (req_content_param_t*)malloc(sizeof(req_content_param_t));
 
     param->hWnd = hWnd;
     param->index = idx;
+    param->begin = GetTickCount();
     param->todo = todo;
     param->_this = this;
+    param->booksrc = m_Booksrc;
+    param->hedge = NULL;
     param->text = NULL;
     param->textlen = 0;
+#if ENABLE_HEDGED_FETCH
+    // only the chapter which user is waiting for is hedged
+    if (todo != todo_nothing)
+        param->hedge = NewHedge(hWnd, idx, todo);
+#endif
 
     // check URL
     combine_url(m_Chapters[idx].url.c_str(), m_MainPage, url);
@@ -761,6 +895,15 @@ BOOL OnlineBook::ParserContent(HWND hWnd, int idx, u32 todo)
         m_hRequestList.insert(hReq);
         ReleaseMutex(m_hMutex);
     }
+#if ENABLE_HEDGED_FETCH
+    else if (param->hedge)
+    {
+        // the mirror is requested at once
+        OnHedgeFailed(param->hedge);
+        _release_hedge(param->hedge);
+        free(param);
+    }
+#endif
     return TRUE;
 }
 
@@ -883,6 +1026,9 @@ BOOL OnlineBook::ReadOlFile(BOOL fast)
     m_Booksrc = FindBookSource(m_Host);
     if (!m_Booksrc)
         goto fail;
+#if ENABLE_HEDGED_FETCH
+    m_MirrorBooksrc = m_MirrorHost[0] ? FindBookSource(m_MirrorHost) : NULL;
+#endif
 
     // parse text
     if (m_Chapters.size() > 0 && len > (int)header->header_size)
@@ -1047,63 +1193,6 @@ BOOL OnlineBook::OnUpDownEvent(HWND hWnd, int draw_type)
     return TRUE;
 }
 
-void OnlineBook::TidyHtml(char* html, int* len)
-{
-    char* buf = NULL;
-    int index = 0;
-    int i;
-
-    buf = (char*)malloc((*len)+1);
-    if (!buf)
-        return;
-    for (i = 0; i < *len; i++)
-    {
-        // replace "<br><br>"
-        if (i < (*len - 8) && strncmp(html+i, "<br><br>", 8) == 0)
-        {
-            buf[index++] = '\n';
-            i += 7;
-        }
-        else if (i < (*len - 4) && strncmp(html+i, "<br>", 4) == 0)
-        {
-            buf[index++] = '\n';
-            i += 3;
-        }
-        else
-        {
-            buf[index++] = html[i];
-        }
-    }
-    if (index < *len)
-    {
-        *len = index;
-        buf[index] = 0;
-        memcpy(html, buf, index + 1);
-    }
-    free(buf);
-}
-
-void OnlineBook::FormatHtml(char** html, int* len, int *needfree)
-{
-    char *htmlfmt = NULL;
-    int lenfmt = 0;
-
-    if (*html && (*len) > 0)
-    {
-        HtmlParser::Instance()->FormatHtml(*html, *len, &htmlfmt, &lenfmt);
-        if (htmlfmt && lenfmt > 0)
-        {
-            if ((*needfree) == 1)
-                free(*html);
-            *html = htmlfmt;
-            *len = lenfmt;
-            *needfree = 2;
-            //HtmlParser::Instance()->FreeFormat(htmlfmt);
-            TidyHtml(*html, len);
-        }
-    }
-}
-
 void OnlineBook::TidyUrl(char* html, int* len)
 {
     char* buf = NULL;
@@ -1217,100 +1306,30 @@ BOOL OnlineBook::RequestNextPage(OnlineBook *_this, request_t *r, const char *ur
     return hReq != NULL;
 }
 
-int OnlineBook::FilterContent(TCHAR* text, int *len)
+void OnlineBook::AddSourceStat(request_result_t* result, DWORD* begin, BOOL parse_fail, book_source_t* bs)
 {
-    int srclen = *len;
-    int dstlen = 0;
-    int i,found = 0,kwlen = 0;
-    int offset = 0;
-    TCHAR *dsttext = NULL;
-    std::wcmatch cm;
-    std::wregex* e = NULL;
+    stat_result_t sr = sr_succ;
 
-    if (m_Booksrc->content_filter_type == 1) // filter by keyword
-    {
-        dsttext = (TCHAR*)malloc(sizeof(TCHAR) * (srclen + 1));
-        memset(dsttext, 0, sizeof(TCHAR) * (srclen + 1));
-        kwlen = (int)_tcslen(m_Booksrc->content_filter_keyword);
-        for (i=0; i<srclen; i++)
-        {
-            if (srclen-i > kwlen)
-            {
-                if (_tcsncmp(text + i, m_Booksrc->content_filter_keyword, kwlen) == 0)
-                {
-                    found = 1;
-                    i += kwlen-1; // for loop will i++, so kwlen-1
-                    continue;
-                }
-            }
-            dsttext[dstlen++] = text[i];
-        }
-        if (found)
-        {
-            memcpy(text, dsttext, sizeof(TCHAR) * (dstlen + 1));
-            *len = dstlen;
-            if (dstlen == 0)
-            {
-                text[0] =_T('\n');
-                *len = 1;
-            }
-        }
-    }
-    else if (m_Booksrc->content_filter_type == 2) // filter by regex
-    {
-        try
-        {
-            e = new std::wregex(m_Booksrc->content_filter_keyword);
-        }
-        catch (...)
-        {
-            if (e)
-            {
-                delete e;
-            }
-            return found;
-        }
-        dsttext = (TCHAR*)malloc(sizeof(TCHAR) * (srclen + 1));
-        memset(dsttext, 0, sizeof(TCHAR) * (srclen + 1));
+    if (!begin || result->cancel || m_bForceKill)
+        return;
+    if (result->errno_ != succ || result->status_code != 200)
+        sr = sr_error;
+    else if (parse_fail)
+        sr = sr_parse_fail;
+    SourceStat::Instance()->AddRequest(bs ? bs : m_Booksrc, GetTickCount() - *begin, sr);
+    // the next page of the same request is measured from now
+    *begin = GetTickCount();
+}
 
-        while (std::regex_search(text + offset, cm, *e, std::regex_constants::format_first_only))
-        {
-            found = 1;
-            if (cm.position() > 0)
-            {
-                memcpy(dsttext + dstlen, text + offset, sizeof(TCHAR) * cm.position());
-                dstlen += (int)cm.position();
-            }
-            offset += (int)(cm.position() + cm.length());
-        }
-        if (e)
-        {
-            delete e;
-        }
-        if (found)
-        {
-            if (srclen > offset)
-            {
-                memcpy(dsttext + dstlen, text + offset, sizeof(TCHAR) * (srclen - offset));
-                dstlen += (srclen - offset);
-            }
-            memcpy(text, dsttext, sizeof(TCHAR) * (dstlen + 1));
-            *len = dstlen;
-            if (dstlen == 0)
-            {
-                text[0] = _T('\n');
-                *len = 1;
-            }
-        }
-    }
-    else // not do filter
-    {
-    }
-    if (dsttext)
-    {
-        free(dsttext);
-    }
-    return found;
+int OnlineBook::FilterContent(book_source_t* bs, TCHAR* text, int *len)
+{
+    std::shared_ptr<ContentFilter> filter;
+
+    // compiled once per book source, all patterns are removed in one pass
+    filter = ContentFilter::Get(bs);
+    if (!filter)
+        return 0;
+    return filter->Apply(text, len);
 }
 
 BOOL OnlineBook::GenerateOlHeader(ol_header_t** header)
@@ -1325,12 +1344,17 @@ BOOL OnlineBook::GenerateOlHeader(ol_header_t** header)
     int bookname_size = ((int)_tcslen(m_BookName) + 1) * sizeof(TCHAR);
     int mainpage_size = ((int)strlen(m_MainPage) + 1) * sizeof(char);
     int host_size = ((int)strlen(m_Host) + 1) * sizeof(char);
+    int mirror_size = 0;
+
+    if (m_MirrorHost[0] && m_MirrorPage[0])
+        mirror_size = (int)(strlen(m_MirrorHost) + 1 + strlen(m_MirrorPage) + 1) * sizeof(char);
 
     // calc buf size
     buf_size += base_size;
     buf_size += bookname_size;
     buf_size += mainpage_size;
     buf_size += host_size;
+    buf_size += mirror_size;
     for (i = 0; i < (int)m_Chapters.size(); i++)
     {
         buf_size += ((int)m_Chapters[i].title.size() + 1) * sizeof(TCHAR);
@@ -1349,6 +1373,10 @@ BOOL OnlineBook::GenerateOlHeader(ol_header_t** header)
     offset += mainpage_size;
     header_->host_offset = offset;
     offset += host_size;
+    header_->mirror_magic = mirror_size ? OL_MIRROR_MAGIC : 0;
+    header_->mirror_offset = mirror_size ? offset : 0;
+    offset += mirror_size;
+    memset(header_->reserve, 0, sizeof(header_->reserve));
     header_->update_time = m_UpdateTime;
     // header_->is_finished = m_IsFinished; deprecated
     header_->chapter_size = (int)m_Chapters.size();
@@ -1367,6 +1395,11 @@ BOOL OnlineBook::GenerateOlHeader(ol_header_t** header)
     memcpy(buf + header_->book_name_offset, m_BookName, bookname_size);
     memcpy(buf + header_->main_page_offset, m_MainPage, mainpage_size);
     memcpy(buf + header_->host_offset, m_Host, host_size);
+    if (mirror_size)
+    {
+        strcpy(buf + header_->mirror_offset, m_MirrorHost);
+        strcpy(buf + header_->mirror_offset + strlen(m_MirrorHost) + 1, m_MirrorPage);
+    }
     for (i = 0; i < (int)m_Chapters.size(); i++)
     {
         memcpy(buf + header_->chapter_info_list[i].title_offset, m_Chapters[i].title.c_str(), (m_Chapters[i].title.size() + 1) * sizeof(TCHAR));
@@ -1388,6 +1421,13 @@ BOOL OnlineBook::ParseOlHeader(ol_header_t* header)
     strcpy(m_MainPage, buf + header->main_page_offset);
     strcpy(m_Host, buf + header->host_offset);
     m_UpdateTime = header->update_time;
+    memset(m_MirrorHost, 0, sizeof(m_MirrorHost));
+    memset(m_MirrorPage, 0, sizeof(m_MirrorPage));
+    if (header->mirror_magic == OL_MIRROR_MAGIC && header->mirror_offset < header->header_size)
+    {
+        strncpy(m_MirrorHost, buf + header->mirror_offset, sizeof(m_MirrorHost) - 1);
+        strncpy(m_MirrorPage, buf + header->mirror_offset + strlen(m_MirrorHost) + 1, sizeof(m_MirrorPage) - 1);
+    }
 
     m_Chapters.clear();
     for (i = 0; i < chapter_size; i++)
@@ -1407,7 +1447,7 @@ BOOL OnlineBook::ParseOlHeader(ol_header_t* header)
 unsigned int OnlineBook::GetChapterPageCompleter(request_result_t *result)
 {
     req_chapter_param_t* param = (req_chapter_param_t*)result->param1;
-    OnlineBook* _this = (OnlineBook*)param->_this;
+    OnlineBook* _this = NULL;
     char* html = NULL;
     int htmllen = 0;
     std::vector<std::string> chapter_url;
@@ -1415,7 +1455,12 @@ unsigned int OnlineBook::GetChapterPageCompleter(request_result_t *result)
     void* ctx = NULL;
     int needfree = 0;
     int ret = 1;
+    BOOL parse_fail = FALSE;
+    DWORD* stat_begin = param ? &param->begin : NULL;
 
+    if (!param)
+        goto end;
+    _this = (OnlineBook*)param->_this;
     check_request_result(result);
 
     HtmlParser::Instance()->HtmlParseBegin(html, htmllen, &doc, &ctx, &_this->m_bForceKill);
@@ -1427,6 +1472,7 @@ unsigned int OnlineBook::GetChapterPageCompleter(request_result_t *result)
 
     if (chapter_url.size() == 0)
     {
+        parse_fail = TRUE;
         DumpParseErrorFile(html, htmllen);
         goto end;
     }
@@ -1440,9 +1486,11 @@ unsigned int OnlineBook::GetChapterPageCompleter(request_result_t *result)
     ret = 0;
 
 end:
+    if (_this)
+        _this->AddSourceStat(result, stat_begin, parse_fail);
     if (needfree && html)
         free(html);
-    if (!result->cancel)
+    if (_this && !result->cancel)
     {
         if (ret && _this->m_hEvent)
             SetEvent(_this->m_hEvent);
@@ -1464,7 +1512,7 @@ end:
         // -->
         free(param);
     }
-    if (ret != 0)
+    if (ret != 0 && _this)
     {
         if (_this->m_cb)
             _this->m_cb(FALSE, ret, _this->m_arg);
@@ -1472,32 +1520,90 @@ end:
     return ret;
 }
 
+BOOL OnlineBook::OnChapterRow(const char** values, int count, void* arg)
+{
+    chapter_rows_t* rows = (chapter_rows_t*)arg;
+    chapter_item_t item;
+    TCHAR* dst = NULL;
+    int dstlen;
+    char dsturl[1024];
+
+    rows->count++;
+    if (rows->title_list)
+    {
+        // keep them until the last page is received
+        rows->title_list->Append(values[0], -1);
+        rows->title_url->Append(values[1], -1);
+        return TRUE;
+    }
+
+    // format title
+    dst = Utf8ToUtf16(values[0]);
+    dstlen = (int)_tcslen(dst);
+    rows->_this->FormatText(dst, &dstlen);
+
+    combine_url(values[1], rows->baseurl, dsturl);
+
+    item.index = -1;
+    item.size = 0;
+    item.title = dst;
+    item.url = dsturl;
+    item.title_len = dstlen;
+    rows->chapters->push_back(item);
+    return !rows->_this->m_bForceKill;
+}
+
 unsigned int OnlineBook::GetChaptersCompleter(request_result_t *result)
 {
     req_chapter_param_t* param = (req_chapter_param_t*)result->param1;
-    OnlineBook* _this = (OnlineBook*)param->_this;
+    OnlineBook* _this = NULL;
     char* html = NULL;
     int htmllen = 0;
-    std::vector<std::string> title_list;
-    std::vector<std::string> title_url;
+    std::vector<std::string> rows;
     std::vector<std::string> url_xpath;
     std::vector<std::string> keyword_xpath;
     void* doc = NULL;
     void* ctx = NULL;
     int i;
     chapter_data_t chapters;
+    chapter_rows_t chapter_rows = { 0 };
+    int rows_ret = 1;
     chapter_item_t item;
     TCHAR* dst = NULL;
     int dstlen;
     int needfree = 0;
     int ret = 1;
+    BOOL parse_fail = FALSE;
+    DWORD* stat_begin = param ? &param->begin : NULL;
     char dsturl[1024];
 
+    if (!param)
+        goto end;
+    _this = (OnlineBook*)param->_this;
     check_request_result(result);
 
+    chapters._this = _this;
+    chapter_rows._this = _this;
+    chapter_rows.baseurl = result->req->url;
+    chapter_rows.chapters = &chapters.chapters;
+    if (_this->m_Booksrc->enable_chapter_next)
+    {
+        // save data
+        if (param->title_url == NULL)
+        {
+            param->title_url = new XpathResult;
+            param->title_list = new XpathResult(TRUE);
+        }
+        chapter_rows.title_list = param->title_list;
+        chapter_rows.title_url = param->title_url;
+    }
+
+    // title and url are zipped in one pass
+    rows.push_back(_this->m_Booksrc->chapter_title_xpath);
+    rows.push_back(_this->m_Booksrc->chapter_url_xpath);
+
     HtmlParser::Instance()->HtmlParseBegin(html, htmllen, &doc, &ctx, &_this->m_bForceKill);
-    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->chapter_title_xpath, title_list, &_this->m_bForceKill);
-    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->chapter_url_xpath, title_url, &_this->m_bForceKill);
+    rows_ret = HtmlParser::Instance()->HtmlParseRowsByXpath(doc, ctx, rows, OnChapterRow, &chapter_rows, &_this->m_bForceKill);
     if (_this->m_Booksrc->enable_chapter_next)
     {
         HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->chapter_next_url_xpath, url_xpath, &_this->m_bForceKill, TRUE);
@@ -1508,71 +1614,41 @@ unsigned int OnlineBook::GetChaptersCompleter(request_result_t *result)
     if (_this->m_bForceKill)
         goto end;
 
-    if (title_list.size() == 0 || title_list.size() != title_url.size())
+    // no chapter, or the title and url are mismatched
+    if (rows_ret != 0 || chapter_rows.count == 0)
     {
+        parse_fail = TRUE;
         DumpParseErrorFile(html, htmllen);
         goto end;
     }
 
     if (_this->m_Booksrc->enable_chapter_next)
     {
-        // save data
-        if (param->title_url == NULL)
-        {
-            param->title_url = new std::vector<std::string>;
-            param->title_list = new std::vector<std::string>;
-        }
-
-        param->title_url->insert(param->title_url->end(), title_url.begin(), title_url.end());
-        param->title_list->insert(param->title_list->end(), title_list.begin(), title_list.end());
-
         if (!url_xpath.empty() && !keyword_xpath.empty())
         {
             if (strstr(_this->m_Booksrc->chapter_next_keyword, keyword_xpath[0].c_str())) // exist next content
             {
-                // request next content
+                // request next content, count this page before the param is passed to the next request
+                _this->AddSourceStat(result, stat_begin, FALSE);
+                stat_begin = NULL;
                 if (_this->RequestNextPage(_this, result->req, url_xpath[0].c_str(), result->handler))
                     goto _next;
             }
         }
 
         // update chapter
-        chapters._this = _this;
-        for (i = 0; i < (int)param->title_url->size(); i++)
+        for (i = 0; i < param->title_url->Size(); i++)
         {
             if (_this->m_bForceKill)
                 goto end;
 
-            // format title
-            dst = Utf8ToUtf16(param->title_list->at(i).c_str());
-            dstlen = (int)_tcslen(dst);
+            // format title, it is formatted in the result set directly
+            dst = param->title_list->WAt(i, &dstlen);
+            if (!dst)
+                continue;
             _this->FormatText(dst, &dstlen);
 
-            combine_url(param->title_url->at(i).c_str(), result->req->url, dsturl);
-
-            item.index = -1;
-            item.size = 0;
-            item.title = dst;
-            item.url = dsturl;
-            item.title_len = dstlen;
-            chapters.chapters.push_back(item);
-        }
-    }
-    else
-    {
-        // update chapter
-        chapters._this = _this;
-        for (i = 0; i < (int)title_url.size(); i++)
-        {
-            if (_this->m_bForceKill)
-                goto end;
-
-            // format title
-            dst = Utf8ToUtf16(title_list[i].c_str());
-            dstlen = (int)_tcslen(dst);
-            _this->FormatText(dst, &dstlen);
-
-            combine_url(title_url[i].c_str(), result->req->url, dsturl);
+            combine_url(param->title_url->At(i), result->req->url, dsturl);
 
             item.index = -1;
             item.size = 0;
@@ -1600,9 +1676,11 @@ unsigned int OnlineBook::GetChaptersCompleter(request_result_t *result)
     ret = 0;
 
 end:
+    if (_this)
+        _this->AddSourceStat(result, stat_begin, parse_fail);
     if (needfree && html)
         free(html);
-    if (!result->cancel)
+    if (_this && !result->cancel)
     {
         if (ret && _this->m_hEvent)
             SetEvent(_this->m_hEvent);
@@ -1629,7 +1707,7 @@ end:
             delete param->title_list;
         free(param);
     }
-    if (chapters.ret != 0)
+    if (chapters.ret != 0 && _this)
     {
         if (_this->m_cb)
             _this->m_cb(chapters.is_updated, ret, _this->m_arg);
@@ -1645,7 +1723,7 @@ _next:
 unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
 {
     req_content_param_t* param = (req_content_param_t*)result->param1;
-    OnlineBook* _this = (OnlineBook*)param->_this;
+    OnlineBook* _this = NULL;
     char* html = NULL;
     int htmllen = 0;
     std::vector<std::string> content_list;
@@ -1658,20 +1736,24 @@ unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
     int dstlen;
     int needfree = 0;
     int ret = 1;
+    BOOL parse_fail = FALSE;
+    BOOL quiet = FALSE; // don't stop the loading, the other request is not completed
+    DWORD* stat_begin = param ? &param->begin : NULL;
+    book_source_t* bs = NULL;
 
-    check_request_result(result);
-
-    _this->FormatHtml(&html, &htmllen, &needfree);
-
-    if (_this->m_bForceKill)
+    if (!param)
         goto end;
+    _this = (OnlineBook*)param->_this;
+    check_request_result(result);
+    bs = param->booksrc;
 
+    // parse once, the text is taken from the content nodes directly
     HtmlParser::Instance()->HtmlParseBegin(html, htmllen, &doc, &ctx, &_this->m_bForceKill);
-    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->content_xpath, content_list, &_this->m_bForceKill);
-    if (_this->m_Booksrc->enable_content_next)
+    HtmlParser::Instance()->HtmlParseTextByXpath(doc, ctx, bs->content_xpath, content_list, &_this->m_bForceKill);
+    if (bs->enable_content_next)
     {
-        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->content_next_url_xpath, url_xpath, &_this->m_bForceKill, TRUE);
-        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _this->m_Booksrc->content_next_keyword_xpath, keyword_xpath, &_this->m_bForceKill, TRUE);
+        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, bs->content_next_url_xpath, url_xpath, &_this->m_bForceKill, TRUE);
+        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, bs->content_next_keyword_xpath, keyword_xpath, &_this->m_bForceKill, TRUE);
     }
     HtmlParser::Instance()->HtmlParseEnd(doc, ctx);
     
@@ -1680,6 +1762,7 @@ unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
 
     if (content_list.size() == 0 || content_list[0].size() == 0)
     {
+        parse_fail = TRUE;
         DumpParseErrorFile(html, htmllen);
         goto end;
     }
@@ -1688,7 +1771,7 @@ unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
     if (!param || param->index < 0 || param->index >= (int)_this->m_Chapters.size())
         goto end;
 
-    if (_this->m_Booksrc->enable_content_next)
+    if (bs->enable_content_next)
     {
         if (param->text == NULL)
         {
@@ -1720,7 +1803,7 @@ unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
     if (_this->m_bForceKill)
         goto end;
 
-    if (_this->FilterContent(dst, &dstlen))
+    if (_this->FilterContent(bs, dst, &dstlen))
     {
         _this->FormatText(dst, &dstlen);
     }
@@ -1728,7 +1811,7 @@ unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
     if (_this->m_bForceKill)
         goto end;
 
-    if (_this->m_Booksrc->enable_content_next)
+    if (bs->enable_content_next)
     {
         // save data
         if (param->text == NULL)
@@ -1748,9 +1831,11 @@ unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
 
         if (!url_xpath.empty() && !keyword_xpath.empty())
         {
-            if (strstr(_this->m_Booksrc->content_next_keyword, keyword_xpath[0].c_str())) // exist next content
+            if (strstr(bs->content_next_keyword, keyword_xpath[0].c_str())) // exist next content
             {
-                // request next content
+                // request next content, count this page before the param is passed to the next request
+                _this->AddSourceStat(result, stat_begin, FALSE, bs);
+                stat_begin = NULL;
                 if (_this->RequestNextPage(_this, result->req, url_xpath[0].c_str(), result->handler))
                     goto _next;
             }
@@ -1771,21 +1856,34 @@ unsigned int OnlineBook::GetContentCompleter(request_result_t *result)
         data.todo = param->todo;
     }
 
+#if ENABLE_HEDGED_FETCH
+    // the first valid response wins, the other request is cancelled
+    if (param->hedge && !_this->ClaimHedge(param->hedge, result->handler))
+    {
+        quiet = TRUE;
+        goto end;
+    }
+#endif
+
     SendMessage(param->hWnd, WM_BOOK_EVENT, BE_UPATE_CONTENT, (LPARAM)&data);
 
     _this->m_result = TRUE;
     ret = 0;
 
 end:
-    if (html)
-        if (needfree == 1)
-            free(html);
-        else if (needfree == 2)
-            HtmlParser::Instance()->FreeFormat(html);
+    if (_this)
+        _this->AddSourceStat(result, stat_begin, parse_fail, param->booksrc);
+    if (html && needfree)
+        free(html);
     if (dst)
         free(dst);
-    if (!result->cancel)
+    if (_this && !result->cancel)
     {
+#if ENABLE_HEDGED_FETCH
+        // the error is not shown if the other request may succeed
+        if (ret && !quiet && param && param->hedge)
+            quiet = _this->OnHedgeFailed(param->hedge);
+#endif
         if (_this->m_hEvent)
             SetEvent(_this->m_hEvent);
         if (_this->m_hMutex)
@@ -1797,20 +1895,32 @@ end:
         }
         if (param)
         {
-            _this->StopLoading(param->hWnd, param->index);
+            if (!quiet)
+                _this->StopLoading(param->hWnd, param->index);
             if (param->text)
                 free(param->text);
+#if ENABLE_HEDGED_FETCH
+            if (param->hedge)
+                _release_hedge(param->hedge);
+#endif
             free(param);
         }
     }
+#if ENABLE_HEDGED_FETCH
+    else if (param && param->hedge)
+    {
+        // cancelled by the winner, _this is not touched
+        if (param->text)
+            free(param->text);
+        _release_hedge(param->hedge);
+        free(param);
+    }
+#endif
     return ret;
 
 _next:
-    if (html)
-        if (needfree == 1)
-            free(html);
-        else if (needfree == 2)
-            HtmlParser::Instance()->FreeFormat(html);
+    if (html && needfree)
+        free(html);
     if (dst)
         free(dst);
     return 1;
@@ -1819,6 +1929,9 @@ _next:
 void OnlineBook::UpdateBookSource(void)
 {
     m_Booksrc = FindBookSource(m_Host);
+#if ENABLE_HEDGED_FETCH
+    m_MirrorBooksrc = m_MirrorHost[0] ? FindBookSource(m_MirrorHost) : NULL;
+#endif
 }
 
 int OnlineBook::CheckUpdate(HWND hWnd, olbook_checkupdate_callback cb, void* arg)
@@ -1865,4 +1978,348 @@ int OnlineBook::ManualCheckUpdate(HWND hWnd, olbook_checkupdate_callback cb, voi
     return 2; // do check
 }
 
+#if ENABLE_HEDGED_FETCH
+BOOL OnlineBook::LoadMirrorChapters(HWND hWnd, const char* url, int stage)
+{
+    request_t req;
+    req_mirror_param_t* param = NULL;
+    req_handler_t hReq;
+    char url_[1024] = { 0 };
+
+    if (!m_MirrorBooksrc || !url || !url[0])
+        return FALSE;
+
+    // parse chapter list page at first
+    if (stage == 0 && !m_MirrorBooksrc->enable_chapter_page)
+        stage = 1;
+
+    param = (req_mirror_param_t*)malloc(sizeof(req_mirror_param_t));
+
+    param->hWnd = hWnd;
+    param->stage = stage;
+    param->begin = GetTickCount();
+    param->_this = this;
+
+    strncpy(url_, url, sizeof(url_) - 1);
+    memset(&req, 0, sizeof(request_t));
+    req.method = GET;
+    req.url = url_;
+    req.completer = GetMirrorChaptersCompleter;
+    req.param1 = param;
+    req.param2 = NULL;
+
+    logger_printk("Request to: %s", req.url);
+
+    hReq = hapi_request(&req);
+    if (!hReq)
+    {
+        free(param);
+        return FALSE;
+    }
+    WaitForSingleObject(m_hMutex, INFINITE);
+    m_hRequestList.insert(hReq);
+    ReleaseMutex(m_hMutex);
+    return TRUE;
+}
+
+unsigned int OnlineBook::GetMirrorChaptersCompleter(request_result_t* result)
+{
+    req_mirror_param_t* param = (req_mirror_param_t*)result->param1;
+    OnlineBook* _this = NULL;
+    book_source_t* bs = NULL;
+    char* html = NULL;
+    int htmllen = 0;
+    std::vector<std::string> chapter_url;
+    std::vector<std::string> rows;
+    std::map<std::wstring, std::string> chapters;
+    mirror_rows_t mirror_rows = { 0 };
+    int rows_ret = 1;
+    void* doc = NULL;
+    void* ctx = NULL;
+    char dsturl[1024] = { 0 };
+    int needfree = 0;
+    int ret = 1;
+    BOOL parse_fail = FALSE;
+
+    if (!param)
+        goto end;
+    _this = (OnlineBook*)param->_this;
+    check_request_result(result);
+
+    bs = _this->m_MirrorBooksrc;
+    if (!bs)
+        goto end;
+
+    HtmlParser::Instance()->HtmlParseBegin(html, htmllen, &doc, &ctx, &_this->m_bForceKill);
+    if (param->stage == 0)
+    {
+        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, bs->chapter_page_xpath, chapter_url, &_this->m_bForceKill);
+    }
+    else
+    {
+        // only the first page of chapter list, the next pages are not followed
+        mirror_rows._this = _this;
+        mirror_rows.baseurl = result->req->url;
+        mirror_rows.chapters = &chapters;
+        rows.push_back(bs->chapter_title_xpath);
+        rows.push_back(bs->chapter_url_xpath);
+        rows_ret = HtmlParser::Instance()->HtmlParseRowsByXpath(doc, ctx, rows, OnMirrorRow, &mirror_rows, &_this->m_bForceKill);
+    }
+    HtmlParser::Instance()->HtmlParseEnd(doc, ctx);
+
+    if (_this->m_bForceKill)
+        goto end;
+
+    if (param->stage == 0)
+    {
+        if (chapter_url.size() == 0)
+        {
+            parse_fail = TRUE;
+            goto end;
+        }
+        combine_url(chapter_url[0].c_str(), result->req->url, dsturl);
+        _this->LoadMirrorChapters(param->hWnd, dsturl, 1);
+    }
+    else
+    {
+        if (rows_ret != 0 || chapters.empty())
+        {
+            parse_fail = TRUE;
+            goto end;
+        }
+        logger_printk("mirror chapters: %d", (int)chapters.size());
+        WaitForSingleObject(_this->m_hMutex, INFINITE);
+        _this->m_MirrorChapters.swap(chapters);
+        ReleaseMutex(_this->m_hMutex);
+    }
+    ret = 0;
+
+end:
+    if (needfree && html)
+        free(html);
+    if (_this && !result->cancel)
+    {
+        if (bs)
+            _this->AddSourceStat(result, &param->begin, parse_fail, bs);
+        if (_this->m_hMutex)
+        {
+            WaitForSingleObject(_this->m_hMutex, INFINITE);
+            if (_this->m_hRequestList.find(result->handler) != _this->m_hRequestList.end())
+                _this->m_hRequestList.erase(result->handler);
+            ReleaseMutex(_this->m_hMutex);
+        }
+    }
+    if (param)
+        free(param);
+    return ret;
+}
+
+BOOL OnlineBook::OnMirrorRow(const char** values, int count, void* arg)
+{
+    mirror_rows_t* rows = (mirror_rows_t*)arg;
+    wchar_t* title = NULL;
+    int len = 0;
+    std::wstring key;
+    char dsturl[1024] = { 0 };
+
+    title = utf8_to_utf16(values[0], (int)strlen(values[0]), &len);
+    if (!title)
+        return TRUE;
+    key = _normalize_title(title);
+    free(title);
+    if (!key.empty())
+    {
+        combine_url(values[1], rows->baseurl, dsturl);
+        // the first one is kept if the title is repeated
+        rows->chapters->insert(std::make_pair(key, std::string(dsturl)));
+    }
+    return !rows->_this->m_bForceKill;
+}
+
+hedge_t* OnlineBook::NewHedge(HWND hWnd, int idx, u32 todo)
+{
+    std::map<std::wstring, std::string>::iterator it;
+    std::wstring key;
+    hedge_t* hedge = NULL;
+    source_health_t health;
+    int delay = HEDGE_DEFAULT_DELAY;
+
+    if (!_header->hedged_fetch)
+        return NULL;
+    if (!m_MirrorBooksrc || !m_hTimerQueue || idx < 0 || idx >= (int)m_Chapters.size())
+        return NULL;
+    if (SourceStat::Instance()->IsDown(m_MirrorBooksrc))
+        return NULL;
+
+    // the chapter is mapped to the mirror source by title
+    key = _normalize_title(m_Chapters[idx].title.c_str());
+    if (key.empty())
+        return NULL;
+    hedge = (hedge_t*)calloc(1, sizeof(hedge_t));
+    if (!hedge)
+        return NULL;
+    WaitForSingleObject(m_hMutex, INFINITE);
+    it = m_MirrorChapters.find(key);
+    if (it != m_MirrorChapters.end())
+        strncpy(hedge->url, it->second.c_str(), sizeof(hedge->url) - 1);
+    ReleaseMutex(m_hMutex);
+    if (!hedge->url[0])
+    {
+        free(hedge);
+        return NULL;
+    }
+
+    // the primary source is slower than usual, by the p90 of its recent requests
+    if (SourceStat::Instance()->GetHealth(m_Booksrc, &health))
+    {
+        if (health.down)
+            delay = HEDGE_MIN_DELAY;
+        else if (health.latency_p90 > 0)
+            delay = health.latency_p90;
+    }
+    if (delay < HEDGE_MIN_DELAY)
+        delay = HEDGE_MIN_DELAY;
+    if (delay > HEDGE_MAX_DELAY)
+        delay = HEDGE_MAX_DELAY;
+
+    hedge->ref = 2; // the primary request and the timer
+    hedge->pending = 1;
+    hedge->_this = this;
+    hedge->hWnd = hWnd;
+    hedge->index = idx;
+    hedge->todo = todo;
+    // registered before the timer is created, the callback may run at once
+    WaitForSingleObject(m_hMutex, INFINITE);
+    m_HedgeTimers.insert(hedge);
+    ReleaseMutex(m_hMutex);
+    if (!CreateTimerQueueTimer(&hedge->hTimer, m_hTimerQueue, OnHedgeTimer, hedge, delay, 0, WT_EXECUTEONLYONCE))
+    {
+        WaitForSingleObject(m_hMutex, INFINITE);
+        m_HedgeTimers.erase(hedge);
+        ReleaseMutex(m_hMutex);
+        hedge->hTimer = NULL;
+        hedge->ref--;
+    }
+    return hedge;
+}
+
+VOID CALLBACK OnlineBook::OnHedgeTimer(PVOID lpParam, BOOLEAN TimerOrWaitFired)
+{
+    hedge_t* hedge = (hedge_t*)lpParam;
+    OnlineBook* _this = hedge->_this;
+
+    // the book is alive, the destructor waits for this callback
+    WaitForSingleObject(_this->m_hMutex, INFINITE);
+    _this->m_HedgeTimers.erase(hedge);
+    if (!hedge->done && !hedge->fired && !_this->m_bForceKill)
+    {
+        logger_printk("chapter %d is slow, request it from mirror", hedge->index);
+        _this->RequestMirror(hedge);
+    }
+    ReleaseMutex(_this->m_hMutex);
+    DeleteTimerQueueTimer(_this->m_hTimerQueue, hedge->hTimer, NULL);
+    _release_hedge(hedge);
+}
+
+// m_hMutex is locked by the caller
+void OnlineBook::RequestMirror(hedge_t* hedge)
+{
+    request_t req;
+    req_content_param_t* param = NULL;
+    req_handler_t hReq;
+
+    hedge->fired = TRUE;
+    if (!m_MirrorBooksrc)
+        return;
+
+    param = (req_content_param_t*)malloc(sizeof(req_content_param_t));
+
+    param->hWnd = hedge->hWnd;
+    param->index = hedge->index;
+    param->begin = GetTickCount();
+    param->todo = hedge->todo;
+    param->_this = this;
+    param->booksrc = m_MirrorBooksrc;
+    param->hedge = hedge;
+    param->text = NULL;
+    param->textlen = 0;
+    InterlockedIncrement(&hedge->ref);
+
+    memset(&req, 0, sizeof(request_t));
+    req.method = GET;
+    req.url = hedge->url;
+    req.completer = GetContentCompleter;
+    req.param1 = param;
+    req.param2 = NULL;
+
+    logger_printk("Request to: %s", req.url);
+
+    hReq = hapi_request(&req);
+    if (!hReq)
+    {
+        _release_hedge(hedge);
+        free(param);
+        return;
+    }
+    hedge->pending++;
+    m_hRequestList.insert(hReq);
+}
+
+BOOL OnlineBook::ClaimHedge(hedge_t* hedge, req_handler_t handler)
+{
+    std::set<req_handler_t>::iterator it;
+    std::vector<req_handler_t> losers;
+    request_t* preq;
+    req_content_param_t* param;
+    BOOL win;
+    size_t i;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    win = !hedge->done;
+    if (win)
+    {
+        hedge->done = TRUE;
+        // cancel the other request of this chapter, its param is freed by the completer
+        for (it = m_hRequestList.begin(); it != m_hRequestList.end(); )
+        {
+            preq = hapi_get_request_info(*it);
+            param = (req_content_param_t*)preq->param1;
+            if (*it != handler && preq->completer == GetContentCompleter && param->hedge == hedge)
+            {
+                losers.push_back(*it);
+                it = m_hRequestList.erase(it);
+            }
+            else
+            {
+                it++;
+            }
+        }
+    }
+    ReleaseMutex(m_hMutex);
+
+    // the canceled completer may take m_hMutex, so don't hold it
+    for (i = 0; i < losers.size(); i++)
+        hapi_cancel(losers[i]);
+    return win;
+}
+
+// returns TRUE if the other request is still in progress
+BOOL OnlineBook::OnHedgeFailed(hedge_t* hedge)
+{
+    BOOL covered = FALSE;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    hedge->pending--;
+    if (!hedge->done)
+    {
+        // don't wait for the timer
+        if (!hedge->fired && !m_bForceKill)
+            RequestMirror(hedge);
+        covered = hedge->pending > 0;
+    }
+    ReleaseMutex(m_hMutex);
+    return covered;
+}
+#endif
+
 #endif
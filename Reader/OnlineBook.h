@@ -6,6 +6,7 @@
 #include "https.h"
 #include "HtmlParser.h"
 #include <set>
+#include <map>
 
 typedef enum comp_todo_t
 {
@@ -19,6 +20,8 @@ typedef enum comp_todo_t
 
 typedef void (*olbook_checkupdate_callback)(int is_update, int err, void *param);
 
+struct hedge_t;
+
 class OnlineBook : public Book
 {
 public:
@@ -48,13 +51,19 @@ protected:
     BOOL DownloadPrevNext(HWND hWnd);
     virtual BOOL OnDrawPageEvent(HWND hWnd);
     virtual BOOL OnUpDownEvent(HWND hWnd, int draw_type);
-    void FormatHtml(char **html, int *len, int *needfree);
-    void TidyHtml(char* html, int* len);
     void TidyUrl(char* html, int* len);
     void PlayLoading(HWND hWnd);
     void StopLoading(HWND hWnd, int idx);
     BOOL RequestNextPage(OnlineBook* _this, request_t *r, const char *url, req_handler_t hOld);
-    int FilterContent(TCHAR *text, int *len);
+    int FilterContent(book_source_t *bs, TCHAR *text, int *len);
+    void AddSourceStat(request_result_t *result, DWORD *begin, BOOL parse_fail, book_source_t *bs = NULL);
+#if ENABLE_HEDGED_FETCH
+    BOOL LoadMirrorChapters(HWND hWnd, const char *url, int stage);
+    hedge_t* NewHedge(HWND hWnd, int idx, u32 todo);
+    void RequestMirror(hedge_t *hedge);
+    BOOL ClaimHedge(hedge_t *hedge, req_handler_t handler);
+    BOOL OnHedgeFailed(hedge_t *hedge);
+#endif
 
 public:
     void UpdateBookSource(void);
@@ -64,7 +73,13 @@ public:
 private:
     static unsigned int GetChapterPageCompleter(request_result_t *result);
     static unsigned int GetChaptersCompleter(request_result_t *result);
+    static BOOL OnChapterRow(const char **values, int count, void *arg);
     static unsigned int GetContentCompleter(request_result_t *result);
+#if ENABLE_HEDGED_FETCH
+    static unsigned int GetMirrorChaptersCompleter(request_result_t *result);
+    static BOOL OnMirrorRow(const char **values, int count, void *arg);
+    static VOID CALLBACK OnHedgeTimer(PVOID lpParam, BOOLEAN TimerOrWaitFired);
+#endif
 
 protected:
     HANDLE m_hEvent;
@@ -82,6 +97,16 @@ protected:
     olbook_checkupdate_callback m_cb;
     void* m_arg;
     BOOL m_IsNotCurnOpenedBook;
+    // the same book from another source, the chapter which user is waiting for is requested
+    // from it too when the primary source is slow, the first valid response wins
+    char m_MirrorHost[1024];
+    char m_MirrorPage[1024];
+#if ENABLE_HEDGED_FETCH
+    book_source_t* m_MirrorBooksrc;
+    std::map<std::wstring, std::string> m_MirrorChapters; // normalized title -> url
+    HANDLE m_hTimerQueue;
+    std::set<hedge_t*> m_HedgeTimers; // the timer is not fired, guarded by m_hMutex
+#endif
 };
 
 #endif
@@ -3,8 +3,12 @@
 #include "BooksourceDlg.h"
 #include "resource.h"
 #include "HtmlParser.h"
+#include "SourceStat.h"
+#include "BookSourceStore.h"
 #include "https.h"
 #include "Utils.h"
+#include <map>
+#include <vector>
 
 extern header_t* _header;
 extern HWND _hWnd;
@@ -14,24 +18,68 @@ extern int MessageBox_(HWND hWnd, UINT textId, UINT captionId, UINT uType);
 extern int MessageBoxFmt_(HWND hWnd, UINT captionId, UINT uType, UINT formatId, ...);
 extern void combine_url(const char* path, const char* url, char* dsturl);
 
+#define QUERY_TIMEOUT       15000   // ms, for each book source
+#define QUERY_TIMER_ELAPSE  500
+#define MAX_QUERY_REQUEST   16      // sources requested at the same time by a global query
+
+struct req_query_param_t;
+
+// one book source of a query, a global query requests MAX_QUERY_REQUEST sources at the
+// same time and a finished source starts the next one
+typedef struct req_source_t {
+    req_query_param_t* query;
+    int bs_id;          // id of BookSourceStore, the position changes if the list is edited
+    req_handler_t hRequest;
+    DWORD begin;
+    int done;
+    int timeout;
+} req_source_t;
+
 typedef struct req_query_param_t {
     HWND hDlg;
     TCHAR text[256];
-    int bs_idx;
+    std::string keyword_utf8;   // converted by ui thread, the completers share them
+    std::string keyword_ansi;
     int is_global;
+    int pending;
+    int next;           // the first source which is not started
+    int canceled;
+    std::vector<req_source_t> sources;
+    std::map<std::wstring, std::pair<int, int>> books; // name + author -> row + source id, only used by ui thread
 } req_query_param_t;
 
+// the result of one source, it is inserted by ui thread
+typedef struct query_result_t {
+    req_query_param_t* query;
+    int bs_id;
+    const char* url;
+    XpathResult* name;
+    XpathResult* mainpage;
+    XpathResult* author;
+} query_result_t;
+
 static BOOL g_Enable = TRUE;
-static req_handler_t g_hRequest = NULL;
 static int g_lastPos = 0;
 static req_query_param_t* g_query_param = NULL;
+static HANDLE g_hQueryMutex = NULL;
+#if ENABLE_HEDGED_FETCH
+static std::map<int, std::pair<int, std::string>> g_mirrors; // row -> mirror source id + main page, only used by ui thread
+#endif
 
 static INT_PTR CALLBACK OnlineDlgProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam);
-static int OnRequestQuery(http_charset_t charset);
-static int OnRequestCharset(void);
+static int OnRequestQuery(req_source_t* src, http_charset_t charset);
+static int OnRequestCharset(req_source_t* src);
+static void OnQueryResult(HWND hDlg, query_result_t* qr);
+static void OnQueryTimer(HWND hDlg);
 static void EnableDialog(HWND hDlg, BOOL enable);
 static BOOL _begin_query(HWND hDlg);
-static void _end_query(HWND hDlg);
+static void _start_query(req_query_param_t* query);
+static void _cancel_query(req_query_param_t* query);
+static void _end_source(req_source_t* src);
+static void _end_query(req_query_param_t* query);
+#if ENABLE_HEDGED_FETCH
+static void _set_mirror(int row, int primary, int bs_id, const char* mainpage);
+#endif
 
 void OpenOnlineDlg(void)
 {
@@ -92,18 +140,18 @@ void TestXpathFromDump(void)
 
 void ReloadBookSourceCombobox(HWND hDlg, int iPos)
 {
-    int i;
+    int i, count = BookSourceStore::Instance()->Count();
     SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_RESETCONTENT, 0, NULL);
-    for (i = 0; i < _header->book_source_count; i++)
+    for (i = 0; i < count; i++)
     {
-        SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_ADDSTRING, 0, (LPARAM)_header->book_sources[i].title);
+        SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_ADDSTRING, 0, (LPARAM)BookSourceStore::Instance()->Get(i)->title);
     }
 #if ENABLE_GLOBAL_SEARCH
-    if (_header->book_source_count > 0)
+    if (count > 0)
         SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_ADDSTRING, 0, (LPARAM)_T("ALL"));
-    if (iPos < 0 || iPos > _header->book_source_count)
+    if (iPos < 0 || iPos > count)
 #else
-    if (g_lastPos < 0 || g_lastPos >= _header->book_source_count)
+    if (g_lastPos < 0 || g_lastPos >= count)
 #endif
         iPos = 0;
     SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_SETCURSEL, iPos, NULL);
@@ -117,6 +165,7 @@ static INT_PTR CALLBACK OnlineDlgProc(HWND hDlg, UINT message, WPARAM wParam, LP
     int iPos;
     int i, colnum;
     int idx;
+    book_source_t* bs = NULL;
     ol_book_param_t param = {0};
     HWND hHeader = NULL;
     LVITEM lvi;
@@ -125,13 +174,12 @@ static INT_PTR CALLBACK OnlineDlgProc(HWND hDlg, UINT message, WPARAM wParam, LP
     {
     case WM_INITDIALOG:
     {
-        g_hRequest = NULL;
         g_Enable = TRUE;
         HICON hIcon = LoadIcon(GetModuleHandle(NULL), MAKEINTRESOURCE(IDI_BOOK));
         SendMessage(hDlg, WM_SETICON, ICON_BIG, (LPARAM)hIcon);
         ListView_SetExtendedListViewStyleEx(GetDlgItem(hDlg, IDC_LIST_QUERY), LVS_REPORT | LVM_SETEXTENDEDLISTVIEWSTYLE, LVS_EX_AUTOSIZECOLUMNS | LVS_EX_GRIDLINES | LVS_EX_FULLROWSELECT);
         ReloadBookSourceCombobox(hDlg, g_lastPos);
-        _end_query(hDlg);
+        EnableDialog(hDlg, TRUE);
         return (INT_PTR)TRUE;
     }
     case WM_COMMAND:
@@ -145,27 +193,39 @@ static INT_PTR CALLBACK OnlineDlgProc(HWND hDlg, UINT message, WPARAM wParam, LP
             lvi.iSubItem = 0;
             if (ListView_GetItem(hList, &lvi) == TRUE)
             {
-                idx = (int)lvi.lParam; // get book source index
+                idx = (int)lvi.lParam; // get book source id
                 iPos = lvi.iItem;
+                // the source may be removed by the book source manager after the query
+                bs = BookSourceStore::Instance()->GetById(idx);
+                if (!bs)
+                {
+                    MessageBox_(hDlg, IDS_SELECT_BOOKSOURCE, IDS_ERROR, MB_ICONERROR | MB_OK);
+                    break;
+                }
 
                 colnum = 2;
                 colnum++; // author
                 ListView_GetItemText(hList, iPos, colnum, path, 1024);
                 ListView_GetItemText(hList, iPos, 1, param.book_name, 256);
                 strcpy(param.main_page, Utf16ToUtf8(path));
-                strcpy(param.host, _header->book_sources[idx].host);
+                strcpy(param.host, bs->host);
+#if ENABLE_HEDGED_FETCH
+                if (g_mirrors.find(iPos) != g_mirrors.end()
+                    && BookSourceStore::Instance()->GetById(g_mirrors[iPos].first))
+                {
+                    strcpy(param.mirror_host, BookSourceStore::Instance()->GetById(g_mirrors[iPos].first)->host);
+                    strcpy(param.mirror_page, g_mirrors[iPos].second.c_str());
+                }
+#endif
                 OnOpenOlBook(_hWnd, &param);
-                g_lastPos = idx;
+                g_lastPos = BookSourceStore::Instance()->IndexOfId(idx);
                 EndDialog(hDlg, LOWORD(wParam));
                 return (INT_PTR)TRUE;
             }
             break;
         case IDCANCEL:
-            if (g_hRequest)
-            {
-                hapi_cancel(g_hRequest);
-            }
-            g_hRequest = NULL;
+            _cancel_query(g_query_param);
+            KillTimer(hDlg, IDT_TIMER_QUERY);
             g_Enable = TRUE;
             g_lastPos = (int)SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_GETCURSEL, 0, NULL);
             EndDialog(hDlg, LOWORD(wParam));
@@ -181,19 +241,23 @@ static INT_PTR CALLBACK OnlineDlgProc(HWND hDlg, UINT message, WPARAM wParam, LP
                 {
                     hList = GetDlgItem(hDlg, IDC_LIST_QUERY);
                     ListView_DeleteAllItems(hList);
+#if ENABLE_HEDGED_FETCH
+                    g_mirrors.clear();
+#endif
                     hHeader = (HWND)SendMessage(hList, LVM_GETHEADER, 0, 0);
                     colnum = (int)SendMessage(hHeader, HDM_GETITEMCOUNT, 0, 0);
                     for (i = colnum - 1; i >= 0; i--)
                         SendMessage(hList, LVM_DELETECOLUMN, i, 0);
-                    OnRequestCharset();
+
+                    // the results are inserted when each source completes. the query is freed
+                    // by the last completer, so don't touch it after it is started.
+                    SetTimer(hDlg, IDT_TIMER_QUERY, QUERY_TIMER_ELAPSE, NULL);
+                    _start_query(g_query_param);
                 }
             }
             else
             {
-                if (g_hRequest)
-                {
-                    hapi_cancel(g_hRequest);
-                }
+                _cancel_query(g_query_param);
             }
             break;
         default:
@@ -201,6 +265,15 @@ static INT_PTR CALLBACK OnlineDlgProc(HWND hDlg, UINT message, WPARAM wParam, LP
         }
         break;
 
+    case WM_QUERY_RESULT:
+        OnQueryResult(hDlg, (query_result_t*)lParam);
+        break;
+
+    case WM_TIMER:
+        if (wParam == IDT_TIMER_QUERY)
+            OnQueryTimer(hDlg);
+        break;
+
     case WM_SIZE:
     {
         const int client_width = LOWORD(lParam);
@@ -232,70 +305,118 @@ static INT_PTR CALLBACK OnlineDlgProc(HWND hDlg, UINT message, WPARAM wParam, LP
     return (INT_PTR)FALSE;
 }
 
+static void _add_stat(req_source_t* src, stat_result_t result, int count)
+{
+    book_source_t* bs = BookSourceStore::Instance()->GetById(src->bs_id);
+
+    if (!bs)
+        return;
+    // the charset request is counted in, it is a part of the query
+    SourceStat::Instance()->AddRequest(bs, GetTickCount() - src->begin, result, count);
+}
+
+static BOOL _begin_source(req_source_t* src)
+{
+    BOOL canceled;
+
+    WaitForSingleObject(g_hQueryMutex, INFINITE);
+    src->hRequest = NULL;
+    canceled = src->query->canceled;
+    ReleaseMutex(g_hQueryMutex);
+    return !canceled;
+}
+
+static void _do_request(req_source_t* src, request_t* req)
+{
+    req_handler_t hRequest = NULL;
+
+    req->param1 = src;
+    req->param2 = NULL;
+
+    // hold the lock, so the completer can't clear the handler before it is saved
+    WaitForSingleObject(g_hQueryMutex, INFINITE);
+    if (!src->query->canceled)
+    {
+        hRequest = hapi_request(req);
+        src->hRequest = hRequest;
+    }
+    ReleaseMutex(g_hQueryMutex);
+
+    if (!hRequest)
+        _end_source(src);
+}
+
 static unsigned int RequestQueryCompleter(request_result_t* result)
 {
     char* html = NULL;
     int htmllen = 0;
-    HWND hDlg = g_query_param->hDlg;
-    int bs_idx = g_query_param->bs_idx;
-    std::vector<std::string> table_name;
-    std::vector<std::string> table_url;
-    std::vector<std::string> table_author;
-    HWND hList = NULL;
-    LV_COLUMN lvc = {0};
-    LVITEM lvitem = {0};
-    int i, col;
+    req_source_t* src = (req_source_t*)result->param1;
+    req_query_param_t* query = src->query;
+    HWND hDlg = query->hDlg;
+    int bs_id = src->bs_id;
+    book_source_t* bs = NULL;
+    XpathResult table_name(TRUE);
+    XpathResult table_url;
+    XpathResult table_author(TRUE);
+    query_result_t qr = {0};
     void* doc = NULL;
     void* ctx = NULL;
     BOOL cancel = FALSE;
-    TCHAR colname[256] = {0};
-    char Url[1024] = {0};
     int needfree = 0;
-    HWND hHeader = NULL;
-    int colnum = 0;
+    BOOL utf8 = FALSE;
 
-    g_hRequest = NULL;
-
-    if (result->cancel)
+    if (!_begin_source(src) || result->cancel)
     {
-        _end_query(hDlg);
+        if (src->timeout)
+        {
+            _add_stat(src, sr_error, -1);
+            if (!query->is_global)
+                MessageBox_(hDlg, IDS_NETWORK_FAIL, IDS_ERROR, MB_ICONERROR | MB_OK);
+        }
+        _end_source(src);
         return 1;
     }
 
     if (result->errno_ != succ)
     {
-        if (g_query_param->is_global)
-            goto _next;
-        _end_query(hDlg);
-        MessageBox_(hDlg, IDS_NETWORK_FAIL, IDS_ERROR, MB_ICONERROR | MB_OK);
+        _add_stat(src, sr_error, -1);
+        if (!query->is_global)
+            MessageBox_(hDlg, IDS_NETWORK_FAIL, IDS_ERROR, MB_ICONERROR | MB_OK);
+        _end_source(src);
         return 1;
     }
 
-    if (bs_idx < 0 || bs_idx >= _header->book_source_count)
+    bs = BookSourceStore::Instance()->GetById(bs_id);
+    if (!bs)
     {
-        if (g_query_param->is_global)
-            goto _next;
-        _end_query(hDlg);
-        MessageBox_(hDlg, IDS_SELECT_BOOKSOURCE, IDS_ERROR, MB_ICONERROR | MB_OK);
+        if (!query->is_global)
+            MessageBox_(hDlg, IDS_SELECT_BOOKSOURCE, IDS_ERROR, MB_ICONERROR | MB_OK);
+        _end_source(src);
         return 1;
     }
 
     if (result->status_code != 200)
     {
-        if (g_query_param->is_global)
-            goto _next;
-        _end_query(hDlg);
-        MessageBoxFmt_(hDlg, IDS_ERROR, MB_ICONERROR | MB_OK, IDS_REQUEST_ERROR, result->status_code);
+        _add_stat(src, sr_error, -1);
+        if (!query->is_global)
+            MessageBoxFmt_(hDlg, IDS_ERROR, MB_ICONERROR | MB_OK, IDS_REQUEST_ERROR, result->status_code);
+        _end_source(src);
         return 1;
     }
 
     html = result->body;
     htmllen = result->bodylen;
 
+    utf8 = is_utf8(html, htmllen);
+    // the body tells the real charset, correct the memo if it is wrong,
+    // a pure ascii body is valid utf8 and tells nothing
+    if (!is_ascii(html, htmllen))
+        SourceStat::Instance()->CheckQueryCharset(bs, utf8);
+
 #if 0
     if (hapi_get_charset(result->header) != utf_8)
 #else
-    if (!is_utf8(html, htmllen)) // fixed bug, focus check encode
+    if (!utf8) // fixed bug, focus check encode
 #endif
     {
         wchar_t* tempbuf = NULL;
@@ -316,157 +437,73 @@ static unsigned int RequestQueryCompleter(request_result_t* result)
     }
 
     HtmlParser::Instance()->HtmlParseBegin(html, htmllen, &doc, &ctx, &cancel);
-    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _header->book_sources[bs_idx].book_name_xpath, table_name, &cancel, TRUE);
-    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _header->book_sources[bs_idx].book_mainpage_xpath, table_url, &cancel);
-    if (_header->book_sources[bs_idx].book_author_xpath[0])
-        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, _header->book_sources[bs_idx].book_author_xpath, table_author, &cancel, TRUE);
+    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, bs->book_name_xpath, table_name, &cancel, TRUE);
+    HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, bs->book_mainpage_xpath, table_url, &cancel);
+    if (bs->book_author_xpath[0])
+        HtmlParser::Instance()->HtmlParseByXpath(doc, ctx, bs->book_author_xpath, table_author, &cancel, TRUE);
     HtmlParser::Instance()->HtmlParseEnd(doc, ctx);
 
     // check value
-    if (table_url.empty() || table_name.size() != table_url.size())
+    if (table_url.Size() == 0 || table_name.Size() != table_url.Size())
     {
-        if (g_query_param->is_global)
-            goto _next;
-
-        DumpParseErrorFile(html, htmllen);
-
+        // an empty page is a valid answer, the book is not in this source
+        if (table_url.Size() == 0 && table_name.Size() == 0)
+            _add_stat(src, sr_succ, 0);
+        else
+            _add_stat(src, sr_parse_fail, -1);
+        if (!query->is_global)
+        {
+            DumpParseErrorFile(html, htmllen);
+            MessageBox_(hDlg, IDS_PARSE_FAIL, IDS_WARN, MB_ICONWARNING | MB_OK);
+        }
         if (needfree)
             free(html);
-        _end_query(hDlg);
-        MessageBox_(hDlg, IDS_PARSE_FAIL, IDS_WARN, MB_ICONWARNING | MB_OK);
+        _end_source(src);
         return 1;
     }
 
     if (needfree)
         free(html);
 
-    hList = GetDlgItem(hDlg, IDC_LIST_QUERY);
-    if (hList)
-    {
-        hHeader = (HWND)SendMessage(hList, LVM_GETHEADER, 0, 0);
-        colnum = (int)SendMessage(hHeader, HDM_GETITEMCOUNT, 0, 0);
-
-        // add list header
-        if (colnum == 0)
-        {
-            col = 0;
-            // book source name
-            LoadString(hInst, IDS_BOOK_SOURCE, colname, 256);
-            memset(&lvc, 0, sizeof(LV_COLUMN));
-            lvc.mask = LVCF_TEXT | LVCF_WIDTH | LVCF_SUBITEM;
-            lvc.pszText = colname;
-            lvc.cx = 80;
-            SendMessage(hList, LVM_INSERTCOLUMN, col++, (LPARAM)&lvc);
-
-            // book name
-            LoadString(hInst, IDS_BOOK_NAME, colname, 256);
-            memset(&lvc, 0, sizeof(LV_COLUMN));
-            lvc.mask = LVCF_TEXT | LVCF_WIDTH | LVCF_SUBITEM;
-            lvc.pszText = colname;
-            lvc.cx = 120;
-            SendMessage(hList, LVM_INSERTCOLUMN, col++, (LPARAM)&lvc);
-
-            // book author
-            //if (g_query_param->is_global || !table_author.empty())
-            {
-                LoadString(hInst, IDS_AUTHOR, colname, 256);
-                memset(&lvc, 0, sizeof(LV_COLUMN));
-                lvc.mask = LVCF_TEXT | LVCF_WIDTH | LVCF_SUBITEM;
-                lvc.pszText = colname;
-                lvc.cx = 100;
-                SendMessage(hList, LVM_INSERTCOLUMN, col++, (LPARAM)&lvc);
-            }
-
-            // mainpage
-            LoadString(hInst, IDS_MAINPAGE, colname, 256);
-            memset(&lvc, 0, sizeof(LV_COLUMN));
-            lvc.mask = LVCF_TEXT | LVCF_WIDTH | LVCF_SUBITEM;
-            lvc.pszText = colname;
-            lvc.cx = 180;
-            SendMessage(hList, LVM_INSERTCOLUMN, col++, (LPARAM)&lvc);
-        }
-
-        colnum = ListView_GetItemCount(hList); // rownum
-        for (i = 0; i < (int)table_name.size(); i++)
-        {
-            col = 0;
-            // book source name
-            lvitem.mask = LVIF_TEXT | LVIF_PARAM;
-            lvitem.cchTextMax = MAX_PATH;
-            lvitem.iItem = i + colnum;
-            lvitem.iSubItem = col++;
-            lvitem.pszText = _header->book_sources[bs_idx].title;
-            lvitem.lParam = bs_idx;
-            ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
-            ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
-
-            // book name
-            memset(&lvitem, 0, sizeof(LVITEM));
-            lvitem.mask = LVIF_TEXT;
-            lvitem.cchTextMax = MAX_PATH;
-            lvitem.iItem = i + colnum;
-            lvitem.iSubItem = col++;
-            lvitem.pszText = Utf8ToUtf16(table_name[i].c_str());
-            ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
-            ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
-
-            // book author
-            if (!table_author.empty() && i < (int)table_author.size())
-            {
-                memset(&lvitem, 0, sizeof(LVITEM));
-                lvitem.mask = LVIF_TEXT;
-                lvitem.cchTextMax = MAX_PATH;
-                lvitem.iItem = i + colnum;
-                lvitem.iSubItem = col;
-                lvitem.pszText = Utf8ToUtf16(table_author[i].c_str());
-                ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
-                ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
-            }
-            col++;
-
-            // mainpage
-            combine_url(table_url[i].c_str(), result->req->url, Url);
-            memset(&lvitem, 0, sizeof(LVITEM));
-            lvitem.mask = LVIF_TEXT;
-            lvitem.cchTextMax = MAX_PATH;
-            lvitem.iItem = i + colnum;
-            lvitem.iSubItem = col++;
-            lvitem.pszText = Utf8ToUtf16(Url);
-            ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
-            ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
-        }
-    }
+    _add_stat(src, sr_succ, table_url.Size());
 
-_next:
-    if (g_query_param->is_global && (++bs_idx < _header->book_source_count))
-    {
-        g_query_param->bs_idx++;
-        OnRequestCharset();
-        return 0;
-    }
+    // stream the rows to ui thread, don't wait for the slower sources
+    qr.query = query;
+    qr.bs_id = bs_id;
+    qr.url = result->req->url;
+    qr.name = &table_name;
+    qr.mainpage = &table_url;
+    qr.author = &table_author;
+    SendMessage(hDlg, WM_QUERY_RESULT, 0, (LPARAM)&qr);
 
-    _end_query(hDlg);
+    _end_source(src);
     return 0;
 }
 
-static int OnRequestQuery(http_charset_t charset)
+static int OnRequestQuery(req_source_t* src, http_charset_t charset)
 {
     char* query_format;
     char url[1024];
     char content[1024] = {0};
     char* encode;
     request_t req;
-    char* keyword = NULL;
-    int bs_idx = g_query_param->bs_idx;
+    const char* keyword = NULL;
+    book_source_t* bs = BookSourceStore::Instance()->GetById(src->bs_id);
+
+    if (!bs)
+    {
+        _end_source(src);
+        return 1;
+    }
 
     if (charset == utf_8)
-        keyword = Utf16ToUtf8(g_query_param->text);
+        keyword = src->query->keyword_utf8.c_str();
     else
-        keyword = Utf16ToAnsi(g_query_param->text);
+        keyword = src->query->keyword_ansi.c_str();
 
-    if (_header->book_sources[bs_idx].query_method == 0) // GET
+    if (bs->query_method == 0) // GET
     {
-        query_format = _header->book_sources[bs_idx].query_url;
+        query_format = bs->query_url;
 
         hapi_url_encode(keyword, &encode);
         sprintf(url, query_format, encode);
@@ -474,95 +511,103 @@ static int OnRequestQuery(http_charset_t charset)
     }
     else // POST
     {
-        strcpy(url, _header->book_sources[bs_idx].query_url);
+        strcpy(url, bs->query_url);
 
         hapi_url_encode(keyword, &encode);
-        sprintf(content, _header->book_sources[bs_idx].query_params, encode);
+        sprintf(content, bs->query_params, encode);
         hapi_buffer_free(encode);
     }
 
     // do request
     memset(&req, 0, sizeof(request_t));
-    req.method = _header->book_sources[bs_idx].query_method == 0 ? GET : POST;
+    req.method = bs->query_method == 0 ? GET : POST;
     req.url = url;
     req.content = content;
     req.content_length = (int)strlen(content);
     req.completer = RequestQueryCompleter;
-    req.param1 = NULL;
-    req.param2 = NULL;
 
-    g_hRequest = hapi_request(&req);
+    _do_request(src, &req);
     return 0;
 }
 
 static unsigned int RequestCharsetCompleter(request_result_t* result)
 {
-    HWND hDlg = g_query_param->hDlg;
-    int bs_idx = g_query_param->bs_idx;
-
-    g_hRequest = NULL;
+    req_source_t* src = (req_source_t*)result->param1;
+    req_query_param_t* query = src->query;
+    HWND hDlg = query->hDlg;
+    http_charset_t charset;
 
-    if (result->cancel)
+    if (!_begin_source(src) || result->cancel)
     {
-        _end_query(hDlg);
+        if (src->timeout)
+        {
+            _add_stat(src, sr_error, -1);
+            if (!query->is_global)
+                MessageBox_(hDlg, IDS_NETWORK_FAIL, IDS_ERROR, MB_ICONERROR | MB_OK);
+        }
+        _end_source(src);
         return 1;
     }
 
     if (result->errno_ != succ)
     {
-        if (g_query_param->is_global)
-            goto _next;
-        _end_query(hDlg);
-        MessageBox_(hDlg, IDS_NETWORK_FAIL, IDS_ERROR, MB_ICONERROR | MB_OK);
+        _add_stat(src, sr_error, -1);
+        if (!query->is_global)
+            MessageBox_(hDlg, IDS_NETWORK_FAIL, IDS_ERROR, MB_ICONERROR | MB_OK);
+        _end_source(src);
         return 1;
     }
 
     if (result->status_code != 200)
     {
-        if (g_query_param->is_global)
-            goto _next;
-        _end_query(hDlg);
-        MessageBoxFmt_(hDlg, IDS_ERROR, MB_ICONERROR | MB_OK, IDS_REQUEST_ERROR, result->status_code);
+        _add_stat(src, sr_error, -1);
+        if (!query->is_global)
+            MessageBoxFmt_(hDlg, IDS_ERROR, MB_ICONERROR | MB_OK, IDS_REQUEST_ERROR, result->status_code);
+        _end_source(src);
         return 1;
     }
 
-    OnRequestQuery(hapi_get_charset(result->header));
-    return 0;
+    // remember it, the next query is sent without HEAD request
+    charset = hapi_get_charset(result->header);
+    SourceStat::Instance()->SetQueryCharset(BookSourceStore::Instance()->GetById(src->bs_id), charset == utf_8 ? 1 : 2);
 
-_next:
-    if (g_query_param->is_global && (++bs_idx < _header->book_source_count))
-    {
-        g_query_param->bs_idx++;
-        OnRequestCharset();
-        return 0;
-    }
-    _end_query(hDlg);
+    OnRequestQuery(src, charset);
     return 0;
 }
 
-static int OnRequestCharset(void)
+static int OnRequestCharset(req_source_t* src)
 {
     request_t req;
     char* query_format;
     char url[1024];
     char content[1024] = {0};
     char* encode;
-    char* keyword = NULL;
+    const char* keyword = NULL;
     http_charset_t charset;
-    int bs_idx = g_query_param->bs_idx;
+    book_source_t* bs = BookSourceStore::Instance()->GetById(src->bs_id);
+    int query_charset;
+
+    if (!bs)
+    {
+        _end_source(src);
+        return 1;
+    }
 
-    if (_header->book_sources[bs_idx].query_charset != 0) // 0: auto
+    query_charset = bs->query_charset;
+    if (query_charset == 0) // 0: auto, use the detected charset if it is remembered
+        query_charset = SourceStat::Instance()->GetQueryCharset(bs);
+    if (query_charset != 0)
     {
-        if (_header->book_sources[bs_idx].query_charset == 1) // utf8
+        if (query_charset == 1) // utf8
             charset = utf_8;
         else
             charset = gbk;
-        return OnRequestQuery(charset);
+        return OnRequestQuery(src, charset);
     }
-    keyword = Utf16ToUtf8(g_query_param->text);
-    if (_header->book_sources[bs_idx].query_method == 0) // GET
+    keyword = src->query->keyword_utf8.c_str();
+    if (bs->query_method == 0) // GET
     {
-        query_format = _header->book_sources[bs_idx].query_url;
+        query_format = bs->query_url;
 
         hapi_url_encode(keyword, &encode);
         sprintf(url, query_format, encode);
@@ -570,10 +615,10 @@ static int OnRequestCharset(void)
     }
     else // POST
     {
-        strcpy(url, _header->book_sources[bs_idx].query_url);
+        strcpy(url, bs->query_url);
 
         hapi_url_encode(keyword, &encode);
-        sprintf(content, _header->book_sources[bs_idx].query_params, encode);
+        sprintf(content, bs->query_params, encode);
         hapi_buffer_free(encode);
     }
 
@@ -586,13 +631,226 @@ static int OnRequestCharset(void)
     req.content_length = strlen(content);
 #endif
     req.completer = RequestCharsetCompleter;
-    req.param1 = NULL;
-    req.param2 = NULL;
 
-    g_hRequest = hapi_request(&req);
+    _do_request(src, &req);
     return 0;
 }
 
+static void OnQueryResult(HWND hDlg, query_result_t* qr)
+{
+    HWND hList = NULL;
+    HWND hHeader = NULL;
+    LV_COLUMN lvc = {0};
+    LVITEM lvitem = {0};
+    TCHAR colname[256] = {0};
+    char Url[1024] = {0};
+#if ENABLE_HEDGED_FETCH
+    TCHAR MainPage[1024] = {0};
+#endif
+    std::wstring key;
+    std::map<std::wstring, std::pair<int, int>>::iterator it;
+    book_source_t* bs = BookSourceStore::Instance()->GetById(qr->bs_id);
+    int i, col, row;
+    int colnum = 0;
+
+    hList = GetDlgItem(hDlg, IDC_LIST_QUERY);
+    if (!hList || !bs)
+        return;
+
+    hHeader = (HWND)SendMessage(hList, LVM_GETHEADER, 0, 0);
+    colnum = (int)SendMessage(hHeader, HDM_GETITEMCOUNT, 0, 0);
+
+    // add list header
+    if (colnum == 0)
+    {
+        col = 0;
+        // book source name
+        LoadString(hInst, IDS_BOOK_SOURCE, colname, 256);
+        memset(&lvc, 0, sizeof(LV_COLUMN));
+        lvc.mask = LVCF_TEXT | LVCF_WIDTH | LVCF_SUBITEM;
+        lvc.pszText = colname;
+        lvc.cx = 80;
+        SendMessage(hList, LVM_INSERTCOLUMN, col++, (LPARAM)&lvc);
+
+        // book name
+        LoadString(hInst, IDS_BOOK_NAME, colname, 256);
+        memset(&lvc, 0, sizeof(LV_COLUMN));
+        lvc.mask = LVCF_TEXT | LVCF_WIDTH | LVCF_SUBITEM;
+        lvc.pszText = colname;
+        lvc.cx = 120;
+        SendMessage(hList, LVM_INSERTCOLUMN, col++, (LPARAM)&lvc);
+
+        // book author
+        LoadString(hInst, IDS_AUTHOR, colname, 256);
+        memset(&lvc, 0, sizeof(LV_COLUMN));
+        lvc.mask = LVCF_TEXT | LVCF_WIDTH | LVCF_SUBITEM;
+        lvc.pszText = colname;
+        lvc.cx = 100;
+        SendMessage(hList, LVM_INSERTCOLUMN, col++, (LPARAM)&lvc);
+
+        // mainpage
+        LoadString(hInst, IDS_MAINPAGE, colname, 256);
+        memset(&lvc, 0, sizeof(LV_COLUMN));
+        lvc.mask = LVCF_TEXT | LVCF_WIDTH | LVCF_SUBITEM;
+        lvc.pszText = colname;
+        lvc.cx = 180;
+        SendMessage(hList, LVM_INSERTCOLUMN, col++, (LPARAM)&lvc);
+    }
+
+    row = ListView_GetItemCount(hList);
+    for (i = 0; i < qr->name->Size(); i++)
+    {
+        // the same book may be returned by many sources, only one row is kept,
+        // it is switched to the healthier (by the statistics) source
+        if (qr->query->is_global)
+        {
+            key = qr->name->WAt(i);
+            key.push_back(L'\x1f');
+            if (i < qr->author->Size())
+                key.append(qr->author->WAt(i));
+            it = qr->query->books.find(key);
+            if (it != qr->query->books.end())
+            {
+                if (SourceStat::Instance()->GetScore(bs)
+                    < SourceStat::Instance()->GetScore(BookSourceStore::Instance()->GetById(it->second.second)))
+                {
+#if ENABLE_HEDGED_FETCH
+                    // the replaced source is kept as the mirror
+                    ListView_GetItemText(hList, it->second.first, 3, MainPage, 1024);
+                    _set_mirror(it->second.first, qr->bs_id, it->second.second, Utf16ToUtf8(MainPage));
+#endif
+                    // book source name
+                    memset(&lvitem, 0, sizeof(LVITEM));
+                    lvitem.mask = LVIF_TEXT | LVIF_PARAM;
+                    lvitem.iItem = it->second.first;
+                    lvitem.iSubItem = 0;
+                    lvitem.pszText = bs->title;
+                    lvitem.lParam = qr->bs_id;
+                    ::SendMessage(hList, LVM_SETITEM, 0, (LPARAM)&lvitem);
+
+                    // mainpage
+                    combine_url(qr->mainpage->At(i), qr->url, Url);
+                    ListView_SetItemText(hList, it->second.first, 3, Utf8ToUtf16(Url));
+                    it->second.second = qr->bs_id;
+                }
+#if ENABLE_HEDGED_FETCH
+                else
+                {
+                    combine_url(qr->mainpage->At(i), qr->url, Url);
+                    _set_mirror(it->second.first, it->second.second, qr->bs_id, Url);
+                }
+#endif
+                continue;
+            }
+            qr->query->books[key] = std::make_pair(row, qr->bs_id);
+        }
+
+        col = 0;
+        // book source name
+        memset(&lvitem, 0, sizeof(LVITEM));
+        lvitem.mask = LVIF_TEXT | LVIF_PARAM;
+        lvitem.cchTextMax = MAX_PATH;
+        lvitem.iItem = row;
+        lvitem.iSubItem = col++;
+        lvitem.pszText = bs->title;
+        lvitem.lParam = qr->bs_id;
+        ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
+        ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
+
+        // book name
+        memset(&lvitem, 0, sizeof(LVITEM));
+        lvitem.mask = LVIF_TEXT;
+        lvitem.cchTextMax = MAX_PATH;
+        lvitem.iItem = row;
+        lvitem.iSubItem = col++;
+        lvitem.pszText = qr->name->WAt(i);
+        ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
+        ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
+
+        // book author
+        if (i < qr->author->Size())
+        {
+            memset(&lvitem, 0, sizeof(LVITEM));
+            lvitem.mask = LVIF_TEXT;
+            lvitem.cchTextMax = MAX_PATH;
+            lvitem.iItem = row;
+            lvitem.iSubItem = col;
+            lvitem.pszText = qr->author->WAt(i);
+            ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
+            ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
+        }
+        col++;
+
+        // mainpage
+        combine_url(qr->mainpage->At(i), qr->url, Url);
+        memset(&lvitem, 0, sizeof(LVITEM));
+        lvitem.mask = LVIF_TEXT;
+        lvitem.cchTextMax = MAX_PATH;
+        lvitem.iItem = row;
+        lvitem.iSubItem = col++;
+        lvitem.pszText = Utf8ToUtf16(Url);
+        ::SendMessage(hList, LVM_INSERTITEM, lvitem.iItem, (LPARAM)&lvitem);
+        ::SendMessage(hList, LVM_SETITEMTEXT, lvitem.iItem, (LPARAM)&lvitem);
+
+        row++;
+    }
+}
+
+static void OnQueryTimer(HWND hDlg)
+{
+    req_query_param_t* query = NULL;
+    std::vector<req_handler_t> handlers;
+    DWORD now = GetTickCount();
+    size_t i;
+
+    WaitForSingleObject(g_hQueryMutex, INFINITE);
+    query = g_query_param;
+    if (!query)
+    {
+        ReleaseMutex(g_hQueryMutex);
+        KillTimer(hDlg, IDT_TIMER_QUERY);
+        return;
+    }
+    // a slow source never blocks the others, cancel it when it is timeout
+    for (i = 0; i < query->sources.size(); i++)
+    {
+        req_source_t* src = &query->sources[i];
+        if (!src->done && src->hRequest && now - src->begin > QUERY_TIMEOUT)
+        {
+            src->timeout = 1;
+            handlers.push_back(src->hRequest);
+            src->hRequest = NULL;
+        }
+    }
+    ReleaseMutex(g_hQueryMutex);
+
+    // a canceled completer may end the query, so it is canceled without the lock
+    for (i = 0; i < handlers.size(); i++)
+        hapi_cancel(handlers[i]);
+}
+
+#if ENABLE_HEDGED_FETCH
+static void _set_mirror(int row, int primary, int bs_id, const char* mainpage)
+{
+    std::map<int, std::pair<int, std::string>>::iterator it;
+    BookSourceStore* store = BookSourceStore::Instance();
+    book_source_t* bs = store->GetById(bs_id);
+    book_source_t* primary_bs = store->GetById(primary);
+
+    if (!bs || !primary_bs || bs_id == primary || strcmp(bs->host, primary_bs->host) == 0)
+        return;
+    if (SourceStat::Instance()->IsDown(bs))
+        return;
+    // only the healthiest one of the other sources is kept
+    it = g_mirrors.find(row);
+    if (it != g_mirrors.end() && it->second.first != primary
+        && SourceStat::Instance()->GetScore(store->GetById(it->second.first))
+        <= SourceStat::Instance()->GetScore(bs))
+        return;
+    g_mirrors[row] = std::make_pair(bs_id, std::string(mainpage));
+}
+#endif
+
 static void EnableDialog(HWND hDlg, BOOL enable)
 {
     TCHAR szQuery[256] = {0};
@@ -613,7 +871,13 @@ static void EnableDialog(HWND hDlg, BOOL enable)
 
 static BOOL _begin_query(HWND hDlg)
 {
-    if (_header->book_source_count == 0)
+    req_query_param_t* query = NULL;
+    req_source_t src = {0};
+    std::vector<int> indexes;
+    int bs_idx;
+    int i, count = BookSourceStore::Instance()->Count();
+
+    if (count == 0)
     {
         if (IDYES == MessageBox_(hDlg, IDS_NOTEXIST_BOOKSOURCE, IDS_ERROR, MB_ICONERROR | MB_YESNO))
         {
@@ -622,53 +886,180 @@ static BOOL _begin_query(HWND hDlg)
         goto _failed;
     }
 
-    if (!g_query_param)
-        g_query_param = (req_query_param_t*)malloc(sizeof(req_query_param_t));
-    if (!g_query_param)
-        goto _failed;
-    memset(g_query_param, 0, sizeof(req_query_param_t));
-    g_query_param->hDlg = hDlg;
+    if (!g_hQueryMutex)
+        g_hQueryMutex = CreateMutex(NULL, FALSE, NULL);
+
+    query = new req_query_param_t;
+    query->hDlg = hDlg;
+    query->text[0] = 0;
+    query->is_global = 0;
+    query->pending = 0;
+    query->next = 0;
+    query->canceled = 0;
 
-    GetDlgItemText(hDlg, IDC_EDIT_QUERY_KEYWORD, g_query_param->text, 256);
-    if (_tcslen(g_query_param->text) == 0)
+    GetDlgItemText(hDlg, IDC_EDIT_QUERY_KEYWORD, query->text, 256);
+    if (_tcslen(query->text) == 0)
     {
         MessageBox_(hDlg, IDS_EMPTY_KEYWORD, IDS_ERROR, MB_ICONERROR | MB_OK);
         goto _failed;
     }
+    // Utf16ToUtf8 and Utf16ToAnsi return a shared buffer, they can't be called by the completers
+    query->keyword_utf8 = Utf16ToUtf8(query->text);
+    query->keyword_ansi = Utf16ToAnsi(query->text);
 
-    g_query_param->bs_idx = (int)SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_GETCURSEL, 0, NULL);
+    bs_idx = (int)SendMessage(GetDlgItem(hDlg, IDC_COMBO_BS_LIST), CB_GETCURSEL, 0, NULL);
 #if ENABLE_GLOBAL_SEARCH
-    if (g_query_param->bs_idx < 0 || g_query_param->bs_idx > _header->book_source_count)
+    if (bs_idx < 0 || bs_idx > count)
 #else
-    if (g_query_param->bs_idx < 0 || g_query_param->bs_idx >= _header->book_source_count)
+    if (bs_idx < 0 || bs_idx >= count)
 #endif    
     {
         MessageBox_(hDlg, IDS_SELECT_BOOKSOURCE, IDS_ERROR, MB_ICONERROR | MB_OK);
         goto _failed;
     }
 
-    if (g_query_param->bs_idx == _header->book_source_count)
+    src.query = query;
+    if (bs_idx == count)
     {
-        g_query_param->bs_idx = 0;
-        g_query_param->is_global = 1;
+        query->is_global = 1;
+        // the healthy and fast sources go first, the down sources are skipped
+        for (i = 0; i < count; i++)
+        {
+            if (!SourceStat::Instance()->IsDown(BookSourceStore::Instance()->Get(i)))
+                indexes.push_back(i);
+        }
+        if (indexes.empty())
+        {
+            for (i = 0; i < count; i++)
+                indexes.push_back(i);
+        }
+        SourceStat::Instance()->SortByHealth(indexes);
+        for (i = 0; i < (int)indexes.size(); i++)
+        {
+            src.bs_id = BookSourceStore::Instance()->IdOf(indexes[i]);
+            query->sources.push_back(src);
+        }
     }
+    else
+    {
+        src.bs_id = BookSourceStore::Instance()->IdOf(bs_idx);
+        query->sources.push_back(src);
+    }
+    // the sources is never resized again, the completers keep the pointer of it
+    query->pending = (int)query->sources.size();
+
+    WaitForSingleObject(g_hQueryMutex, INFINITE);
+    g_query_param = query;
+    ReleaseMutex(g_hQueryMutex);
 
     EnableDialog(hDlg, FALSE);
     return TRUE;
 
 _failed:
-    _end_query(hDlg);
+    if (query)
+        delete query;
+    EnableDialog(hDlg, TRUE);
     return FALSE;
 }
 
-static void _end_query(HWND hDlg)
+static void _start_query(req_query_param_t* query)
+{
+    std::vector<req_source_t*> sources;
+    size_t i;
+
+    // claim the first sources at once, the query can't end before they are started
+    WaitForSingleObject(g_hQueryMutex, INFINITE);
+    while (query->next < (int)query->sources.size() && sources.size() < MAX_QUERY_REQUEST)
+    {
+        query->sources[query->next].begin = GetTickCount();
+        sources.push_back(&query->sources[query->next++]);
+    }
+    ReleaseMutex(g_hQueryMutex);
+
+    for (i = 0; i < sources.size(); i++)
+        OnRequestCharset(sources[i]);
+}
+
+static void _cancel_query(req_query_param_t* query)
+{
+    std::vector<req_handler_t> handlers;
+    size_t i;
+
+    if (!query || !g_hQueryMutex)
+        return;
+
+    WaitForSingleObject(g_hQueryMutex, INFINITE);
+    // the query may be finished by the last completer
+    if (query == g_query_param)
+    {
+        query->canceled = 1;
+        for (i = 0; i < query->sources.size(); i++)
+        {
+            if (query->sources[i].hRequest)
+            {
+                handlers.push_back(query->sources[i].hRequest);
+                query->sources[i].hRequest = NULL;
+            }
+        }
+    }
+    ReleaseMutex(g_hQueryMutex);
+
+    // a canceled completer may end and free the query, don't touch it from here
+    for (i = 0; i < handlers.size(); i++)
+        hapi_cancel(handlers[i]);
+}
+
+static void _end_source(req_source_t* src)
 {
-    if (g_query_param)
+    req_query_param_t* query = src->query;
+    req_source_t* next = NULL;
+    int pending;
+
+    WaitForSingleObject(g_hQueryMutex, INFINITE);
+    src->done = 1;
+    src->hRequest = NULL;
+    pending = --query->pending;
+    // the finished source hands over to the next one, the sources which are not started
+    // are dropped if the query is canceled
+    if (query->next < (int)query->sources.size())
+    {
+        if (query->canceled)
+        {
+            query->pending -= (int)query->sources.size() - query->next;
+            query->next = (int)query->sources.size();
+            pending = query->pending;
+        }
+        else
+        {
+            next = &query->sources[query->next++];
+            next->begin = GetTickCount();
+        }
+    }
+    ReleaseMutex(g_hQueryMutex);
+
+    if (next)
+        OnRequestCharset(next);
+    // the last source ends the query
+    else if (pending == 0)
+        _end_query(query);
+}
+
+static void _end_query(req_query_param_t* query)
+{
+    HWND hDlg = query->hDlg;
+    BOOL current = FALSE;
+
+    WaitForSingleObject(g_hQueryMutex, INFINITE);
+    if (query == g_query_param)
     {
-        free(g_query_param);
         g_query_param = NULL;
+        current = TRUE;
     }
-    EnableDialog(hDlg, TRUE);
+    ReleaseMutex(g_hQueryMutex);
+
+    delete query;
+    if (current)
+        EnableDialog(hDlg, TRUE);
 }
 
 #endif
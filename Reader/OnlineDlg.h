@@ -10,6 +10,8 @@ typedef struct ol_book_param_t
     char main_page[1024];
     char host[1024];
     u32 is_finished;
+    char mirror_host[1024]; // the same book from another source, for hedged fetch
+    char mirror_page[1024];
 } ol_book_param_t;
 
 void OpenOnlineDlg(void);
@@ -6,6 +6,7 @@
  */
 
 #include "QuickJsEngine.hpp"
+#include "JsCrypto.h"
 #include <cstring>
 #include <ctime>
 #include <sstream>
@@ -13,6 +14,9 @@
 #include <regex>
 #include <algorithm>
 #include <cctype>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 namespace Reader {
 
@@ -287,6 +291,43 @@ static std::string html_decode(const std::string& str) {
     return result;
 }
 
+// 大字符串缓存：短字符串直接转换比比较更快，过长的不缓存以免占满运行时内存
+static const size_t HOST_STRING_MIN_SIZE = 4 * 1024;
+static const size_t HOST_STRING_MAX_SIZE = 1024 * 1024;
+static const size_t HOST_STRING_SLOTS = 4;
+
+// 同时进行的异步请求数，超出的排队等待
+static const size_t MAX_ASYNC_REQUESTS = 6;
+
+// 等待请求完成时检查停止标志的间隔
+static const int ASYNC_POLL_MS = 50;
+
+// 默认每执行这么多次在空闲时 GC 一次，GC 后已用内存超过上限的 3/4 时重建运行时
+static const unsigned HEAP_GC_INTERVAL = 32;
+
+// 缓存的模板数，来自书源，超出时全部丢弃
+static const size_t MAX_TEMPLATES = 256;
+
+// 异步请求的完成队列，请求线程写入，执行脚本的线程取出
+struct QuickJsEngine::HttpInbox {
+    struct Response {
+        uint64_t id;
+        bool ok;
+        std::string text;
+    };
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::deque<Response> responses;
+    
+    void push(uint64_t id, bool ok, const std::string& text) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            responses.push_back({ id, ok, text });
+        }
+        cond.notify_one();
+    }
+};
+
 // 获取引擎实例指针（用于静态回调）
 static QuickJsEngine* getEngineFromContext(JSContext* ctx) {
     return static_cast<QuickJsEngine*>(JS_GetContextOpaque(ctx));
@@ -297,17 +338,45 @@ static QuickJsEngine* getEngineFromContext(JSContext* ctx) {
 QuickJsEngine::QuickJsEngine(size_t memoryLimit)
     : m_runtime(nullptr)
     , m_context(nullptr)
+    , m_codeCache(nullptr)
+    , m_hostStringSlots(HOST_STRING_SLOTS)
+    , m_hostStringClock(0)
+    , m_inbox(std::make_shared<HttpInbox>())
+    , m_requestsInFlight(0)
+    , m_nextRequestId(0)
     , m_hasError(false)
+    , m_memoryLimit(memoryLimit)
+    , m_timeLimit(0)
+    , m_stopFlag(nullptr)
+    , m_interrupted(false)
+    , m_gcInterval(HEAP_GC_INTERVAL)
+    , m_recycleBytes(memoryLimit / 4 * 3)
+    , m_evalsSinceGc(0)
+    , m_outOfMemory(false)
 {
+    memset(&m_usage, 0, sizeof(m_usage));
+    memset(&m_heap, 0, sizeof(m_heap));
+    m_heap.limitBytes = (int64_t)memoryLimit;
+    createContext();
+}
+
+QuickJsEngine::~QuickJsEngine() {
+    destroyContext();
+}
+
+bool QuickJsEngine::createContext() {
     // 创建运行时
     m_runtime = JS_NewRuntime();
     if (!m_runtime) {
         setError("Failed to create JS runtime");
-        return;
+        return false;
     }
     
     // 设置内存限制
-    JS_SetMemoryLimit(m_runtime, memoryLimit);
+    JS_SetMemoryLimit(m_runtime, m_memoryLimit);
+    
+    // 执行时间限制
+    JS_SetInterruptHandler(m_runtime, js_interrupt_handler, this);
     
     // 创建上下文
     m_context = JS_NewContext(m_runtime);
@@ -315,23 +384,141 @@ QuickJsEngine::QuickJsEngine(size_t memoryLimit)
         setError("Failed to create JS context");
         JS_FreeRuntime(m_runtime);
         m_runtime = nullptr;
-        return;
+        return false;
     }
     
     // 存储 this 指针到上下文
     JS_SetContextOpaque(m_context, this);
     
+    // 规则脚本只编译一次
+    m_codeCache = new JsBytecodeCache(m_context);
+    
     // 初始化 Legado API
     initLegadoApi();
+    return true;
 }
 
-QuickJsEngine::~QuickJsEngine() {
+void QuickJsEngine::destroyContext() {
+    // 字节码、缓存的字符串和未完成的 Promise 属于运行时，先于上下文释放
+    abandonRequests();
+    delete m_codeCache;
+    m_codeCache = nullptr;
+    clearHostStrings();
     if (m_context) {
         JS_FreeContext(m_context);
+        m_context = nullptr;
     }
     if (m_runtime) {
         JS_FreeRuntime(m_runtime);
+        m_runtime = nullptr;
+    }
+}
+
+void QuickJsEngine::resetRuntime() {
+    // 被中止的脚本可能留下不完整的全局状态，丢弃整个运行时
+    // 字节码序列化后带到新的运行时，不用重新编译
+    JsBytecodeCache* codeCache = m_codeCache;
+    m_codeCache = nullptr;
+    if (codeCache) {
+        codeCache->detach();
+    }
+    destroyContext();
+    if (!createContext()) {
+        delete codeCache;
+        return;
+    }
+    if (codeCache) {
+        delete m_codeCache;
+        codeCache->attach(m_context);
+        m_codeCache = codeCache;
+    }
+    for (const auto& var : m_variables) {
+        JSValue global = JS_GetGlobalObject(m_context);
+        JS_SetPropertyStr(m_context, global, var.first.c_str(),
+            newString(var.second.c_str(), var.second.length()));
+        JS_FreeValue(m_context, global);
+    }
+}
+
+int QuickJsEngine::js_interrupt_handler(JSRuntime* rt, void* opaque) {
+    QuickJsEngine* engine = static_cast<QuickJsEngine*>(opaque);
+    engine->m_usage.ticks++;
+    if (engine->stopped()) {
+        engine->m_interrupted = true;
+        return 1;
+    }
+    if (engine->m_timeLimit && std::chrono::steady_clock::now() >= engine->m_deadline) {
+        engine->m_interrupted = true;
+        return 1;
+    }
+    return 0;
+}
+
+void QuickJsEngine::setTimeLimit(unsigned ms) {
+    m_timeLimit = ms;
+}
+
+void QuickJsEngine::setStopFlag(const volatile int* stop) {
+    m_stopFlag = stop;
+}
+
+bool QuickJsEngine::stopped() const {
+    return m_stopFlag && *m_stopFlag;
+}
+
+bool QuickJsEngine::wasInterrupted() const {
+    return m_interrupted;
+}
+
+JsUsage QuickJsEngine::takeUsage() {
+    JsUsage usage = m_usage;
+    memset(&m_usage, 0, sizeof(m_usage));
+    return usage;
+}
+
+void QuickJsEngine::setHeapPolicy(unsigned gcInterval, size_t recycleBytes) {
+    m_gcInterval = gcInterval;
+    m_recycleBytes = recycleBytes;
+}
+
+bool QuickJsEngine::idle() {
+    if (!m_runtime) {
+        return false;
     }
+    if (!m_outOfMemory && (!m_gcInterval || m_evalsSinceGc < m_gcInterval)) {
+        return false;
+    }
+    
+    m_evalsSinceGc = 0;
+    JS_RunGC(m_runtime);
+    m_heap.gcRuns++;
+    sampleHeap();
+    
+    // 内存不足时的失败可能留下不完整的状态，同样重建
+    bool recycle = m_outOfMemory || (m_recycleBytes && m_heap.usedBytes > (int64_t)m_recycleBytes);
+    m_outOfMemory = false;
+    if (!recycle) {
+        return false;
+    }
+    resetRuntime();
+    m_heap.recycles++;
+    sampleHeap();
+    return true;
+}
+
+void QuickJsEngine::sampleHeap() {
+    JSMemoryUsage usage;
+    JS_ComputeMemoryUsage(m_runtime, &usage);
+    m_heap.usedBytes = usage.memory_used_size;
+    m_heap.objects = usage.obj_count;
+    m_heap.strings = usage.str_count;
+    if (m_heap.usedBytes > m_heap.peakBytes) {
+        m_heap.peakBytes = m_heap.usedBytes;
+    }
+}
+
+JsHeapStats QuickJsEngine::getHeapStats() const {
+    return m_heap;
 }
 
 void QuickJsEngine::initLegadoApi() {
@@ -351,6 +538,12 @@ void QuickJsEngine::registerJavaObject() {
         JS_NewCFunction(m_context, js_java_ajax, "ajax", 1));
     JS_SetPropertyStr(m_context, java, "post",
         JS_NewCFunction(m_context, js_java_post, "post", 3));
+    JS_SetPropertyStr(m_context, java, "ajaxAsync",
+        JS_NewCFunction(m_context, js_java_ajaxAsync, "ajaxAsync", 1));
+    JS_SetPropertyStr(m_context, java, "postAsync",
+        JS_NewCFunction(m_context, js_java_postAsync, "postAsync", 3));
+    JS_SetPropertyStr(m_context, java, "ajaxAll",
+        JS_NewCFunction(m_context, js_java_ajaxAll, "ajaxAll", 1));
     JS_SetPropertyStr(m_context, java, "get",
         JS_NewCFunction(m_context, js_java_get, "get", 1));
     JS_SetPropertyStr(m_context, java, "put",
@@ -373,6 +566,7 @@ void QuickJsEngine::registerJavaObject() {
         JS_NewCFunction(m_context, js_java_timeFormat, "timeFormat", 2));
     JS_SetPropertyStr(m_context, java, "htmlFormat",
         JS_NewCFunction(m_context, js_java_htmlFormat, "htmlFormat", 1));
+    JsCrypto::registerFunctions(m_context, java);
     
     // 将 java 对象添加到全局
     JS_SetPropertyStr(m_context, global, "java", java);
@@ -388,27 +582,203 @@ std::string QuickJsEngine::eval(const std::string& code) {
         return "";
     }
     
-    JSValue result = JS_Eval(m_context, code.c_str(), code.length(), "<eval>", JS_EVAL_TYPE_GLOBAL);
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    m_deadline = begin + std::chrono::milliseconds(m_timeLimit);
+    m_interrupted = false;
+    m_usage.evals++;
     
-    if (JS_IsException(result)) {
-        JSValue exception = JS_GetException(m_context);
-        const char* str = JS_ToCString(m_context, exception);
-        if (str) {
-            setError(std::string("JS Error: ") + str);
-            JS_FreeCString(m_context, str);
-        } else {
-            setError("Unknown JS error");
-        }
-        JS_FreeValue(m_context, exception);
-        JS_FreeValue(m_context, result);
-        return "";
+    JSValue result = m_codeCache->eval(code);
+    if (!JS_IsException(result)) {
+        result = settle(result);
     }
     
-    std::string resultStr = jsValueToString(result);
+    std::string resultStr;
+    if (JS_IsException(result)) {
+        setErrorFromException();
+    } else {
+        resultStr = jsValueToString(result);
+    }
     JS_FreeValue(m_context, result);
+    
+    endEval(begin);
     return resultStr;
 }
 
+bool QuickJsEngine::evalBatch(const std::string& code, const std::vector<std::string>& items,
+                              std::vector<std::string>& results) {
+    // 出错的条目保留原值
+    results = items;
+    return evalBatch(code, results);
+}
+
+bool QuickJsEngine::evalBatch(const std::string& code, std::vector<std::string>& results) {
+    clearError();
+    
+    if (!m_context) {
+        setError("JS context not initialized");
+        return false;
+    }
+    if (results.empty()) {
+        return true;
+    }
+    
+    // 整个列表算一次执行，共用一个时间上限
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    m_deadline = begin + std::chrono::milliseconds(m_timeLimit);
+    m_interrupted = false;
+    m_usage.evals++;
+    
+    uint64_t hash = JsBytecodeCache::hashSource(code);
+    if (m_statementScripts.count(hash)) {
+        evalEach(code, results);
+    } else if (!evalMap(code, results)) {
+        // 不是单个表达式（有 var、多条语句等），只能逐条执行
+        m_statementScripts.insert(hash);
+        evalEach(code, results);
+    }
+    
+    // 脚本发起的异步请求在返回前完成
+    JSValue settled = settle(JS_UNDEFINED);
+    if (JS_IsException(settled) && (!m_hasError || m_interrupted)) {
+        setErrorFromException();
+    }
+    JS_FreeValue(m_context, settled);
+    
+    endEval(begin);
+    return !m_hasError;
+}
+
+bool QuickJsEngine::evalMap(const std::string& code, std::vector<std::string>& results) {
+    // 规则包成函数，整个列表作为数组传入，一次 map 调用处理完
+    // 单条出错时记录错误并返回原值，不影响其它条目
+    std::string wrapper =
+        "(function(list, errors) { return list.map(function(result, i) { try { return (\n"
+        + code +
+        "\n); } catch (e) { errors[i] = String(e); return result; } }); })";
+    
+    JSValue mapper = m_codeCache->eval(wrapper, "<batch>");
+    if (JS_IsException(mapper)) {
+        JS_FreeValue(m_context, JS_GetException(m_context));
+        return false;
+    }
+    
+    uint32_t count = (uint32_t)results.size();
+    std::vector<JSValue> inputs(count);
+    JSValue args[2];
+    args[0] = JS_NewArray(m_context);
+    args[1] = JS_NewArray(m_context);
+    for (uint32_t i = 0; i < count; i++) {
+        inputs[i] = newString(results[i].c_str(), results[i].length());
+        JS_SetPropertyUint32(m_context, args[0], i, JS_DupValue(m_context, inputs[i]));
+    }
+    
+    JSValue ret = JS_Call(m_context, mapper, JS_UNDEFINED, 2, args);
+    if (JS_IsException(ret)) {
+        // 只有中断会走到这里，其它异常已在 map 内捕获
+        setErrorFromException();
+    } else {
+        for (uint32_t i = 0; i < count; i++) {
+            JSValue error = JS_GetPropertyUint32(m_context, args[1], i);
+            if (JS_IsUndefined(error)) {
+                JSValue value = JS_GetPropertyUint32(m_context, ret, i);
+                if (JS_VALUE_GET_TAG(value) == JS_TAG_STRING
+                    && JS_VALUE_GET_PTR(value) == JS_VALUE_GET_PTR(inputs[i])) {
+                    // 原样返回，保留原值
+                    m_usage.bytesReused += results[i].length();
+                } else {
+                    results[i] = jsValueToString(value);
+                }
+                JS_FreeValue(m_context, value);
+            } else if (!m_hasError) {
+                setError("JS Error: " + jsValueToString(error));
+            }
+            JS_FreeValue(m_context, error);
+        }
+    }
+    
+    for (uint32_t i = 0; i < count; i++) {
+        JS_FreeValue(m_context, inputs[i]);
+    }
+    JS_FreeValue(m_context, ret);
+    JS_FreeValue(m_context, args[0]);
+    JS_FreeValue(m_context, args[1]);
+    JS_FreeValue(m_context, mapper);
+    return true;
+}
+
+void QuickJsEngine::evalEach(const std::string& code, std::vector<std::string>& results) {
+    // 编译一次，每个条目只更新 result 再执行字节码
+    JSValue func = m_codeCache->getFunction(code, "<eval>");
+    if (JS_IsException(func)) {
+        setErrorFromException();
+        return;
+    }
+    
+    JSValue global = JS_GetGlobalObject(m_context);
+    JSAtom atom = JS_NewAtom(m_context, "result");
+    for (size_t i = 0; i < results.size(); i++) {
+        JSValue item = newString(results[i].c_str(), results[i].length());
+        JS_SetProperty(m_context, global, atom, JS_DupValue(m_context, item));
+        
+        // JS_EvalFunction 会释放传入的函数
+        JSValue ret = JS_EvalFunction(m_context, JS_DupValue(m_context, func));
+        if (JS_IsException(ret)) {
+            if (!m_hasError || m_interrupted) {
+                setErrorFromException();
+            } else {
+                JS_FreeValue(m_context, JS_GetException(m_context));
+            }
+        } else if (JS_VALUE_GET_TAG(ret) == JS_TAG_STRING
+                   && JS_VALUE_GET_PTR(ret) == JS_VALUE_GET_PTR(item)) {
+            m_usage.bytesReused += results[i].length();
+        } else {
+            results[i] = jsValueToString(ret);
+        }
+        JS_FreeValue(m_context, ret);
+        JS_FreeValue(m_context, item);
+        
+        if (m_interrupted) {
+            break;
+        }
+    }
+    JS_FreeAtom(m_context, atom);
+    JS_FreeValue(m_context, global);
+    JS_FreeValue(m_context, func);
+}
+
+void QuickJsEngine::setErrorFromException() {
+    JSValue exception = JS_GetException(m_context);
+    const char* str = JS_ToCString(m_context, exception);
+    if (m_interrupted) {
+        setError(stopped() ? "JS Error: script stopped"
+            : "JS Error: script timed out after " + std::to_string(m_timeLimit) + " ms");
+    } else if (str) {
+        setError(std::string("JS Error: ") + str);
+    } else {
+        setError("Unknown JS error");
+    }
+    // 下次空闲时回收运行时
+    if (!str || strstr(str, "out of memory")) {
+        m_outOfMemory = true;
+    }
+    if (str) {
+        JS_FreeCString(m_context, str);
+    }
+    JS_FreeValue(m_context, exception);
+}
+
+void QuickJsEngine::endEval(std::chrono::steady_clock::time_point begin) {
+    m_evalsSinceGc++;
+    m_usage.elapsedMs += std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - begin).count();
+    if (m_interrupted) {
+        if (!stopped()) {
+            m_usage.timeouts++;
+        }
+        resetRuntime();
+    }
+}
+
 int QuickJsEngine::evalInt(const std::string& code, int defaultValue) {
     std::string result = eval(code);
     if (hasError() || result.empty()) {
@@ -466,32 +836,204 @@ std::string QuickJsEngine::processRule(const std::string& rule, const std::strin
     return eval(code);
 }
 
+// 变量名，{{key}}、{{page}} 这样的表达式不需要执行 JS
+static bool isIdentifier(const std::string& expr) {
+    if (expr.empty() || std::isdigit((unsigned char)expr[0])) {
+        return false;
+    }
+    for (char c : expr) {
+        if (!std::isalnum((unsigned char)c) && c != '_' && c != '$') {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 文本转换为 JS 字符串字面量
+static std::string quoteString(const std::string& text) {
+    std::string quoted = "'";
+    for (size_t i = 0; i < text.length(); i++) {
+        char c = text[i];
+        switch (c) {
+        case '\\': quoted += "\\\\"; break;
+        case '\'': quoted += "\\'"; break;
+        case '\n': quoted += "\\n"; break;
+        case '\r': quoted += "\\r"; break;
+        default:
+            // U+2028/U+2029 在旧引擎的字符串字面量中是换行
+            if ((unsigned char)c == 0xE2 && i + 2 < text.length()
+                && (unsigned char)text[i + 1] == 0x80
+                && ((unsigned char)text[i + 2] == 0xA8 || (unsigned char)text[i + 2] == 0xA9)) {
+                quoted += (unsigned char)text[i + 2] == 0xA8 ? "\\u2028" : "\\u2029";
+                i += 2;
+            } else {
+                quoted += c;
+            }
+            break;
+        }
+    }
+    quoted += "'";
+    return quoted;
+}
+
 std::string QuickJsEngine::processTemplate(const std::string& templateStr) {
+    TemplatePlan& plan = compileTemplate(templateStr);
+    if (plan.exprs.empty()) {
+        return plan.texts[0];
+    }
+    
     std::string result;
+    if (plan.native && evalTemplateNative(plan, result)) {
+        return result;
+    }
+    if (plan.statements) {
+        return evalTemplateEach(plan);
+    }
+    return evalTemplateFunction(plan);
+}
+
+QuickJsEngine::TemplatePlan& QuickJsEngine::compileTemplate(const std::string& templateStr) {
+    auto it = m_templates.find(templateStr);
+    if (it != m_templates.end()) {
+        return it->second;
+    }
+    if (m_templates.size() >= MAX_TEMPLATES) {
+        m_templates.clear();
+    }
+    
+    TemplatePlan& plan = m_templates[templateStr];
+    std::string text;
     size_t pos = 0;
     
+    plan.native = true;
+    plan.statements = false;
     while (pos < templateStr.length()) {
         size_t start = templateStr.find("{{", pos);
         if (start == std::string::npos) {
-            result += templateStr.substr(pos);
+            text += templateStr.substr(pos);
             break;
         }
         
-        result += templateStr.substr(pos, start - pos);
+        text += templateStr.substr(pos, start - pos);
         
         size_t end = templateStr.find("}}", start);
         if (end == std::string::npos) {
-            result += templateStr.substr(start);
+            text += templateStr.substr(start);
             break;
         }
         
-        std::string expr = templateStr.substr(start + 2, end - start - 2);
-        std::string value = eval(expr);
-        result += value;
+        plan.texts.push_back(text);
+        text.clear();
+        plan.exprs.push_back(templateStr.substr(start + 2, end - start - 2));
+        if (!isIdentifier(plan.exprs.back())) {
+            plan.native = false;
+        }
         
         pos = end + 2;
     }
+    plan.texts.push_back(text);
+    
+    // 每个表达式单独求值，出错的记录错误并替换为空，与逐个执行时一致
+    plan.function = "(function(errors) { var text = function(f) { try { var v = f(); "
+        "return v === undefined || v === null ? '' : String(v); } "
+        "catch (e) { errors.push(String(e)); return ''; } }; return " + quoteString(plan.texts[0]);
+    for (size_t i = 0; i < plan.exprs.size(); i++) {
+        plan.function += " + text(function() { return (\n" + plan.exprs[i] + "\n); }) + "
+            + quoteString(plan.texts[i + 1]);
+    }
+    plan.function += "; })";
+    return plan;
+}
+
+bool QuickJsEngine::evalTemplateNative(const TemplatePlan& plan, std::string& result) {
+    clearError();
+    if (!m_context) {
+        setError("JS context not initialized");
+        return false;
+    }
+    
+    // 直接读取全局变量，变量不存在时交给 JS 执行以得到同样的错误
+    JSValue global = JS_GetGlobalObject(m_context);
+    bool ok = true;
+    result = plan.texts[0];
+    for (size_t i = 0; i < plan.exprs.size() && ok; i++) {
+        JSAtom atom = JS_NewAtom(m_context, plan.exprs[i].c_str());
+        if (JS_HasProperty(m_context, global, atom) > 0) {
+            JSValue value = JS_GetProperty(m_context, global, atom);
+            if (JS_IsException(value)) {
+                JS_FreeValue(m_context, JS_GetException(m_context));
+                ok = false;
+            } else {
+                result += jsValueToString(value);
+                result += plan.texts[i + 1];
+            }
+            JS_FreeValue(m_context, value);
+        } else {
+            ok = false;
+        }
+        JS_FreeAtom(m_context, atom);
+    }
+    JS_FreeValue(m_context, global);
+    return ok;
+}
+
+std::string QuickJsEngine::evalTemplateFunction(TemplatePlan& plan) {
+    clearError();
+    
+    if (!m_context) {
+        setError("JS context not initialized");
+        return "";
+    }
     
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    m_deadline = begin + std::chrono::milliseconds(m_timeLimit);
+    m_interrupted = false;
+    
+    JSValue func = m_codeCache->eval(plan.function, "<template>");
+    if (JS_IsException(func)) {
+        if (m_interrupted) {
+            setErrorFromException();
+            endEval(begin);
+            return "";
+        }
+        // 表达式是语句（有 var、多条语句等），以后都逐个执行
+        JS_FreeValue(m_context, JS_GetException(m_context));
+        plan.statements = true;
+        return evalTemplateEach(plan);
+    }
+    m_usage.evals++;
+    
+    JSValue errors = JS_NewArray(m_context);
+    JSValue result = JS_Call(m_context, func, JS_UNDEFINED, 1, &errors);
+    if (!JS_IsException(result)) {
+        result = settle(result);
+    }
+    
+    std::string resultStr;
+    if (JS_IsException(result)) {
+        setErrorFromException();
+    } else {
+        resultStr = jsValueToString(result);
+        JSValue error = JS_GetPropertyUint32(m_context, errors, 0);
+        if (!JS_IsUndefined(error)) {
+            setError("JS Error: " + jsValueToString(error));
+        }
+        JS_FreeValue(m_context, error);
+    }
+    JS_FreeValue(m_context, result);
+    JS_FreeValue(m_context, errors);
+    JS_FreeValue(m_context, func);
+    
+    endEval(begin);
+    return resultStr;
+}
+
+std::string QuickJsEngine::evalTemplateEach(const TemplatePlan& plan) {
+    std::string result = plan.texts[0];
+    for (size_t i = 0; i < plan.exprs.size(); i++) {
+        result += eval(plan.exprs[i]);
+        result += plan.texts[i + 1];
+    }
     return result;
 }
 
@@ -504,10 +1046,13 @@ bool QuickJsEngine::containsJs(const std::string& rule) {
 void QuickJsEngine::setVariable(const std::string& name, const std::string& value) {
     m_variables[name] = value;
     
-    // 同时设置到 JS 环境
-    std::string code = "var " + name + " = " + 
-        "\"" + value + "\";";  // 简化处理，实际应转义
-    eval(code);
+    // 同时设置到 JS 环境，直接设置全局属性，不拼接源码，避免每个值都编译一次
+    if (m_context) {
+        JSValue global = JS_GetGlobalObject(m_context);
+        JS_SetPropertyStr(m_context, global, name.c_str(),
+            newString(value.c_str(), value.length()));
+        JS_FreeValue(m_context, global);
+    }
 }
 
 std::string QuickJsEngine::getVariable(const std::string& name) {
@@ -519,19 +1064,71 @@ std::string QuickJsEngine::getVariable(const std::string& name) {
 }
 
 void QuickJsEngine::setResult(const std::string& value) {
-    // 转义字符串
-    std::string escaped;
-    for (char c : value) {
-        switch (c) {
-            case '\\': escaped += "\\\\"; break;
-            case '"': escaped += "\\\""; break;
-            case '\n': escaped += "\\n"; break;
-            case '\r': escaped += "\\r"; break;
-            case '\t': escaped += "\\t"; break;
-            default: escaped += c;
+    setResult(value.c_str(), value.length());
+}
+
+void QuickJsEngine::setResult(const char* data, size_t len) {
+    // 每个结果项的内容都不同，拼接成源码会导致每次都重新编译
+    if (!m_context) {
+        return;
+    }
+    JSValue global = JS_GetGlobalObject(m_context);
+    JS_SetPropertyStr(m_context, global, "result", newString(data, len));
+    JS_FreeValue(m_context, global);
+}
+
+void QuickJsEngine::setStringCacheSize(size_t entries) {
+    clearHostStrings();
+    m_hostStringSlots = entries;
+}
+
+JSValue QuickJsEngine::newString(const char* data, size_t len) {
+    if (len < HOST_STRING_MIN_SIZE || len > HOST_STRING_MAX_SIZE || m_hostStringSlots == 0) {
+        m_usage.bytesIn += len;
+        return JS_NewStringLen(m_context, data, len);
+    }
+    
+    // 同一个页面常被多条规则使用，比较内容比重新解码 UTF-8 快得多
+    for (auto& entry : m_hostStrings) {
+        if (entry.text.length() == len && memcmp(entry.text.data(), data, len) == 0) {
+            entry.lastUse = ++m_hostStringClock;
+            m_usage.bytesReused += len;
+            return JS_DupValue(m_context, entry.value);
+        }
+    }
+    
+    JSValue value = JS_NewStringLen(m_context, data, len);
+    m_usage.bytesIn += len;
+    if (JS_IsException(value)) {
+        return value;
+    }
+    
+    HostString* slot = nullptr;
+    if (m_hostStrings.size() < m_hostStringSlots) {
+        m_hostStrings.push_back(HostString());
+        slot = &m_hostStrings.back();
+    } else {
+        slot = &m_hostStrings[0];
+        for (auto& entry : m_hostStrings) {
+            if (entry.lastUse < slot->lastUse) {
+                slot = &entry;
+            }
+        }
+        JS_FreeValue(m_context, slot->value);
+    }
+    slot->text.assign(data, len);
+    slot->value = JS_DupValue(m_context, value);
+    slot->lastUse = ++m_hostStringClock;
+    return value;
+}
+
+void QuickJsEngine::clearHostStrings() {
+    if (m_context) {
+        for (auto& entry : m_hostStrings) {
+            JS_FreeValue(m_context, entry.value);
         }
     }
-    eval("var result = \"" + escaped + "\";");
+    m_hostStrings.clear();
 }
 
 void QuickJsEngine::setBaseUrl(const std::string& url) {
@@ -542,10 +1139,43 @@ void QuickJsEngine::setKeyword(const std::string& keyword) {
     setVariable("key", keyword);
 }
 
+const std::map<std::string, std::string>& QuickJsEngine::getVariables() const {
+    return m_variables;
+}
+
+void QuickJsEngine::resetState() {
+    if (m_context) {
+        JSValue global = JS_GetGlobalObject(m_context);
+        for (const auto& var : m_variables) {
+            JSAtom atom = JS_NewAtom(m_context, var.first.c_str());
+            JS_DeleteProperty(m_context, global, atom, 0);
+            JS_FreeAtom(m_context, atom);
+        }
+        JSAtom atom = JS_NewAtom(m_context, "result");
+        JS_DeleteProperty(m_context, global, atom, 0);
+        JS_FreeAtom(m_context, atom);
+        JS_FreeValue(m_context, global);
+    }
+    m_variables.clear();
+    m_stopFlag = nullptr;
+    m_timeLimit = 0;
+    clearError();
+}
+
+void QuickJsEngine::attachThread() {
+    if (m_runtime) {
+        JS_UpdateStackTop(m_runtime);
+    }
+}
+
 void QuickJsEngine::setHttpCallback(HttpCallback callback) {
     m_httpCallback = callback;
 }
 
+void QuickJsEngine::setAsyncHttpCallback(AsyncHttpCallback callback) {
+    m_asyncHttpCallback = callback;
+}
+
 void QuickJsEngine::setLogCallback(LogCallback callback) {
     m_logCallback = callback;
 }
@@ -568,13 +1198,26 @@ std::string QuickJsEngine::jsValueToString(JSValue val) {
         return "";
     }
     
-    const char* str = JS_ToCString(m_context, val);
+    // 原样返回的输入直接取回原文，不再转换
+    if (JS_VALUE_GET_TAG(val) == JS_TAG_STRING) {
+        for (const auto& entry : m_hostStrings) {
+            if (JS_VALUE_GET_PTR(entry.value) == JS_VALUE_GET_PTR(val)) {
+                m_usage.bytesReused += entry.text.length();
+                return entry.text;
+            }
+        }
+    }
+    
+    // 纯 ASCII 的字符串 JS_ToCStringLen 不分配内存，长度已知时也不用再 strlen
+    size_t len = 0;
+    const char* str = JS_ToCStringLen(m_context, &len, val);
     if (!str) {
         return "";
     }
     
-    std::string result(str);
+    std::string result(str, len);
     JS_FreeCString(m_context, str);
+    m_usage.bytesOut += len;
     return result;
 }
 
@@ -583,6 +1226,243 @@ void QuickJsEngine::setError(const std::string& error) {
     m_hasError = true;
 }
 
+bool QuickJsEngine::loadCodeCache(const std::string& path) {
+    return m_codeCache && m_codeCache->load(path);
+}
+
+bool QuickJsEngine::saveCodeCache(const std::string& path) {
+    return m_codeCache && m_codeCache->save(path);
+}
+
+JsCacheStats QuickJsEngine::getCacheStats() const {
+    JsCacheStats stats = {};
+    if (m_codeCache) {
+        stats = m_codeCache->stats();
+    }
+    return stats;
+}
+
+// ============ 异步请求 ============
+
+uint64_t QuickJsEngine::queueRequest(HttpRequest request, JSValue* resolvingFuncs) {
+    AsyncCall call;
+    call.resolve = resolvingFuncs ? resolvingFuncs[0] : JS_UNDEFINED;
+    call.reject = resolvingFuncs ? resolvingFuncs[1] : JS_UNDEFINED;
+    call.done = false;
+    call.ok = false;
+    
+    request.id = ++m_nextRequestId;
+    m_asyncCalls[request.id] = call;
+    m_waitingRequests.push_back(std::move(request));
+    dispatchRequests();
+    return m_nextRequestId;
+}
+
+void QuickJsEngine::dispatchRequests() {
+    while (m_requestsInFlight < MAX_ASYNC_REQUESTS && !m_waitingRequests.empty()) {
+        HttpRequest request = std::move(m_waitingRequests.front());
+        m_waitingRequests.pop_front();
+        m_requestsInFlight++;
+        
+        std::shared_ptr<HttpInbox> inbox = m_inbox;
+        uint64_t id = request.id;
+        if (m_asyncHttpCallback) {
+            m_asyncHttpCallback(request.url, request.method, request.body, request.headers,
+                [inbox, id](bool ok, const std::string& response) {
+                    inbox->push(id, ok, response);
+                });
+        } else if (m_httpCallback) {
+            // 没有异步回调时每个请求一个线程，线程只持有回调副本和完成队列
+            HttpCallback callback = m_httpCallback;
+            std::thread([inbox, callback, request]() {
+                try {
+                    inbox->push(request.id, true,
+                        callback(request.url, request.method, request.body, request.headers));
+                } catch (...) {
+                    inbox->push(request.id, false, "request failed: " + request.url);
+                }
+            }).detach();
+        } else {
+            // 与同步的 java.ajax 一致，返回模拟结果
+            inbox->push(id, true, "{\"code\":0,\"msg\":\"mock response\"}");
+        }
+    }
+}
+
+bool QuickJsEngine::receiveResponses() {
+    std::deque<HttpInbox::Response> responses;
+    {
+        std::unique_lock<std::mutex> lock(m_inbox->mutex);
+        while (m_inbox->responses.empty()) {
+            // 等待网络不占用脚本的执行时间，但仍受时间上限和停止标志约束
+            std::chrono::steady_clock::time_point until =
+                std::chrono::steady_clock::now() + std::chrono::milliseconds(ASYNC_POLL_MS);
+            if (m_timeLimit && m_deadline < until) {
+                until = m_deadline;
+            }
+            m_inbox->cond.wait_until(lock, until);
+            if (!m_inbox->responses.empty()) {
+                break;
+            }
+            if (stopped() || (m_timeLimit && std::chrono::steady_clock::now() >= m_deadline)) {
+                m_interrupted = true;
+                return false;
+            }
+        }
+        responses.swap(m_inbox->responses);
+    }
+    
+    for (auto& response : responses) {
+        m_requestsInFlight--;
+        auto it = m_asyncCalls.find(response.id);
+        if (it == m_asyncCalls.end()) {
+            continue;
+        }
+        AsyncCall& call = it->second;
+        if (JS_IsUndefined(call.resolve)) {
+            // 同步等待的请求，由 fetch 取走结果
+            call.done = true;
+            call.ok = response.ok;
+            call.response.swap(response.text);
+            continue;
+        }
+        
+        // resolve/reject 只把后续任务加入队列，由 settle 执行
+        JSValue arg;
+        if (response.ok) {
+            arg = newString(response.text.c_str(), response.text.length());
+        } else {
+            arg = JS_NewError(m_context);
+            JS_SetPropertyStr(m_context, arg, "message",
+                JS_NewStringLen(m_context, response.text.c_str(), response.text.length()));
+        }
+        JSValue ret = JS_Call(m_context, response.ok ? call.resolve : call.reject, JS_UNDEFINED, 1, &arg);
+        JS_FreeValue(m_context, ret);
+        JS_FreeValue(m_context, arg);
+        JS_FreeValue(m_context, call.resolve);
+        JS_FreeValue(m_context, call.reject);
+        m_asyncCalls.erase(it);
+    }
+    dispatchRequests();
+    return true;
+}
+
+bool QuickJsEngine::fetch(std::vector<HttpRequest>& requests, std::vector<std::string>& responses) {
+    std::vector<uint64_t> ids;
+    for (auto& request : requests) {
+        ids.push_back(queueRequest(std::move(request), nullptr));
+    }
+    
+    responses.assign(ids.size(), std::string());
+    size_t pending = ids.size();
+    bool ok = true;
+    while (pending) {
+        if (!receiveResponses()) {
+            ok = false;
+            break;
+        }
+        for (size_t i = 0; i < ids.size(); i++) {
+            auto it = m_asyncCalls.find(ids[i]);
+            if (it != m_asyncCalls.end() && it->second.done) {
+                // 失败的请求返回空字符串
+                if (it->second.ok) {
+                    responses[i].swap(it->second.response);
+                }
+                m_asyncCalls.erase(it);
+                pending--;
+            }
+        }
+    }
+    
+    // 中止时未完成的请求不再需要结果
+    for (uint64_t id : ids) {
+        m_asyncCalls.erase(id);
+    }
+    return ok;
+}
+
+JSValue QuickJsEngine::settle(JSValue value) {
+    int state = JS_PromiseState(m_context, value);
+    if (state < 0 && m_asyncCalls.empty() && !JS_IsJobPending(m_runtime)) {
+        return value;
+    }
+    
+    // 执行挂起的任务，没有任务时等待请求完成，完成的请求又会产生新的任务
+    for (;;) {
+        JSContext* ctx;
+        while (JS_IsJobPending(m_runtime)) {
+            if (JS_ExecutePendingJob(m_runtime, &ctx) < 0) {
+                if (m_interrupted) {
+                    JS_FreeValue(m_context, value);
+                    return JS_EXCEPTION;
+                }
+                JS_FreeValue(m_context, JS_GetException(m_context));
+            }
+        }
+        if (m_asyncCalls.empty()) {
+            break;
+        }
+        if (!receiveResponses()) {
+            JS_FreeValue(m_context, value);
+            return JS_ThrowInternalError(m_context, "interrupted while waiting for ajax");
+        }
+    }
+    
+    if (state < 0) {
+        return value;
+    }
+    state = JS_PromiseState(m_context, value);
+    JSValue result = JS_PromiseResult(m_context, value);
+    JS_FreeValue(m_context, value);
+    if (state == JS_PROMISE_FULFILLED) {
+        return result;
+    }
+    if (state == JS_PROMISE_REJECTED) {
+        return JS_Throw(m_context, result);
+    }
+    JS_FreeValue(m_context, result);
+    return JS_ThrowInternalError(m_context, "promise was never settled");
+}
+
+void QuickJsEngine::abandonRequests() {
+    if (m_context) {
+        for (auto& call : m_asyncCalls) {
+            JS_FreeValue(m_context, call.second.resolve);
+            JS_FreeValue(m_context, call.second.reject);
+        }
+    }
+    m_asyncCalls.clear();
+    m_waitingRequests.clear();
+    if (m_requestsInFlight) {
+        // 还在进行的请求写入旧的完成队列，不再被读取
+        m_inbox = std::make_shared<HttpInbox>();
+        m_requestsInFlight = 0;
+    }
+}
+
+// 请求头对象转换为 map，非对象忽略
+static void toHeaders(JSContext* ctx, JSValueConst obj, std::map<std::string, std::string>& headers) {
+    JSPropertyEnum* props = nullptr;
+    uint32_t count = 0;
+    if (!JS_IsObject(obj)
+        || JS_GetOwnPropertyNames(ctx, &props, &count, obj, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY) < 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        const char* name = JS_AtomToCString(ctx, props[i].atom);
+        JSValue value = JS_GetProperty(ctx, obj, props[i].atom);
+        const char* str = JS_ToCString(ctx, value);
+        if (name && str) {
+            headers[name] = str;
+        }
+        if (str) JS_FreeCString(ctx, str);
+        if (name) JS_FreeCString(ctx, name);
+        JS_FreeValue(ctx, value);
+        JS_FreeAtom(ctx, props[i].atom);
+    }
+    js_free(ctx, props);
+}
+
 // ============ JS API 静态回调实现 ============
 
 JSValue QuickJsEngine::js_java_log(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv) {
@@ -615,6 +1495,13 @@ JSValue QuickJsEngine::js_java_ajax(JSContext* ctx, JSValueConst this_val, int a
     std::string result;
     if (engine && engine->m_httpCallback) {
         result = engine->m_httpCallback(url, "GET", "", {});
+    } else if (engine && engine->m_asyncHttpCallback) {
+        std::vector<HttpRequest> requests(1);
+        std::vector<std::string> responses;
+        requests[0].url = url;
+        requests[0].method = "GET";
+        engine->fetch(requests, responses);
+        result = responses[0];
     } else {
         // 模拟返回
         result = "{\"code\":0,\"msg\":\"mock response\"}";
@@ -643,6 +1530,14 @@ JSValue QuickJsEngine::js_java_post(JSContext* ctx, JSValueConst this_val, int a
     std::string result;
     if (engine && engine->m_httpCallback) {
         result = engine->m_httpCallback(url ? url : "", "POST", body, {});
+    } else if (engine && engine->m_asyncHttpCallback) {
+        std::vector<HttpRequest> requests(1);
+        std::vector<std::string> responses;
+        requests[0].url = url ? url : "";
+        requests[0].method = "POST";
+        requests[0].body = body;
+        engine->fetch(requests, responses);
+        result = responses[0];
     } else {
         result = "{\"code\":0,\"msg\":\"mock post response\"}";
     }
@@ -651,6 +1546,94 @@ JSValue QuickJsEngine::js_java_post(JSContext* ctx, JSValueConst this_val, int a
     return JS_NewString(ctx, result.c_str());
 }
 
+JSValue QuickJsEngine::js_java_ajaxAsync(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv) {
+    QuickJsEngine* engine = getEngineFromContext(ctx);
+    const char* url = argc > 0 ? JS_ToCString(ctx, argv[0]) : nullptr;
+    if (!engine || !url) {
+        return JS_ThrowTypeError(ctx, "ajaxAsync: url expected");
+    }
+    
+    HttpRequest request;
+    request.url = url;
+    request.method = "GET";
+    JS_FreeCString(ctx, url);
+    
+    JSValue funcs[2];
+    JSValue promise = JS_NewPromiseCapability(ctx, funcs);
+    if (JS_IsException(promise)) {
+        return promise;
+    }
+    engine->queueRequest(std::move(request), funcs);
+    return promise;
+}
+
+JSValue QuickJsEngine::js_java_postAsync(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv) {
+    QuickJsEngine* engine = getEngineFromContext(ctx);
+    const char* url = argc > 0 ? JS_ToCString(ctx, argv[0]) : nullptr;
+    if (!engine || !url) {
+        return JS_ThrowTypeError(ctx, "postAsync: url expected");
+    }
+    
+    HttpRequest request;
+    request.url = url;
+    request.method = "POST";
+    JS_FreeCString(ctx, url);
+    if (argc > 1) {
+        const char* body = JS_ToCString(ctx, argv[1]);
+        if (body) {
+            request.body = body;
+            JS_FreeCString(ctx, body);
+        }
+    }
+    if (argc > 2) {
+        toHeaders(ctx, argv[2], request.headers);
+    }
+    
+    JSValue funcs[2];
+    JSValue promise = JS_NewPromiseCapability(ctx, funcs);
+    if (JS_IsException(promise)) {
+        return promise;
+    }
+    engine->queueRequest(std::move(request), funcs);
+    return promise;
+}
+
+JSValue QuickJsEngine::js_java_ajaxAll(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv) {
+    // 同步接口，请求并发进行，按 url 的顺序返回响应
+    QuickJsEngine* engine = getEngineFromContext(ctx);
+    if (!engine || argc < 1 || !JS_IsArray(ctx, argv[0])) {
+        return JS_ThrowTypeError(ctx, "ajaxAll: array of url expected");
+    }
+    
+    int64_t length = 0;
+    JSValue lengthVal = JS_GetPropertyStr(ctx, argv[0], "length");
+    JS_ToInt64(ctx, &length, lengthVal);
+    JS_FreeValue(ctx, lengthVal);
+    
+    std::vector<HttpRequest> requests((size_t)length);
+    for (int64_t i = 0; i < length; i++) {
+        JSValue item = JS_GetPropertyUint32(ctx, argv[0], (uint32_t)i);
+        const char* url = JS_ToCString(ctx, item);
+        if (url) {
+            requests[i].url = url;
+            JS_FreeCString(ctx, url);
+        }
+        requests[i].method = "GET";
+        JS_FreeValue(ctx, item);
+    }
+    
+    std::vector<std::string> responses;
+    if (!engine->fetch(requests, responses)) {
+        return JS_ThrowInternalError(ctx, "interrupted while waiting for ajax");
+    }
+    JSValue array = JS_NewArray(ctx);
+    for (size_t i = 0; i < responses.size(); i++) {
+        JS_SetPropertyUint32(ctx, array, (uint32_t)i,
+            engine->newString(responses[i].c_str(), responses[i].length()));
+    }
+    return array;
+}
+
 JSValue QuickJsEngine::js_java_get(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv) {
     QuickJsEngine* engine = getEngineFromContext(ctx);
     if (argc < 1 || !engine) {
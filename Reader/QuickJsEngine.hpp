@@ -16,12 +16,18 @@
 #include <vector>
 #include <functional>
 #include <memory>
+#include <chrono>
+#include <cstdint>
+#include <unordered_set>
+#include <deque>
 
 // QuickJS C 头文件
 extern "C" {
 #include "quickjs.h"
 }
 
+#include "JsBytecodeCache.h"
+
 namespace Reader {
 
 /**
@@ -33,11 +39,52 @@ using HttpCallback = std::function<std::string(const std::string& url,
                                                 const std::string& body,
                                                 const std::map<std::string, std::string>& headers)>;
 
+/**
+ * 异步 HTTP 请求完成时的通知，可以在任意线程调用
+ */
+using HttpDone = std::function<void(bool ok, const std::string& response)>;
+
+/**
+ * 异步 HTTP 请求回调函数类型
+ * 用于 java.ajaxAsync() 等返回 Promise 的请求，发起请求后立即返回，完成时调用 done
+ */
+using AsyncHttpCallback = std::function<void(const std::string& url,
+                                             const std::string& method,
+                                             const std::string& body,
+                                             const std::map<std::string, std::string>& headers,
+                                             HttpDone done)>;
+
 /**
  * 日志回调函数类型
  */
 using LogCallback = std::function<void(const std::string& message)>;
 
+/**
+ * 脚本执行的资源统计
+ */
+struct JsUsage {
+    uint64_t evals;         // 执行次数
+    uint64_t ticks;         // 中断检查次数，QuickJS 大约每执行 10000 条指令检查一次
+    uint64_t timeouts;      // 超时被中止的次数
+    double elapsedMs;       // 累计执行时间（毫秒）
+    uint64_t bytesIn;       // 转换为 JS 字符串的字节数
+    uint64_t bytesOut;      // 从 JS 字符串转换回来的字节数
+    uint64_t bytesReused;   // 复用已有字符串、免去转换的字节数
+};
+
+/**
+ * 运行时的堆统计，在空闲时通过 JS_ComputeMemoryUsage 采样
+ */
+struct JsHeapStats {
+    int64_t usedBytes;      // 最近一次采样的已用内存
+    int64_t peakBytes;      // 采样到的最大已用内存
+    int64_t limitBytes;     // 内存上限
+    int64_t objects;        // 最近一次采样的对象数
+    int64_t strings;        // 最近一次采样的字符串数
+    uint64_t gcRuns;        // 空闲时执行 GC 的次数
+    uint64_t recycles;      // 超过阈值后重建运行时的次数
+};
+
 /**
  * QuickJS 引擎封装类
  * 
@@ -69,6 +116,8 @@ public:
     
     /**
      * 执行 JavaScript 代码
+     * 代码发起了异步请求或返回 Promise 时，继续执行挂起的任务直到请求全部完成，
+     * 返回 Promise 的结果
      * @param code JavaScript 代码
      * @return 执行结果的字符串表示
      */
@@ -90,6 +139,24 @@ public:
      */
     bool evalBool(const std::string& code, bool defaultValue = false);
     
+    /**
+     * 对列表中的每一项执行同一段代码，result 变量为当前项
+     * 单个表达式的代码包成函数，整个列表作为 JS 数组一次 map 处理；
+     * 多条语句的代码只编译一次，逐项执行字节码
+     * 
+     * @param code JavaScript 代码
+     * @param items 输入列表
+     * @param results 输出列表，与 items 一一对应，出错的项保留原值
+     * @return 是否全部执行成功，失败时 getLastError() 为第一个错误
+     */
+    bool evalBatch(const std::string& code, const std::vector<std::string>& items,
+                   std::vector<std::string>& results);
+    
+    /**
+     * 同上，结果直接写回 items，省去整个列表的一次拷贝
+     */
+    bool evalBatch(const std::string& code, std::vector<std::string>& items);
+    
     // ============ Legado 规则处理 ============
     
     /**
@@ -107,7 +174,8 @@ public:
     
     /**
      * 处理模板字符串
-     * 将 {{expression}} 替换为表达式的执行结果
+     * 将 {{expression}} 替换为表达式的执行结果。模板只解析一次：表达式都是变量名时直接读取变量拼接，
+     * 否则整个模板编译为一个函数，一次调用得到结果
      * 
      * @param templateStr 模板字符串
      * @return 处理后的字符串
@@ -143,6 +211,20 @@ public:
      */
     void setResult(const std::string& value);
     
+    /**
+     * 设置 result 变量，内容不必是 std::string（如整个响应的缓冲区）
+     * 超过 4KB 的内容与最近转换过的比较，相同时直接复用已有的 JS 字符串
+     * @param data 内容
+     * @param len 长度
+     */
+    void setResult(const char* data, size_t len);
+    
+    /**
+     * 设置大字符串缓存的条目数，0 表示不缓存
+     * @param entries 条目数，默认 4
+     */
+    void setStringCacheSize(size_t entries);
+    
     /**
      * 设置 baseUrl 变量
      * @param url 基础 URL
@@ -155,6 +237,67 @@ public:
      */
     void setKeyword(const std::string& keyword);
     
+    /**
+     * 获取所有持久化变量（setVariable 和 java.put 写入的）
+     */
+    const std::map<std::string, std::string>& getVariables() const;
+    
+    /**
+     * 清除本次求值设置的变量、result、停止标志和时间限制，供引擎池归还时隔离上下文
+     */
+    void resetState();
+    
+    /**
+     * 引擎在另一个线程上使用前调用，更新 QuickJS 的栈顶检查
+     */
+    void attachThread();
+    
+    // ============ 执行时间限制 ============
+    
+    /**
+     * 设置每次 eval 的执行时间上限
+     * 超时的脚本被中止（try/catch 无法捕获），随后重建运行时，防止死循环卡住下载线程
+     * @param ms 毫秒，0 表示不限制
+     */
+    void setTimeLimit(unsigned ms);
+    
+    /**
+     * 设置外部停止标志，标志非 0 时中止正在执行的脚本
+     * @param stop 停止标志，nullptr 表示不检查
+     */
+    void setStopFlag(const volatile int* stop);
+    
+    /**
+     * 最后一次 eval 是否因超时或停止标志被中止
+     */
+    bool wasInterrupted() const;
+    
+    /**
+     * 取出并清零累计的资源统计
+     */
+    JsUsage takeUsage();
+    
+    // ============ 堆管理 ============
+    
+    /**
+     * 设置堆策略
+     * @param gcInterval 每执行多少次后在空闲时 GC，0 表示不主动 GC
+     * @param recycleBytes GC 后已用内存仍超过它时重建运行时，0 表示不重建
+     */
+    void setHeapPolicy(unsigned gcInterval, size_t recycleBytes);
+    
+    /**
+     * 空闲时调用（如两章之间、引擎归还时）：按策略 GC、采样内存，超过阈值或曾内存不足时
+     * 重建运行时。持久化变量和编译好的脚本带到新的运行时
+     * @return 是否重建了运行时
+     */
+    bool idle();
+    
+    /**
+     * 获取堆统计
+     */
+    JsHeapStats getHeapStats() const;
+    
     // ============ 回调设置 ============
     
     /**
@@ -164,6 +307,14 @@ public:
      */
     void setHttpCallback(HttpCallback callback);
     
+    /**
+     * 设置异步 HTTP 请求回调
+     * java.ajaxAsync()/java.postAsync() 返回的 Promise 和 java.ajaxAll() 通过它并发请求；
+     * 未设置时在后台线程上调用同步回调。设置后同步的 java.ajax() 在没有同步回调时也使用它
+     * @param callback 异步 HTTP 回调函数
+     */
+    void setAsyncHttpCallback(AsyncHttpCallback callback);
+    
     /**
      * 设置日志回调
      * 当 JS 调用 java.log() 时会调用此回调
@@ -189,23 +340,140 @@ public:
      * 清除错误状态
      */
     void clearError();
+    
+    // ============ 字节码缓存 ============
+    
+    /**
+     * 从文件加载字节码缓存，冷启动时跳过解析和编译
+     * @param path 缓存文件路径
+     * @return 是否加载成功
+     */
+    bool loadCodeCache(const std::string& path);
+    
+    /**
+     * 保存字节码缓存到文件
+     * @param path 缓存文件路径
+     * @return 是否保存成功
+     */
+    bool saveCodeCache(const std::string& path);
+    
+    /**
+     * 获取字节码缓存的命中统计
+     */
+    JsCacheStats getCacheStats() const;
 
 private:
     // QuickJS 运行时和上下文
     JSRuntime* m_runtime;
     JSContext* m_context;
     
+    // 编译后的脚本，按源码哈希索引
+    JsBytecodeCache* m_codeCache;
+    
     // 持久化变量存储
     std::map<std::string, std::string> m_variables;
     
+    // 不能作为表达式包装的代码（源码哈希），evalBatch 直接逐项执行
+    std::unordered_set<uint64_t> m_statementScripts;
+    
+    // 解析后的模板，文本和表达式交替，texts 比 exprs 多一个
+    struct TemplatePlan {
+        std::vector<std::string> texts;
+        std::vector<std::string> exprs;
+        bool native;            // 表达式都是变量名，不执行 JS
+        bool statements;        // 有表达式不能包装成函数，逐个执行
+        std::string function;   // 整个模板包装成的函数
+    };
+    std::map<std::string, TemplatePlan> m_templates;
+    
+    // 最近转换的大字符串，内容不变时复用，脚本原样返回时直接取回原文
+    struct HostString {
+        std::string text;
+        JSValue value;
+        uint64_t lastUse;
+    };
+    std::vector<HostString> m_hostStrings;
+    size_t m_hostStringSlots;
+    uint64_t m_hostStringClock;
+    
+    // 异步请求：等待发起的请求、未完成的调用和完成队列
+    // 完成队列与发起请求的线程共享，运行时重建后换成新的，迟到的结果被丢弃
+    struct HttpRequest {
+        uint64_t id;
+        std::string url;
+        std::string method;
+        std::string body;
+        std::map<std::string, std::string> headers;
+    };
+    struct AsyncCall {
+        JSValue resolve;        // Promise 的 resolve/reject，同步等待的调用为 undefined
+        JSValue reject;
+        bool done;
+        bool ok;
+        std::string response;
+    };
+    struct HttpInbox;
+    std::shared_ptr<HttpInbox> m_inbox;
+    std::deque<HttpRequest> m_waitingRequests;
+    std::map<uint64_t, AsyncCall> m_asyncCalls;
+    size_t m_requestsInFlight;
+    uint64_t m_nextRequestId;
+    
     // 回调函数
     HttpCallback m_httpCallback;
+    AsyncHttpCallback m_asyncHttpCallback;
     LogCallback m_logCallback;
     
     // 错误信息
     std::string m_lastError;
     bool m_hasError;
     
+    // 执行时间限制
+    size_t m_memoryLimit;
+    unsigned m_timeLimit;
+    std::chrono::steady_clock::time_point m_deadline;
+    const volatile int* m_stopFlag;
+    bool m_interrupted;
+    JsUsage m_usage;
+    
+    // 堆策略和统计
+    unsigned m_gcInterval;
+    size_t m_recycleBytes;
+    unsigned m_evalsSinceGc;
+    bool m_outOfMemory;
+    JsHeapStats m_heap;
+    
+    // 创建和释放运行时、上下文
+    bool createContext();
+    void destroyContext();
+    
+    // 超时后或堆过大时重建运行时，保留变量、回调和编译好的脚本
+    void resetRuntime();
+    void sampleHeap();
+    bool stopped() const;
+    
+    // evalBatch 的两种执行方式
+    bool evalMap(const std::string& code, std::vector<std::string>& results);
+    void evalEach(const std::string& code, std::vector<std::string>& results);
+    
+    // 模板：解析并缓存，再按解析结果选择执行方式
+    TemplatePlan& compileTemplate(const std::string& templateStr);
+    bool evalTemplateNative(const TemplatePlan& plan, std::string& result);
+    std::string evalTemplateFunction(TemplatePlan& plan);
+    std::string evalTemplateEach(const TemplatePlan& plan);
+    
+    // 取出当前异常设置错误信息，并在执行结束时记录统计
+    void setErrorFromException();
+    void endEval(std::chrono::steady_clock::time_point begin);
+    
+    // 异步请求：排队发起、取回完成的结果、驱动 Promise 任务直到结束
+    uint64_t queueRequest(HttpRequest request, JSValue* resolvingFuncs);
+    void dispatchRequests();
+    bool receiveResponses();
+    bool fetch(std::vector<HttpRequest>& requests, std::vector<std::string>& responses);
+    JSValue settle(JSValue value);
+    void abandonRequests();
+    
     // 初始化 Legado API
     void initLegadoApi();
     
@@ -213,13 +481,19 @@ private:
     void registerJavaObject();
     
     // 辅助函数
+    JSValue newString(const char* data, size_t len);
+    void clearHostStrings();
     std::string jsValueToString(JSValue val);
     void setError(const std::string& error);
     
     // 静态回调函数（用于 QuickJS C API）
+    static int js_interrupt_handler(JSRuntime* rt, void* opaque);
     static JSValue js_java_log(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv);
     static JSValue js_java_ajax(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv);
     static JSValue js_java_post(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv);
+    static JSValue js_java_ajaxAsync(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv);
+    static JSValue js_java_postAsync(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv);
+    static JSValue js_java_ajaxAll(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv);
     static JSValue js_java_get(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv);
     static JSValue js_java_put(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv);
     static JSValue js_java_base64Encode(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst* argv);
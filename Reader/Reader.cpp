@@ -6,6 +6,10 @@
 #include "EpubBook.h"
 #include "MobiBook.h"
 #include "OnlineBook.h"
+#include "HtmlParser.h"
+#include "LegadoRuleParser.h"
+#include "SourceStat.h"
+#include "BookSourceStore.h"
 #include "Keyset.h"
 #include "Editctrl.h"
 #include "Advset.h"
@@ -1491,6 +1495,11 @@ INT_PTR CALLBACK Setting(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
             SendMessage(GetDlgItem(hDlg, IDC_CHECK_TASKBAR), BM_SETCHECK, BST_UNCHECKED, NULL);
         SendMessage(GetDlgItem(hDlg, IDC_CHECK_LRHIDE), BM_SETCHECK, _header->disable_lrhide ? BST_UNCHECKED : BST_CHECKED, NULL);
         SendMessage(GetDlgItem(hDlg, IDC_CHECK_ESCHIDE), BM_SETCHECK, _header->disable_eschide ? BST_UNCHECKED : BST_CHECKED, NULL);
+#if defined(ENABLE_NETWORK) && ENABLE_HEDGED_FETCH
+        SendMessage(GetDlgItem(hDlg, IDC_CHECK_HEDGE), BM_SETCHECK, _header->hedged_fetch ? BST_CHECKED : BST_UNCHECKED, NULL);
+#else
+        EnableWindow(GetDlgItem(hDlg, IDC_CHECK_HEDGE), FALSE);
+#endif
         if ((_header->autopage_mode & 0x0f) == apm_page)
             SendMessage(GetDlgItem(hDlg, IDC_RADIO_ATPAGE), BM_SETCHECK, BST_CHECKED, NULL);
         else
@@ -1562,6 +1571,10 @@ INT_PTR CALLBACK Setting(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
             _header->disable_lrhide = res == BST_CHECKED ? 0 : 1;
             res = SendMessage(GetDlgItem(hDlg, IDC_CHECK_ESCHIDE), BM_GETCHECK, 0, NULL);
             _header->disable_eschide = res == BST_CHECKED ? 0 : 1;
+#if defined(ENABLE_NETWORK) && ENABLE_HEDGED_FETCH
+            res = SendMessage(GetDlgItem(hDlg, IDC_CHECK_HEDGE), BM_GETCHECK, 0, NULL);
+            _header->hedged_fetch = res == BST_CHECKED ? 1 : 0;
+#endif
             res = SendMessage(GetDlgItem(hDlg, IDC_RADIO_ATPAGE), BM_GETCHECK, 0, NULL);
             _header->autopage_mode = 0;
             _header->autopage_mode |= res == BST_CHECKED ? apm_page : apm_line;
@@ -3083,7 +3096,7 @@ BOOL IsVaildFile(HWND hWnd, TCHAR *filename, int *p_size)
     ext = PathFindExtension(filename);
 
 #ifdef ENABLE_NETWORK
-    if (!_header || _header->book_source_count == 0)
+    if (!_header || BookSourceStore::Instance()->Count() == 0)
     {
         if (0 == _tcscmp(ext, _T(".ol")))
         {
@@ -3280,6 +3293,12 @@ void OnOpenOlBook(HWND hWnd, void* olparam)
     olheader.header_size += (u32)((strlen(param->host) + 1) * sizeof(char));
     olheader.update_time = 0;
     olheader.is_finished = param->is_finished;
+    if (param->mirror_host[0] && param->mirror_page[0])
+    {
+        olheader.mirror_magic = OL_MIRROR_MAGIC;
+        olheader.mirror_offset = olheader.header_size;
+        olheader.header_size += (u32)(strlen(param->mirror_host) + 1 + strlen(param->mirror_page) + 1);
+    }
     olheader.chapter_size = 0;
 
     // write file
@@ -3287,7 +3306,12 @@ void OnOpenOlBook(HWND hWnd, void* olparam)
     fwrite(&olheader, 1, olheader.book_name_offset, fp);
     fwrite(param->book_name, 1, olheader.main_page_offset - olheader.book_name_offset, fp);
     fwrite(param->main_page, 1, olheader.host_offset - olheader.main_page_offset, fp);
-    fwrite(param->host, 1, olheader.header_size - olheader.host_offset, fp);
+    fwrite(param->host, 1, strlen(param->host) + 1, fp);
+    if (olheader.mirror_magic == OL_MIRROR_MAGIC)
+    {
+        fwrite(param->mirror_host, 1, strlen(param->mirror_host) + 1, fp);
+        fwrite(param->mirror_page, 1, strlen(param->mirror_page) + 1, fp);
+    }
     fclose(fp);
 
     OnOpenBook(hWnd, savepath, FALSE);
@@ -3319,6 +3343,9 @@ VOID GetCacheVersion(TCHAR *ver)
 
 BOOL Init(void)
 {
+    // the singleton isn't synchronized, create it before any worker thread is started
+    HtmlParser::Instance();
+
     if (!_Cache.init())
     {
         MessageBox_(NULL, IDS_INIT_CACHE_FAIL, IDS_ERROR, MB_OK);
@@ -3352,6 +3379,26 @@ BOOL Init(void)
 #if 0
     extern void TestXpathFromDump(void);
     TestXpathFromDump();
+    extern void BenchContentFromDump(const char*);
+    BenchContentFromDump("//*[@id='content']/text()");
+    extern void BenchCssFromDump(const char*, BOOL);
+    BenchCssFromDump("div#list dd a@href", FALSE);
+    extern void BenchJsonPathFromDump(const char*, const char*);
+    BenchJsonPathFromDump("$.data.list[*].name", "data.list.map(function(x) { return x.name; })");
+    extern void BenchRulesFromDump(const char*, const char*);
+    BenchRulesFromDump("dump.html", "class.bookname@tag.a@text\nclass.author@text\nclass.bookname@tag.a@href\ntag.img@src\nclass.intro@text\nclass.kind@text");
+    extern void TestJsCrypto(void);
+    TestJsCrypto();
+    extern void BenchJsCrypto(int);
+    BenchJsCrypto(64);
+    extern void BenchAjaxAsync(int);
+    BenchAjaxAsync(200);
+    extern void BenchRulePlan(const char*);
+    BenchRulePlan("class.bookname@tag.a@text##\\s+\nclass.author@text||tag.p.1@text\n$.data.list[*].name\n//div[@id='intro']/text()@js:result.trim()\n@css:div.kind a@text%%@css:div.tag a@text");
+    extern void BenchBridgeFromDump(const char*);
+    BenchBridgeFromDump("result.replace(/<br\\s*\\/?>/g, '\\n')\nvar m = result.match(/<h1>(.*?)<\\/h1>/); m ? m[1] : ''\nvar n = result.match(/href=\"([^\"]+)\" rel=\"next\"/); n ? n[1] : ''\nresult.length");
+    extern void BenchLegadoImport(const char*);
+    BenchLegadoImport("legado.json");
 #endif
 
     return TRUE;
@@ -3369,8 +3416,11 @@ void Exit(void)
     {
         MessageBox_(NULL, IDS_SAVE_CACHE_FAIL, IDS_ERROR, MB_OK);
     }
-#ifdef ENABLE_NETWORK
+    LegadoRuleParser::ReleaseInstance(); // save the compiled scripts
     HtmlParser::ReleaseInstance();
+    BookSourceStore::ReleaseInstance();
+#ifdef ENABLE_NETWORK
+    SourceStat::ReleaseInstance();
     hapi_uninit();
 #if TEST_MODEL
     logger_destroy();
@@ -3450,6 +3500,10 @@ static void _update_data(HWND hWnd, BOOL keep_header, BOOL do_save)
     if (do_save)
     {
         _Cache.save();
+        BookSourceStore::Instance()->Save();
+#ifdef ENABLE_NETWORK
+        SourceStat::Instance()->Save();
+#endif
     }    
 
     // restore
@@ -4318,16 +4372,7 @@ BOOL LoadResourceImage(LPCWSTR lpName, LPCWSTR lpType, Gdiplus::Bitmap **image,
 
 book_source_t* FindBookSource(const char* host)
 {
-    int i = 0;
-
-    if (!host)
-        return NULL;
-    for (i = 0; i < _header->book_source_count; i++)
-    {
-        if (0 == strcmp(_header->book_sources[i].host, host))
-            return &_header->book_sources[i];
-    }
-    return NULL;
+    return BookSourceStore::Instance()->Find(host);
 }
 
 void SetGlobalKey(HWND hWnd)
@@ -0,0 +1,313 @@
+#include "framework.h"
+#include "RulePlan.h"
+#include "CssSelector.h"
+#include "JsonPath.h"
+#include "LegadoRuleParser.h"
+
+// rules of a book source, the cache of a source is dropped when it grows over it
+#define MAX_CACHED_RULE     512
+
+HANDLE RulePlan::s_hMutex = CreateMutex(NULL, FALSE, NULL);
+std::map<std::string, std::map<std::string, std::shared_ptr<RulePlan>>> RulePlan::s_Cache;
+
+typedef RulePlan::step_t step_t;
+
+RulePlan::RulePlan()
+    : m_Combine(COMBINE_NONE)
+    , m_NeedJs(FALSE)
+{
+}
+
+RulePlan::~RulePlan()
+{
+}
+
+static BOOL _starts_with(const std::string &s, const char *prefix)
+{
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+// find the operator out of the quotes and brackets, the ones in [?(@.a && @.b)] or
+// [contains(text(),'||')] belong to the selector, the ones in {{a || b}} and {"k": "a&&b"}
+// belong to the template or the json, same as RuleAnalyzer of Legado
+static size_t _find_top_level(const std::string &rule, const char *op, size_t from)
+{
+    size_t oplen = strlen(op);
+    int depth = 0;
+    char quote = 0;
+    size_t i;
+
+    for (i = from; i < rule.size(); i++)
+    {
+        char c = rule[i];
+        if (quote)
+        {
+            if (c == '\\' && i + 1 < rule.size())
+                i++;
+            else if (c == quote)
+                quote = 0;
+            continue;
+        }
+        if (c == '\'' || c == '"')
+            quote = c;
+        else if (c == '[' || c == '(' || c == '{')
+            depth++;
+        else if ((c == ']' || c == ')' || c == '}') && depth > 0)
+            depth--;
+        else if (depth == 0 && rule.compare(i, oplen, op) == 0)
+            return i;
+    }
+    return std::string::npos;
+}
+
+BOOL RulePlan::Compile(const std::string &rule)
+{
+    static const char *ops[] = { "&&", "||", "%%" };
+    static const combine_t combines[] = { COMBINE_AND, COMBINE_OR, COMBINE_MIX };
+    std::string base;
+    std::vector<std::string> parts;
+    size_t pos, start, first = std::string::npos;
+    const char *op = NULL;
+    int i;
+
+    m_Combine = COMBINE_NONE;
+    m_Steps.clear();
+    m_Js.clear();
+    m_NeedJs = FALSE;
+    m_Error.clear();
+
+    // @js: and <js></js> post-step
+    pos = rule.find("@js:");
+    if (pos != std::string::npos)
+    {
+        base = rule.substr(0, pos);
+        m_Js = rule.substr(pos + 4);
+    }
+    else
+    {
+        size_t js_start = rule.find("<js>");
+        size_t js_end = rule.find("</js>");
+        if (js_start != std::string::npos && js_end != std::string::npos)
+        {
+            base = rule.substr(0, js_start);
+            m_Js = rule.substr(js_start + 4, js_end - js_start - 4);
+        }
+        else
+        {
+            base = rule;
+        }
+    }
+    m_NeedJs = !m_Js.empty();
+
+    // a rule uses one kind of combinator, the first one found decides it
+    for (i = 0; i < (int)(sizeof(ops) / sizeof(ops[0])); i++)
+    {
+        pos = _find_top_level(base, ops[i], 0);
+        if (pos < first)
+        {
+            first = pos;
+            op = ops[i];
+            m_Combine = combines[i];
+        }
+    }
+    if (op)
+    {
+        start = 0;
+        while ((pos = _find_top_level(base, op, start)) != std::string::npos)
+        {
+            parts.push_back(base.substr(start, pos - start));
+            start = pos + 2;
+        }
+        parts.push_back(base.substr(start));
+    }
+    else
+    {
+        parts.push_back(base);
+    }
+
+    m_Steps.resize(parts.size());
+    for (i = 0; i < (int)parts.size(); i++)
+    {
+        if (!CompileStep(parts[i], m_Steps[i]))
+            return FALSE;
+        if (m_Steps[i].type == STEP_JSONPATH_JS)
+            m_NeedJs = TRUE;
+    }
+    return TRUE;
+}
+
+BOOL RulePlan::CompileStep(const std::string &rule, step_t &step)
+{
+    std::string sel = rule;
+    size_t pos;
+
+    step.type = STEP_RAW;
+    step.has_replace = FALSE;
+    step.replace_first = FALSE;
+
+    // selector##regex##replacement###, split like java String.split of legado:
+    // the empty trailing parts are dropped and a fourth part means replace first
+    pos = _find_top_level(rule, "##", 0);
+    if (pos != std::string::npos)
+    {
+        std::vector<std::string> parts;
+        size_t start = pos + 2, end;
+        std::string pattern;
+
+        sel = rule.substr(0, pos);
+        while ((end = rule.find("##", start)) != std::string::npos)
+        {
+            parts.push_back(rule.substr(start, end - start));
+            start = end + 2;
+        }
+        parts.push_back(rule.substr(start));
+        while (!parts.empty() && parts.back().empty())
+            parts.pop_back();
+
+        if (parts.size() > 0)
+            pattern = parts[0];
+        if (parts.size() > 1)
+            step.replacement = parts[1];
+        step.replace_first = parts.size() > 2;
+
+        if (!pattern.empty())
+        {
+            try
+            {
+                step.regex = std::regex(pattern, std::regex_constants::ECMAScript | std::regex_constants::optimize);
+                step.has_replace = TRUE;
+            }
+            catch (...)
+            {
+                m_Error = "Invalid regex: " + pattern;
+                return FALSE;
+            }
+        }
+    }
+
+    if (sel.empty())
+        return TRUE;
+
+    if (_starts_with(sel, "@css:"))
+    {
+        std::string css = sel.substr(5);
+        step.selector = CssSelector::Get(css, FALSE);
+        if (step.selector)
+        {
+            step.type = STEP_SELECTOR;
+            return TRUE;
+        }
+        step.expr = LegadoRuleParser::CssToXPath(css);
+        if (step.expr.empty())
+        {
+            m_Error = "Failed to convert CSS to XPath: " + css;
+            return FALSE;
+        }
+        step.type = STEP_XPATH;
+    }
+    else if (_starts_with(sel, "@json:") || _starts_with(sel, "$.") || _starts_with(sel, "$["))
+    {
+        std::string path = _starts_with(sel, "@json:") ? sel.substr(6) : sel;
+        step.jsonpath = JsonPath::Get(path);
+        if (step.jsonpath)
+        {
+            step.type = STEP_JSONPATH;
+            return TRUE;
+        }
+        // can't be compiled (such as $.list.map(...)), it is evaluated as js
+        step.type = STEP_JSONPATH_JS;
+        if (_starts_with(path, "$."))
+            step.expr = "var data = JSON.parse(result); data." + path.substr(2);
+        else
+            step.expr = "var data = JSON.parse(result); data." + path;
+    }
+    else if (_starts_with(sel, "//") || _starts_with(sel, "@XPath:"))
+    {
+        step.type = STEP_XPATH;
+        step.expr = _starts_with(sel, "@XPath:") ? sel.substr(7) : sel;
+    }
+    else
+    {
+        // jsoup rule, the xpath translation is the fallback and the content as is at last
+        step.selector = CssSelector::Get(sel, TRUE);
+        if (step.selector)
+        {
+            step.type = STEP_SELECTOR;
+            return TRUE;
+        }
+        step.expr = LegadoRuleParser::CssToXPath(sel);
+        if (!step.expr.empty())
+            step.type = STEP_XPATH;
+    }
+    return TRUE;
+}
+
+void RulePlan::Replace(const step_t &step, std::vector<std::string> &values, size_t from)
+{
+    size_t i;
+
+    if (!step.has_replace)
+        return;
+
+    for (i = from; i < values.size(); i++)
+    {
+        if (step.replace_first)
+        {
+            // legado: only the first match is kept and replaced, empty if nothing matched
+            std::smatch m;
+            if (std::regex_search(values[i], m, step.regex))
+                values[i] = std::regex_replace(m.str(0), step.regex, step.replacement,
+                    std::regex_constants::format_first_only);
+            else
+                values[i].clear();
+        }
+        else
+        {
+            values[i] = std::regex_replace(values[i], step.regex, step.replacement);
+        }
+    }
+}
+
+std::shared_ptr<RulePlan> RulePlan::Get(const std::string &source, const std::string &rule)
+{
+    std::shared_ptr<RulePlan> plan;
+    std::map<std::string, std::map<std::string, std::shared_ptr<RulePlan>>>::iterator it;
+    std::map<std::string, std::shared_ptr<RulePlan>>::iterator it2;
+
+    WaitForSingleObject(s_hMutex, INFINITE);
+    it = s_Cache.find(source);
+    if (it != s_Cache.end())
+    {
+        it2 = it->second.find(rule);
+        if (it2 != it->second.end())
+        {
+            // NULL is cached too if the rule is invalid
+            plan = it2->second;
+            ReleaseMutex(s_hMutex);
+            return plan;
+        }
+    }
+    ReleaseMutex(s_hMutex);
+
+    plan = std::make_shared<RulePlan>();
+    if (!plan->Compile(rule))
+    {
+        logger_printk("invalid rule: %s", plan->Error().c_str());
+        plan.reset();
+    }
+
+    WaitForSingleObject(s_hMutex, INFINITE);
+    std::map<std::string, std::shared_ptr<RulePlan>> &plans = s_Cache[source];
+    if (plans.size() >= MAX_CACHED_RULE)
+        plans.clear();
+    plans[rule] = plan;
+    ReleaseMutex(s_hMutex);
+    return plan;
+}
+
+void RulePlan::ClearCache(void)
+{
+    WaitForSingleObject(s_hMutex, INFINITE);
+    s_Cache.clear();
+    ReleaseMutex(s_hMutex);
+}
@@ -0,0 +1,92 @@
+#ifndef __RULE_PLAN_H__
+#define __RULE_PLAN_H__
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <regex>
+#include "types.h"
+
+class CssSelector;
+class JsonPath;
+
+// compiled legado rule, the string surgery (prefix detection, @js: split, combinators,
+// ## replacement, css to xpath) is done once per rule of a book source, the parser only
+// walks the steps. a rule is:
+//   base[@js:code]  or  base<js>code</js>
+// base is sub rules joined by one kind of combinator:
+//   a&&b  results of all the sub rules are joined
+//   a||b  result of the first sub rule which has any
+//   a%%b  results of all the sub rules are interleaved, a1 b1 a2 b2 ...
+// and each sub rule is  selector[##regex[##replacement[###]]], the trailing ### replaces the
+// first match only and the value is empty if nothing matched, like legado.
+class RulePlan
+{
+public:
+    typedef enum step_type_t
+    {
+        STEP_RAW,           // empty rule, the content as is
+        STEP_XPATH,         // // or @XPath:, and the css rules which are translated
+        STEP_SELECTOR,      // @css: and jsoup rules matched by CssSelector
+        STEP_JSONPATH,      // native JsonPath
+        STEP_JSONPATH_JS    // the path can't be compiled, it is evaluated as js code
+    } step_type_t;
+
+    typedef enum combine_t
+    {
+        COMBINE_NONE,
+        COMBINE_AND,        // &&
+        COMBINE_OR,         // ||
+        COMBINE_MIX         // %%
+    } combine_t;
+
+    typedef struct step_t
+    {
+        step_type_t type;
+        std::string expr;   // xpath, or the js code of STEP_JSONPATH_JS
+        std::shared_ptr<CssSelector> selector;
+        std::shared_ptr<JsonPath> jsonpath;
+        BOOL has_replace;
+        BOOL replace_first;
+        std::regex regex;
+        std::string replacement;
+    } step_t;
+
+public:
+    RulePlan();
+    ~RulePlan();
+
+    BOOL Compile(const std::string &rule);
+
+    combine_t Combine() const { return m_Combine; }
+    const std::vector<step_t> &Steps() const { return m_Steps; }
+    // the js post-step which is run on every value, empty for none
+    const std::string &Js() const { return m_Js; }
+    // js is needed by the post-step or a step, the plans without it never touch the js engine
+    BOOL NeedJs() const { return m_NeedJs; }
+    const std::string &Error() const { return m_Error; }
+
+    // apply the ## replacement of the step to the values
+    static void Replace(const step_t &step, std::vector<std::string> &values, size_t from);
+
+    // get the compiled plan of a rule of the book source, it is compiled at the first time.
+    // NULL if the rule is invalid
+    static std::shared_ptr<RulePlan> Get(const std::string &source, const std::string &rule);
+    static void ClearCache(void);
+
+private:
+    BOOL CompileStep(const std::string &rule, step_t &step);
+
+private:
+    combine_t m_Combine;
+    std::vector<step_t> m_Steps;
+    std::string m_Js;
+    BOOL m_NeedJs;
+    std::string m_Error;
+
+    static HANDLE s_hMutex;
+    static std::map<std::string, std::map<std::string, std::shared_ptr<RulePlan>>> s_Cache;
+};
+
+#endif // !__RULE_PLAN_H__
@@ -0,0 +1,388 @@
+#ifdef ENABLE_NETWORK
+#include "framework.h"
+#include "SourceStat.h"
+#include "BookSourceStore.h"
+#include "cJSON.h"
+#include "Utils.h"
+#include <time.h>
+#include <algorithm>
+
+#define SOURCE_STAT_FILE_NAME       _T(".bs_stat.json")
+
+// several book sources may share one host, the state is keyed by "host title"
+static std::string _source_key(const book_source_t* bs)
+{
+    char title[sizeof(bs->title) / sizeof(TCHAR) * 3];
+    std::string key = bs->host;
+
+    if (WideCharToMultiByte(CP_UTF8, 0, bs->title, -1, title, sizeof(title), NULL, NULL) <= 0)
+        title[0] = 0;
+    key += ' ';
+    key += title;
+    return key;
+}
+
+SourceStat::SourceStat()
+    : m_Dirty(FALSE)
+{
+    m_hMutex = CreateMutex(NULL, FALSE, NULL);
+    GetHiddenFilePath(SOURCE_STAT_FILE_NAME, m_FileName);
+    Load();
+}
+
+SourceStat::~SourceStat()
+{
+    Save();
+    if (m_hMutex)
+        CloseHandle(m_hMutex);
+}
+
+SourceStat* SourceStat::Instance()
+{
+    static SourceStat* s_SourceStat = NULL;
+    if (!s_SourceStat)
+        s_SourceStat = new SourceStat;
+    return s_SourceStat;
+}
+
+void SourceStat::ReleaseInstance()
+{
+    if (Instance())
+        delete Instance();
+}
+
+int SourceStat::GetQueryCharset(const book_source_t* bs)
+{
+    std::map<std::string, source_stat_t>::iterator it;
+    int charset = 0;
+
+    if (!bs)
+        return 0;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    it = m_Stats.find(_source_key(bs));
+    if (it != m_Stats.end() && it->second.query_charset
+        && it->second.query_url == bs->query_url
+        && difftime(time(NULL), (time_t)it->second.charset_time) < CHARSET_EXPIRE_TIME)
+    {
+        charset = it->second.query_charset;
+    }
+    ReleaseMutex(m_hMutex);
+    return charset;
+}
+
+void SourceStat::SetQueryCharset(const book_source_t* bs, int charset)
+{
+    source_stat_t* stat;
+
+    if (!bs || (charset != 1 && charset != 2))
+        return;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    stat = &m_Stats[_source_key(bs)];
+    stat->query_charset = charset;
+    stat->charset_time = (double)time(NULL);
+    stat->query_url = bs->query_url;
+    m_Dirty = TRUE;
+    ReleaseMutex(m_hMutex);
+}
+
+void SourceStat::CheckQueryCharset(const book_source_t* bs, BOOL utf8)
+{
+    std::map<std::string, source_stat_t>::iterator it;
+    int charset = utf8 ? 1 : 2;
+    BOOL update = TRUE;
+
+    // the charset is configured by user
+    if (!bs || bs->query_charset != 0)
+        return;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    it = m_Stats.find(_source_key(bs));
+    if (it != m_Stats.end() && it->second.query_charset == charset && it->second.query_url == bs->query_url)
+        update = FALSE;
+    ReleaseMutex(m_hMutex);
+
+    if (update)
+    {
+        logger_printk("correct query charset, host=%s, charset=%d", bs->host, charset);
+        SetQueryCharset(bs, charset);
+    }
+}
+
+void SourceStat::AddRequest(const book_source_t* bs, DWORD elapse, stat_result_t result, int count)
+{
+    source_stat_t* stat;
+
+    if (!bs || !bs->host[0])
+        return;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    stat = &m_Stats[_source_key(bs)];
+    stat->request_count++;
+    if (result == sr_error)
+    {
+        // no latency sample, the timeout or refused request tells nothing about the speed
+        stat->error_count++;
+        stat->fail_streak++;
+        stat->fail_time = (double)time(NULL);
+    }
+    else
+    {
+        if (result == sr_parse_fail)
+            stat->parse_fail_count++;
+        else if (count >= 0)
+        {
+            stat->query_count++;
+            stat->result_count += count;
+        }
+        stat->fail_streak = 0;
+        if ((int)stat->latency.size() < STAT_LATENCY_SAMPLES)
+        {
+            stat->latency.push_back((int)elapse);
+        }
+        else
+        {
+            stat->latency_pos %= STAT_LATENCY_SAMPLES;
+            stat->latency[stat->latency_pos++] = (int)elapse;
+        }
+    }
+    m_Dirty = TRUE;
+    ReleaseMutex(m_hMutex);
+}
+
+void SourceStat::CalcHealth(const source_stat_t& stat, source_health_t* health)
+{
+    std::vector<int> latency = stat.latency;
+    int n = (int)latency.size();
+
+    memset(health, 0, sizeof(source_health_t));
+    health->request_count = stat.request_count;
+    health->error_count = stat.error_count;
+    health->parse_fail_count = stat.parse_fail_count;
+    health->query_count = stat.query_count;
+    health->result_count = stat.result_count;
+    health->fail_streak = stat.fail_streak;
+    if (n > 0)
+    {
+        std::sort(latency.begin(), latency.end());
+        health->latency_p50 = latency[(n - 1) * 50 / 100];
+        health->latency_p90 = latency[(n - 1) * 90 / 100];
+    }
+    health->down = stat.fail_streak >= STAT_DOWN_FAILURES
+        && difftime(time(NULL), (time_t)stat.fail_time) < STAT_DOWN_RETRY_TIME;
+}
+
+int SourceStat::CalcScore(const source_stat_t& stat)
+{
+    source_health_t health;
+    double latency, succ;
+
+    CalcHealth(stat, &health);
+    if (health.down)
+        return INT_MAX;
+    latency = stat.latency.empty() ? STAT_UNKNOWN_LATENCY : health.latency_p50;
+    // smoothed success rate, a new source is neither good nor bad
+    succ = (double)(health.request_count - health.error_count - health.parse_fail_count + 1) / (health.request_count + 2);
+    if (succ < 0.05)
+        succ = 0.05;
+    return (int)(latency / succ);
+}
+
+BOOL SourceStat::GetHealth(const book_source_t* bs, source_health_t* health)
+{
+    std::map<std::string, source_stat_t>::iterator it;
+    BOOL ret = FALSE;
+
+    if (!bs || !health)
+        return FALSE;
+
+    memset(health, 0, sizeof(source_health_t));
+    WaitForSingleObject(m_hMutex, INFINITE);
+    it = m_Stats.find(_source_key(bs));
+    if (it != m_Stats.end())
+    {
+        CalcHealth(it->second, health);
+        ret = TRUE;
+    }
+    ReleaseMutex(m_hMutex);
+    return ret;
+}
+
+BOOL SourceStat::IsDown(const book_source_t* bs)
+{
+    source_health_t health;
+
+    if (!GetHealth(bs, &health))
+        return FALSE;
+    return health.down;
+}
+
+int SourceStat::GetScore(const book_source_t* bs)
+{
+    std::map<std::string, source_stat_t>::iterator it;
+    int score = STAT_UNKNOWN_LATENCY * 2;
+
+    if (!bs)
+        return INT_MAX;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    it = m_Stats.find(_source_key(bs));
+    if (it != m_Stats.end())
+        score = CalcScore(it->second);
+    ReleaseMutex(m_hMutex);
+    return score;
+}
+
+static bool _score_less(const std::pair<int, int>& a, const std::pair<int, int>& b)
+{
+    return a.first < b.first;
+}
+
+void SourceStat::SortByHealth(std::vector<int>& indexes)
+{
+    std::vector<std::pair<int, int>> scores;
+    size_t i;
+
+    for (i = 0; i < indexes.size(); i++)
+        scores.push_back(std::make_pair(GetScore(BookSourceStore::Instance()->Get(indexes[i])), indexes[i]));
+    // stable, the sources with the same score keep the order of user
+    std::stable_sort(scores.begin(), scores.end(), _score_less);
+    for (i = 0; i < indexes.size(); i++)
+        indexes[i] = scores[i].second;
+}
+
+BOOL SourceStat::Load(void)
+{
+    char* json = NULL;
+    cJSON* root = NULL;
+    cJSON* item = NULL;
+    cJSON* value = NULL;
+    cJSON* sample = NULL;
+    source_stat_t stat;
+
+    json = ReadHiddenFile(m_FileName, NULL);
+    if (!json)
+        return FALSE;
+
+    root = cJSON_Parse(json);
+    free(json);
+    if (!root)
+        return FALSE;
+
+    cJSON_ArrayForEach(item, root)
+    {
+        // the old file is keyed by host only, it can't tell the sources of one host
+        if (!item->string || !strchr(item->string, ' '))
+            continue;
+        stat.query_charset = 0;
+        stat.charset_time = 0;
+        stat.query_url.clear();
+        stat.request_count = 0;
+        stat.error_count = 0;
+        stat.parse_fail_count = 0;
+        stat.query_count = 0;
+        stat.result_count = 0;
+        stat.fail_streak = 0;
+        stat.fail_time = 0;
+        stat.latency_pos = 0;
+        stat.latency.clear();
+        value = cJSON_GetObjectItem(item, "query_charset");
+        if (value)
+            stat.query_charset = value->valueint;
+        value = cJSON_GetObjectItem(item, "charset_time");
+        if (value)
+            stat.charset_time = value->valuedouble;
+        value = cJSON_GetObjectItem(item, "query_url");
+        if (value && value->valuestring)
+            stat.query_url = value->valuestring;
+        value = cJSON_GetObjectItem(item, "request_count");
+        if (value)
+            stat.request_count = value->valueint;
+        value = cJSON_GetObjectItem(item, "error_count");
+        if (value)
+            stat.error_count = value->valueint;
+        value = cJSON_GetObjectItem(item, "parse_fail_count");
+        if (value)
+            stat.parse_fail_count = value->valueint;
+        value = cJSON_GetObjectItem(item, "query_count");
+        if (value)
+            stat.query_count = value->valueint;
+        value = cJSON_GetObjectItem(item, "result_count");
+        if (value)
+            stat.result_count = value->valueint;
+        value = cJSON_GetObjectItem(item, "fail_streak");
+        if (value)
+            stat.fail_streak = value->valueint;
+        value = cJSON_GetObjectItem(item, "fail_time");
+        if (value)
+            stat.fail_time = value->valuedouble;
+        // the samples are saved from the oldest one
+        value = cJSON_GetObjectItem(item, "latency");
+        cJSON_ArrayForEach(sample, value)
+        {
+            if ((int)stat.latency.size() < STAT_LATENCY_SAMPLES)
+                stat.latency.push_back(sample->valueint);
+        }
+        m_Stats[item->string] = stat;
+    }
+    cJSON_Delete(root);
+    return TRUE;
+}
+
+BOOL SourceStat::Save(void)
+{
+    BOOL ret = FALSE;
+    char* json = NULL;
+    cJSON* root = NULL;
+    cJSON* item = NULL;
+    cJSON* latency = NULL;
+    std::map<std::string, source_stat_t>::iterator it;
+    size_t i, n;
+
+    WaitForSingleObject(m_hMutex, INFINITE);
+    if (!m_Dirty)
+    {
+        ReleaseMutex(m_hMutex);
+        return TRUE;
+    }
+    root = cJSON_CreateObject();
+    for (it = m_Stats.begin(); it != m_Stats.end(); it++)
+    {
+        item = cJSON_AddObjectToObject(root, it->first.c_str());
+        cJSON_AddNumberToObject(item, "query_charset", it->second.query_charset);
+        cJSON_AddNumberToObject(item, "charset_time", it->second.charset_time);
+        cJSON_AddStringToObject(item, "query_url", it->second.query_url.c_str());
+        cJSON_AddNumberToObject(item, "request_count", it->second.request_count);
+        cJSON_AddNumberToObject(item, "error_count", it->second.error_count);
+        cJSON_AddNumberToObject(item, "parse_fail_count", it->second.parse_fail_count);
+        cJSON_AddNumberToObject(item, "query_count", it->second.query_count);
+        cJSON_AddNumberToObject(item, "result_count", it->second.result_count);
+        cJSON_AddNumberToObject(item, "fail_streak", it->second.fail_streak);
+        cJSON_AddNumberToObject(item, "fail_time", it->second.fail_time);
+        latency = cJSON_AddArrayToObject(item, "latency");
+        n = it->second.latency.size();
+        for (i = 0; i < n; i++)
+            cJSON_AddItemToArray(latency, cJSON_CreateNumber(it->second.latency[(it->second.latency_pos + i) % n]));
+    }
+    m_Dirty = FALSE;
+    ReleaseMutex(m_hMutex);
+
+    json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+    if (!json)
+        return FALSE;
+
+    ret = WriteHiddenFile(m_FileName, json, (int)strlen(json));
+    free(json);
+    if (!ret)
+    {
+        // it is saved again with the cache
+        WaitForSingleObject(m_hMutex, INFINITE);
+        m_Dirty = TRUE;
+        ReleaseMutex(m_hMutex);
+    }
+    return ret;
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef __SOURCE_STAT_H__
+#define __SOURCE_STAT_H__
+#ifdef ENABLE_NETWORK
+
+#include <string>
+#include <vector>
+#include <map>
+#include "types.h"
+
+#define CHARSET_EXPIRE_TIME         (7 * 24 * 3600) // seconds
+#define STAT_LATENCY_SAMPLES        32              // the latest samples for percentiles
+#define STAT_DOWN_FAILURES          3               // consecutive failures, the source is down
+#define STAT_DOWN_RETRY_TIME        (30 * 60)       // seconds, the down source is tried again after it
+#define STAT_UNKNOWN_LATENCY        3000            // ms, for the source without samples
+
+typedef enum stat_result_t
+{
+    sr_succ = 0,
+    sr_error,       // network error, bad status code or timeout
+    sr_parse_fail   // nothing is parsed from the page
+} stat_result_t;
+
+typedef struct source_health_t
+{
+    int request_count;
+    int error_count;
+    int parse_fail_count;
+    int query_count;        // the succeeded queries
+    int result_count;       // total results of the succeeded queries
+    int latency_p50;        // ms
+    int latency_p90;        // ms
+    int fail_streak;
+    BOOL down;
+} source_health_t;
+
+// persistent per book source state, it is keyed by the host and title of book source
+// and saved into a hidden json file beside the cache file together with the cache.
+class SourceStat
+{
+private:
+    SourceStat();
+    ~SourceStat();
+
+public:
+    static SourceStat* Instance();
+    static void ReleaseInstance();
+
+    // the detected charset of query page (1: utf8, 2: gbk), 0 if it is unknown or expired,
+    // then the HEAD request is required to detect it
+    int GetQueryCharset(const book_source_t *bs);
+    void SetQueryCharset(const book_source_t *bs, int charset);
+    // correct the memo by the charset of the query response body
+    void CheckQueryCharset(const book_source_t *bs, BOOL utf8);
+
+    // telemetry of requests, count is the result count of a query (-1 for the other requests)
+    void AddRequest(const book_source_t *bs, DWORD elapse, stat_result_t result, int count = -1);
+    BOOL GetHealth(const book_source_t *bs, source_health_t *health);
+    // the source failed several times in a row, it is skipped until STAT_DOWN_RETRY_TIME
+    BOOL IsDown(const book_source_t *bs);
+    // the expected cost of a request (ms), the failure rate is counted in, lower is better
+    int GetScore(const book_source_t *bs);
+    // order the indexes of BookSourceStore, the healthy and fast one at first
+    void SortByHealth(std::vector<int> &indexes);
+
+    BOOL Save(void);
+
+private:
+    BOOL Load(void);
+
+private:
+    typedef struct source_stat_t
+    {
+        int query_charset;      // 0: unknown, 1: utf8, 2: gbk
+        double charset_time;    // time(NULL) when the charset is detected
+        std::string query_url;  // the charset belongs to this query url
+
+        int request_count;
+        int error_count;
+        int parse_fail_count;
+        int query_count;
+        int result_count;
+        int fail_streak;
+        double fail_time;       // time(NULL) of the last failure
+        int latency_pos;
+        std::vector<int> latency; // ring buffer of the latest samples (ms)
+    } source_stat_t;
+
+    void CalcHealth(const source_stat_t &stat, source_health_t *health);
+    int CalcScore(const source_stat_t &stat);
+
+    HANDLE m_hMutex;
+    BOOL m_Dirty;
+    TCHAR m_FileName[MAX_PATH];
+    std::map<std::string, source_stat_t> m_Stats;
+};
+
+#endif
+#endif // !__SOURCE_STAT_H__
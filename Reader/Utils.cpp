@@ -580,6 +580,67 @@ void GetApplicationVersion(TCHAR* version)
     }
 }
 
+BOOL GetHiddenFilePath(const TCHAR* name, TCHAR* path)
+{
+    TCHAR* p;
+
+    path[0] = 0;
+    if (GetModuleFileName(NULL, path, MAX_PATH - 1) == 0)
+        return FALSE;
+    p = _tcsrchr(path, _T('\\'));
+    if (!p || (p - path) + 1 + _tcslen(name) >= MAX_PATH)
+    {
+        path[0] = 0;
+        return FALSE;
+    }
+    _tcscpy(p + 1, name);
+    return TRUE;
+}
+
+char* ReadHiddenFile(const TCHAR* path, int* len)
+{
+    FILE* fp;
+    char* data;
+    long size;
+
+    fp = _tfopen(path, _T("rb"));
+    if (!fp)
+        return NULL;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    if (size <= 0)
+    {
+        fclose(fp);
+        return NULL;
+    }
+    data = (char*)malloc(size + 1);
+    if (data)
+    {
+        size = (long)fread(data, 1, size, fp);
+        data[size] = 0;
+        if (len)
+            *len = (int)size;
+    }
+    fclose(fp);
+    return data;
+}
+
+BOOL WriteHiddenFile(const TCHAR* path, const char* data, int len)
+{
+    HANDLE hFile;
+    DWORD dwBytesWritten = 0;
+    BOOL ret;
+
+    // CREATE_ALWAYS fails on a hidden file without the same attribute
+    hFile = CreateFile(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_HIDDEN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+    ret = WriteFile(hFile, data, (DWORD)len, &dwBytesWritten, NULL) && dwBytesWritten == (DWORD)len;
+    CloseHandle(hFile);
+    return ret;
+}
+
 // return: 1, TRUE, 0, FALSE
 int memvcmp(void *memory, unsigned char val, unsigned int size)
 {
@@ -43,6 +43,12 @@ BOOL Is_WinXP_SP2_or_Later(void);
 
 void GetApplicationVersion(TCHAR *version);
 
+// hidden data files beside the exe, e.g. ".book_sources.json". path is MAX_PATH,
+// the data read is ended with 0 and freed by free()
+BOOL GetHiddenFilePath(const TCHAR *name, TCHAR *path);
+char* ReadHiddenFile(const TCHAR *path, int *len);
+BOOL WriteHiddenFile(const TCHAR *path, const char *data, int len);
+
 int memvcmp(void *memory, unsigned char val, unsigned int size);
 
 #endif
\ No newline at end of file
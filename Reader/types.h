@@ -20,6 +20,7 @@
 #define ENABLE_REALTIME_SAVE        1
 #define ENABLE_GLOBAL_SEARCH        1
 #define ENABLE_GLOBAL_KEY           0
+#define ENABLE_HEDGED_FETCH         1 // build switch, it is turned on by header_t::hedged_fetch
 
 #ifdef _DEBUG
 #define TEST_MODEL                  1
@@ -30,7 +31,6 @@
 #define MAX_CHAPTER_LENGTH          256
 #define MAX_MARK_COUNT              256
 #define MAX_TAG_COUNT               256
-#define MAX_BOOKSRC_COUNT           64
 #define MAX_CUST_COLOR_COUNT        16
 #define MAX_KEYSET_COUNT            32
 
@@ -50,6 +50,7 @@
 #define IDM_TS_EDIT                 (IDM_OPEN_END + 9)
 #define IDM_TS_ENABLE               (IDM_OPEN_END + 10)
 #define IDM_TS_DISABLE              (IDM_OPEN_END + 11)
+#define IDM_BS_STAT                 (IDM_OPEN_END + 12)
 
 #ifdef ENABLE_NETWORK
 #define WM_NEW_VERSION              (WM_USER + 100)
@@ -59,6 +60,11 @@
 #define WM_SYSTRAY                  (WM_USER + 103)
 #define WM_BOOK_EVENT               (WM_USER + 104)
 #define WM_SAVE_CACHE               (WM_USER + 105)
+#ifdef ENABLE_NETWORK
+#define WM_QUERY_RESULT             (WM_USER + 106)
+#define WM_IMPORT_PROGRESS          (WM_USER + 107)
+#define WM_IMPORT_DONE              (WM_USER + 108)
+#endif
 #define WM_TASKBAR_CREATED          (RegisterWindowMessage(_T("TaskbarCreated")))
 
 
@@ -69,6 +75,9 @@
 #define IDT_TIMER_CHECKBOOK         104
 #endif
 #define IDT_TIMER_LOADING           105
+#ifdef ENABLE_NETWORK
+#define IDT_TIMER_QUERY             106
+#endif
 
 
 typedef unsigned char               u8;
@@ -233,8 +242,7 @@ typedef struct header_t
     tagitem_t tags[MAX_TAG_COUNT];
 #endif
     int meun_font_follow;
-    int book_source_count;
-    book_source_t book_sources[MAX_BOOKSRC_COUNT];
+    int hedged_fetch; // request the waiting chapter from the mirror source too when the primary one is slow
 } header_t;
 
 typedef struct body_t
@@ -292,6 +300,8 @@ typedef struct ol_chapter_info_t
     u32 size;
 } ol_chapter_info_t;
 
+#define OL_MIRROR_MAGIC             0x524D4C4F // "OLMR", the old files have garbage in the reserved fields
+
 typedef struct ol_header_t
 {
     u32 header_size;
@@ -300,7 +310,9 @@ typedef struct ol_header_t
     u32 host_offset;
     u64 update_time;
     u32 is_finished; // for bookstatus, deprecated
-    u32 reserve[4]; // reserve
+    u32 mirror_magic; // OL_MIRROR_MAGIC if the mirror source is saved
+    u32 mirror_offset; // mirror host + '\0' + mirror main page
+    u32 reserve[2]; // reserve
     u32 chapter_size;
     ol_chapter_info_t chapter_info_list[1];
 } ol_header_t;